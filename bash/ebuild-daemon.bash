@@ -79,7 +79,17 @@ __ebd_write_raw() {
 	echo -n "$*" >&${PKGCORE_EBD_WRITE_FD} || die "coms error, __ebd_write_raw failed;  Backing out."
 }
 
-for x in ebd_read_{line,{cat_,}size} __ebd_write_line __set_perf_debug; do
+# send a frame; a command line carrying the payload's size (in bytes, thus
+# the C locale), followed by the payload itself.
+__ebd_write_frame() {
+	local LC_ALL=C
+	printf '%s %i\n%s' "$1" "${#2}" "$2" >&${PKGCORE_EBD_WRITE_FD}
+	local ret=$?
+	[[ ${ret} -ne 0 ]] && \
+		die "coms error, write_frame failed w/ ${ret}: backing out of daemon."
+}
+
+for x in ebd_read_{line,{cat_,}size} __ebd_write_{line,frame} __set_perf_debug; do
 	declare -rf ${x}
 done
 unset x
@@ -420,6 +430,14 @@ __ebd_main_loop() {
 				__ebd_write_line "preload_eclass ${success}"
 				unset e x success
 				;;
+			preload_eclass_bundle\ *)
+				# pre-serialized and syntax checked by the python side.
+				if source "${com#preload_eclass_bundle }" >&2; then
+					__ebd_write_line "preload_eclass_bundle succeeded"
+				else
+					__ebd_write_line "preload_eclass_bundle failed"
+				fi
+				;;
 			clear_preloaded_eclasses)
 				unset PKGCORE_PRELOADED_ECLASSES
 				declare -A PKGCORE_PRELOADED_ECLASSES
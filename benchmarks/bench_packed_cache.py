@@ -0,0 +1,122 @@
+#!/usr/bin/env python
+# License: BSD/GPL2
+
+"""
+benchmark loading every entry of a metadata cache, flat_hash vs packed
+
+Both caches are populated with the same synthetic entries, then fully
+loaded (every key, via a fresh cache instance) with the page cache warm,
+and cold.  Going cold requires either root (everything is dropped via
+/proc/sys/vm/drop_caches) or posix_fadvise (only the cache files' pages are
+dropped; dentries and inodes stay cached, flattering flat_hash).
+"""
+
+import ctypes
+import ctypes.util
+import os
+import shutil
+import sys
+import tempfile
+import time
+
+from pkgcore.cache import flat_hash, packed
+
+ENTRIES = 20000
+POSIX_FADV_DONTNEED = 4
+
+_libc = ctypes.CDLL(ctypes.util.find_library("c"), use_errno=True)
+
+
+class chf(object):
+    mtime = 1000
+
+
+def make_entry(i):
+    return {
+        "DEPEND": "dev-libs/foo-%i >=dev-lang/perl-5.8 virtual/pkgconfig" % i,
+        "RDEPEND": "dev-libs/foo-%i >=dev-lang/perl-5.8" % i,
+        "DESCRIPTION": "synthetic package number %i for benchmarking" % i,
+        "EAPI": "5",
+        "HOMEPAGE": "http://example.com/pkg%i" % i,
+        "IUSE": "doc examples +ipv6 static-libs test",
+        "KEYWORDS": "~alpha amd64 arm ~hppa ia64 ~mips ppc ppc64 sparc x86",
+        "LICENSE": "GPL-2",
+        "SLOT": "0",
+        "SRC_URI": "http://example.com/distfiles/pkg%i-1.0.tar.gz" % i,
+        "_chf_": chf,
+    }
+
+
+def populate(db, cpvs):
+    db.set_sync_rate(len(cpvs) + 1)
+    for i, cpv in enumerate(cpvs):
+        db[cpv] = make_entry(i)
+    db.commit(force=True)
+
+
+def iter_files(location):
+    for root, dirs, files in os.walk(location):
+        for f in files:
+            yield os.path.join(root, f)
+
+
+def drop_caches(location):
+    """:return: description of how caches were dropped, or None"""
+    _libc.sync()
+    if os.access("/proc/sys/vm/drop_caches", os.W_OK):
+        with open("/proc/sys/vm/drop_caches", "w") as f:
+            f.write("3\n")
+        return "drop_caches"
+    fadvise = getattr(_libc, "posix_fadvise", None)
+    if fadvise is None:
+        return None
+    for path in iter_files(location):
+        fd = os.open(path, os.O_RDONLY)
+        try:
+            fadvise(fd, ctypes.c_longlong(0), ctypes.c_longlong(0),
+                POSIX_FADV_DONTNEED)
+        finally:
+            os.close(fd)
+    return "fadvise"
+
+
+def load_all(kls, location, cpvs):
+    start = time.time()
+    db = kls(location, readonly=True)
+    for cpv in cpvs:
+        db[cpv]
+    return time.time() - start
+
+
+def main():
+    entries = ENTRIES
+    if len(sys.argv) > 1:
+        entries = int(sys.argv[1])
+    cpvs = ["cat-%i/pkg%i-1.0" % (i % 150, i) for i in xrange(entries)]
+    base = tempfile.mkdtemp(prefix="bench-packed-")
+    try:
+        impls = []
+        for name, kls in (("flat_hash", flat_hash.database),
+                          ("packed", packed.database)):
+            location = os.path.join(base, name)
+            populate(kls(location), cpvs)
+            impls.append((name, kls, location))
+
+        if packed.decode_record is packed.native_decode_record:
+            print 'cpython extension unavailable; packed is using the native decoder'
+        print '%i entries' % (entries,)
+        for name, kls, location in impls:
+            warm = min(load_all(kls, location, cpvs) for x in xrange(3))
+            how = drop_caches(location)
+            if how is None:
+                cold = 'n/a'
+            else:
+                cold = '%7.1f ms (%s)' % (
+                    load_all(kls, location, cpvs) * 1000, how)
+            print '%-10s warm: %7.1f ms  cold: %s' % (name, warm * 1000, cold)
+    finally:
+        shutil.rmtree(base)
+
+
+if __name__ == '__main__':
+    main()
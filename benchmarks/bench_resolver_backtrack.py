@@ -0,0 +1,146 @@
+#!/usr/bin/env python
+# License: BSD/GPL2
+
+"""
+benchmark resolver backtracking over a synthetic conflicting graph
+
+Drives plan_state the way merge_plan does: a depth first walk adding (or,
+for installed packages, replacing) one package per key along with its
+blockers, backtracking to the frame's start point when a choice conflicts.
+Keys are split into groups whose first package's preferred version blocks
+the group's last key outright, so every group is resolved only after
+unwinding the whole group and retrying with the older version.  Finally
+the resolved plan is unwound entirely, as a merge_plan reset does.
+"""
+
+import sys
+import time
+
+from pkgcore.resolver import state
+from pkgcore.restrictions import restriction
+
+KEYS = 400
+GROUP = 20
+# unrelated blockers every package carries, like typical !cat/pkg deps.
+BALLAST = 3
+REPEAT = 5
+
+
+class pkg(object):
+
+    __slots__ = ("key", "slot", "ver")
+
+    def __init__(self, key, ver):
+        self.key = key
+        self.slot = 0
+        self.ver = ver
+
+    def __str__(self):
+        return "%s-%s" % (self.key, self.ver)
+
+
+class blocker(restriction.base):
+
+    __slots__ = ("key",)
+
+    def __init__(self, key):
+        restriction.base.__init__(self)
+        object.__setattr__(self, "key", key)
+
+    def match(self, obj):
+        return obj.key == self.key
+
+
+def make_graph(keys, group):
+    """:return: [(installed pkg or None, [(pkg, [blockers])])] per key"""
+    graph = []
+    for i in xrange(keys):
+        key = "cat/pkg%i" % i
+        blockers = [blocker("cat/absent%i-%i" % (i, x))
+                    for x in xrange(BALLAST)]
+        versions = [(pkg(key, 2), list(blockers))]
+        if i % group == 0:
+            # the preferred version blocks the group's last key.
+            versions[0][1].append(blocker("cat/pkg%i" % (i + group - 1)))
+            versions.append((pkg(key, 1), blockers))
+        installed = None
+        if i % 2:
+            installed = pkg(key, 0)
+        graph.append((installed, versions))
+    return graph
+
+
+def resolve(graph):
+    plan = state.plan_state()
+    for installed, versions in graph:
+        if installed is not None:
+            state.add_op(None, installed).apply(plan)
+    stats = dict(backtracks=0, reverted=0, elapsed=0.0)
+
+    def backtrack(point):
+        stats['backtracks'] += 1
+        stats['reverted'] += plan.current_state - point
+        start = time.time()
+        plan.backtrack(point)
+        stats['elapsed'] += time.time() - start
+
+    points = [0] * len(graph)
+    choice = [0] * len(graph)
+    depth = 0
+    while depth < len(graph):
+        installed, versions = graph[depth]
+        if choice[depth] == len(versions):
+            choice[depth] = 0
+            depth -= 1
+            if depth < 0:
+                raise AssertionError("unresolvable graph")
+            backtrack(points[depth])
+            choice[depth] += 1
+            continue
+        points[depth] = plan.current_state
+        new, blockers = versions[choice[depth]]
+        if installed is None:
+            conflicts = state.add_op(new, new).apply(plan)
+        else:
+            conflicts = state.replace_op(new, new).apply(plan)
+        for b in blockers:
+            if conflicts:
+                break
+            conflicts = plan.add_blocker(new, b)
+        if conflicts:
+            backtrack(points[depth])
+            choice[depth] += 1
+            continue
+        depth += 1
+    return plan, stats
+
+
+def main():
+    keys = KEYS
+    if len(sys.argv) > 1:
+        keys = int(sys.argv[1])
+    graph = make_graph(keys, GROUP)
+    best = None
+    total = unwind = 0.0
+    for x in xrange(REPEAT):
+        start = time.time()
+        plan, stats = resolve(graph)
+        total += time.time() - start
+        if best is None or stats['elapsed'] < best['elapsed']:
+            best = stats
+        entries = plan.current_state
+        start = time.time()
+        plan.backtrack(0)
+        unwind += time.time() - start
+    total /= REPEAT
+    unwind /= REPEAT
+    print '%i keys, groups of %i: %i plan entries, unwound in %.1f ms' % (
+        keys, GROUP, entries, unwind * 1000)
+    print 'resolve: %7.1f ms  backtrack: %7.1f ms  (%i backtracks, %i ' \
+        'entries reverted, %.2f us/entry)' % (
+        total * 1000, best['elapsed'] * 1000, best['backtracks'],
+        best['reverted'], best['elapsed'] / max(best['reverted'], 1) * 1e6)
+
+
+if __name__ == '__main__':
+    main()
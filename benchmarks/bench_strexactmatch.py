@@ -0,0 +1,42 @@
+#!/usr/bin/env python
+# License: BSD/GPL2
+
+"""
+microbenchmark for case insensitive StrExactMatch matching
+
+Compares the cpython extension against the native implementation, over
+str candidates of matching and differing case, and the unicode fallback.
+"""
+
+import timeit
+
+from pkgcore.restrictions import values
+
+ITERATIONS = 200000
+CANDIDATES = ('dev-libs', 'DEV-LIBS', 'dev-lang', 'sys-apps', 'Dev-Libs-x')
+
+
+def bench(name, restrict, value):
+    timer = timeit.Timer(lambda: restrict.match(value))
+    elapsed = min(timer.repeat(3, ITERATIONS))
+    print '%-28s %-14r %8.1f ns/match' % (
+        name, value, elapsed / ITERATIONS * 1e9)
+
+
+def main():
+    native = values.native_StrExactMatch('dev-libs', case_sensitive=False)
+    impls = [('native', native)]
+    if values.extension is not None:
+        impls.append(('cpy', values.extension.StrExactMatch(
+            'dev-libs', case_sensitive=False)))
+    else:
+        print 'cpython extension unavailable; only benchmarking native'
+
+    for name, restrict in impls:
+        for value in CANDIDATES:
+            bench(name, restrict, value)
+        bench(name + ' (unicode fallback)', restrict, u'DEV-LIBS')
+
+
+if __name__ == '__main__':
+    main()
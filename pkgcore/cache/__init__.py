@@ -119,8 +119,10 @@ class base(object):
         """
         self._sync_if_needed()
         d = self._getitem(cpv)
-        if "_eclasses_" in d:
-            d["_eclasses_"] = self.reconstruct_eclasses(cpv, d["_eclasses_"])
+        eclasses = d.get("_eclasses_")
+        # backends may hand back _eclasses_ already reconstructed.
+        if isinstance(eclasses, basestring):
+            d["_eclasses_"] = self.reconstruct_eclasses(cpv, eclasses)
         return d
 
     def _getitem(self, cpv):
@@ -130,6 +132,19 @@ class base(object):
         """
         raise NotImplementedError
 
+    def prefetch(self, cpvs):
+        """
+        hint that the entries for cpvs are about to be read
+
+        Backends where reads are costly may start reading (and parsing)
+        them in the background; by default this does nothing.
+
+        :param cpvs: sequence of cpv strings
+        :return: None, or a callable to invoke once the caller is done with
+            cpvs, discarding any of them read ahead but never requested
+        """
+        return None
+
     def __setitem__(self, cpv, values):
         """set a cpv to values
 
@@ -0,0 +1,197 @@
+# License: GPL2/BSD
+
+"""
+bulk verification, pruning and compaction of a repository's metadata caches
+
+Cache entries are normally only validated when the package they describe
+is loaded, thus entries for removed ebuilds (and those made stale by
+ebuild or eclass changes nobody regenerated) linger.  :obj:`check_cache`
+walks a whole cache instead, across a pool of threads.
+"""
+
+__all__ = ("VALID", "STALE_EBUILD", "STALE_ECLASS", "ORPHANED", "CORRUPT",
+           "statuses", "check_cache", "disk_usage")
+
+import os
+import time
+
+from snakeoil import compatibility
+from snakeoil.chksum import LazilyHashedPath
+from snakeoil.demandload import demandload
+from snakeoil.osutils import pjoin
+
+from pkgcore.cache import errors
+
+demandload(
+    'errno',
+    'multiprocessing.pool:ThreadPool',
+    'pkgcore.ebuild.cpv:versioned_CPV',
+    'pkgcore.ebuild.errors:InvalidCPV',
+)
+
+VALID = "valid"
+# the ebuild changed since the entry was generated.
+STALE_EBUILD = "stale (ebuild)"
+# an eclass it inherited changed or vanished.
+STALE_ECLASS = "stale (eclass)"
+# the ebuild is gone.
+ORPHANED = "orphaned"
+# the entry couldn't be read.
+CORRUPT = "corrupt"
+
+statuses = (VALID, STALE_EBUILD, STALE_ECLASS, ORPHANED, CORRUPT)
+
+
+def disk_usage(path):
+    """
+    :return: bytes allocated on disk for path, recursively if a directory;
+        0 if it doesn't exist
+    """
+    def usage(st):
+        # account for per file allocation overhead; that's what a denser
+        # backend reclaims.
+        return getattr(st, 'st_blocks', 0) * 512 or st.st_size
+    try:
+        st = os.lstat(path)
+    except EnvironmentError as e:
+        if e.errno not in (errno.ENOENT, errno.ENOTDIR):
+            raise
+        return 0
+    total = usage(st)
+    if os.path.isdir(path):
+        for root, dirs, files in os.walk(path):
+            for x in dirs + files:
+                try:
+                    total += usage(os.lstat(pjoin(root, x)))
+                except EnvironmentError as e:
+                    if e.errno != errno.ENOENT:
+                        raise
+    return total
+
+
+def _ebuild_path(repo, cpvstr):
+    """:return: path to the ebuild a cache key describes, or None if gone"""
+    try:
+        cpv = versioned_CPV(cpvstr)
+    except InvalidCPV:
+        return None
+    versions = repo.versions.get((cpv.category, cpv.package), ())
+    ver = cpv.fullver
+    if ver not in versions:
+        # cache keys never carry an explicit -r0; the ebuild may.
+        if cpv.revision is not None or ver + "-r0" not in versions:
+            return None
+        ver += "-r0"
+    return pjoin(repo.location, cpv.category, cpv.package,
+                 "%s-%s%s" % (cpv.package, ver, repo.extension))
+
+
+def _check_entry(cache, repo, eclass_cache, cpv):
+    """:return: (cpv, status, entry, ebuild path); entry only if valid"""
+    path = _ebuild_path(repo, cpv)
+    if path is None:
+        return cpv, ORPHANED, None, None
+    try:
+        data = cache[cpv]
+    except KeyError:
+        # removed while we were walking.
+        return cpv, ORPHANED, None, path
+    except errors.CacheError:
+        return cpv, CORRUPT, None, path
+    ebuild_hash = LazilyHashedPath(path)
+    try:
+        if data.get(cache._chf_key) != getattr(
+                ebuild_hash, cache.chf_type, None):
+            return cpv, STALE_EBUILD, None, path
+    except EnvironmentError:
+        # the ebuild vanished since the versions were listed.
+        return cpv, ORPHANED, None, path
+    if not cache.validate_entry(data, ebuild_hash, eclass_cache):
+        return cpv, STALE_ECLASS, None, path
+    return cpv, VALID, data, path
+
+
+def check_cache(repo, cache, observer, threads=1, prune=False, target=None):
+    """
+    validate every entry of a repository's metadata cache
+
+    Each entry is checked against its ebuild's chksum (typically mtime)
+    and the chksums of the eclasses it inherited.
+
+    :param repo: ebuild repository the cache belongs to
+    :param cache: :obj:`pkgcore.cache.base` derivative to check
+    :param observer: observer instance; each invalid entry is reported via
+        its info method
+    :param threads: number of threads reading and validating entries
+    :param prune: if True, remove every invalid entry from cache (unless
+        it's readonly)
+    :param target: if given, a writable cache every valid entry is copied
+        into, fex a :obj:`pkgcore.cache.packed.database` to move a flat_hash
+        cache into a denser backend
+    :return: dict holding the count of entries per status (see
+        :obj:`statuses`), along with 'entries', 'elapsed' (seconds),
+        'pruned', 'copied', and 'before'/'after' (disk usage in bytes of the
+        cache, if it's filesystem based)
+    """
+    location = getattr(cache, 'location', None)
+    stats = dict((status, 0) for status in statuses)
+    stats.update(pruned=0, copied=0, before=None, after=None)
+    if location is not None:
+        stats['before'] = disk_usage(location)
+    prune = prune and not cache.readonly
+    eclass_cache = getattr(repo, 'eclass_cache', None)
+
+    start_time = time.time()
+    keys = list(cache.iterkeys())
+    check = lambda cpv: _check_entry(cache, repo, eclass_cache, cpv)
+    pool = None
+    if threads > 1 and len(keys) > threads:
+        pool = ThreadPool(threads)
+        results = pool.imap_unordered(
+            check, keys, max(1, len(keys) // (threads * 16)))
+    else:
+        results = (check(cpv) for cpv in keys)
+
+    try:
+        for cpv, status, data, path in results:
+            stats[status] += 1
+            if status == VALID:
+                if target is None:
+                    continue
+                data = dict(data.iteritems())
+                data.pop(cache._chf_key, None)
+                data['_chf_'] = LazilyHashedPath(path)
+                try:
+                    target[cpv] = data
+                except compatibility.IGNORED_EXCEPTIONS:
+                    raise
+                except Exception as e:
+                    observer.error("failed copying %s: %s" % (cpv, e))
+                else:
+                    stats['copied'] += 1
+                continue
+            observer.info("%s: %s" % (cpv, status))
+            if prune:
+                try:
+                    del cache[cpv]
+                except KeyError:
+                    continue
+                except errors.CacheError as e:
+                    observer.error("failed removing %s: %s" % (cpv, e))
+                    continue
+                stats['pruned'] += 1
+    finally:
+        if pool is not None:
+            pool.close()
+            pool.join()
+
+    if stats['pruned'] and not cache.autocommits:
+        # force; the point is reclaiming the space.
+        cache.commit(force=True)
+    if target is not None:
+        target.commit(force=True)
+    stats['entries'] = len(keys)
+    stats['elapsed'] = time.time() - start_time
+    if location is not None:
+        stats['after'] = disk_usage(location)
+    return stats
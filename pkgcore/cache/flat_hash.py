@@ -8,21 +8,114 @@ per key file based backend
 __all__ = ("database",)
 
 import errno
+from functools import partial
 import os
 import stat
+import threading
+import Queue
 
 from snakeoil.compatibility import raise_from
 from snakeoil.fileutils import readlines_ascii
+from snakeoil.mappings import OrderedDict
 from snakeoil.osutils import pjoin
 
-from pkgcore.cache import fs_template, errors
+from pkgcore.cache import base, fs_template, errors
 from pkgcore.config import ConfigHint
 
 
+def native_parse_entry(data, known_keys, chf_key, chf_type, eclass_splitter,
+                       eclass_chf_types):
+    """
+    parse an entry's raw content
+
+    :param data: file content, key=value lines
+    :param known_keys: keys to keep; others are skipped
+    :param chf_key: key holding the entry's chf
+    :param chf_type: chf type used to deserialize chf_key's value, or None
+        to leave it as is
+    :param eclass_splitter: separator used within _eclasses_
+    :param eclass_chf_types: chf types stored per eclass
+    :return: dict of the entry's known keys, with _eclasses_ reconstructed
+    """
+    lines = data.split("\n")
+    if not lines[-1]:
+        lines.pop()
+    d = {}
+    for x in lines:
+        k, v = x.strip().split("=", 1)
+        if k in known_keys:
+            d[k] = v
+    get_deserializer = base._get_chf_deserializer
+    if chf_type is not None:
+        d[chf_key] = get_deserializer(chf_type)(d[chf_key])
+
+    eclasses = d.get("_eclasses_")
+    if eclasses is not None:
+        eclass_data = eclasses.strip().split(eclass_splitter)
+        if eclass_data == [""]:
+            eclass_data = []
+        tuple_len = len(eclass_chf_types) + 1
+        if len(eclass_data) % tuple_len:
+            raise ValueError("_eclasses_ was of invalid len %i(must be mod %i)"
+                % (len(eclass_data), tuple_len))
+        chfs = [(chf, get_deserializer(chf)) for chf in eclass_chf_types]
+        l = []
+        i = iter(eclass_data)
+        for eclass in i:
+            l.append((eclass, tuple((chf, f(i.next())) for chf, f in chfs)))
+        d["_eclasses_"] = l
+    return d
+
+
+try:
+    from pkgcore.cache._flat_hash import parse_entry
+except ImportError:
+    parse_entry = native_parse_entry
+
+
+class _prefetched_entry(object):
+
+    """
+    entry being read ahead; whoever gets to it first does the read
+
+    mtime is the file's as stat'd just before the read, so later users can
+    tell if what was parsed is stale; None if it was missing.  Dropped
+    entries are skipped by the workers that have yet to get to them.
+    """
+
+    __slots__ = ("lock", "data", "error", "mtime", "dropped")
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.data = self.error = self.mtime = None
+        self.dropped = False
+
+    def fill(self, db, cpv):
+        """
+        :return: True if this call did the read, False if it was already done
+            (or the entry was dropped)
+        """
+        with self.lock:
+            if self.dropped or self.data is not None or \
+                    self.error is not None:
+                return False
+            self.mtime = db._entry_mtime(cpv)
+            try:
+                self.data = db._read_entry(cpv)
+            except (KeyError, errors.CacheError) as e:
+                self.error = e
+            return True
+
+
 class database(fs_template.FsBased):
 
     """
     stores cache entries in key=value form, stripping newlines
+
+    :cvar prefetch_threads: max number of threads reading entries handed to
+        :obj:`prefetch`
+    :cvar prefetch_limit: max number of read ahead entries held at once;
+        past that the oldest are dropped
     """
 
     # TODO different way of passing in default auxdbkeys and location
@@ -37,9 +130,110 @@ class database(fs_template.FsBased):
     autocommits = True
     mtime_in_entry = True
     eclass_chf_types = ('eclassdir', 'mtime')
+    prefetch_threads = 4
+    prefetch_limit = 1024
+
+    def __init__(self, *args, **config):
+        fs_template.FsBased.__init__(self, *args, **config)
+        # subclasses overriding _parse_data still get handed lines.
+        parse_data = type(self)._parse_data
+        self._raw_parsing = getattr(parse_data, '__func__', parse_data) is \
+            database.__dict__['_parse_data']
+        self._reset_prefetch()
+
+    def _reset_prefetch(self):
+        # cpv -> _prefetched_entry, oldest first
+        self._prefetched = OrderedDict()
+        self._prefetch_queue = Queue.Queue()
+        self._prefetch_lock = threading.Lock()
+        self._prefetch_workers = 0
+        self._prefetch_pid = os.getpid()
+
+    def prefetch(self, cpvs):
+        """
+        read the entries for cpvs ahead of time via a few threads
+
+        File reads release the GIL, so disk latency overlaps with
+        whatever the caller does meanwhile; :obj:`_getitem` then hands back
+        the parsed entry (if the file is unchanged since), or waits for its
+        read if it's in flight.
+
+        :return: callable dropping whichever of the entries queued by this
+            call were never requested
+        """
+        if self._prefetch_pid != os.getpid():
+            # forked; threads and locks didn't come along.
+            self._reset_prefetch()
+        entries = self._prefetched
+        queue = self._prefetch_queue
+        queued = []
+        for cpv in cpvs:
+            entry = entries.pop(cpv, None)
+            if entry is not None:
+                # wanted again; it's now the most recent.
+                entries[cpv] = entry
+                continue
+            if len(entries) >= self.prefetch_limit:
+                if not entries:
+                    continue
+                entries.pop(next(iter(entries))).dropped = True
+            entry = entries[cpv] = _prefetched_entry()
+            queue.put((cpv, entry))
+            queued.append((cpv, entry))
+        with self._prefetch_lock:
+            spawn = min(self.prefetch_threads, queue.qsize()) - \
+                self._prefetch_workers
+            for x in xrange(spawn):
+                t = threading.Thread(target=self._prefetch_worker)
+                t.daemon = True
+                self._prefetch_workers += 1
+                t.start()
+        return partial(self._discard_prefetched, queued)
+
+    def _discard_prefetched(self, queued):
+        entries = self._prefetched
+        for cpv, entry in queued:
+            # only if it's still ours; it may have been consumed, or be
+            # from before a fork.
+            if entries.get(cpv) is entry:
+                del entries[cpv]
+                entry.dropped = True
+
+    def _prefetch_worker(self):
+        queue = self._prefetch_queue
+        while True:
+            with self._prefetch_lock:
+                try:
+                    cpv, entry = queue.get_nowait()
+                except Queue.Empty:
+                    self._prefetch_workers -= 1
+                    return
+            try:
+                entry.fill(self, cpv)
+            except Exception:
+                # left unfilled; the reader retries it itself.
+                pass
 
     def _getitem(self, cpv):
+        if self._prefetched and self._prefetch_pid == os.getpid():
+            entry = self._prefetched.pop(cpv, None)
+            if entry is not None and (entry.fill(self, cpv) or
+                    entry.mtime == self._entry_mtime(cpv)):
+                if entry.error is not None:
+                    raise entry.error
+                return entry.data
+        return self._read_entry(cpv)
+
+    def _entry_mtime(self, cpv):
+        try:
+            return os.stat(pjoin(self.location, cpv)).st_mtime
+        except EnvironmentError:
+            return None
+
+    def _read_entry(self, cpv):
         path = pjoin(self.location, cpv)
+        if self._raw_parsing:
+            return self._getitem_raw(cpv, path)
         try:
             data = readlines_ascii(path, True, True, True)
             if data is None:
@@ -48,6 +242,27 @@ class database(fs_template.FsBased):
         except (EnvironmentError, ValueError) as e:
             raise_from(errors.CacheCorruption(cpv, e))
 
+    def _getitem_raw(self, cpv, path):
+        file_mtime = self._mtime_used and not self.mtime_in_entry
+        try:
+            with open(path, "rb") as f:
+                data = f.read()
+                if file_mtime:
+                    mtime = os.fstat(f.fileno()).st_mtime
+        except EnvironmentError as e:
+            if e.errno in (errno.ENOENT, errno.ENOTDIR):
+                raise KeyError(cpv)
+            raise_from(errors.CacheCorruption(cpv, e))
+        try:
+            d = parse_entry(data, self._known_keys, self._chf_key,
+                None if file_mtime else self.chf_type,
+                self.eclass_splitter, self.eclass_chf_types)
+        except ValueError as e:
+            raise_from(errors.CacheCorruption(cpv, e))
+        if file_mtime:
+            d[self._chf_key] = long(mtime)
+        return self._cdict_kls(d.iteritems())
+
     def _parse_data(self, data, mtime):
         d = self._cdict_kls()
         known = self._known_keys
@@ -66,6 +281,7 @@ class database(fs_template.FsBased):
         return d
 
     def _setitem(self, cpv, values):
+        self._prefetched.pop(cpv, None)
         # might seem weird, but we rely on the trailing +1; this
         # makes it behave properly for any cache depth (including no depth)
         s = cpv.rfind("/") + 1
@@ -109,6 +325,7 @@ class database(fs_template.FsBased):
             raise_from(errors.CacheCorruption(cpv, e))
 
     def _delitem(self, cpv):
+        self._prefetched.pop(cpv, None)
         try:
             os.remove(pjoin(self.location, cpv))
         except OSError as e:
@@ -94,6 +94,7 @@ class database(flat_hash.database):
         return d
 
     def _setitem(self, cpv, values):
+        self._prefetched.pop(cpv, None)
         values = ProtectedDict(values)
 
         # hack. proper solution is to make this a __setitem__ override, since
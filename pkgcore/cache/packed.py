@@ -0,0 +1,318 @@
+# License: GPL2/BSD
+
+"""
+single file, memory mapped cache backend
+
+Every entry lives in one file: a fixed size header, followed by records
+(flat_hash style key=value lines) and index blocks.  An index block maps
+each cpv to the offset and length of its record; the header points at the
+current one.  Reads mmap the file and decode records straight out of the
+mapping, so loading a full tree's metadata costs one open rather than one
+per cpv.
+
+Updates are queued until :obj:`database.commit`, which appends the new
+records followed by a complete index block, fsyncs, then repoints the
+header.  Committed records and index blocks are never modified in place,
+thus readers (including those in other processes holding an older
+mapping) always see a consistent snapshot, and a writer dying midway
+leaves the previous commit intact.  Once superseded data outweighs live
+data, commit rewrites the file and atomically renames it into place.
+"""
+
+__all__ = ("database",)
+
+import errno
+import fcntl
+import mmap
+import os
+import struct
+
+from snakeoil.compatibility import raise_from
+from snakeoil.osutils import pjoin
+
+from pkgcore.cache import fs_template, errors
+from pkgcore.config import ConfigHint
+
+MAGIC = "PKGCPACK"
+VERSION = 1
+# magic, version, flags, index offset, index length
+_header = struct.Struct("<8sIIQQ")
+_index_pointer = struct.Struct("<QQ")
+HEADER_SIZE = _header.size
+_INDEX_POINTER_OFFSET = HEADER_SIZE - _index_pointer.size
+
+
+def native_parse_index(buf, offset, length):
+    d = {}
+    for line in buf[offset:offset + length].split("\n"):
+        if not line:
+            continue
+        try:
+            cpv, rec_offset, rec_length = line.split(" ")
+            if not cpv or not rec_offset.isdigit() or not rec_length.isdigit():
+                raise ValueError
+        except ValueError:
+            raise ValueError("malformed index line: %s" % (line,))
+        d[cpv] = (int(rec_offset), int(rec_length))
+    return d
+
+
+def native_decode_record(buf, offset, length, known_keys):
+    l = []
+    for line in buf[offset:offset + length].split("\n"):
+        if not line:
+            continue
+        k, sep, v = line.partition("=")
+        if not sep:
+            raise ValueError("malformed line: %s" % (line,))
+        if k in known_keys:
+            l.append((k, v))
+    return l
+
+
+try:
+    from pkgcore.cache._packed import parse_index, decode_record
+except ImportError:
+    parse_index = native_parse_index
+    decode_record = native_decode_record
+
+
+def _read_header(buf, path):
+    if len(buf) < HEADER_SIZE:
+        raise errors.GeneralCacheCorruption(
+            "%s: truncated header" % (path,))
+    magic, version, flags, index_offset, index_length = \
+        _header.unpack_from(buf)
+    if magic != MAGIC:
+        raise errors.GeneralCacheCorruption(
+            "%s: not a packed cache" % (path,))
+    if version != VERSION:
+        raise errors.GeneralCacheCorruption(
+            "%s: unsupported version %i" % (path, version))
+    return index_offset, index_length
+
+
+def _map_file(f, path):
+    """
+    :return: (buffer, index, end) for the committed state of an open file;
+        end being where the committed data stops
+    """
+    size = os.fstat(f.fileno()).st_size
+    if not size:
+        return "", {}, HEADER_SIZE
+    buf = mmap.mmap(f.fileno(), size, access=mmap.ACCESS_READ)
+    index_offset, index_length = _read_header(buf, path)
+    if not index_offset:
+        return buf, {}, HEADER_SIZE
+    try:
+        index = parse_index(buf, index_offset, index_length)
+    except ValueError as e:
+        raise_from(errors.GeneralCacheCorruption("%s: %s" % (path, e)))
+    return buf, index, index_offset + index_length
+
+
+_missing = object()
+
+
+class database(fs_template.FsBased):
+
+    """
+    stores all cache entries in a single mmap'd file, in key=value form
+    """
+
+    pkgcore_config_type = ConfigHint(
+        {'readonly': 'bool', 'location': 'str', 'label': 'str',
+         'auxdbkeys': 'list'},
+        required=['location'],
+        positional=['location'],
+        typename='cache')
+
+    autocommits = False
+    default_sync_rate = 100
+    eclass_chf_types = ('eclassdir', 'mtime')
+
+    filename = "packed.cache"
+    # superseded data allowed (beyond the amount of live data) before a
+    # commit rewrites the file.
+    compact_min = 1 << 20
+
+    def __init__(self, location, **config):
+        fs_template.FsBased.__init__(self, location, **config)
+        self._path = pjoin(self.location, self.filename)
+        self._pending = {}
+        self._mapped = None
+
+    def _load(self):
+        """:return: (buffer, index) of the last commit seen"""
+        if self._mapped is None:
+            try:
+                f = open(self._path, "rb")
+            except IOError as e:
+                if e.errno != errno.ENOENT:
+                    raise_from(errors.GeneralCacheCorruption(e))
+                return "", {}
+            try:
+                self._mapped = _map_file(f, self._path)[:2]
+            except EnvironmentError as e:
+                raise_from(errors.GeneralCacheCorruption(e))
+            finally:
+                f.close()
+        return self._mapped
+
+    def _getitem(self, cpv):
+        data = self._pending.get(cpv, _missing)
+        if data is _missing:
+            buf, index = self._load()
+            offset, length = index[cpv]
+        elif data is None:
+            raise KeyError(cpv)
+        else:
+            buf, offset, length = data, 0, len(data)
+        try:
+            d = self._cdict_kls(decode_record(
+                buf, offset, length, self._known_keys))
+            d[self._chf_key] = self._chf_deserializer(d[self._chf_key])
+        except ValueError as e:
+            raise_from(errors.CacheCorruption(cpv, e))
+        return d
+
+    def _setitem(self, cpv, values):
+        self._pending[cpv] = "".join(
+            "%s=%s\n" % (k, v) for k, v in values.iteritems())
+
+    def _delitem(self, cpv):
+        if cpv not in self:
+            raise KeyError(cpv)
+        self._pending[cpv] = None
+
+    def __contains__(self, cpv):
+        data = self._pending.get(cpv, _missing)
+        if data is not _missing:
+            return data is not None
+        return cpv in self._load()[1]
+
+    def iterkeys(self):
+        pending = dict(self._pending)
+        for cpv in self._load()[1]:
+            if cpv not in pending:
+                yield cpv
+        for cpv, data in pending.iteritems():
+            if data is not None:
+                yield cpv
+
+    def commit(self, force=False):
+        """
+        :param force: if True, the file is rewritten without superseded data
+            regardless of :obj:`compact_min`
+        """
+        if not self._pending and not (force and os.path.exists(self._path)):
+            return
+        if not self._ensure_dirs():
+            raise errors.GeneralCacheCorruption(
+                "failed creating %r" % (self.location,))
+        # swap the queue out; regen may be adding to it from other threads.
+        pending, self._pending = self._pending, {}
+        committed = False
+        try:
+            f = self._open_locked()
+            try:
+                self._append(f, pending, compact=force)
+            finally:
+                f.close()
+            committed = True
+        except EnvironmentError as e:
+            raise_from(errors.GeneralCacheCorruption(e))
+        finally:
+            if not committed:
+                # requeue, without clobbering anything queued since.
+                pending.update(self._pending)
+                self._pending = pending
+            self._mapped = None
+
+    def _open_locked(self):
+        """open the cache file for writing, holding an exclusive lock on it"""
+        while True:
+            fd = os.open(self._path, os.O_RDWR | os.O_CREAT, self._perms)
+            f = os.fdopen(fd, "r+b")
+            fcntl.lockf(f, fcntl.LOCK_EX)
+            # a compaction may have renamed a new file into place while
+            # we waited on the lock; if so, retry against that.
+            try:
+                st = os.stat(self._path)
+            except OSError as e:
+                if e.errno != errno.ENOENT:
+                    f.close()
+                    raise
+            else:
+                fst = os.fstat(fd)
+                if (st.st_dev, st.st_ino) == (fst.st_dev, fst.st_ino):
+                    return f
+            f.close()
+
+    def _append(self, f, pending, compact=False):
+        # reread the file under the lock; another process may have
+        # committed since it was last mapped.
+        buf, index, end = _map_file(f, self._path)
+        if not buf:
+            f.write(_header.pack(MAGIC, VERSION, 0, 0, 0))
+            self._ensure_access(self._path)
+        f.seek(end)
+        for cpv, data in pending.iteritems():
+            if data is None:
+                index.pop(cpv, None)
+                continue
+            f.write(data)
+            index[cpv] = (end, len(data))
+            end += len(data)
+        blob = self._write_index(f, index)
+        f.truncate()
+        f.flush()
+        os.fsync(f.fileno())
+        # the new records and index are on disk; now make them current.
+        f.seek(_INDEX_POINTER_OFFSET)
+        f.write(_index_pointer.pack(end, len(blob)))
+        f.flush()
+        os.fsync(f.fileno())
+
+        live = HEADER_SIZE + len(blob) + sum(
+            length for offset, length in index.itervalues())
+        if compact or end + len(blob) - live > max(live, self.compact_min):
+            self._compact(f, index)
+
+    @staticmethod
+    def _write_index(f, index):
+        blob = "".join("%s %i %i\n" % (cpv, offset, length)
+                       for cpv, (offset, length) in sorted(index.iteritems()))
+        f.write(blob)
+        return blob
+
+    def _compact(self, f, index):
+        size = os.fstat(f.fileno()).st_size
+        buf = mmap.mmap(f.fileno(), size, access=mmap.ACCESS_READ)
+        tmp_path = pjoin(self.location,
+            ".update.%i.%s" % (os.getpid(), self.filename))
+        try:
+            with open(tmp_path, "wb") as new:
+                new.write(_header.pack(MAGIC, VERSION, 0, 0, 0))
+                end = HEADER_SIZE
+                new_index = {}
+                # sorted, so that walking the cache reads sequentially.
+                for cpv, (offset, length) in sorted(index.iteritems()):
+                    new.write(buf[offset:offset + length])
+                    new_index[cpv] = (end, length)
+                    end += length
+                blob = self._write_index(new, new_index)
+                new.seek(_INDEX_POINTER_OFFSET)
+                new.write(_index_pointer.pack(end, len(blob)))
+                new.flush()
+                os.fsync(new.fileno())
+            self._ensure_access(tmp_path)
+            os.rename(tmp_path, self._path)
+        except EnvironmentError:
+            try:
+                os.remove(tmp_path)
+            except EnvironmentError:
+                pass
+            raise
+        finally:
+            buf.close()
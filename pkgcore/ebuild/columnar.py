@@ -0,0 +1,135 @@
+# License: GPL2/BSD
+
+"""
+lazily built, columnar view of a repository's cached metadata
+
+Whole tree queries restricting on, say, KEYWORDS used to instantiate every
+package just to test that one attribute.  :obj:`MetadataColumns` instead
+holds the metadata keys queries commonly restrict on as columns, loaded a
+package at a time from the cache on first use; the query planner (see
+:obj:`pkgcore.repository.planner`) evaluates restrictions against them and
+only the surviving versions get instantiated.
+
+Columns are dictionary encoded: each row holds a small integer code for
+its value, and every distinct value is stored (and converted to what the
+package attribute would hold) once.  Since most rows share a handful of
+values (SLOT="0", the same KEYWORDS), restrictions are evaluated once per
+distinct value rather than once per row.
+"""
+
+__all__ = ("MetadataColumns",)
+
+from array import array
+
+from snakeoil.compatibility import intern
+
+
+def _slot(raw):
+    if raw is None:
+        return "0"
+    return raw.strip().partition('/')[0]
+
+
+def _subslot(raw):
+    if raw is None:
+        return "0"
+    slot, _, subslot = raw.strip().partition('/')
+    return subslot or slot
+
+
+def _keywords(raw):
+    return tuple(map(intern, (raw or "").split()))
+
+
+def _iuse(raw):
+    return frozenset(map(intern, (raw or "").split()))
+
+
+class MetadataColumns(object):
+
+    """
+    dictionary encoded columns of cached metadata, loaded per package
+
+    Only validated cache entries are loaded; versions lacking one are
+    left out, thus never pruned by the planner.
+
+    :cvar keys: metadata keys held as columns
+    :cvar attrs: mapping of the package attributes derivable from a column
+        to (metadata key, converter of the raw value to the attribute's)
+    """
+
+    keys = ("SLOT", "KEYWORDS", "IUSE", "EAPI", "LICENSE",
+            "DEPEND", "RDEPEND", "PDEPEND")
+
+    attrs = {
+        "slot": ("SLOT", _slot),
+        "subslot": ("SLOT", _subslot),
+        "keywords": ("KEYWORDS", _keywords),
+        "iuse": ("IUSE", _iuse),
+    }
+
+    def __init__(self, lookup):
+        """
+        :param lookup: callable taking a (category, package) tuple, returning
+            an iterable of (version, metadata) pairs for the versions it has
+            a valid cache entry for
+        """
+        self._lookup = lookup
+        # (category, package) -> {version: row}
+        self._rows = {}
+        self._codes = dict((key, array('I')) for key in self.keys)
+        self._values = dict((key, []) for key in self.keys)
+        self._encodings = dict((key, {}) for key in self.keys)
+        # attr -> converted value per code
+        self._converted = dict((attr, []) for attr in self.attrs)
+
+    def __len__(self):
+        return len(self._codes["SLOT"])
+
+    def _load(self, cp):
+        rows = self._rows[cp] = {}
+        for ver, data in self._lookup(cp):
+            rows[ver] = len(self)
+            for key in self.keys:
+                val = data.get(key)
+                encoding = self._encodings[key]
+                code = encoding.get(val)
+                if code is None:
+                    code = encoding[val] = len(self._values[key])
+                    self._values[key].append(val)
+                self._codes[key].append(code)
+        return rows
+
+    def rows(self, cp):
+        """:return: mapping of version to row for the loaded versions of cp"""
+        rows = self._rows.get(cp)
+        if rows is None:
+            rows = self._load(cp)
+        return rows
+
+    def codes(self, cp, attr):
+        """
+        :param attr: one of :obj:`attrs`
+        :return: mapping of version to the code of attr's value
+        """
+        column = self._codes[self.attrs[attr][0]]
+        return dict((ver, column[row])
+                    for ver, row in self.rows(cp).iteritems())
+
+    def value(self, attr, code):
+        """:return: the value a package's attr holds for a code of it"""
+        converted = self._converted[attr]
+        key, func = self.attrs[attr]
+        values = self._values[key]
+        while len(converted) < len(values):
+            converted.append(func(values[len(converted)]))
+        return converted[code]
+
+    def raw(self, cp, ver, key):
+        """
+        :param key: one of :obj:`keys`
+        :return: the raw cached value of key for a version, None if unset
+        :raise KeyError: if there's no valid cache entry for the version
+        """
+        row = self.rows(cp)[ver]
+        return self._values[key][self._codes[key][row]]
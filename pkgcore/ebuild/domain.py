@@ -27,14 +27,13 @@ from pkgcore.config.errors import BaseError
 from pkgcore.ebuild import const
 from pkgcore.ebuild.atom import atom as _atom
 from pkgcore.ebuild.misc import (
-    ChunkedDataDict, chunked_data, collapsed_restrict_to_data,
-    incremental_expansion, incremental_expansion_license,
-    non_incremental_collapsed_restrict_to_data, optimize_incrementals,
-    package_keywords_splitter, split_negations)
+    ChunkedDataDict, FlagSet, PackageUseCache, RestrictIndex, VisibilityFilter,
+    chunked_data, collapsed_restrict_to_data, compile_license_acceptance,
+    incremental_expansion, non_incremental_collapsed_restrict_to_data,
+    optimize_incrementals, package_keywords_splitter, split_negations)
 from pkgcore.ebuild.repo_objs import OverlayedLicenses
 from pkgcore.repository import multiplex, visibility
-from pkgcore.restrictions import packages, values
-from pkgcore.restrictions.delegated import delegate
+from pkgcore.restrictions import packages
 from pkgcore.util.parserestrict import parse_match
 
 demandload(
@@ -67,37 +66,46 @@ def package_env_splitter(basedir, val):
     return parse_match(val[0]), local_source(pjoin(basedir, val[1]))
 
 
-def apply_mask_filter(globs, atoms, pkg, mode):
-    # mode is ignored; non applicable.
-    for r in chain(globs, atoms.get(pkg.key, ())):
+def apply_mask_filter(globs, atoms, pkg):
+    for r in atoms.get(pkg.key, ()):
         if r.match(pkg):
             return True
+    for r, _ in globs.iter_match(pkg):
+        return True
     return False
 
 
-def make_mask_filter(masks, negate=False):
+def make_mask_filter(masks):
+    """:return: callable returning True if a package is matched by masks"""
     atoms = defaultdict(list)
-    globs = []
+    globs = RestrictIndex()
     for m in masks:
         if isinstance(m, _atom):
             atoms[m.key].append(m)
         else:
-            globs.append(m)
-    return delegate(partial(apply_mask_filter, globs, atoms), negate=negate)
+            globs.add(m, None)
+    return partial(apply_mask_filter, globs, atoms)
 
 
-def generate_filter(masks, unmasks, *extra):
+def apply_visibility_masks(masked, unmasked, pkg):
+    # masking isn't influenced by conditionals; no mode to honor.
+    return not masked(pkg) or unmasked(pkg)
+
+
+def generate_filter(masks, unmasks, *checks):
+    """
+    :param checks: callables taking a package, returning True if it's
+        visible; run after the mask check in the order given
+    :return: :obj:`pkgcore.ebuild.misc.VisibilityFilter` instance
+    """
     # note that we ignore unmasking if masking isn't specified.
     # no point, mainly
-    masking = make_mask_filter(masks, negate=True)
-    unmasking = make_mask_filter(unmasks, negate=False)
-    r = ()
-    if masking:
-        if unmasking:
-            r = (packages.OrRestriction(masking, unmasking, disable_inst_caching=True),)
-        else:
-            r = (masking,)
-    return packages.AndRestriction(disable_inst_caching=True, finalize=True, *(r + extra))
+    l = []
+    if masks:
+        l.append(partial(apply_visibility_masks,
+            make_mask_filter(masks), make_mask_filter(unmasks)))
+    l.extend(checks)
+    return VisibilityFilter(l)
 
 
 # ow ow ow ow ow ow....
@@ -230,7 +238,7 @@ class domain(pkgcore.config.domain.domain):
             # skipped because negations are required for license filtering.
             if incremental not in settings or incremental in ("USE", "ACCEPT_LICENSE"):
                 continue
-            s = set()
+            s = FlagSet()
             incremental_expansion(
                 s, settings[incremental],
                 'While expanding %s ' % (incremental,))
@@ -252,7 +260,7 @@ class domain(pkgcore.config.domain.domain):
         if 'ACCEPT_KEYWORDS' not in settings:
             raise Failure("No ACCEPT_KEYWORDS setting detected from profile, "
                           "or user config")
-        s = set()
+        s = FlagSet()
         default_keywords = []
         incremental_expansion(
             s, settings['ACCEPT_KEYWORDS'],
@@ -323,6 +331,10 @@ class domain(pkgcore.config.domain.domain):
              c.merge(getattr(profile, attr + 'masked_use'))
              setattr(self, attr + 'disabled_use', c)
 
+        # rendered USE per package; reset via invalidate_use_cache if any of
+        # the above is modified.
+        self.use_cache = PackageUseCache()
+
         self.repos = []
         self.vdb = []
         self.repos_configured = {}
@@ -404,45 +416,48 @@ class domain(pkgcore.config.domain.domain):
             use_settings.add("prefix")
 
     def make_license_filter(self, master_license, pkg_licenses):
-        """Generates a restrict that matches iff the licenses are allowed."""
-        return delegate(partial(self.apply_license_filter, master_license, pkg_licenses))
+        """Generates a check that returns True iff the licenses are allowed."""
+        return partial(self.apply_license_filter, master_license,
+            RestrictIndex(pkg_licenses), {})
 
-    def apply_license_filter(self, master_licenses, pkg_licenses, pkg, mode):
+    def apply_license_filter(self, master_licenses, pkg_licenses, compiled, pkg):
         """Determine if a package's license is allowed."""
-        # note we're not honoring mode; it's always match.
+        # note there's no mode to honor; it's always match.
         # reason is that of not turning on use flags to get acceptable license
         # pairs, maybe change this down the line?
 
         matched_pkg_licenses = []
-        for atom, licenses in pkg_licenses:
-            if atom.match(pkg):
-                matched_pkg_licenses += licenses
+        for restrict, licenses in pkg_licenses.iter_match(pkg):
+            matched_pkg_licenses += licenses
 
-        raw_accepted_licenses = master_licenses + matched_pkg_licenses
         license_manager = getattr(pkg.repo, 'licenses', self.default_licenses_manager)
+        # the expanded ACCEPT_LICENSE only depends on which package.license
+        # entries matched; thus compile it once per combination.
+        key = (license_manager, tuple(matched_pkg_licenses))
+        accepts = compiled.get(key)
+        if accepts is None:
+            accepts = compiled[key] = compile_license_acceptance(
+                license_manager.groups, master_licenses + matched_pkg_licenses,
+                msg_prefix="while checking ACCEPT_LICENSE for %s" % (pkg,))
 
         for and_pair in pkg.license.dnf_solutions():
-            accepted = incremental_expansion_license(
-                and_pair, license_manager.groups,
-                raw_accepted_licenses,
-                msg_prefix="while checking ACCEPT_LICENSE for %s" % (pkg,))
-            if accepted.issuperset(and_pair):
+            if accepts(and_pair):
                 return True
         return False
 
     def make_keywords_filter(self, arch, default_keys, accept_keywords,
                              profile_keywords, incremental=False):
-        """Generates a restrict that matches iff the keywords are allowed."""
+        """Generates a check that returns True iff the keywords are allowed."""
         if not accept_keywords and not profile_keywords:
-            return packages.PackageRestriction(
-                "keywords", values.ContainmentMatch(*default_keys))
+            return partial(self.apply_default_keywords_filter,
+                frozenset(default_keys))
 
         if "~" + arch.lstrip("~") not in default_keys:
             # stable; thus empty entries == ~arch
             unstable = "~" + arch
             def f(r, v):
                 if not v:
-                    return r, unstable
+                    return r, (unstable,)
                 return r, v
             data = collapsed_restrict_to_data(
                 ((packages.AlwaysTrue, default_keys),),
@@ -459,24 +474,27 @@ class domain(pkgcore.config.domain.domain):
             #f = self.incremental_apply_keywords_filter
         else:
             f = self.apply_keywords_filter
-        return delegate(partial(f, data, profile_keywords))
+        return partial(f, data, RestrictIndex(profile_keywords))
+
+    @staticmethod
+    def apply_default_keywords_filter(allowed, pkg):
+        return not allowed.isdisjoint(pkg.keywords)
 
     @staticmethod
-    def incremental_apply_keywords_filter(data, pkg, mode):
-        # note we ignore mode; keywords aren't influenced by conditionals.
+    def incremental_apply_keywords_filter(data, pkg):
+        # note there's no mode; keywords aren't influenced by conditionals.
         # note also, we're not using a restriction here.  this is faster.
-        allowed = data.pull_data(pkg)
+        allowed = data.pull_frozen_data(pkg)
         return any(True for x in pkg.keywords if x in allowed)
 
     @staticmethod
-    def apply_keywords_filter(data, profile_keywords, pkg, mode):
-        # note we ignore mode; keywords aren't influenced by conditionals.
+    def apply_keywords_filter(data, profile_keywords, pkg):
+        # note there's no mode; keywords aren't influenced by conditionals.
         # note also, we're not using a restriction here.  this is faster.
         pkg_keywords = pkg.keywords
-        for atom, keywords in profile_keywords:
-            if atom.match(pkg):
-                pkg_keywords += keywords
-        allowed = data.pull_data(pkg)
+        for restrict, keywords in profile_keywords.iter_match(pkg):
+            pkg_keywords += keywords
+        allowed = data.pull_frozen_data(pkg)
         if '**' in allowed:
             return True
         if "*" in allowed:
@@ -496,6 +514,18 @@ class domain(pkgcore.config.domain.domain):
         return map(itemgetter(1), flags), [(x[0].groups(), x[1]) for x in ue_flags]
 
     def get_package_use_unconfigured(self, pkg, for_metadata=True):
+        """
+        :return: (immutable, enabled, disabled) frozensets of USE flags
+            for pkg; memoized in :obj:`use_cache`
+        """
+        return self.use_cache.get(
+            self.use_cache.key(pkg, for_metadata),
+            self._render_package_use, pkg, for_metadata)
+
+    def invalidate_use_cache(self):
+        self.use_cache.invalidate()
+
+    def _render_package_use(self, pkg, for_metadata):
         # roughly, this should result in the following, evaluated l->r:
         # non USE_EXPAND; profiles, pkg iuse, global configuration, package.use configuration, commandline?
         # stack profiles + pkg iuse; split it into use and use_expanded use;
@@ -533,7 +563,7 @@ class domain(pkgcore.config.domain.domain):
             enabled.update(immutable)
             enabled.difference_update(disabled)
 
-        return immutable, enabled, disabled
+        return frozenset(immutable), frozenset(enabled), frozenset(disabled)
 
     def get_package_use_buildable(self, pkg):
         # isolate just what isn't exposed for metadata- anything non-IUSE
@@ -543,8 +573,8 @@ class domain(pkgcore.config.domain.domain):
 
         metadata_use = self.get_package_use_unconfigured(pkg, for_metadata=True)[1]
         raw_use = self.get_package_use_unconfigured(pkg, for_metadata=False)[1]
-        enabled = raw_use.difference(metadata_use)
-
+        enabled = set(raw_use)
+        enabled.difference_update(metadata_use)
         enabled.update(pkg.use)
         return enabled
 
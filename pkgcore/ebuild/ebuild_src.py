@@ -354,27 +354,50 @@ class package_factory(metadata.factory):
         return os.stat(self._get_ebuild_path(pkg)).st_mtime
 
     def _get_metadata(self, pkg, ebp=None, force_regen=False):
-        caches = self._cache
-        if force_regen:
-            caches = ()
-        ebuild_hash = chksum.LazilyHashedPath(pkg.path)
-        for cache in caches:
+        if not force_regen:
+            data = self._get_cached_metadata(pkg.cpvstr, pkg.path)
+            if data is not None:
+                return data
+
+        # no cache entries, regen
+        return self._update_metadata(pkg, ebp=ebp)
+
+    def _get_cached_metadata(self, cpvstr, ebuild_path, prune=True):
+        """
+        :return: the first valid cache entry for cpvstr, or None
+        :param prune: if True, invalid entries are removed from writable
+            caches
+        """
+        ebuild_hash = chksum.LazilyHashedPath(ebuild_path)
+        for cache in self._cache:
             if cache is not None:
                 try:
-                    data = cache[pkg.cpvstr]
+                    data = cache[cpvstr]
                     if cache.validate_entry(data, ebuild_hash, self._ecache):
                         return data
-                    if not cache.readonly:
-                        del cache[pkg.cpvstr]
+                    if prune and not cache.readonly:
+                        del cache[cpvstr]
                 except KeyError:
                     continue
                 except cache_errors.CacheError as ce:
                     logger.warning("caught cache error: %s" % ce)
                     del ce
                     continue
+        return None
 
-        # no cache entries, regen
-        return self._update_metadata(pkg, ebp=ebp)
+    def prefetch(self, cpvstrs):
+        """
+        hint that the metadata of cpvstrs is about to be needed
+
+        Only the first cache is told, that being the one consulted first.
+
+        :return: whatever the cache's prefetch returned; a callable dropping
+            the unused read ahead, or None
+        """
+        for cache in self._cache:
+            if cache is not None:
+                return cache.prefetch(cpvstrs)
+        return None
 
     def _update_metadata(self, pkg, ebp=None):
         parsed_eapi = pkg.eapi_obj
@@ -21,10 +21,11 @@ from pkgcore.config import ConfigHint
 demandload(
     "errno",
     "os",
-    "snakeoil.mappings:StackedDict",
     "snakeoil.osutils:normpath",
 )
 
+_unset = object()
+
 
 class base(object):
     """
@@ -33,6 +34,10 @@ class base(object):
 
     def __init__(self, portdir=None, eclassdir=None):
         self._eclass_data_inst_cache = WeakValCache()
+        # validated entry eclass vectors -> rebuild_cache_entry's result
+        self._rebuilt_entries = {}
+        # chf -> list of that chf's value per eclass id, filled on demand
+        self._chf_table = {}
         # generate this.
         # self.eclasses = {} # {"Name": ("location", "_mtime_")}
         self.portdir = portdir
@@ -62,25 +67,62 @@ class base(object):
 
     eclasses = jit_attr_ext_method("_load_eclasses", "_eclasses")
 
+    def _load_eclass_ids(self):
+        return ImmutableDict(
+            (eclass, idx) for idx, eclass in enumerate(sorted(self.eclasses)))
+
+    # eclass name -> small integer, stable for this instance.
+    eclass_ids = jit_attr_ext_method("_load_eclass_ids", "_eclass_ids")
+
+    def _get_chf(self, chf, idx, eclass):
+        table = self._chf_table.get(chf)
+        if table is None:
+            table = self._chf_table[chf] = [_unset] * len(self.eclass_ids)
+        val = table[idx]
+        if val is _unset:
+            val = table[idx] = getattr(self.eclasses[eclass], chf, None)
+        return val
+
     def rebuild_cache_entry(self, entry_eclasses):
         """Check if eclass data is still valid.
 
         Given a dict as returned by get_eclass_data, walk it comparing
-        it to internal eclass view.
+        it to internal eclass view.  Each eclass's checksums are read
+        at most once per instance, and the verdict for a given eclass
+        vector is reused across every entry sharing it.
 
-        :return: a boolean representing whether that eclass data is still
-            up to date, or not
+        :return: mapping of eclass to its data if that eclass data is
+            still up to date, else None
         """
+        try:
+            key = tuple(entry_eclasses)
+            result = self._rebuilt_entries.get(key, _unset)
+        except TypeError:
+            # unhashable (list based) chksums; validate the slow way.
+            return self._rebuild_cache_entry(entry_eclasses)
+        if result is _unset:
+            result = self._rebuilt_entries[key] = \
+                self._rebuild_cache_entry(key)
+        return result
+
+    def _rebuild_cache_entry(self, entry_eclasses):
+        ids = self.eclass_ids
         ec = self.eclasses
         d = {}
 
         for eclass, chksums in entry_eclasses:
-            data = ec.get(eclass)
-            if any(val != getattr(data, chf, None) for chf, val in chksums):
-                return None
-            d[eclass] = data
+            idx = ids.get(eclass)
+            if idx is None:
+                if chksums:
+                    return None
+                d[eclass] = None
+                continue
+            for chf, val in chksums:
+                if val != self._get_chf(chf, idx, eclass):
+                    return None
+            d[eclass] = ec[eclass]
 
-        return d
+        return ImmutableDict(d)
 
 
 class cache(base):
@@ -144,4 +186,8 @@ class StackedCaches(base):
         base.__init__(self, **kwds)
 
     def _load_eclasses(self):
-        return StackedDict(*[ec.eclasses for ec in self._caches])
+        # flattened once, rather than searching L->R on every lookup.
+        d = {}
+        for ec in reversed(self._caches):
+            d.update(ec.eclasses)
+        return ImmutableDict(d)
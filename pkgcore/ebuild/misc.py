@@ -6,9 +6,11 @@ misc. stuff we've not found a spot for yet.
 """
 
 __all__ = (
-    "ChunkedDataDict", "IncrementalsDict", "PayloadDict",
-    "chunked_data", "collapsed_restrict_to_data", "incremental_chunked",
-    "incremental_expansion", "incremental_expansion_license",
+    "ChunkedDataDict", "FlagSet", "IncrementalsDict", "PackageUseCache",
+    "PayloadDict", "RestrictIndex", "VisibilityFilter", "chunked_data",
+    "collapsed_restrict_to_data", "compile_license_acceptance",
+    "incremental_chunked", "incremental_expansion",
+    "incremental_expansion_layers", "incremental_expansion_license",
     "non_incremental_collapsed_restrict_to_data", "optimize_incrementals",
     "package_keywords_splitter", "split_negations"
 )
@@ -23,6 +25,7 @@ from snakeoil.lists import iflatten_instance, stable_unique
 from snakeoil.sequences import namedtuple
 
 from pkgcore.ebuild import atom
+from pkgcore.repository import planner
 from pkgcore.restrictions import packages, restriction, boolean
 from pkgcore.util.parserestrict import parse_match
 
@@ -78,13 +81,33 @@ def render_incrementals(iterable, **kwds):
 
     :param iterable: sequence of items to incrementally stack
     :param kwargs: options to pass to incremental_expansion
-    :return: a set of the rendered results from incremental_expansion
+    :return: a :obj:`FlagSet` of the rendered results from incremental_expansion
     """
-    s = set()
+    s = FlagSet()
     incremental_expansion(s, iterable, **kwds)
     return s
 
 
+class native_FlagSet(set):
+
+    """
+    set of USE/KEYWORDS/FEATURES style flags
+
+    The cpython version stores flags as a bitset of interned flag indexes,
+    turning :obj:`incremental_expansion` against it into bit operations.
+    """
+
+    __slots__ = ()
+
+    def to_frozenset(self):
+        return frozenset(self)
+
+try:
+    from pkgcore.ebuild._misc import FlagSet
+except ImportError:
+    FlagSet = native_FlagSet
+
+
 def native_incremental_expansion(orig, iterable, msg_prefix='', finalize=True):
     for token in iterable:
         if token[0] == '-':
@@ -102,10 +125,36 @@ def native_incremental_expansion(orig, iterable, msg_prefix='', finalize=True):
             orig.discard("-" + token)
             orig.add(token)
 
+def native_incremental_expansion_layers(orig, layers, msg_prefix='',
+                                        finalize=True):
+    """
+    :obj:`incremental_expansion` of a stack of layers, in order
+
+    Everything prior to the final '-*' is skipped, although still validated.
+
+    :return: orig
+    """
+    layers = [tuple(layer) for layer in layers]
+    start_layer, start = 0, 0
+    for i, layer in enumerate(layers):
+        for j, token in enumerate(layer):
+            if token == '-*':
+                start_layer, start = i, j
+            elif token == '-':
+                raise ValueError("%sencountered an incomplete negation, '-'"
+                    % (msg_prefix,))
+    for layer in layers[start_layer:]:
+        incremental_expansion(orig, layer[start:], msg_prefix=msg_prefix,
+            finalize=finalize)
+        start = 0
+    return orig
+
 try:
-    from pkgcore.ebuild._misc import incremental_expansion
+    from pkgcore.ebuild._misc import (incremental_expansion,
+        incremental_expansion_layers)
 except ImportError:
     incremental_expansion = native_incremental_expansion
+    incremental_expansion_layers = native_incremental_expansion_layers
 
 def incremental_expansion_license(licenses, license_groups, iterable, msg_prefix=''):
     seen = set()
@@ -139,6 +188,65 @@ def incremental_expansion_license(licenses, license_groups, iterable, msg_prefix
     return seen
 
 
+def _accepts_licenses(star, added, removed, licenses):
+    for license in licenses:
+        if license not in added and (not star or license in removed):
+            return False
+    return True
+
+
+def compile_license_acceptance(license_groups, iterable, msg_prefix=''):
+    """
+    precompute an ACCEPT_LICENSE style stack for repeated checks
+
+    :return: callable taking a sequence of licenses, returning True if
+        :obj:`incremental_expansion_license` of them, license_groups, and
+        iterable would accept all of them
+    """
+    # '*' expands to whatever licenses are being checked, so track
+    # whether it's in effect and what was discarded after it rather than
+    # expanding it.
+    star = False
+    added, removed = set(), set()
+    for token in iterable:
+        if token[0] == '-':
+            i = token[1:]
+            if not i:
+                raise ValueError("%sencountered an incomplete negation, '-'"
+                    % (msg_prefix,))
+            if i == '*':
+                star = False
+                added.clear()
+                removed.clear()
+                continue
+            if i[0] == '@':
+                i = i[1:]
+                if not i:
+                    raise ValueError("%sencountered an incomplete negation"
+                        " of a license group, '-@'" % (msg_prefix,))
+                i = license_groups.get(i, ())
+            else:
+                i = (i,)
+            added.difference_update(i)
+            if star:
+                removed.update(i)
+        elif token == '*':
+            star = True
+            removed.clear()
+        else:
+            if token[0] == '@':
+                i = token[1:]
+                if not i:
+                    raise ValueError("%sencountered an incomplete license "
+                        "group, '@'" % (msg_prefix,))
+                i = license_groups.get(i, ())
+            else:
+                i = (token,)
+            added.update(i)
+            removed.difference_update(i)
+    return partial(_accepts_licenses, star, frozenset(added), frozenset(removed))
+
+
 class IncrementalsDict(mappings.DictMixin):
 
     disable_py3k_rewriting = True
@@ -168,6 +276,223 @@ class IncrementalsDict(mappings.DictMixin):
     del x, s
 
 
+class PackageUseCache(object):
+
+    """
+    memoized per package USE rendering
+
+    Entries are keyed on cpv, slot and repo (see :obj:`key`); since the
+    rendering only depends on the configuration, the whole thing must be
+    invalidated whenever that changes.  Hit/miss counts are tracked for
+    reporting.
+    """
+
+    __slots__ = ("_cache", "hits", "misses")
+
+    def __init__(self):
+        self._cache = {}
+        self.hits = self.misses = 0
+
+    @staticmethod
+    def key(pkg, *args):
+        return (pkg.cpvstr, pkg.slot, getattr(pkg.repo, 'repo_id', None)) + args
+
+    def get(self, key, func, *args):
+        """
+        :return: cached value for key, else the result of func(\*args),
+            stored under key
+        """
+        val = self._cache.get(key)
+        if val is None:
+            self.misses += 1
+            val = self._cache[key] = func(*args)
+        else:
+            self.hits += 1
+        return val
+
+    def invalidate(self):
+        self._cache.clear()
+
+    def __len__(self):
+        return len(self._cache)
+
+    @property
+    def hit_rate(self):
+        total = self.hits + self.misses
+        if not total:
+            return 0.0
+        return float(self.hits) / total
+
+    def __str__(self):
+        return "%i hits, %i misses (%.1f%% hit rate), %i entries" % (
+            self.hits, self.misses, self.hit_rate * 100, len(self._cache))
+
+
+class native_VisibilityFilter(object):
+
+    __slots__ = ("checks", "verdicts")
+
+    def __init__(self, checks):
+        object.__setattr__(self, "checks", tuple(checks))
+        object.__setattr__(self, "verdicts", {})
+
+    def match(self, pkg):
+        key = getattr(pkg, "cpvstr", None)
+        if key is not None:
+            verdict = self.verdicts.get(key)
+            if verdict is not None:
+                return verdict
+        verdict = True
+        for check in self.checks:
+            if not check(pkg):
+                verdict = False
+                break
+        if key is not None:
+            self.verdicts[key] = verdict
+        return verdict
+
+    def invalidate(self):
+        self.verdicts.clear()
+
+
+try:
+    from pkgcore.ebuild._misc import VisibilityFilter as VisibilityFilter_base
+except ImportError:
+    VisibilityFilter_base = native_VisibilityFilter
+
+
+class VisibilityFilter(VisibilityFilter_base, restriction.base):
+
+    """
+    package restriction fusing a domain's visibility checks
+
+    Checks (callables taking a package, returning True if it's visible)
+    are run in order, stopping at the first failure; thus the cheapest
+    should come first.  Verdicts are cached on the package's cpvstr for
+    the life of the instance, so an instance must only be used against a
+    single repository, and must be invalidated (via :obj:`invalidate`)
+    if the configuration the checks rely on changes.
+    """
+
+    __slots__ = ()
+    __inst_caching__ = False
+    type = packages.package_type
+
+    def __str__(self):
+        return "visibility filter: %i checks, %i cached verdicts" % (
+            len(self.checks), len(self.verdicts))
+
+
+class RestrictIndex(object):
+
+    """
+    multi level index of (restrict, data) pairs for per package lookups
+
+    Each restriction is bucketed by what it requires of a package (via
+    :obj:`pkgcore.repository.planner`): an exact (category, package) hash,
+    exact category and package hashes, category/package glob tables
+    (evaluated once per distinct category/package name, then memoized), and
+    a residual list for anything else.  Looking up a package thus costs
+    O(matching entries) rather than O(entries); matches are returned in
+    the order they were added.
+    """
+
+    __slots__ = ("_cp", "_cat", "_pkg", "_cat_globs", "_pkg_globs",
+                 "_cat_glob_cache", "_pkg_glob_cache", "_residual", "_len",
+                 "_plans")
+
+    def __init__(self, pairs=(), plans=None):
+        """
+        :param pairs: iterable of (restrict, data) to add
+        :param plans: if not None, dict of restrict -> planned terms; used
+            (and filled in) so indexes sharing restrictions plan them once
+        """
+        self._cp = {}
+        self._cat = {}
+        self._pkg = {}
+        self._cat_globs = []
+        self._pkg_globs = []
+        self._cat_glob_cache = {}
+        self._pkg_glob_cache = {}
+        self._residual = []
+        self._len = 0
+        self._plans = plans
+        for restrict, data in pairs:
+            self.add(restrict, data)
+
+    def _plan(self, restrict):
+        plans = self._plans
+        if plans is None:
+            return planner.plan_query(restrict).terms
+        terms = plans.get(restrict)
+        if terms is None:
+            terms = plans[restrict] = planner.plan_query(restrict).terms
+        return terms
+
+    def add(self, restrict, data):
+        entry = (self._len, restrict, data)
+        self._len += 1
+        terms = self._plan(restrict)
+        if not terms:
+            # can never match.
+            return
+        elif len(terms) > 1:
+            self._residual.append(entry)
+            return
+        term = terms[0]
+        if term.cats is not None and term.pkgs is not None:
+            for cp in ((c, p) for c in term.cats for p in term.pkgs):
+                self._cp.setdefault(cp, []).append(entry)
+        elif term.cats is not None:
+            for c in term.cats:
+                self._cat.setdefault(c, []).append(entry)
+        elif term.pkgs is not None:
+            for p in term.pkgs:
+                self._pkg.setdefault(p, []).append(entry)
+        elif term.cat_preds:
+            self._cat_globs.append((term.accepts_cat, entry))
+        elif term.pkg_preds:
+            self._pkg_globs.append((term.accepts_pkg, entry))
+        else:
+            self._residual.append(entry)
+            return
+        self._cat_glob_cache.clear()
+        self._pkg_glob_cache.clear()
+
+    @staticmethod
+    def _glob_lookup(cache, globs, key):
+        l = cache.get(key)
+        if l is None:
+            l = cache[key] = tuple(entry for accepts, entry in globs
+                                   if accepts(key))
+        return l
+
+    def _candidates(self, cat, pkg):
+        sources = [x for x in (
+            self._cp.get((cat, pkg)), self._cat.get(cat), self._pkg.get(pkg),
+            self._cat_globs and self._glob_lookup(
+                self._cat_glob_cache, self._cat_globs, cat),
+            self._pkg_globs and self._glob_lookup(
+                self._pkg_glob_cache, self._pkg_globs, pkg),
+            self._residual) if x]
+        if len(sources) == 1:
+            return sources[0]
+        # entries are unique per package; restore insertion order.
+        return sorted(chain.from_iterable(sources))
+
+    def iter_match(self, pkg):
+        """yield the (restrict, data) pairs matching pkg"""
+        for pos, restrict, data in self._candidates(pkg.category, pkg.package):
+            if restrict.match(pkg):
+                yield restrict, data
+
+    def __len__(self):
+        return self._len
+
+    def __nonzero__(self):
+        return self._len != 0
+
+
 class collapsed_restrict_to_data(object):
 
     __metaclass__ = generic_equality
@@ -233,26 +558,41 @@ class collapsed_restrict_to_data(object):
         self.defaults_finalized = set(x for x in self.defaults
             if not x.startswith("-"))
         self.freeform = tuple(x for x in (repo, cat, pkg, multi) if x)
+        self.freeform_index = RestrictIndex(chain.from_iterable(self.freeform))
         self.atoms = atom_d
+        self._frozen = {}
 
-    def pull_data(self, pkg, force_copy=False, pre_defaults=()):
-        l = []
-        for specific in self.freeform:
-            for restrict, data in specific:
-                if restrict.match(pkg):
-                    l.append(data)
+    def _matched_data(self, pkg):
+        l = [data for restrict, data in self.freeform_index.iter_match(pkg)]
         for atom, data in self.atoms.get(pkg.key, ()):
             if atom.match(pkg):
                 l.append(data)
+        return l
+
+    def pull_frozen_data(self, pkg):
+        """
+        :return: frozenset of what :obj:`pull_data` returns for pkg; this is
+            memoized on which entries matched pkg, so packages matching the
+            same entries share the result
+        """
+        l = self._matched_data(pkg)
+        key = tuple(map(id, l))
+        val = self._frozen.get(key)
+        if val is None:
+            val = self._frozen[key] = frozenset(self._render_data(l))
+        return val
 
+    def pull_data(self, pkg, force_copy=False, pre_defaults=()):
+        l = self._matched_data(pkg)
         if pre_defaults:
-            s = set(pre_defaults)
-            incremental_expansion(s, self.defaults)
-        else:
-            s = set(self.defaults_finalized)
+            l.insert(0, self.defaults)
+            return incremental_expansion_layers(set(pre_defaults), l)
+        return self._render_data(l)
 
+    def _render_data(self, l):
+        s = set(self.defaults_finalized)
         if l:
-            incremental_expansion(s, iflatten_instance(l))
+            incremental_expansion_layers(s, l)
         return s
 
     def iter_pull_data(self, pkg, pre_defaults=()):
@@ -260,11 +600,9 @@ class collapsed_restrict_to_data(object):
             yield item
         for item in self.defaults:
             yield item
-        for specific in self.freeform:
-            for restrict, data in specific:
-                if restrict.match(pkg):
-                    for item in data:
-                        yield item
+        for restrict, data in self.freeform_index.iter_match(pkg):
+            for item in data:
+                yield item
         for atom, data in self.atoms.get(pkg.key, ()):
             if atom.match(pkg):
                 for item in data:
@@ -274,26 +612,21 @@ class collapsed_restrict_to_data(object):
 class non_incremental_collapsed_restrict_to_data(collapsed_restrict_to_data):
 
     def pull_data(self, pkg, force_copy=False):
-        l = []
-        for specific in self.freeform:
-            for restrict, data in specific:
-                if restrict.match(pkg):
-                    l.append(data)
-        for atom, data in self.atoms.get(pkg.key, ()):
-            if atom.match(pkg):
-                l.append(data)
+        l = self._matched_data(pkg)
         if not l:
             if force_copy:
                 return set(self.defaults)
             return self.defaults
+        return self._render_data(l)
+
+    def _render_data(self, l):
         s = set(self.defaults)
         s.update(iflatten_instance(l))
         return s
 
     def iter_pull_data(self, pkg):
         l = [self.defaults]
-        for specific in self.freeform:
-            l.extend(data for restrict, data in specific if restrict.match(pkg))
+        l.extend(data for restrict, data in self.freeform_index.iter_match(pkg))
         for atom, data in self.atoms.get(pkg.key, ()):
             if atom.match(pkg):
                 l.append(data)
@@ -376,12 +709,29 @@ def _build_cp_atom_payload(sequence, restrict, payload_form=False):
 
 class ChunkedDataDict(object):
 
+    """
+    per package key stacks of chunked_data, plus a stack of globals
+
+    Each key's stack has the globals interleaved, in order.  Rendering
+    matches a package against its key's stack (or the globals, if its key
+    has none) via a :obj:`RestrictIndex` built for that stack on first use,
+    so glob and other non atom entries aren't each tried on every package;
+    any modification discards the indexes.
+    """
+
     __metaclass__ = generic_equality
     __attr_comparison__ = ('_global_settings', '_dict')
 
     def __init__(self):
         self._global_settings = []
         self._dict = defaultdict(partial(list, self._global_settings))
+        self._reset_indexes()
+
+    def _reset_indexes(self):
+        # key -> RestrictIndex of its stack; None for the globals.
+        self._indexes = {}
+        # restrict -> planned terms, shared across the indexes.
+        self._plans = {}
 
     @property
     def frozen(self):
@@ -389,6 +739,7 @@ class ChunkedDataDict(object):
 
     def clone(self, unfreeze=False):
         obj = self.__class__()
+        obj._plans = self._plans
         if self.frozen and not unfreeze:
             obj._dict = self._dict
             obj._global_settings = self._global_settings
@@ -421,6 +772,7 @@ class ChunkedDataDict(object):
             vals.append(payload)
 
         self._expand_globals([payload])
+        self._indexes.clear()
 
     def merge(self, cdict):
         if not isinstance(cdict, ChunkedDataDict):
@@ -445,6 +797,7 @@ class ChunkedDataDict(object):
             for key in updates:
                 d[key].extend(new_globals)
         self._expand_globals(new_globals)
+        self._indexes.clear()
 
     def _expand_globals(self, new_globals):
         # while a chain seems obvious here, reversed is used w/in _build_cp_atom;
@@ -467,6 +820,7 @@ class ChunkedDataDict(object):
                                if x not in self._dict[cinst.key.key])
                 self._dict[cinst.key.key].extend(new_globals)
                 self._dict[cinst.key.key].append(cinst)
+                self._indexes.pop(cinst.key.key, None)
             else:
                 self.add_global(cinst)
 
@@ -494,6 +848,7 @@ class ChunkedDataDict(object):
         else:
             self._dict.update(d_stream)
             self._global_settings[:] = list(g_stream)
+        self._indexes.clear()
 
     def render_to_dict(self):
         d = dict(self._dict)
@@ -514,12 +869,25 @@ class ChunkedDataDict(object):
     def __nonzero__(self):
         return bool(self._global_settings) or bool(self._dict)
 
-    def render_pkg(self, pkg, pre_defaults=()):
-        items = self._dict.get(pkg.key)
+    @staticmethod
+    def _item_restrict(item):
+        return item.key
+
+    def _iter_matching(self, pkg, key):
+        """yield the items of key's stack matching pkg, in stacking order"""
+        items = self._dict.get(key)
         if items is None:
-            items = self._global_settings
+            key, items = None, self._global_settings
+        index = self._indexes.get(key)
+        if index is None:
+            restrict = self._item_restrict
+            index = self._indexes[key] = RestrictIndex(
+                ((restrict(x), x) for x in items), plans=self._plans)
+        return (item for restrict, item in index.iter_match(pkg))
+
+    def render_pkg(self, pkg, pre_defaults=()):
         s = set(pre_defaults)
-        incremental_chunked(s, (cinst for cinst in items if cinst.key.match(pkg)))
+        incremental_chunked(s, self._iter_matching(pkg, pkg.key))
         return s
 
     pull_data = render_pkg
@@ -549,17 +917,17 @@ class PayloadDict(ChunkedDataDict):
                 # hack also... recreate the restriction; this is due to
                 # internal idiocy in ChunkedDataDict that will be fixed.
                 self._dict[pinst.restrict.key].append(pinst)
+                self._indexes.pop(pinst.restrict.key, None)
             else:
                 self.add_global(pinst)
 
+    @staticmethod
+    def _item_restrict(item):
+        return item.restrict
+
     def render_pkg(self, pkg, pre_defaults=()):
-        items = self._dict.get(atom.atom(pkg.key))
-        if items is None:
-            items = self._global_settings
-        s = set(pre_defaults)
-        incremental_expansion(s,
-            chain.from_iterable(item.data for item in items
-                if item.restrict.match(pkg)))
-        return s
+        return incremental_expansion_layers(set(pre_defaults),
+            [item.data for item in
+             self._iter_matching(pkg, atom.atom(pkg.key))])
 
     pull_data = render_pkg
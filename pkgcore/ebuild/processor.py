@@ -55,8 +55,11 @@ from snakeoil.osutils import abspath, normpath, pjoin
 from snakeoil.weakrefs import WeakRefFinalizer
 
 demandload(
+    'hashlib',
+    'tempfile',
     'traceback',
     'snakeoil:fileutils',
+    'snakeoil.mappings:ImmutableDict',
     'pkgcore.log:logger',
 )
 
@@ -79,6 +82,22 @@ def forget_all_processors():
     inactive_ebp_list[:] = []
 
 
+@_single_thread_allowed
+def forget_inherited_processors():
+    """
+    disown processors inherited across a fork
+
+    Must be called in a forked child before it requests a processor; the
+    inherited instances share their daemons with the parent, thus are
+    marked dead (so neither reuse nor finalization touches the daemon)
+    rather than shut down.
+    """
+    for ebp in active_ebp_list + inactive_ebp_list:
+        ebp.pid = None
+    active_ebp_list[:] = []
+    inactive_ebp_list[:] = []
+
+
 @_single_thread_allowed
 def shutdown_all_processors():
     """kill off all known processors"""
@@ -104,6 +123,134 @@ def shutdown_all_processors():
 pkgcore.spawn.atexit_register(shutdown_all_processors)
 
 
+class EclassBundle(object):
+
+    """
+    an eclass stack pre-serialized into bash functions, in a tmpfs file
+
+    Each eclass is rendered once into a function named after the sha1 of
+    its source (identical eclasses thus share one); daemons source the
+    bundle rather than each reading, syntax checking and evaluating every
+    eclass on its own.
+    """
+
+    def __init__(self, path, key, index):
+        """
+        :param path: location of the bundle file
+        :param key: sha1 of the index, identifying the bundle's content
+        :param index: mapping of eclass name to (eclass path, content sha1)
+        """
+        self.path = path
+        self.key = key
+        self.index = index
+        self._owner = os.getpid()
+
+    def remove(self):
+        # forked children inherit the parent's bundles; leave those be.
+        if self._owner != os.getpid():
+            return
+        try:
+            os.unlink(self.path)
+        except EnvironmentError as e:
+            if e.errno != errno.ENOENT:
+                raise
+
+
+# index key -> EclassBundle, and the stat level view of an eclass stack
+# (name, path, mtime triplets) -> EclassBundle; the latter spares hashing
+# every eclass for each daemon.
+_eclass_bundles = {}
+_eclass_bundles_by_stat = {}
+
+
+def _eclass_bundle_dir():
+    if os.path.isdir('/dev/shm') and os.access('/dev/shm', os.W_OK | os.X_OK):
+        return '/dev/shm'
+    return None
+
+
+def _render_eclass_bundle(path, sources, index):
+    with open(path, 'w') as f:
+        os.fchmod(f.fileno(), 0644)
+        for chksum, text in sorted(sources.iteritems()):
+            f.write("__preloaded_eclass_%s() {\n%s\n}\n" % (chksum, text))
+        for eclass, (_, chksum) in sorted(index.iteritems()):
+            f.write("PKGCORE_PRELOADED_ECLASSES[%s]=__preloaded_eclass_%s\n"
+                    % (eclass, chksum))
+
+
+def _syntax_ok(path):
+    return pkgcore.spawn.spawn(
+        [const.BASH_BINARY, '-n', path], fd_pipes={1: 1, 2: 2}) == 0
+
+
+@_single_thread_allowed
+def get_eclass_bundle(cache):
+    """
+    get the shared bundle for an eclass stack, building it if needed
+
+    The bundle is built once per process (and shared with any processes
+    forked after); eclasses that fail a syntax check are left out of it.
+
+    :param cache: :obj:`pkgcore.ebuild.eclass_cache.base` instance
+    :return: :obj:`EclassBundle` instance, or None if the stack is empty
+    """
+    stat_key = tuple(sorted(
+        (eclass, data.path, data.mtime)
+        for eclass, data in cache.eclasses.iteritems()
+        if data.path is not None))
+    bundle = _eclass_bundles_by_stat.get(stat_key)
+    if bundle is not None:
+        return bundle
+    if not stat_key:
+        return None
+
+    sources, index = {}, {}
+    for eclass, path, _ in stat_key:
+        with open(path, 'r') as f:
+            text = f.read()
+        chksum = hashlib.sha1(text).hexdigest()
+        sources[chksum] = text
+        index[eclass] = (path, chksum)
+    key = hashlib.sha1(''.join(
+        "%s %s\n" % (eclass, chksum)
+        for eclass, (_, chksum) in sorted(index.iteritems()))).hexdigest()
+
+    bundle = _eclass_bundles.get(key)
+    if bundle is None:
+        fd, path = tempfile.mkstemp(
+            prefix='pkgcore-eclasses-', suffix='.bash',
+            dir=_eclass_bundle_dir())
+        os.close(fd)
+        _render_eclass_bundle(path, sources, index)
+        if not _syntax_ok(path):
+            # find the offenders; this is the slow path, thus only taken
+            # for broken trees.
+            for eclass, (ec_path, chksum) in index.items():
+                if not _syntax_ok(ec_path):
+                    logger.error("errors detected in %r, not bundling it",
+                                 ec_path)
+                    del index[eclass]
+            used = frozenset(chksum for _, chksum in index.itervalues())
+            sources = dict((k, v) for k, v in sources.iteritems() if k in used)
+            _render_eclass_bundle(path, sources, index)
+        bundle = EclassBundle(path, key, ImmutableDict(index))
+        _eclass_bundles[key] = bundle
+    _eclass_bundles_by_stat[stat_key] = bundle
+    return bundle
+
+
+@_single_thread_allowed
+def remove_eclass_bundles():
+    """remove the bundle files this process created"""
+    for bundle in _eclass_bundles.itervalues():
+        bundle.remove()
+    _eclass_bundles.clear()
+    _eclass_bundles_by_stat.clear()
+
+pkgcore.spawn.atexit_register(remove_eclass_bundles)
+
+
 @_single_thread_allowed
 def request_ebuild_processor(userpriv=False, sandbox=None, fakeroot=False,
                              save_file=None):
@@ -238,6 +385,44 @@ class InitializationError(Exception):
     pass
 
 
+def native_encode_env(env, dont_export):
+    data = []
+    for key, val in env.iteritems():
+        if key in dont_export:
+            continue
+        if not key[0].isalpha():
+            raise KeyError("%s: bash doesn't allow digits as the first char" % (key,))
+        if not isinstance(val, basestring):
+            raise ValueError("_generate_env_str was fed a bad value; key=%s, val=%s"
+                             % (key, val))
+        if val.isalnum():
+            data.append("%s=%s" % (key, val))
+        elif "'" not in val:
+            data.append("%s='%s'" % (key, val))
+        else:
+            data.append("%s=$'%s'" % (key, val.replace("'", "\\'")))
+    return 'export %s' % (' '.join(data),)
+
+
+def native_decode_keys(payload):
+    d = {}
+    for line in payload.split("\n"):
+        if not line:
+            continue
+        key, sep, val = line.partition("=")
+        if not sep:
+            raise ValueError("malformed key line: %s" % (line,))
+        d[key] = val
+    return d
+
+
+try:
+    from pkgcore.ebuild._processor import encode_env, decode_keys
+except ImportError:
+    encode_env = native_encode_env
+    decode_keys = native_decode_keys
+
+
 class EbuildProcessor(object):
 
     """abstraction of a running ebuild.sh instance.
@@ -262,6 +447,7 @@ class EbuildProcessor(object):
         spawn_opts = {'umask': 0002}
 
         self._preloaded_eclasses = {}
+        self._eclass_bundle = None
         self._eclass_caching = False
         self._outstanding_expects = []
         self._metadata_paths = None
@@ -357,7 +543,7 @@ class EbuildProcessor(object):
         if self.__sandbox:
             self.write("sandbox_log?")
             self.__sandbox_log = self.read().split()[0]
-        self.dont_export_vars = self.read().split()
+        self.dont_export_vars = frozenset(self.read().split())
         # locking isn't used much, but w/ threading this will matter
         self.unlock()
 
@@ -384,8 +570,8 @@ class EbuildProcessor(object):
             return False
         self.write("set_sandbox_state %i" % sandbox)
         if logging:
-            if not self.set_logfile(logging):
-                return False
+            # pipelined; generic_handler consumes the ack.
+            self.set_logfile(logging, async=True)
         self.write("start_processing")
         return self.generic_handler(additional_commands=additional_commands)
 
@@ -429,6 +615,29 @@ class EbuildProcessor(object):
                 raise RuntimeError(ie)
             raise
 
+    def write_frame(self, command, payload, flush=True):
+        """send a frame: a command line carrying the payload's size,
+        followed by the payload itself.
+
+        :param command: command the payload is for
+        :param payload: string to transfer as is
+        """
+        self.write("%s %i\n%s" % (command, len(payload), payload),
+                   flush=flush, append_newline=False)
+
+    def read_frame(self, size):
+        """read the payload of a frame from the daemon.
+
+        :param size: the size from the frame's command line
+        :return: the payload
+        """
+        size = size.strip() if size else size
+        if not size:
+            raise InternalError(size, "frame lacks a size")
+        elif not size.isdigit():
+            raise InternalError(size, "frame size wasn't an integer")
+        return self.ebd_read.read(int(size))
+
     def _consume_async_expects(self):
         if any(x[0] for x in self._outstanding_expects):
             self.ebd_write.flush()
@@ -519,6 +728,7 @@ class EbuildProcessor(object):
                 self.shutdown_processor()
                 return False
         self._preloaded_eclasses.clear()
+        self._eclass_bundle = None
         return True
 
     def preload_eclasses(self, cache, async=False, limited_to=None):
@@ -527,20 +737,24 @@ class EbuildProcessor(object):
 
         Avoids the cost of going to disk on inherit. Preloading eutils
         (which is heavily inherited) speeds up regen times for
-        example.
+        example.  The full stack is loaded from the shared bundle (see
+        :obj:`get_eclass_bundle`) rather than eclass by eclass.
 
-        :param ec_file: filepath of eclass to preload
+        :param cache: :obj:`pkgcore.ebuild.eclass_cache.base` instance
+        :param limited_to: if given, only preload these eclasses
         :return: boolean, True for success
         """
-        ec = cache.eclasses
-        if limited_to:
-            i = ((eclass, ec[eclass]) for eclass in limited_to)
+        if not limited_to:
+            bundle = get_eclass_bundle(cache)
+            if bundle is not None:
+                self._preload_eclass_bundle(bundle, async=True)
         else:
-            i = cache.eclasses.iteritems()
-        for eclass, data in i:
-            if data.path != self._preloaded_eclasses.get(eclass):
-                if self._preload_eclass(data.path, async=True):
-                    self._preloaded_eclasses[eclass] = data.path
+            ec = cache.eclasses
+            for eclass in limited_to:
+                data = ec[eclass]
+                if data.path != self._preloaded_eclasses.get(eclass):
+                    if self._preload_eclass(data.path, async=True):
+                        self._preloaded_eclasses[eclass] = data.path
         if not async:
             return self._consume_async_expects()
         return True
@@ -552,6 +766,24 @@ class EbuildProcessor(object):
         self.clear_preloaded_eclasses()
         self._eclass_caching = False
 
+    def _preload_eclass_bundle(self, bundle, async=False):
+        """
+        Have the daemon source an :obj:`EclassBundle`.
+
+        :param async: if True, the ack is consumed along with the next
+            command's replies rather than waited on
+        :return: boolean, True for success
+        """
+        if self._eclass_bundle is bundle:
+            return True
+        self.write("preload_eclass_bundle %s" % bundle.path, flush=not async)
+        if not self.expect("preload_eclass_bundle succeeded", async=async):
+            return False
+        self._eclass_bundle = bundle
+        self._preloaded_eclasses.update(
+            (eclass, path) for eclass, (path, _) in bundle.index.iteritems())
+        return True
+
     def _preload_eclass(self, ec_file, async=False):
         """
         Preload an eclass into a bash function.
@@ -635,22 +867,7 @@ class EbuildProcessor(object):
         self.pid = None
 
     def _generate_env_str(self, env_dict):
-        data = []
-        for key, val in env_dict.iteritems():
-            if key in self.dont_export_vars:
-                continue
-            if not key[0].isalpha():
-                raise KeyError("%s: bash doesn't allow digits as the first char" % (key,))
-            if not isinstance(val, basestring):
-                raise ValueError("_generate_env_str was fed a bad value; key=%s, val=%s"
-                                 % (key, val))
-            if val.isalnum():
-                data.append("%s=%s" % (key, val))
-            elif "'" not in val:
-                data.append("%s='%s'" % (key, val))
-            else:
-                data.append("%s=$'%s'" % (key, val.replace("'", "\\'")))
-        return 'export %s' % (' '.join(data),)
+        return encode_env(env_dict, self.dont_export_vars)
 
     def send_env(self, env_dict, async=False, tmpdir=None):
         """
@@ -667,21 +884,22 @@ class EbuildProcessor(object):
             self.write("start_receiving_env file %s\n" %
                        (path,), append_newline=False)
         else:
-            self.write("start_receiving_env bytes %i\n%s" %
-                       (len(data), data), append_newline=False)
+            self.write_frame("start_receiving_env bytes", data)
         os.umask(old_umask)
         return self.expect("env_received", async=async, flush=True)
 
-    def set_logfile(self, logfile=''):
+    def set_logfile(self, logfile='', async=False):
         """
         Set the logfile (location to log to).
 
         Relevant only when the daemon is sandbox'd,
 
         :param logfile: filepath to log to
+        :param async: if True, the ack is consumed along with the next
+            command's replies rather than waited on
         """
-        self.write("logging %s" % logfile)
-        return self.expect("logging_ack")
+        self.write("logging %s" % logfile, flush=not async)
+        return self.expect("logging_ack", async=async)
 
     def __del__(self):
         """simply attempts to notify the daemon to die"""
@@ -700,21 +918,26 @@ class EbuildProcessor(object):
         # filter here, so that a screwy default doesn't result in resetting it
         # every time.
         data = ':'.join(filter(None, paths))
-        self.write("set_metadata_path %i\n%s" % (len(data), data), append_newline=False)
-        if self.expect("metadata_path_received", flush=True):
-            self._metadata_paths = paths
+        # pipelined with the request following it; generic_handler
+        # consumes the ack.
+        self.write_frame("set_metadata_path", data, flush=False)
+        self.expect("metadata_path_received", async=True)
+        self._metadata_paths = paths
 
     def _run_depend_like_phase(self, command, package_inst, eclass_cache,
                                extra_commands={}):
         self._ensure_metadata_paths(const.HOST_NONROOT_PATHS)
 
-        e = expected_ebuild_env(package_inst, depends=True)
-        data = self._generate_env_str(e)
-        self.write("%s %i\n%s" % (command, len(data), data), append_newline=False)
-
         updates = None
         if self._eclass_caching:
             updates = set()
+            if self._eclass_bundle is None:
+                # pipelined with the request following it.
+                self.preload_eclasses(eclass_cache, async=True)
+
+        e = expected_ebuild_env(package_inst, depends=True)
+        self.write_frame(command, self._generate_env_str(e))
+
         commands = extra_commands.copy()
         commands["request_inherit"] = partial(inherit_handler, eclass_cache, updates=updates)
         val = self.generic_handler(additional_commands=commands)
@@ -743,13 +966,8 @@ class EbuildProcessor(object):
         def receive_env(self, line):
             if environ:
                 raise InternalError(line, "receive_env was invoked twice.")
-            line = line.strip()
-            if not line:
-                raise InternalError(line, "During env receive, ebd didn't give us a size.")
-            elif not line.isdigit():
-                raise InternalError(line, "Returned size wasn't an integer")
             # This is a raw transfer, for obvious reasons.
-            environ.append(self.ebd_read.read(int(line)))
+            environ.append(self.read_frame(line))
 
         self._run_depend_like_phase('gen_ebuild_env', package_inst, eclass_cache,
                                     {'receive_env': receive_env})
@@ -770,14 +988,16 @@ class EbuildProcessor(object):
         """
         metadata_keys = {}
 
-        def receive_key(self, line):
-            line = line.split("=", 1)
-            if len(line) != 2:
-                raise FinishedProcessing(True)
-            metadata_keys[line[0]] = line[1]
+        def receive_keys(self, line):
+            # every key arrives in a single frame.
+            payload = self.read_frame(line)
+            try:
+                metadata_keys.update(decode_keys(payload))
+            except ValueError as e:
+                raise InternalError(line, str(e))
 
         self._run_depend_like_phase('gen_metadata', package_inst, eclass_cache,
-                                    {"key": receive_key})
+                                    {"keys": receive_keys})
 
         return metadata_keys
 
@@ -34,7 +34,7 @@ demandload(
     'random:shuffle',
     'snakeoil.chksum:get_chksums',
     'snakeoil.data_source:local_source',
-    'pkgcore.ebuild:ebd,digest,repo_objs,atom,profiles,processor',
+    'pkgcore.ebuild:columnar,ebd,digest,repo_objs,atom,profiles,processor',
     'pkgcore.ebuild:errors@ebuild_errors',
     'pkgcore.fs.livefs:iter_scan',
     'pkgcore.log:logger',
@@ -391,6 +391,37 @@ class _UnconfiguredTree(prototype.tree):
                 "failed fetching versions for package %s: %s" %
                 (pjoin(self.base, catpkg.lstrip(os.path.sep)), str(e))))
 
+    @klass.jit_attr
+    def metadata_index(self):
+        """
+        :obj:`pkgcore.ebuild.columnar.MetadataColumns` view of the metadata
+        cache, loaded on demand; used by itermatch to prune candidates
+        """
+        return columnar.MetadataColumns(self._iter_cached_metadata)
+
+    @staticmethod
+    def _cpvstr(category, package, ver):
+        # cache keys use the normalized version; see _get_ebuild_path.
+        return "%s/%s-%s" % (
+            category, package, ver[:-3] if ver.endswith("-r0") else ver)
+
+    def _iter_cached_metadata(self, cp):
+        category, package = cp
+        get = self.package_class._get_cached_metadata
+        for ver in self.versions.get(cp, ()):
+            data = get(self._cpvstr(category, package, ver),
+                pjoin(self.base, category, package,
+                      "%s-%s%s" % (package, ver, self.extension)),
+                prune=False)
+            if data is not None:
+                yield ver, data
+
+    def prefetch_metadata(self, pairs):
+        """have the metadata cache read ahead the entries of upcoming packages"""
+        cpvstr = self._cpvstr
+        return self.package_class.prefetch([cpvstr(cp[0], cp[1], ver)
+            for cp, versions in pairs for ver in versions])
+
     def _get_ebuild_path(self, pkg):
         if pkg.revision is None:
             if pkg.fullver not in self.versions[(pkg.category, pkg.package)]:
@@ -5,7 +5,15 @@ from snakeoil import compatibility
 from snakeoil.demandload import demandload
 
 demandload(
-    'pkgcore.util.thread_pool:map_async',
+    'errno',
+    'multiprocessing',
+    'multiprocessing.pool:ThreadPool',
+    'os',
+    'Queue',
+    'time',
+    'snakeoil:fileutils',
+    'pkgcore.ebuild:processor',
+    'pkgcore.log:logger',
 )
 
 
@@ -21,7 +29,328 @@ def regen_iter(iterable, regen_func, observer, is_thread=False):
             observer.error("caught exception %s while processing %s" % (e, x))
 
 
-def regen_repository(repo, observer, threads=1, pkg_attr='keywords', **options):
+def _claim_chunks(total, cursor, workers):
+    """
+    yield ranges of work claimed from a cursor shared between workers
+
+    Chunks shrink as the remaining work does (guided self-scheduling);
+    early claims are large to keep cursor contention and the loss of
+    locality down, late ones small so that workers finish together.
+    """
+    while True:
+        with cursor.get_lock():
+            start = cursor.value
+            if start >= total:
+                return
+            size = max(1, (total - start) // (workers * 4))
+            cursor.value = start + size
+        yield start, start + size
+
+
+def _regen_worker(worker_id, pkgs, cursor, workers, get_helper, results,
+                  flush, record):
+    # the parent's processors share its daemons; never touch them here.
+    processor.forget_inherited_processors()
+    start_time = time.time()
+    processed = failed = 0
+    helper = get_helper()
+    try:
+        for start, end in _claim_chunks(len(pkgs), cursor, workers):
+            for idx in xrange(start, end):
+                pkg = pkgs[idx]
+                try:
+                    val = helper(pkg)
+                except compatibility.IGNORED_EXCEPTIONS:
+                    raise
+                except Exception as e:
+                    failed += 1
+                    results.put((worker_id, "error",
+                        "caught exception %s while processing %s" % (e, pkg)))
+                else:
+                    if record:
+                        results.put((worker_id, "result", (idx, val)))
+                processed += 1
+    finally:
+        f = getattr(helper, 'finish', None)
+        if f is not None:
+            f()
+    # cache writes were queued (see the regen_cache operation); commit
+    # them as one batch.
+    flush()
+    results.put((worker_id, "done",
+        (processed, failed, time.time() - start_time)))
+
+
+def regen_parallel(pkgs, get_helper, observer, workers, flush=lambda: None,
+                   record=None):
+    """
+    regenerate packages across a pool of forked worker processes
+
+    Each worker builds its own helper (thus its own ebuild processor) and
+    claims packages from a shared cursor until none remain.
+
+    :param pkgs: sequence of packages to regenerate
+    :param get_helper: callable returning a regen callable; invoked once per
+        worker, within it.  If the helper has a finish method, it's invoked
+        once the worker runs out of work.
+    :param observer: observer instance, errors and per-worker throughput
+        are reported to it
+    :param workers: number of worker processes
+    :param flush: callable invoked in each worker after its helper finished,
+        to commit any queued cache updates
+    :param record: if given, invoked in this process with each successfully
+        regenerated package and what the helper returned for it (which must
+        be picklable)
+    :return: list of (processed, failed, elapsed seconds) per worker
+    """
+    pkgs = list(pkgs)
+    workers = max(min(workers, len(pkgs)), 1)
+    cursor = multiprocessing.Value('l', 0)
+    results = multiprocessing.Queue()
+    procs = [multiprocessing.Process(target=_regen_worker,
+                 args=(x, pkgs, cursor, workers, get_helper, results, flush,
+                       record is not None))
+             for x in xrange(workers)]
+    stats = [None] * workers
+    try:
+        for proc in procs:
+            proc.start()
+        while None in stats:
+            try:
+                worker_id, kind, data = results.get(timeout=1)
+            except Queue.Empty:
+                if not any(proc.is_alive() for proc in procs):
+                    # drain anything sent before the last worker exited.
+                    if results.empty():
+                        break
+                continue
+            if kind == "error":
+                observer.error(data)
+            elif kind == "result":
+                record(pkgs[data[0]], data[1])
+            else:
+                stats[worker_id] = data
+    except:
+        for proc in procs:
+            if proc.is_alive():
+                proc.terminate()
+        raise
+    finally:
+        for proc in procs:
+            proc.join()
+
+    for worker_id, data in enumerate(stats):
+        if data is None:
+            observer.error("regen worker %i died (exit code %s)"
+                % (worker_id, procs[worker_id].exitcode))
+            continue
+        processed, failed, elapsed = data
+        observer.info("regen worker %i: %i packages in %.2fs (%.1f/s), "
+            "%i failed" % (worker_id, processed, elapsed,
+            processed / max(elapsed, 1e-6), failed))
+    return stats
+
+
+def _stat_ebuild(path):
+    try:
+        st = os.stat(path)
+    except EnvironmentError as e:
+        if e.errno not in (errno.ENOENT, errno.ENOTDIR):
+            raise
+        return None
+    return (st.st_mtime, st.st_size)
+
+
+def stat_ebuilds(paths, threads=1):
+    """
+    stat a set of ebuilds, across a pool of threads if asked
+
+    :param paths: sequence of ebuild paths
+    :param threads: number of threads to stat from; stat releases the GIL,
+        so this overlaps the disk latency of a cold tree
+    :return: dict mapping each path to (mtime, size), or None if it's gone
+    """
+    paths = list(paths)
+    if threads <= 1 or len(paths) < threads:
+        return dict((path, _stat_ebuild(path)) for path in paths)
+    pool = ThreadPool(threads)
+    try:
+        stats = pool.map(_stat_ebuild, paths,
+                         max(1, len(paths) // (threads * 4)))
+    finally:
+        pool.close()
+        pool.join()
+    return dict(zip(paths, stats))
+
+
+class ChangeIndex(object):
+
+    """
+    persistent record of the state packages were last regenerated against
+
+    Keyed by ebuild path, each entry holds the ebuild's (mtime, size) and
+    the eclasses it inherited; alongside, the (path, mtime) of every eclass
+    as of the last run.  From those and a reverse eclass to ebuilds map,
+    :obj:`changed` derives what needs regenerating.  The index can't see
+    cache entries lost behind its back (pruned, wiped, corrupted); callers
+    hand it a check for those, consulted for otherwise unchanged ebuilds.
+    """
+
+    header = "pkgcore regen index 1"
+
+    def __init__(self, path):
+        """
+        :param path: location of the index file; it needn't exist
+        """
+        self.path = path
+        # ebuild path -> ((mtime, size), eclasses)
+        self.ebuilds = {}
+        # eclass -> (path, mtime)
+        self.eclasses = {}
+        self._load()
+
+    def _load(self):
+        try:
+            with open(self.path) as f:
+                lines = f.read().splitlines()
+        except EnvironmentError as e:
+            if e.errno != errno.ENOENT:
+                raise
+            return
+        if not lines or lines[0] != self.header:
+            logger.warning("ignoring regen index %s: unknown format",
+                           self.path)
+            return
+        try:
+            for line in lines[1:]:
+                kind, data = line.split("\t", 1)
+                if kind == "eclass":
+                    name, path, mtime = data.split("\t")
+                    self.eclasses[name] = (path, long(mtime))
+                elif kind == "ebuild":
+                    path, mtime, size, eclasses = data.split("\t")
+                    self.ebuilds[path] = ((float(mtime), long(size)),
+                                          tuple(eclasses.split()))
+                else:
+                    raise ValueError("unknown record %r" % (kind,))
+        except ValueError as e:
+            logger.warning("ignoring corrupt regen index %s: %s",
+                           self.path, e)
+            self.ebuilds.clear()
+            self.eclasses.clear()
+
+    def eclass_users(self):
+        """:return: dict mapping each eclass to the set of ebuilds using it"""
+        users = {}
+        for path, (_, eclasses) in self.ebuilds.iteritems():
+            for eclass in eclasses:
+                users.setdefault(eclass, set()).add(path)
+        return users
+
+    def changed(self, stats, eclasses, uncached=None):
+        """
+        determine which ebuilds need regenerating
+
+        :param stats: mapping of ebuild path to its current (mtime, size), as
+            returned by :obj:`stat_ebuilds`
+        :param eclasses: mapping of eclass to its current (path, mtime)
+        :param uncached: if not None, callable taking an iterable of ebuild
+            paths and returning those lacking a valid cache entry
+        :return: set of ebuild paths that are new, whose ebuild or
+            inherited eclasses changed since the last :obj:`update`, or
+            whose cache entry went missing
+        """
+        dirty = set(path for path, st in stats.iteritems()
+                    if st is not None and
+                    self.ebuilds.get(path, (None,))[0] != st)
+        users = self.eclass_users()
+        for eclass, ebuilds in users.iteritems():
+            if self.eclasses.get(eclass) != eclasses.get(eclass):
+                dirty.update(path for path in ebuilds if path in stats)
+        if uncached is not None:
+            dirty.update(uncached(path for path, st in stats.iteritems()
+                                  if st is not None and path not in dirty))
+        return dirty
+
+    def update(self, stats, eclasses, regenerated, dirty=None):
+        """
+        rebase the index onto the current tree
+
+        Ebuilds that vanished are dropped, as are those that needed
+        regenerating but weren't (successfully) regenerated; they're thus
+        picked up again by the next run.
+
+        :param stats: as passed to :obj:`changed`
+        :param eclasses: as passed to :obj:`changed`
+        :param regenerated: mapping of ebuild path to the eclasses it
+            inherited, for each ebuild regenerated
+        :param dirty: what :obj:`changed` returned for this run; computed
+            (without any cache check) if not given
+        """
+        if dirty is None:
+            dirty = self.changed(stats, eclasses)
+        ebuilds = {}
+        for path, st in stats.iteritems():
+            if st is None:
+                continue
+            if path in regenerated:
+                ebuilds[path] = (st, tuple(sorted(regenerated[path])))
+            elif path not in dirty:
+                ebuilds[path] = self.ebuilds[path]
+        self.ebuilds = ebuilds
+        self.eclasses = dict(eclasses)
+
+    def save(self):
+        f = None
+        try:
+            f = fileutils.AtomicWriteFile(self.path, binary=False, perms=0664)
+            f.write(self.header + "\n")
+            for name, (path, mtime) in sorted(self.eclasses.iteritems()):
+                f.write("eclass\t%s\t%s\t%i\n" % (name, path, mtime))
+            for path, ((mtime, size), eclasses) in sorted(
+                    self.ebuilds.iteritems()):
+                f.write("ebuild\t%s\t%r\t%i\t%s\n"
+                        % (path, mtime, size, ' '.join(eclasses)))
+            f.close()
+        finally:
+            if f is not None:
+                f.discard()
+
+
+def _eclass_snapshot(ecache):
+    return dict((eclass, (data.path, data.mtime))
+                for eclass, data in ecache.eclasses.iteritems())
+
+
+def _uncached_checker(repo, pkgs):
+    """
+    :return: callable for :obj:`ChangeIndex.changed`'s uncached, or None if
+        the repo's cache can't be checked
+    """
+    get = getattr(getattr(repo, 'package_class', None),
+                  '_get_cached_metadata', None)
+    if get is None:
+        return None
+    by_path = dict((pkg.path, pkg) for pkg in pkgs)
+
+    def uncached(paths):
+        # a full read and validation of the entry; without pruning, this
+        # doesn't touch the cache.
+        return [path for path in paths
+                if get(by_path[path].cpvstr, path, prune=False) is None]
+    return uncached
+
+
+def regen_repository(repo, observer, threads=1, pkg_attr='keywords',
+                     index=None, **options):
+    """
+    regenerate a repository's metadata cache
+
+    :param index: if given, path to a :obj:`ChangeIndex`; only packages whose
+        ebuild or inherited eclasses changed since the last run using it are
+        regenerated, and the index is updated afterwards.  Ignored for repos
+        lacking eclasses or a regen helper.
+    """
 
     helpers = []
 
@@ -33,18 +362,71 @@ def regen_repository(repo, observer, threads=1, pkg_attr='keywords', **options):
         helpers.append(helper)
         return helper
 
+    ecache = getattr(repo, 'eclass_cache', None)
+    pkgs, get_helper, record = repo, _get_repo_helper, None
+    if index is not None and (ecache is None or
+                              not hasattr(repo, '_regen_operation_helper')):
+        observer.warn("repository %s doesn't support incremental regen"
+                      % (repo,))
+        index = None
+    if index is not None:
+        index = ChangeIndex(index)
+        pkgs = list(repo)
+        paths = dict((pkg, pkg.path) for pkg in pkgs)
+        stats = stat_ebuilds(paths.itervalues(), threads)
+        eclasses = _eclass_snapshot(ecache)
+        if options.get('force', False):
+            dirty = set(path for path, st in stats.iteritems()
+                        if st is not None)
+        else:
+            dirty = index.changed(stats, eclasses,
+                                  _uncached_checker(repo, pkgs))
+            observer.info("%i of %i packages changed since the last regen"
+                          % (len(dirty), len(pkgs)))
+            pkgs = [pkg for pkg in pkgs if paths[pkg] in dirty]
+        regenerated = {}
+
+        def record(pkg, inherited):
+            regenerated[paths[pkg]] = inherited
+
+        def get_helper():
+            helper = _get_repo_helper()
+            def _regen(pkg):
+                # only the eclass names are needed, and those pickle cheaply.
+                return tuple(helper(pkg).get('_eclasses_') or ())
+            if hasattr(helper, 'finish'):
+                _regen.finish = helper.finish
+            return _regen
+
+    flush = lambda: None
+    operations = getattr(repo, 'operations', None)
+    if operations is not None:
+        flush = lambda: operations.run_if_supported("flush_cache")
+
     if threads == 1:
-        def passthru(iterable):
-            global count
-            for x in iterable:
-                yield x
-        regen_iter(passthru(repo), _get_repo_helper(), observer)
+        helper = get_helper()
+        if record is not None:
+            def regen_func(pkg):
+                record(pkg, helper(pkg))
+        else:
+            regen_func = helper
+        regen_iter(pkgs, regen_func, observer)
     else:
-        def get_args():
-            return (_get_repo_helper(), observer, True)
-        map_async(repo, regen_iter, per_thread_args=get_args)
+        if ecache is not None and options.get('eclass_caching', True):
+            # build the eclass bundle ahead of the fork so that every
+            # worker's daemon shares it.
+            processor.get_eclass_bundle(ecache)
+        # workers finish their own helpers.
+        regen_parallel(pkgs, get_helper, observer, threads, flush=flush,
+                       record=record)
 
     for helper in helpers:
         f = getattr(helper, 'finish', None)
         if f is not None:
             f()
+
+    if index is not None:
+        # the index must never claim more than the cache holds.
+        flush()
+        index.update(stats, eclasses, regenerated, dirty)
+        index.save()
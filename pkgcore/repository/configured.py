@@ -35,6 +35,8 @@ class tree(prototype.tree):
         self.wrapped_attrs = wrapped_attrs
         self.attr_filters = frozenset(wrapped_attrs.keys() +
                                       [self.configurable])
+        # everything the wrapper may answer differently than raw_repo would.
+        self._override_attrs = self.attr_filters.union(pkg_kls_injections)
 
         self._klass = self._mk_kls(pkg_kls_injections)
 
@@ -57,6 +59,7 @@ class tree(prototype.tree):
             kwds["pkg_klass_override"] = partial(self.package_class, o)
         else:
             kwds["pkg_klass_override"] = self.package_class
+            kwds.setdefault("pkg_klass_override_attrs", self._override_attrs)
         return (x for x in self.raw_repo.itermatch(restrict, **kwds) if x.is_supported)
 
     itermatch.__doc__ = prototype.tree.itermatch.__doc__.replace(
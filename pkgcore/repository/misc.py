@@ -1,10 +1,14 @@
 # Copyright: 2006-2008 Brian Harring <ferringb@gmail.com>
 # License: GPL2/BSD
 
-__all__ = ("nodeps_repo", "caching_repo")
+__all__ = ("nodeps_repo", "caching_repo", "bounded_caching_repo",
+           "estimate_bytes")
+
+import sys
 
 from snakeoil.iterables import caching_iter, iter_sort
 from snakeoil.klass import GetAttrProxy
+from snakeoil.mappings import OrderedDict
 
 from pkgcore.ebuild.conditionals import DepSet
 from pkgcore.operations.repo import operations_proxy
@@ -62,6 +66,7 @@ class caching_repo(object):
     in memory till the cache is cleared.  General use, not usually what
     you want- if you're making a lot of random queries that are duplicates
     (resolver does this for example), caching helps.
+    :obj:`bounded_caching_repo` limits how much is kept.
     """
 
     operations_kls = operations_proxy
@@ -94,6 +99,131 @@ class caching_repo(object):
         self.__cache__.clear()
 
 
+def estimate_bytes(obj, getsizeof=sys.getsizeof):
+    """
+    rough estimate of the memory held by obj
+
+    Counts obj, the values its attributes (slots included) reference, and
+    the items of those that are dicts, lists, tuples or sets.  Nothing
+    lazily loaded is triggered.
+    """
+    values = []
+    d = getattr(obj, '__dict__', None)
+    if d:
+        values.extend(d.itervalues())
+    for kls in type(obj).__mro__:
+        slots = kls.__dict__.get('__slots__', ())
+        if isinstance(slots, basestring):
+            slots = (slots,)
+        for slot in slots:
+            descriptor = kls.__dict__.get(slot)
+            if descriptor is None or slot in ('__dict__', '__weakref__'):
+                continue
+            try:
+                values.append(descriptor.__get__(obj, kls))
+            except AttributeError:
+                # unset.
+                pass
+    size = getsizeof(obj) + (d is not None and getsizeof(d) or 0)
+    for val in values:
+        size += getsizeof(val)
+        if isinstance(val, dict):
+            size += sum(getsizeof(x) for x in val.itervalues())
+        elif isinstance(val, (list, tuple, set, frozenset)):
+            size += sum(getsizeof(x) for x in val)
+    return size
+
+
+class bounded_caching_repo(caching_repo):
+
+    """
+    :obj:`caching_repo` holding at most an estimated amount of memory
+
+    Cached queries are sharded by package key (restrictions lacking one
+    share a shard); once the estimated size of what's cached exceeds the
+    limit, least recently used shards are evicted whole.  A shard is
+    weighed as the packages its queries returned (each counted once, via
+    :obj:`estimate_bytes` by default) plus a per query overhead.  Results
+    are weighed as they're pulled in, so a query still being iterated
+    counts only what it yielded so far; eviction happens on the next miss.
+
+    :ivar stats: dict of hits, misses, evictions (queries evicted) and
+        bytes (current estimate)
+    """
+
+    # caching_iter and its list.
+    query_overhead = 150
+
+    def __init__(self, db, strategy, max_bytes, weigher=estimate_bytes):
+        """
+        :param db: an instance supporting the repository protocol to cache
+          queries from.
+        :param strategy: forced sorting strategy for results.  If you don't
+          need sorting, pass in iter.
+        :param max_bytes: estimated size cached results are kept under
+        :param weigher: callable returning the estimated bytes held by a
+          package
+        """
+        caching_repo.__init__(self, db, strategy)
+        self.max_bytes = max_bytes
+        self.weigher = weigher
+        # key -> [bytes, set(restricts), pkg ids]
+        self.__shards__ = OrderedDict()
+        self.stats = {'hits': 0, 'misses': 0, 'evictions': 0, 'bytes': 0}
+
+    def match(self, restrict):
+        key = getattr(restrict, 'key', None)
+        shards = self.__shards__
+        v = self.__cache__.get(restrict)
+        if v is not None:
+            self.stats['hits'] += 1
+            # most recently used goes last.
+            shards[key] = shards.pop(key)
+            return v
+        self.stats['misses'] += 1
+        shard = shards.pop(key, None)
+        if shard is None:
+            shard = [0, set(), set()]
+        shards[key] = shard
+        shard[0] += self.query_overhead
+        self.stats['bytes'] += self.query_overhead
+        shard[1].add(restrict)
+        v = self.__cache__[restrict] = \
+            caching_iter(self._weigh(key, shard,
+                self.__db__.itermatch(restrict, sorter=self.__strategy__)))
+        self._evict()
+        return v
+
+    def _weigh(self, key, shard, pkgs):
+        weigher = self.weigher
+        stats = self.stats
+        seen = shard[2]
+        for pkg in pkgs:
+            # once evicted, it's no longer ours to account for.
+            if id(pkg) not in seen and self.__shards__.get(key) is shard:
+                seen.add(id(pkg))
+                size = weigher(pkg)
+                shard[0] += size
+                stats['bytes'] += size
+            yield pkg
+
+    def _evict(self):
+        shards = self.__shards__
+        stats = self.stats
+        # the shard just queried is last; it's always kept.
+        while stats['bytes'] > self.max_bytes and len(shards) > 1:
+            size, queries, _ = shards.pop(next(iter(shards)))
+            for restrict in queries:
+                del self.__cache__[restrict]
+            stats['bytes'] -= size
+            stats['evictions'] += len(queries)
+
+    def clear(self):
+        caching_repo.clear(self)
+        self.__shards__.clear()
+        self.stats['bytes'] = 0
+
+
 class multiplex_sorting_repo(object):
 
     def __init__(self, sorter, *repos):
@@ -0,0 +1,471 @@
+# License: GPL2/BSD
+
+"""
+restriction to index query planning for repository itermatch
+
+A restriction tree is broken down into a union of terms; each term holds
+the constraints it places on category, package, version, slot and the
+metadata attributes in :obj:`METADATA_ATTRS`.  Terms are then run against
+the repository's category/package/version indices (and its slot and
+metadata indices, if it provides them) so that only candidates that could
+possibly match are instantiated.
+
+The plan is always a superset of what the restriction matches; the
+restriction itself is still applied to every candidate.  Anything the
+planner doesn't understand is treated as unconstrained.
+"""
+
+__all__ = ("QueryPlan", "plan_query")
+
+from pkgcore.ebuild.restricts import VersionMatch
+from pkgcore.restrictions import boolean, packages, restriction, values
+
+# beyond this many terms, the union is collapsed into a single
+# (looser) term rather than risking combinatorial explosion.
+MAX_TERMS = 64
+
+# package attributes restrictions on which are handed to the repository's
+# metadata_index (if it indexes them) rather than evaluated per package.
+METADATA_ATTRS = frozenset(["subslot", "keywords", "iuse"])
+
+
+class _version_view(object):
+
+    """minimal version/revision carrier so version restrictions can be
+    evaluated without instantiating a package"""
+
+    __slots__ = ("version", "revision", "fullver")
+
+    def __init__(self, fullver):
+        self.fullver = fullver
+        version, sep, rev = fullver.rpartition("-r")
+        if sep and rev.isdigit():
+            self.version = version
+            self.revision = int(rev) or None
+        else:
+            self.version = fullver
+            self.revision = None
+
+
+class _predicate(object):
+
+    __slots__ = ("desc", "func")
+
+    def __init__(self, desc, func):
+        self.desc = desc
+        self.func = func
+
+    def __call__(self, val):
+        try:
+            return self.func(val)
+        except (KeyboardInterrupt, RuntimeError, SystemExit):
+            raise
+        except Exception:
+            # can't judge it here; let the actual match decide.
+            return True
+
+    def __str__(self):
+        return self.desc
+
+
+def _intersect(s1, s2):
+    if s1 is None:
+        return s2
+    elif s2 is None:
+        return s1
+    return s1.intersection(s2)
+
+
+class Term(object):
+
+    """conjunction of constraints on category, package, version, slot and
+    metadata attributes
+
+    Exact sets are None when unconstrained; predicates are applied on top
+    of any exact sets.  meta_preds holds (attribute, predicate) pairs.
+    """
+
+    __slots__ = ("cats", "cat_preds", "pkgs", "pkg_preds", "ver_preds",
+                 "slots", "slot_preds", "meta_preds")
+
+    def __init__(self, cats=None, cat_preds=(), pkgs=None, pkg_preds=(),
+                 ver_preds=(), slots=None, slot_preds=(), meta_preds=()):
+        self.cats = cats
+        self.cat_preds = tuple(cat_preds)
+        self.pkgs = pkgs
+        self.pkg_preds = tuple(pkg_preds)
+        self.ver_preds = tuple(ver_preds)
+        self.slots = slots
+        self.slot_preds = tuple(slot_preds)
+        self.meta_preds = tuple(meta_preds)
+
+    @property
+    def unconstrained(self):
+        return (self.cats is None and self.pkgs is None and
+                self.slots is None and not self.cat_preds and
+                not self.pkg_preds and not self.ver_preds and
+                not self.slot_preds and not self.meta_preds)
+
+    @property
+    def empty(self):
+        return (self.cats is not None and not self.cats) or \
+            (self.pkgs is not None and not self.pkgs) or \
+            (self.slots is not None and not self.slots)
+
+    @property
+    def version_constrained(self):
+        return bool(self.ver_preds)
+
+    @property
+    def slot_constrained(self):
+        return self.slots is not None or bool(self.slot_preds)
+
+    @property
+    def meta_constrained(self):
+        return bool(self.meta_preds)
+
+    @property
+    def filtering(self):
+        return (self.version_constrained or self.slot_constrained or
+                self.meta_constrained)
+
+    def intersect(self, other):
+        return Term(
+            _intersect(self.cats, other.cats),
+            self.cat_preds + other.cat_preds,
+            _intersect(self.pkgs, other.pkgs),
+            self.pkg_preds + other.pkg_preds,
+            self.ver_preds + other.ver_preds,
+            _intersect(self.slots, other.slots),
+            self.slot_preds + other.slot_preds,
+            self.meta_preds + other.meta_preds)
+
+    def accepts_cat(self, cat):
+        if self.cats is not None and cat not in self.cats:
+            return False
+        return all(pred(cat) for pred in self.cat_preds)
+
+    def accepts_pkg(self, pkg):
+        if self.pkgs is not None and pkg not in self.pkgs:
+            return False
+        return all(pred(pkg) for pred in self.pkg_preds)
+
+    def accepts_ver(self, ver):
+        if self.ver_preds:
+            view = _version_view(ver)
+            return all(pred(view) for pred in self.ver_preds)
+        return True
+
+    def accepts_slot(self, slot):
+        if self.slots is not None and slot not in self.slots:
+            return False
+        return all(pred(slot) for pred in self.slot_preds)
+
+    def describe(self):
+        l = []
+        for name, exact, preds in (
+                ("category", self.cats, self.cat_preds),
+                ("package", self.pkgs, self.pkg_preds),
+                ("version", None, self.ver_preds),
+                ("slot", self.slots, self.slot_preds)):
+            if exact is not None:
+                l.append("%s in index lookup [%s]" % (
+                    name, ', '.join(sorted(exact))))
+            for pred in preds:
+                l.append("%s filter: %s" % (name, pred))
+        for attr, pred in self.meta_preds:
+            l.append("%s filter: %s" % (attr, pred))
+        if not l:
+            return "full scan"
+        return "; ".join(l)
+
+
+def _hull(terms):
+    """collapse terms into a single term matching a superset of them all"""
+    def merge(attr):
+        sets = [getattr(t, attr) for t in terms]
+        if any(s is None for s in sets):
+            return None
+        return frozenset().union(*sets)
+    return Term(cats=merge("cats"), pkgs=merge("pkgs"), slots=merge("slots"))
+
+
+def _str_leaf(child, negate):
+    """returns (exact_set, predicate); one of which is None"""
+    if not negate and isinstance(child, values.StrExactMatch) and \
+            not child.negate and child.case_sensitive:
+        return frozenset([child.exact]), None
+    if negate:
+        desc = "not (%s)" % (child,)
+        func = lambda val: not child.match(val)
+    else:
+        desc = str(child)
+        func = child.match
+    return None, _predicate(desc, func)
+
+
+def _analyze_package_restrict(r, negate):
+    attrs = getattr(r, "attrs", ())
+    if len(attrs) != 1:
+        return [Term()]
+    attr = attrs[0]
+    negate = negate != bool(r.negate)
+    child = r.restriction
+    if attr in ("category", "package", "slot"):
+        exact, pred = _str_leaf(child, negate)
+        preds = (pred,) if pred is not None else ()
+        if attr == "category":
+            return [Term(cats=exact, cat_preds=preds)]
+        elif attr == "package":
+            return [Term(pkgs=exact, pkg_preds=preds)]
+        return [Term(slots=exact, slot_preds=preds)]
+    elif attr in ("fullver", "version"):
+        if negate:
+            desc = "not %s %s" % (attr, child)
+            func = lambda view: not child.match(getattr(view, attr))
+        else:
+            desc = "%s %s" % (attr, child)
+            func = lambda view: child.match(getattr(view, attr))
+        return [Term(ver_preds=(_predicate(desc, func),))]
+    elif attr in METADATA_ATTRS:
+        if negate:
+            desc = "not %s" % (child,)
+            func = lambda val: not child.match(val)
+        else:
+            desc = str(child)
+            func = child.match
+        return [Term(meta_preds=((attr, _predicate(desc, func)),))]
+    return [Term()]
+
+
+def _analyze(r, negate=False):
+    """
+    :return: list of :obj:`Term` instances whose union is a superset of
+        what r (negated if negate is True) matches; an empty list means
+        nothing can match.
+    """
+    if isinstance(r, boolean.base):
+        negate = negate != bool(r.negate)
+        if isinstance(r, boolean.AndRestriction):
+            # De Morgan: a negated And is an Or of negated children.
+            if negate:
+                return _union([_analyze(x, True) for x in r.restrictions])
+            return _product([_analyze(x) for x in r.restrictions])
+        elif isinstance(r, boolean.OrRestriction):
+            if negate:
+                return _product([_analyze(x, True) for x in r.restrictions])
+            return _union([_analyze(x) for x in r.restrictions])
+        return [Term()]
+    elif isinstance(r, restriction.Negate):
+        return _analyze(r._restrict, not negate)
+    elif isinstance(r, restriction.AlwaysBool):
+        if bool(r.negate) != negate:
+            return [Term()]
+        return []
+    elif isinstance(r, VersionMatch):
+        if negate:
+            pred = _predicate("not %s" % (r,), lambda view: not r.match(view))
+        else:
+            pred = _predicate(str(r), r.match)
+        return [Term(ver_preds=(pred,))]
+    elif isinstance(r, packages.PackageRestriction):
+        return _analyze_package_restrict(r, negate)
+    return [Term()]
+
+
+def _union(term_lists):
+    terms = []
+    for l in term_lists:
+        for term in l:
+            if term.unconstrained:
+                return [term]
+            terms.append(term)
+    if len(terms) > MAX_TERMS:
+        return [_hull(terms)]
+    return terms
+
+
+def _product(term_lists):
+    # smallest first so that an oversized product drops the least
+    # selective components.
+    result = [Term()]
+    for l in sorted(term_lists, key=len):
+        if not l:
+            return []
+        if len(result) * len(l) > MAX_TERMS:
+            # a conjunction is a subset of any of its components; skipping
+            # this one keeps the plan a superset.
+            continue
+        result = [x for x in (t1.intersect(t2) for t1 in result for t2 in l)
+                  if not x.empty]
+        if not result:
+            return []
+    return result
+
+
+class QueryPlan(object):
+
+    """candidate plan for a restriction against a repository
+
+    :ivar terms: sequence of :obj:`Term` instances; the union of them is
+        what is searched.
+    """
+
+    def __init__(self, terms, restrict=None):
+        self.terms = tuple(terms)
+        self.restrict = restrict
+
+    @property
+    def full_scan(self):
+        return len(self.terms) == 1 and self.terms[0].unconstrained
+
+    @property
+    def version_filtering(self):
+        return any(t.filtering for t in self.terms)
+
+    @property
+    def filtered_attrs(self):
+        """package attributes the version filter judges candidates by"""
+        attrs = set()
+        for t in self.terms:
+            if t.version_constrained:
+                attrs.update(("version", "revision", "fullver"))
+            if t.slot_constrained:
+                attrs.add("slot")
+            attrs.update(attr for attr, _ in t.meta_preds)
+        return frozenset(attrs)
+
+    def candidates(self, repo, sorter=iter):
+        """generate the (category, package) candidates from repo's indices"""
+        if not self.terms:
+            return ()
+        if self.full_scan:
+            if sorter is iter:
+                return repo.versions
+            return ((c, p)
+                    for c in sorter(repo.categories)
+                    for p in sorter(repo.packages.get(c, ())))
+        if len(self.terms) == 1:
+            return self._term_candidates(self.terms[0], repo, sorter)
+        # union; dedupe across terms.
+        cps = set()
+        for term in self.terms:
+            cps.update(self._term_candidates(term, repo, iter))
+        return sorter(cps)
+
+    @staticmethod
+    def _term_candidates(term, repo, sorter):
+        if term.cats is not None:
+            cats = (c for c in sorter(term.cats) if c in repo.categories)
+        else:
+            cats = sorter(repo.categories)
+        if term.cat_preds:
+            cats = (c for c in cats if all(p(c) for p in term.cat_preds))
+
+        pgetter = repo.packages.get
+        pkg_preds = term.pkg_preds
+        for cat in cats:
+            pkgs = pgetter(cat, ())
+            if term.pkgs is not None:
+                if not pkgs:
+                    continue
+                available = pkgs
+                pkgs = (p for p in sorter(term.pkgs) if p in available)
+            else:
+                pkgs = sorter(pkgs)
+            for pkg in pkgs:
+                if not pkg_preds or all(p(pkg) for p in pkg_preds):
+                    yield (cat, pkg)
+
+    def version_filter(self, repo):
+        """
+        :return: None if no version/slot/metadata level pruning is possible,
+            else a callable taking (cp, versions) returning the versions
+            that are still candidates.
+        """
+        if not self.version_filtering:
+            return None
+        slot_index = getattr(repo, "slot_index", None)
+        index = getattr(repo, "metadata_index", None)
+        indexed = frozenset(getattr(index, "attrs", ()))
+        if slot_index is None and "slot" in indexed:
+            def slot_index(cp):
+                return dict((ver, index.value("slot", code))
+                            for ver, code in index.codes(cp, "slot").iteritems())
+        terms = self.terms
+        # metadata values are dictionary encoded, thus each predicate is
+        # evaluated once per distinct value; (attr, pred) -> {code: bool}
+        verdicts = {}
+
+        def accepts_meta(t, codes, ver):
+            for attr, pred in t.meta_preds:
+                code = codes.get(attr, {}).get(ver)
+                if code is None:
+                    # not indexed; let the actual match decide.
+                    continue
+                memo = verdicts.setdefault((attr, pred), {})
+                ok = memo.get(code)
+                if ok is None:
+                    ok = memo[code] = pred(index.value(attr, code))
+                if not ok:
+                    return False
+            return True
+
+        def f(cp, versions):
+            relevant = [t for t in terms
+                        if t.accepts_cat(cp[0]) and t.accepts_pkg(cp[1])]
+            if any(not t.filtering for t in relevant):
+                return versions
+            slots = None
+            if slot_index is not None and \
+                    any(t.slot_constrained for t in relevant):
+                slots = slot_index(cp)
+            codes = {}
+            for t in relevant:
+                for attr, _ in t.meta_preds:
+                    if attr in indexed and attr not in codes:
+                        codes[attr] = index.codes(cp, attr)
+            l = []
+            for ver in versions:
+                for t in relevant:
+                    if not t.accepts_ver(ver):
+                        continue
+                    if slots is not None and t.slot_constrained:
+                        slot = slots.get(ver)
+                        if slot is not None and not t.accepts_slot(slot):
+                            continue
+                    if codes and not accepts_meta(t, codes, ver):
+                        continue
+                    l.append(ver)
+                    break
+            return l
+        return f
+
+    def explain(self):
+        """
+        :return: string describing the chosen plan; one line per term,
+            prefixed with how the terms are combined.
+        """
+        if self.restrict is not None:
+            header = ["plan for %s:" % (self.restrict,)]
+        else:
+            header = ["plan:"]
+        if not self.terms:
+            return "\n".join(header + ["  nothing can match"])
+        if len(self.terms) == 1:
+            return "\n".join(header + ["  " + self.terms[0].describe()])
+        return "\n".join(header + ["  union of %i terms:" % len(self.terms)] +
+            ["    %s" % t.describe() for t in self.terms])
+
+    def __str__(self):
+        return self.explain()
+
+
+def plan_query(restrict, negate=False):
+    """
+    analyze a restriction, generating a :obj:`QueryPlan` for it
+
+    :param restrict: package restriction to plan for
+    :param negate: if True, plan for packages the restriction doesn't match
+    """
+    return QueryPlan(_analyze(restrict, negate), restrict)
@@ -9,15 +9,30 @@ __all__ = (
     "CategoryIterValLazyDict", "PackageMapping", "VersionMapping", "tree"
 )
 
+from itertools import islice
+
 from snakeoil.compatibility import is_py3k
-from snakeoil.lists import iflatten_instance
 from snakeoil.mappings import LazyValDict, DictMixin
 
 from pkgcore.ebuild.atom import atom
 from pkgcore.operations import repo
-from pkgcore.restrictions import values, boolean, restriction, packages
+from pkgcore.repository import planner
+from pkgcore.restrictions import restriction, packages
 from pkgcore.restrictions.util import collect_package_restrictions
 
+# package attributes answerable from the repository indices (or the
+# repository itself) alone; restrictions on anything else need the
+# packages' metadata.
+_index_attrs = frozenset(["category", "package", "key", "cpvstr",
+                          "version", "revision", "fullver",
+                          "repo", "repo.repo_id"])
+
+# (restriction, negate) -> (plan, attrs its version filter judges by,
+# whether matching needs metadata); only instance cached (thus immutable,
+# and usually repeatedly queried- atoms fex) restrictions are kept.
+_plan_cache = {}
+_plan_cache_limit = 4096
+
 
 class IterValLazyDict(LazyValDict):
 
@@ -131,6 +146,21 @@ class tree(object):
         yielding a configured form of the repository
     :ivar frozen_settable: bool controlling whether frozen is able to be set via
         __init__
+    :ivar slot_index: None, or a callable taking a (category, package) tuple
+        and returning a mapping of version -> slot; if the repository can
+        answer that without instantiating packages, itermatch uses it to
+        prune slot restricted searches.
+    :ivar metadata_index: None, or a
+        :obj:`pkgcore.ebuild.columnar.MetadataColumns` like object; if set,
+        itermatch uses it to prune searches restricting on the attributes
+        it indexes.
+    :ivar prefetch_metadata: None, or a callable taking a sequence of
+        ((category, package), versions) pairs about to be instantiated; if
+        set, itermatch hands it the next prefetch_window candidates of
+        searches that need package metadata, so it can be read while the
+        current ones are matched.  It may return a callable; that's invoked
+        once the search ends (or is abandoned) to drop whatever read ahead
+        went unused.
     """
 
     raw_repo = None
@@ -140,7 +170,10 @@ class tree(object):
     configure = None
     frozen_settable = True
     operations_kls = repo.operations
-
+    slot_index = None
+    metadata_index = None
+    prefetch_metadata = None
+    prefetch_window = 16
 
     def __init__(self, frozen=False):
         """
@@ -199,7 +232,8 @@ class tree(object):
         return list(self.itermatch(atom, **kwds))
 
     def itermatch(self, restrict, restrict_solutions=None, sorter=None,
-                  pkg_klass_override=None, force=None, yield_none=False):
+                  pkg_klass_override=None, force=None, yield_none=False,
+                  pkg_klass_override_attrs=None):
 
         """
         generator that yields packages match a restriction.
@@ -218,6 +252,10 @@ class tree(object):
             packages. If you override this method you should yield
             None in long-running loops, strictly calling it for every package
             is not necessary.
+        :param pkg_klass_override_attrs: if given, the package attributes
+            pkg_klass_override may change; versions are still pruned via
+            the repository's indices if the restriction doesn't depend on
+            any of them.
         """
 
         if not isinstance(restrict, restriction.base):
@@ -228,10 +266,23 @@ class tree(object):
         if sorter is None:
             sorter = iter
 
-        if isinstance(restrict, atom):
+        negate = force is False
+        plan, filtered_attrs, needs_metadata = self._cached_plan(
+            restrict, negate)
+        if isinstance(restrict, atom) and not negate:
             candidates = [(restrict.category, restrict.package)]
         else:
-            candidates = self._identify_candidates(restrict, sorter)
+            candidates = plan.candidates(self, sorter)
+        version_filter = None
+        if pkg_klass_override is None or (
+                pkg_klass_override_attrs is not None and
+                not filtered_attrs.intersection(pkg_klass_override_attrs)):
+            version_filter = plan.version_filter(self)
+
+        prefetch = None
+        if needs_metadata and self.prefetch_metadata is not None and \
+                self.prefetch_window > 0:
+            prefetch = self.prefetch_metadata
 
         if force is None:
             match = restrict.match
@@ -241,18 +292,88 @@ class tree(object):
             match = restrict.force_False
         return self._internal_match(
             candidates, match, sorter, pkg_klass_override,
-            yield_none=yield_none)
+            yield_none=yield_none, version_filter=version_filter,
+            prefetch=prefetch)
+
+    def _cached_plan(self, restrict, negate):
+        key = None
+        if getattr(restrict, '__inst_caching__', False):
+            key = (restrict, negate)
+            entry = _plan_cache.get(key)
+            if entry is not None:
+                return entry
+        plan = self.plan_query(restrict, negate=negate)
+        entry = (plan, plan.filtered_attrs,
+                 any(not _index_attrs.issuperset(getattr(r, "attrs", ()))
+                     for r in collect_package_restrictions(restrict)))
+        if key is not None:
+            if len(_plan_cache) >= _plan_cache_limit:
+                _plan_cache.clear()
+            _plan_cache[key] = entry
+        return entry
+
+    def plan_query(self, restrict, negate=False):
+        """
+        generate the candidate plan itermatch would use for a restriction
+
+        :param restrict: package restriction to plan for
+        :param negate: plan for what restrict doesn't match
+        :return: :obj:`pkgcore.repository.planner.QueryPlan` instance;
+            use its explain method to see the chosen plan.
+        """
+        return planner.plan_query(restrict, negate=negate)
 
-    def _internal_gen_candidates(self, candidates, sorter):
+    def _iter_candidate_versions(self, candidates, version_filter=None,
+                                 prefetch=None):
+        """
+        generate ((category, package), versions) for candidates
+
+        :param prefetch: if not None, callable handed each window of
+            upcoming pairs before any of them are yielded; callables it
+            returns are invoked when the generator finishes or is closed
+        """
+        vgetter = self.versions.get
+        pairs = ((cp, vgetter(cp, ())) for cp in candidates)
+        if version_filter is not None:
+            pairs = ((cp, version_filter(cp, versions))
+                     for cp, versions in pairs)
+        if prefetch is None:
+            for pair in pairs:
+                yield pair
+            return
+        window = self.prefetch_window
+        discards = []
+        try:
+            chunk = list(islice(pairs, window))
+            if chunk:
+                discards.append(prefetch(chunk))
+            while chunk:
+                # hint the next window while this one is being consumed.
+                upcoming = list(islice(pairs, window))
+                if upcoming:
+                    discards.append(prefetch(upcoming))
+                for pair in chunk:
+                    yield pair
+                chunk = upcoming
+        finally:
+            for discard in discards:
+                if discard is not None:
+                    discard()
+
+    def _internal_gen_candidates(self, candidates, sorter, version_filter=None,
+                                 prefetch=None):
         pkls = self.package_class
-        for cp in sorter(candidates):
-            for pkg in sorter(pkls(cp[0], cp[1], ver)
-                              for ver in self.versions.get(cp, ())):
+        for cp, versions in self._iter_candidate_versions(
+                candidates, version_filter, prefetch):
+            for pkg in sorter(pkls(cp[0], cp[1], ver) for ver in versions):
                 yield pkg
 
     def _internal_match(self, candidates, match_func, sorter,
-                        pkg_klass_override, yield_none=False):
-        for pkg in self._internal_gen_candidates(candidates, sorter):
+                        pkg_klass_override, yield_none=False,
+                        version_filter=None, prefetch=None):
+        for pkg in self._internal_gen_candidates(candidates, sorter,
+                                                 version_filter=version_filter,
+                                                 prefetch=prefetch):
             if pkg_klass_override is not None:
                 pkg = pkg_klass_override(pkg)
 
@@ -261,144 +382,6 @@ class tree(object):
             elif yield_none:
                 yield None
 
-    def _identify_candidates(self, restrict, sorter):
-        # full expansion
-
-        if not isinstance(restrict, boolean.base) or isinstance(restrict, atom):
-            return self._fast_identify_candidates(restrict, sorter)
-        dsolutions = [
-            ([c.restriction
-              for c in collect_package_restrictions(x, ("category",))],
-             [p.restriction
-              for p in collect_package_restrictions(x, ("package",))])
-            for x in restrict.iter_dnf_solutions(True)]
-
-        # see if any solution state isn't dependent on cat/pkg in anyway.
-        # if so, search whole search space.
-        for x in dsolutions:
-            if not x[0] and not x[1]:
-                if sorter is iter:
-                    return self.versions
-                return (
-                    (c,p)
-                    for c in sorter(self.categories)
-                    for p in sorter(self.packages.get(c, ())))
-
-        # simple cases first.
-        # if one specifies categories, and one doesn't
-        cat_specified = bool(dsolutions[0][0])
-        pkg_specified = bool(dsolutions[0][1])
-        pgetter = self.packages.get
-        if any(True for x in dsolutions[1:] if bool(x[0]) != cat_specified):
-            if any(True for x in dsolutions[1:] if bool(x[1]) != pkg_specified):
-                # merde.  so we've got a mix- some specify cats, some
-                # don't, some specify pkgs, some don't.
-                # this may be optimizable
-                return self.versions
-            # ok. so... one doesn't specify a category, but they all
-            # specify packages (or don't)
-            pr = values.OrRestriction(*tuple(iflatten_instance(
-                        (x[1] for x in dsolutions if x[1]), values.base)))
-            return ((c, p)
-                for c in sorter(self.categories)
-                for p in sorter(pgetter(c, [])) if pr.match(p))
-
-        elif any(True for x in dsolutions[1:] if bool(x[1]) != pkg_specified):
-            # one (or more) don't specify pkgs, but they all specify cats.
-            cr = values.OrRestriction(*tuple(iflatten_instance(
-                        (x[0] for x in dsolutions), values.base)))
-            cats_iter = (c for c in sorter(self.categories) if cr.match(c))
-            return ((c, p)
-                for c in cats_iter for p in sorter(pgetter(c, [])))
-
-        return self._fast_identify_candidates(restrict, sorter)
-
-    def _fast_identify_candidates(self, restrict, sorter):
-        pkg_restrict = set()
-        cat_restrict = set()
-        cat_exact = set()
-        pkg_exact = set()
-
-        for x in collect_package_restrictions(restrict,
-                                              ("category", "package",)):
-            if x.attr == "category":
-                cat_restrict.add(x.restriction)
-            elif x.attr == "package":
-                pkg_restrict.add(x.restriction)
-
-        for e, s in ((pkg_exact, pkg_restrict), (cat_exact, cat_restrict)):
-            l = [x for x in s
-                 if isinstance(x, values.StrExactMatch) and not x.negate]
-            s.difference_update(l)
-            e.update(x.exact for x in l)
-        del l
-
-        if restrict.negate:
-            cat_exact = pkg_exact = ()
-
-        if cat_exact:
-            if not cat_restrict and len(cat_exact) == 1:
-                # Cannot use pop here, cat_exact is reused below.
-                c = iter(cat_exact).next()
-                if not pkg_restrict and len(pkg_exact) == 1:
-                    cp = (c, pkg_exact.pop())
-                    if cp in self.versions:
-                        return [cp]
-                    return []
-                cats_iter = [c]
-            else:
-                cat_restrict.add(values.ContainmentMatch(*cat_exact))
-                cats_iter = sorter(self._cat_filter(cat_restrict))
-        elif cat_restrict:
-            cats_iter = self._cat_filter(cat_restrict, \
-                negate=restrict.negate)
-        else:
-            cats_iter = sorter(self.categories)
-
-        if pkg_exact:
-            if not pkg_restrict:
-                if sorter is iter:
-                    pkg_exact = tuple(pkg_exact)
-                else:
-                    pkg_exact = sorter(pkg_exact)
-                return (
-                    (c,p)
-                    for c in cats_iter for p in pkg_exact)
-            else:
-                pkg_restrict.add(values.ContainmentMatch(*pkg_exact))
-
-        if pkg_restrict:
-            return self._package_filter(cats_iter, pkg_restrict,
-                negate=restrict.negate)
-        elif not cat_restrict:
-            if sorter is iter and not cat_exact:
-                return self.versions
-            else:
-                return ((c, p) for c in
-                    cats_iter for p in sorter(self.packages.get(c, ())))
-        return ((c, p)
-            for c in cats_iter for p in sorter(self.packages.get(c, ())))
-
-    def _cat_filter(self, cat_restricts, negate=False):
-        sentinel = not negate
-        cats = [x.match for x in cat_restricts]
-        for x in self.categories:
-            for match in cats:
-                if match(x) == sentinel:
-                    yield x
-                    break
-
-    def _package_filter(self, cats_iter, pkg_restricts, negate=False):
-        sentinel = not negate
-        restricts = [x.match for x in pkg_restricts]
-        pkgs_dict = self.packages
-        for cat in cats_iter:
-            for pkg in pkgs_dict.get(cat, ()):
-                for match in restricts:
-                    if match(pkg) == sentinel:
-                        yield (cat, pkg)
-                        break
-
     def notify_remove_package(self, pkg):
         """
         internal function,
@@ -95,6 +95,27 @@ class choice_point(object):
             else:
                 return round > 0
 
+    def would_change(self, atom):
+        """Check, without altering anything, if reduce_atoms(atom) would
+        move off the current pkg.
+
+        :param atom: as for :obj:`reduce_atoms`
+        """
+        if self.matches is None:
+            raise IndexError("no solutions remain")
+        if self.matches_cur is None:
+            return True
+        filterset = set(self.solution_filters)
+        if hasattr(atom, "__contains__") and not isinstance(atom, basestring):
+            filterset.update(atom)
+        else:
+            filterset.add(atom)
+        for depset in (self._deps, self._rdeps, self._prdeps):
+            for choices in depset:
+                if all(x in filterset for x in choices):
+                    return True
+        return False
+
     def _reset_iters(self):
         """
         Reset depends, rdepends, post_rdepends, and provides properties
@@ -8,14 +8,14 @@ from pkgcore.restrictions import restriction
 # lil too getter/setter like for my tastes...
 
 
-class PigeonHoledSlots(object):
-    """class for tracking slotting to a specific atom/obj key
-    no atoms present, just prevents conflicts of obj.key; atom present, assumes
-    it's a blocker and ensures no obj matches the atom for that key
-    """
+class native_PigeonHoledSlots(object):
+
+    __slots__ = ("slots", "limiters")
 
     def __init__(self):
-        self.slot_dict = {}
+        # key -> {slot: [objs]}
+        self.slots = {}
+        # key -> [limiters]
         self.limiters = {}
 
     def fill_slotting(self, obj, force=False):
@@ -28,22 +28,33 @@ class PigeonHoledSlots(object):
 
         key = obj.key
         dslot = obj.slot
-        l.extend(x for x in self.slot_dict.get(key, ()) if x.slot == dslot)
+        slots = self.slots.get(key)
+        bucket = None
+        if slots is not None:
+            bucket = slots.get(dslot)
+            if bucket is not None:
+                l.extend(bucket)
 
         if not l or force:
-            self.slot_dict.setdefault(key, []).append(obj)
+            if bucket is None:
+                if slots is None:
+                    slots = self.slots[key] = {}
+                bucket = slots[dslot] = []
+            bucket.append(obj)
         return l
 
     def get_conflicting_slot(self, pkg):
-        for x in self.slot_dict.get(pkg.key, ()):
-            if pkg.slot == x.slot:
-                return x
+        bucket = self.slots.get(pkg.key, {}).get(pkg.slot)
+        if bucket:
+            return bucket[0]
         return None
 
     def find_atom_matches(self, atom, key=None):
         if key is None:
             key = atom.key
-        return filter(atom.match, self.slot_dict.get(key, ()))
+        match = atom.match
+        return [x for bucket in self.slots.get(key, {}).itervalues()
+                for x in bucket if match(x)]
 
     def add_limiter(self, atom, key=None):
         """add a limiter, returning any conflicting objs"""
@@ -59,32 +70,59 @@ class PigeonHoledSlots(object):
 
     def check_limiters(self, obj):
         """return any limiters conflicting w/ the psased in obj"""
-        key = obj.key
-        return [x for x in self.limiters.get(key, ()) if x.match(obj)]
+        return [x for x in self.limiters.get(obj.key, ()) if x.match(obj)]
 
     def remove_slotting(self, obj):
         key = obj.key
         # let the key error be thrown if they screwed up.
-        l = [x for x in self.slot_dict[key] if x is not obj]
-        if len(l) == len(self.slot_dict[key]):
+        slots = self.slots[key]
+        bucket = slots.get(obj.slot)
+        if bucket is None or not _remove_identity(bucket, obj):
             raise KeyError("obj %s isn't slotted" % obj)
-        if l:
-            self.slot_dict[key] = l
-        else:
-            del self.slot_dict[key]
+        if not bucket:
+            del slots[obj.slot]
+            if not slots:
+                del self.slots[key]
 
     def remove_limiter(self, atom, key=None):
         if key is None:
             key = atom.key
-        l = [x for x in self.limiters[key] if x is not atom]
-        if len(l) == len(self.limiters[key]):
+        l = self.limiters[key]
+        if not _remove_identity(l, atom):
             raise KeyError("obj %s isn't slotted" % atom)
         if not l:
             del self.limiters[key]
-        else:
-            self.limiters[key] = l
+
+
+def _remove_identity(l, obj):
+    """remove every occurence of obj from l in place, returning the count"""
+    count = 0
+    for idx in xrange(len(l) - 1, -1, -1):
+        if l[idx] is obj:
+            del l[idx]
+            count += 1
+    return count
+
+
+try:
+    from pkgcore.resolver._pigeonholes import \
+        PigeonHoledSlots as PigeonHoledSlots_base
+except ImportError:
+    PigeonHoledSlots_base = native_PigeonHoledSlots
+
+
+class PigeonHoledSlots(PigeonHoledSlots_base):
+    """class for tracking slotting to a specific atom/obj key
+    no atoms present, just prevents conflicts of obj.key; atom present, assumes
+    it's a blocker and ensures no obj matches the atom for that key
+
+    Objs are bucketed by (key, slot), so conflict checks and removals only
+    ever touch the objs sharing both; limiters are held per key.
+    """
+
+    __slots__ = ()
 
     def __contains__(self, obj):
         if isinstance(obj, restriction.base):
             return obj in self.limiters.get(obj.key, ())
-        return obj in self.slot_dict.get(obj.key, ())
+        return obj in self.slots.get(obj.key, {}).get(obj.slot, ())
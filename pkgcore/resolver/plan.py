@@ -10,15 +10,18 @@ from itertools import chain, islice, ifilterfalse as filterfalse
 import sys
 
 from snakeoil.compatibility import cmp, sort_cmp
+from snakeoil.demandload import demandload
 from snakeoil.iterables import caching_iter
 
 # XXX: hack; see insert_blockers
 from pkgcore.ebuild import atom as _atom
 from pkgcore.repository import misc, multiplex, visibility
-from pkgcore.resolver import state
+from pkgcore.resolver import speculate, state
 from pkgcore.resolver.choice_point import choice_point
 from pkgcore.restrictions import packages, values, restriction
 
+demandload('pkgcore.ebuild:processor')
+
 limiters = set(["cycle"])
 
 
@@ -222,16 +225,35 @@ class resolver_stack(deque):
         return -1
 
 
+class _choice_memo(object):
+
+    """outcome of successfully resolving an atom; see merge_plan._rec_add_atom"""
+
+    __slots__ = ("choices", "ops", "reads")
+
+    def __init__(self, choices, ops, reads):
+        self.choices = choices
+        # top level plan ops applied, nested ones are redone by those.
+        self.ops = ops
+        # key -> generation of every key the resolution looked at.
+        self.reads = reads
+
+
 class merge_plan(object):
 
     vdb_restrict = packages.PackageRestriction("repo.livefs",
         values.EqualityMatch(True))
 
+    # reuse the outcome of resolving an atom when the state it depended on
+    # is unchanged; see _rec_add_atom.
+    memoize_choices = True
+
     def __init__(self, dbs, per_repo_strategy,
                  global_strategy=None,
                  depset_reorder_strategy=None,
                  process_built_depends=False,
-                 drop_cycles=False, debug=False, debug_handle=None):
+                 drop_cycles=False, debug=False, debug_handle=None,
+                 speculative_jobs=0, cache_bytes=None):
 
         if debug_handle is None:
             debug_handle = sys.stdout
@@ -252,7 +274,14 @@ class merge_plan(object):
         self.depset_reorder = depset_reorder_strategy
         self.per_repo_strategy = per_repo_strategy
         self.total_ordering_strategy = global_strategy
-        self.all_raw_dbs = [misc.caching_repo(x, self.per_repo_strategy) for x in dbs]
+        if cache_bytes is None:
+            self.all_raw_dbs = [misc.caching_repo(x, self.per_repo_strategy)
+                                for x in dbs]
+        else:
+            # split evenly; each repo evicts on its own.
+            cache_bytes //= max(len(dbs), 1)
+            self.all_raw_dbs = [misc.bounded_caching_repo(x,
+                self.per_repo_strategy, cache_bytes) for x in dbs]
         self.all_dbs = global_strategy(self.all_raw_dbs)
         self.default_dbs = self.all_dbs
 
@@ -263,6 +292,13 @@ class merge_plan(object):
                 for x in self.all_raw_dbs if x.livefs])
 
         self.insoluble = set()
+        self._choice_memo = {}
+        self._cycle_events = 0
+        self.choice_memo_stats = {'hits': 0, 'stale': 0, 'recorded': 0}
+        self.speculation = None
+        if speculative_jobs > 0:
+            self.speculation = speculate.probe_pool(speculative_jobs)
+        self.speculation_stats = {'forked': 0, 'skipped': 0}
         self.vdb_preloaded = False
         self._ensure_livefs_is_loaded = \
             self._ensure_livefs_is_loaded_nonpreloaded
@@ -390,9 +426,95 @@ class merge_plan(object):
     def _rec_add_atom(self, atom, stack, dbs, mode="none", drop_cycles=False):
         """Add an atom.
 
+        Successful resolutions are memoized per (atom, mode, dbs,
+        drop_cycles) along with the generations of every package key looked
+        at while resolving (see :obj:`pkgcore.resolver.state.plan_state`);
+        if those keys are unchanged when the atom is next resolved (fex after
+        a parent frame backtracked), the same plan ops are just reapplied.
+
         :return: False on no issues (inserted succesfully),
             else a list of the stack that screwed it up.
         """
+        if not self.memoize_choices:
+            return self._resolve_atom(atom, stack, dbs, mode, drop_cycles)
+        memo_key = (atom, mode, dbs, drop_cycles)
+        plan_state = self.state
+        outer_reads = plan_state.reads
+        reads = plan_state.reads = {}
+        try:
+            memo = self._choice_memo.get(memo_key)
+            if memo is not None:
+                if self._replay_choice(memo, atom, stack, dbs, mode,
+                                       drop_cycles):
+                    self.choice_memo_stats['hits'] += 1
+                    return None
+                self.choice_memo_stats['stale'] += 1
+                del self._choice_memo[memo_key]
+
+            start = plan_state.current_state
+            cycle_events = self._cycle_events
+            ret = self._resolve_atom(atom, stack, dbs, mode, drop_cycles)
+            # cycle handling depends on the parent frames, and dropped deps
+            # on what's insoluble at the time; neither is reusable.
+            if not ret and cycle_events == self._cycle_events:
+                self._record_choice(memo_key, stack, start, reads)
+            return ret
+        finally:
+            plan_state.reads = outer_reads
+            if outer_reads is not None:
+                for key, gen in reads.iteritems():
+                    outer_reads.setdefault(key, gen)
+
+    def _record_choice(self, memo_key, stack, start, reads):
+        plan_state = self.state
+        if plan_state.current_state - start < 2:
+            # pre-solved, or a lone pkg; not worth saving.
+            return
+        events = stack[-1].events if stack else stack.events
+        frame = events[-1] if events else None
+        if not isinstance(frame, resolver_frame) or \
+                frame.atom is not memo_key[0]:
+            return
+        self._choice_memo[memo_key] = _choice_memo(frame.choices,
+            plan_state.applied_ops(start), dict(reads))
+        self.choice_memo_stats['recorded'] += 1
+
+    def _replay_choice(self, memo, atom, stack, dbs, mode, drop_cycles):
+        """reapply a memoized resolution of atom if it's still valid
+
+        :return: True if it was applied
+        """
+        plan_state = self.state
+        key_gens = plan_state.key_gens
+        reads = memo.reads
+        # insoluble isn't checked; its atoms have no matches at all, so the
+        # resolution failed on any it ran into (resolutions that dropped
+        # failed deps aren't memoized).
+        for key, gen in reads.iteritems():
+            if key_gens.get(key, 0) != gen:
+                return False
+        for frame in stack:
+            pkg = frame.current_pkg
+            if pkg is not None and pkg.key in reads:
+                # could be a cycle now.
+                return False
+        start = plan_state.current_state
+        plan_state.reads.update(reads)
+        stack.add_frame(mode, atom, memo.choices, dbs, start, drop_cycles,
+            vdb_limited=dbs == self.livefs_dbs)
+        for op in memo.ops:
+            # anything conflicting (blockers that hit something included,
+            # even if the original resolution worked past that) means the
+            # resolution differs now.
+            if op.apply(plan_state):
+                plan_state.backtrack(start)
+                stack.pop()
+                return False
+        stack.add_event(("memoized", len(memo.ops)))
+        stack.pop_frame(True)
+        return True
+
+    def _resolve_atom(self, atom, stack, dbs, mode, drop_cycles):
         assert hasattr(dbs, 'itermatch')
         limit_to_vdb = dbs == self.livefs_dbs
 
@@ -493,6 +615,7 @@ class merge_plan(object):
                    atom, "cycle")
             # note everything is retored to a pristine state prior also.
             stack[-1].ignored = True
+            self._cycle_events += 1
             l = self._rec_add_atom(atom, stack, dbs,
                 mode=mode, drop_cycles=True)
             if not l:
@@ -590,6 +713,7 @@ class merge_plan(object):
         """
         force_vdb = False
         for frame in stack.slot_cycles(cur_frame, reverse=True):
+            self._cycle_events += 1
             if not any(f.mode == 'post_rdepends' for f in
                 islice(stack, stack.index(frame), stack.index(cur_frame))):
                 # exact same pkg.
@@ -652,40 +776,108 @@ class merge_plan(object):
         self.notify_starting_mode(mode, stack)
         for potentials in depset:
             failure = []
-            for or_node in potentials:
-                if or_node.blocks:
-                    failure = self.process_blocker(stack, choices, or_node, mode, atom)
-                    if not failure:
-                        blocks.append(or_node)
-                        break
-                else:
-                    failure = self._rec_add_atom(or_node, stack,
-                        cur_frame.dbs, mode=mode,
-                        drop_cycles=cur_frame.drop_cycles)
-                    if not failure:
-                        additions.append(or_node)
-                        break
-                    # XXX this is whacky tacky fantastically crappy
-                    # XXX kill it; purpose seems... questionable.
-                    if cur_frame.drop_cycles:
-                        self._dprint("%s level cycle: %s: "
-                               "dropping cycle for %s from %s",
-                                (mode, cur_frame.atom, or_node,
-                                cur_frame.current_pkg),
-                                "cycle")
-                        failure = None
-                        break
-
-                if cur_frame.reduce_solutions(or_node):
-                    # pkg changed.
-                    return [failure]
-                continue
-            else: # didn't find any solutions to this or block.
-                cur_frame.reduce_solutions(potentials)
-                return [potentials]
+            probes = self._speculate(potentials, stack, mode)
+            try:
+                for idx, or_node in enumerate(potentials):
+                    if or_node.blocks:
+                        failure = self.process_blocker(stack, choices, or_node, mode, atom)
+                        if not failure:
+                            blocks.append(or_node)
+                            break
+                    elif idx in probes and \
+                        self.speculation.wait(probes.pop(idx)) is False and \
+                        not choices.would_change(or_node):
+                        # a forked copy already tried it, and failed.  If
+                        # the pkg changes over it, the failure is returned;
+                        # that case is redone for real, for the details.
+                        self.speculation_stats['skipped'] += 1
+                        self._dprint("%s: speculation: skipping %s",
+                            (mode, or_node))
+                        cur_frame.reduce_solutions(or_node)
+                        continue
+                    else:
+                        failure = self._rec_add_atom(or_node, stack,
+                            cur_frame.dbs, mode=mode,
+                            drop_cycles=cur_frame.drop_cycles)
+                        if not failure:
+                            additions.append(or_node)
+                            break
+                        # XXX this is whacky tacky fantastically crappy
+                        # XXX kill it; purpose seems... questionable.
+                        if cur_frame.drop_cycles:
+                            self._cycle_events += 1
+                            self._dprint("%s level cycle: %s: "
+                                   "dropping cycle for %s from %s",
+                                    (mode, cur_frame.atom, or_node,
+                                    cur_frame.current_pkg),
+                                    "cycle")
+                            failure = None
+                            break
+
+                    if cur_frame.reduce_solutions(or_node):
+                        # pkg changed.
+                        return [failure]
+                    continue
+                else: # didn't find any solutions to this or block.
+                    cur_frame.reduce_solutions(potentials)
+                    return [potentials]
+            finally:
+                for p in probes.itervalues():
+                    self.speculation.cancel(p)
         else: # all potentials were usable.
             return additions, blocks
 
+    def _speculate(self, potentials, stack, mode):
+        """
+        fork probes trying the fallback alternatives of an or block
+
+        While the preferred alternative is resolved as usual, each later
+        one that would actually need resolving is tried against a forked
+        copy of the current state.  If the preferred one fails, alternatives
+        their probe found unsolvable are skipped rather than retried; the
+        first viable one is then resolved for real, so the outcome is what
+        trying them one after another would give.
+
+        Frames dropping cycles aren't speculated on; what a dropped
+        dependency leaves behind (see :obj:`insoluble`) isn't reflected
+        back from the probe.
+
+        :return: dict of alternative index -> :obj:`speculate.probe`
+        """
+        probes = {}
+        pool = self.speculation
+        if pool is None or len(potentials) < 2 or \
+            stack.current_frame.drop_cycles:
+            return probes
+        match = self.state.match_atom
+        # the preferred alternative's already satisfied; nothing to gain.
+        if potentials[0].blocks or match(potentials[0]):
+            return probes
+        dbs = stack.current_frame.dbs
+        for idx, or_node in enumerate(potentials):
+            if not idx or or_node.blocks or or_node in self.insoluble or \
+                match(or_node):
+                continue
+            p = pool.spawn(partial(self._probe_atom, or_node, stack, dbs,
+                                   mode))
+            if p is None:
+                break
+            probes[idx] = p
+            self.speculation_stats['forked'] += 1
+        return probes
+
+    def _probe_atom(self, atom, stack, dbs, mode):
+        # runs in the forked child; keep quiet, and don't fork further.
+        # the parent's processors share its daemons; never touch them here,
+        # and since the child exits skipping atexit, reap any it spawned.
+        processor.forget_inherited_processors()
+        self.speculation = None
+        self._dprint = lambda *args: None
+        try:
+            return not self._rec_add_atom(atom, stack, dbs, mode=mode)
+        finally:
+            processor.shutdown_all_processors()
+
     def process_blocker(self, stack, choices, blocker, mode, atom):
         ret = self.insert_blockers(stack, choices, [blocker])
         if ret is None:
@@ -814,6 +1006,7 @@ class merge_plan(object):
     def free_caches(self):
         for repo in self.all_raw_dbs:
             repo.clear()
+        self._choice_memo.clear()
 
     # selection strategies for atom matches
 
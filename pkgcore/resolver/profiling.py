@@ -0,0 +1,239 @@
+# License: GPL2/BSD
+
+"""
+structured profiling of a :obj:`pkgcore.resolver.plan.merge_plan` run
+
+:obj:`resolver_profiler` instruments a resolver instance while enabled,
+recording per atom wall time and repository queries (itermatch calls),
+the resolver's caching_repo hit rates, how deep backtracks unwind, and how
+often the (usually C implemented) atom parsing and cpv comparison are
+invoked.  The result is available as a dict, JSON, or folded stacks (one
+``frame;frame;frame microseconds`` line per stack) as flamegraph.pl and
+similar tools consume.
+"""
+
+__all__ = ("resolver_profiler",)
+
+from functools import partial
+import time
+
+from snakeoil.demandload import demandload
+
+from pkgcore.ebuild import atom as _atom, cpv
+from pkgcore.repository import misc
+
+demandload('json')
+
+
+class _atom_stats(object):
+
+    __slots__ = ("calls", "failures", "elapsed", "self_elapsed", "itermatch")
+
+    def __init__(self):
+        self.calls = self.failures = self.itermatch = 0
+        self.elapsed = self.self_elapsed = 0.0
+
+
+class resolver_profiler(object):
+
+    """
+    instrument a resolver, collecting where its time goes
+
+    Enabling wraps the instance's atom resolution, its caching repos' match
+    and its state's backtrack; atom and cpv classes are patched to count
+    parses and comparisons.  All of it is undone on disable, so profile
+    only one resolver at a time.
+
+    :ivar atoms: mapping of atom string to its stats; elapsed includes
+        the atom's dependencies, self_elapsed doesn't
+    :ivar stacks: mapping of resolution stack (tuple of atom strings) to
+        self time in seconds
+    """
+
+    # backtrack depth histogram buckets: entries reverted, upper bound.
+    histogram_buckets = (1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024)
+
+    def __init__(self, resolver, timer=time.time):
+        """
+        :param resolver: :obj:`pkgcore.resolver.plan.merge_plan` instance
+        :param timer: callable returning the current time in seconds
+        """
+        self.resolver = resolver
+        self.timer = timer
+        self.atoms = {}
+        self.stacks = {}
+        self.repos = [[repo, 0, 0] for repo in resolver.all_raw_dbs]
+        self.backtracks = [0] * (len(self.histogram_buckets) + 1)
+        self.reverted = self.max_reverted = 0
+        self.frames = self.max_depth = 0
+        self.counts = dict.fromkeys(("atom_parse", "cpv_compare", "ver_cmp"),
+                                    0)
+        self.elapsed = 0.0
+        self._stack = []
+        self._undo = []
+        self._started = None
+
+    def enable(self):
+        if self._started is not None:
+            return
+        resolver = self.resolver
+        self._patch(resolver, '_rec_add_atom',
+                    partial(self._rec_add_atom, resolver._rec_add_atom))
+        self._patch(resolver.state, 'backtrack',
+                    partial(self._backtrack, resolver.state.backtrack))
+        for idx, (repo, _, _) in enumerate(self.repos):
+            self._patch(repo, 'match', partial(self._match, idx, repo.match))
+        self._patch_counter(_atom.atom, '__init__', 'atom_parse')
+        self._patch_counter(cpv.CPV, '__cmp__', 'cpv_compare')
+        self._patch(cpv, 'ver_cmp', partial(self._count, 'ver_cmp',
+                                            cpv.ver_cmp))
+        self._started = self.timer()
+
+    def disable(self):
+        if self._started is None:
+            return
+        self.elapsed += self.timer() - self._started
+        self._started = None
+        while self._undo:
+            obj, attr, present, orig = self._undo.pop()
+            if present:
+                setattr(obj, attr, orig)
+            else:
+                delattr(obj, attr)
+
+    def __enter__(self):
+        self.enable()
+        return self
+
+    def __exit__(self, *exc_info):
+        self.disable()
+
+    def _patch(self, obj, attr, replacement):
+        # if it's inherited (from the class, for instances), undo's a delete.
+        d = getattr(obj, '__dict__', {})
+        self._undo.append((obj, attr, attr in d, d.get(attr)))
+        setattr(obj, attr, replacement)
+
+    def _patch_counter(self, kls, attr, key):
+        # works for both python functions and the C extensions' bindings.
+        orig = getattr(kls, attr)
+        if hasattr(orig, 'im_func'):
+            orig = orig.im_func
+        counts = self.counts
+
+        def counter(inst, *args, **kwds):
+            counts[key] += 1
+            return orig.__get__(inst, inst.__class__)(*args, **kwds)
+        self._patch(kls, attr, counter)
+
+    def _count(self, key, func, *args, **kwds):
+        self.counts[key] += 1
+        return func(*args, **kwds)
+
+    def _rec_add_atom(self, func, atom, stack, dbs, **kwds):
+        key = str(atom)
+        stats = self.atoms.get(key)
+        if stats is None:
+            stats = self.atoms[key] = _atom_stats()
+        self._stack.append([key, stats, 0.0])
+        self.frames += 1
+        self.max_depth = max(self.max_depth, len(self._stack))
+        timer = self.timer
+        start = timer()
+        try:
+            ret = func(atom, stack, dbs, **kwds)
+        finally:
+            elapsed = timer() - start
+            frame = self._stack.pop()
+            self_elapsed = elapsed - frame[2]
+            if self._stack:
+                self._stack[-1][2] += elapsed
+            # recursion back into the same atom is already accounted for.
+            if not any(x[1] is stats for x in self._stack):
+                stats.elapsed += elapsed
+            stats.self_elapsed += self_elapsed
+            stats.calls += 1
+            path = tuple(x[0] for x in self._stack) + (key,)
+            self.stacks[path] = self.stacks.get(path, 0.0) + self_elapsed
+        if ret:
+            stats.failures += 1
+        return ret
+
+    def _match(self, idx, func, restrict):
+        counts = self.repos[idx]
+        if restrict in counts[0].__cache__:
+            counts[1] += 1
+        else:
+            counts[2] += 1
+        if self._stack:
+            self._stack[-1][1].itermatch += 1
+        return func(restrict)
+
+    def _backtrack(self, func, point):
+        reverted = self.resolver.state.current_state - point
+        if reverted > 0:
+            for idx, bound in enumerate(self.histogram_buckets):
+                if reverted <= bound:
+                    break
+            else:
+                idx = len(self.histogram_buckets)
+            self.backtracks[idx] += 1
+            self.reverted += reverted
+            self.max_reverted = max(self.max_reverted, reverted)
+        return func(point)
+
+    def report(self):
+        """
+        :return: dict of everything recorded, suitable for json
+        """
+        elapsed = self.elapsed
+        if self._started is not None:
+            elapsed += self.timer() - self._started
+        repos = []
+        for repo, hits, misses in self.repos:
+            total = hits + misses
+            repos.append({
+                "repo": str(getattr(repo, 'repo_id', repo)),
+                "hits": hits, "misses": misses,
+                "hit_rate": total and float(hits) / total or 0.0})
+            if isinstance(repo, misc.bounded_caching_repo):
+                repos[-1].update(evictions=repo.stats['evictions'],
+                                 bytes=repo.stats['bytes'])
+        histogram = {}
+        for idx, count in enumerate(self.backtracks):
+            if count:
+                if idx < len(self.histogram_buckets):
+                    label = "<=%i" % self.histogram_buckets[idx]
+                else:
+                    label = ">%i" % self.histogram_buckets[-1]
+                histogram[label] = count
+        calls = dict(self.counts)
+        calls["cpython"] = {
+            "atom": _atom.atom_overrides is not _atom.native_atom_overrides,
+            "cpv": bool(cpv.cpy_builtin)}
+        return {
+            "elapsed": elapsed,
+            "atoms": dict((key, {
+                "calls": s.calls, "failures": s.failures,
+                "elapsed": s.elapsed, "self_elapsed": s.self_elapsed,
+                "itermatch": s.itermatch}) for key, s in self.atoms.iteritems()),
+            "frames": {"total": self.frames, "max_depth": self.max_depth},
+            "repos": repos,
+            "backtracks": {
+                "count": sum(self.backtracks), "reverted": self.reverted,
+                "max_reverted": self.max_reverted, "histogram": histogram},
+            "calls": calls,
+            "choice_memo": dict(self.resolver.choice_memo_stats),
+            "speculation": dict(self.resolver.speculation_stats),
+        }
+
+    def write_json(self, handle):
+        json.dump(self.report(), handle, indent=2, sort_keys=True)
+        handle.write("\n")
+
+    def write_stacks(self, handle):
+        """write folded stacks, weighted by self time in microseconds"""
+        for path, elapsed in sorted(self.stacks.iteritems()):
+            usecs = int(round(elapsed * 1e6))
+            if usecs:
+                handle.write("%s %i\n" % (";".join(path), usecs))
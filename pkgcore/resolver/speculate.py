@@ -0,0 +1,106 @@
+# License: GPL2/BSD
+
+"""
+speculative evaluation of resolver alternatives in forked children
+
+fork() hands the child a copy on write snapshot of the resolver as it
+stands- plan_state, stack, repo caches, everything- so it can try
+resolving something without disturbing the parent; all that comes back is
+whether it worked.
+"""
+
+__all__ = ("probe", "probe_pool")
+
+import os
+import signal
+
+
+class probe(object):
+
+    """
+    a forked child evaluating a single callable
+
+    :ivar pid: pid of the child, None once reaped
+    :ivar result: True/False as the callable returned, None if it threw
+        (or was cancelled); only meaningful once :obj:`wait` was invoked
+    """
+
+    __slots__ = ("pid", "fd", "result")
+
+    def __init__(self, func):
+        rfd, wfd = os.pipe()
+        pid = os.fork()
+        if pid == 0:
+            # never return into the parent's frames; nor flush its buffers.
+            status = 1
+            try:
+                os.close(rfd)
+                os.write(wfd, func() and "1" or "0")
+                status = 0
+            finally:
+                os._exit(status)
+        os.close(wfd)
+        self.pid = pid
+        self.fd = rfd
+        self.result = None
+
+    def wait(self):
+        """block till the child finishes, returning its result"""
+        if self.pid is not None:
+            try:
+                data = os.read(self.fd, 1)
+            finally:
+                self._reap()
+            if data:
+                self.result = data == "1"
+        return self.result
+
+    def cancel(self):
+        if self.pid is not None:
+            try:
+                os.kill(self.pid, signal.SIGKILL)
+            except OSError:
+                pass
+            self._reap()
+
+    def _reap(self):
+        os.close(self.fd)
+        os.waitpid(self.pid, 0)
+        self.pid = None
+
+
+class probe_pool(object):
+
+    """
+    bounds how many probes run at once
+
+    Probes are forked on demand rather than handed to long lived workers;
+    a worker's view of the resolver would be stale by the time it got a job.
+    """
+
+    def __init__(self, jobs):
+        self.jobs = jobs
+        self.running = set()
+        self.forked = 0
+
+    def __len__(self):
+        return len(self.running)
+
+    def spawn(self, func):
+        """
+        :return: a :obj:`probe` evaluating func, or None if the pool is full
+        """
+        if len(self.running) >= self.jobs:
+            return None
+        p = probe(func)
+        self.running.add(p)
+        self.forked += 1
+        return p
+
+    def wait(self, p):
+        self.running.discard(p)
+        return p.wait()
+
+    def cancel(self, p):
+        self.running.discard(p)
+        p.cancel()
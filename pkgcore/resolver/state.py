@@ -12,18 +12,72 @@ from snakeoil.containers import RefCountingSet
 
 from pkgcore.resolver.pigeonholes import PigeonHoledSlots
 
+# undo record types for plan_state.journal; records are (type, a, b) tuples.
+# pkg a was slotted.
+UNDO_SLOT = 0
+# pkg a was unslotted.
+UNDO_UNSLOT = 1
+# pkg_choices[a] was set; b is the prior value, or _missing.
+UNDO_CHOICES = 2
+# pkg a was added to vdb_filter.
+UNDO_VDB_FILTER = 3
+# restriction a was added to forced_restrictions.
+UNDO_HARDREF = 4
+# choices a gained blocker b (a (blocker, key) pair).
+UNDO_INCREF = 5
+# choices a lost blocker b[:2], from index b[2] of its rev_blockers list.
+UNDO_DECREF = 6
+# key a's generation was bumped from b.
+UNDO_GEN = 7
+
+_missing = object()
+
 
 class plan_state(object):
 
+    """
+    resolver state: the slotted packages, blockers and the plan built so far
+
+    Every change ops make is recorded in :obj:`journal` as a typed undo
+    record; :obj:`_marks` holds the journal position each plan entry's
+    changes start at.  Backtracking is thus undoing the journal's tail back
+    to a mark, then truncating plan, marks and journal in one go.
+
+    Each package key also has a generation in :obj:`key_gens`, bumped on any
+    change to the key's slotting, limiters or vdb filtering and restored on
+    backtrack; equal generations mean equal state for that key.  If
+    :obj:`reads` is a dict, the generation of each key first read (or
+    changed) is recorded in it.
+    """
+
     def __init__(self):
         self.state = PigeonHoledSlots()
         self.plan = []
+        self.journal = []
+        self._marks = []
         self.pkg_choices = {}
         self.rev_blockers = {}
         self.blockers_refcnt = RefCountingSet()
-        self.match_atom = self.state.find_atom_matches
         self.vdb_filter = set()
         self.forced_restrictions = RefCountingSet()
+        self.key_gens = {}
+        self._generation = 0
+        self.reads = None
+
+    def match_atom(self, atom):
+        self._read(atom.key)
+        return self.state.find_atom_matches(atom)
+
+    def _read(self, key):
+        reads = self.reads
+        if reads is not None and key not in reads:
+            reads[key] = self.key_gens.get(key, 0)
+
+    def _touch(self, key):
+        self._read(key)
+        self._generation += 1
+        self.journal.append((UNDO_GEN, key, self.key_gens.get(key, 0)))
+        self.key_gens[key] = self._generation
 
     def add_blocker(self, choices, blocker, key=None):
         """Adds blocker, returning any packages blocked.
@@ -44,25 +98,125 @@ class plan_state(object):
         for blocker, key in l[:]:
             decref_forward_block_op(choices, blocker, key).apply(self)
 
+    def applied_ops(self, state_pos):
+        """
+        :return: tuple of the ops applied since state_pos, excluding those
+            applied by another op (fex the blockers a remove drops);
+            reapplying them redoes all changes since state_pos
+        """
+        ops = []
+        low = None
+        for op, mark in reversed(zip(self.plan[state_pos:],
+                                     self._marks[state_pos:])):
+            if low is None or mark <= low:
+                ops.append(op)
+                low = mark
+        ops.reverse()
+        return tuple(ops)
+
+    def _append(self, op, mark):
+        """add op to the plan
+
+        :param mark: journal position prior to any of op's changes
+        """
+        self.plan.append(op)
+        self._marks.append(mark)
+
+    def _slot(self, pkg, force=False):
+        self._read(pkg.key)
+        l = self.state.fill_slotting(pkg, force=force)
+        if not l or force:
+            self._touch(pkg.key)
+            self.journal.append((UNDO_SLOT, pkg, None))
+        return l
+
+    def _unslot(self, pkg):
+        self.state.remove_slotting(pkg)
+        self._touch(pkg.key)
+        self.journal.append((UNDO_UNSLOT, pkg, None))
+
+    def _set_choices(self, pkg, choices):
+        self.journal.append(
+            (UNDO_CHOICES, pkg, self.pkg_choices.get(pkg, _missing)))
+        self.pkg_choices[pkg] = choices
+
+    def _del_choices(self, pkg):
+        self.journal.append((UNDO_CHOICES, pkg, self.pkg_choices.pop(pkg)))
+
+    def _filter_vdb(self, pkg):
+        self.vdb_filter.add(pkg)
+        self._touch(pkg.key)
+        self.journal.append((UNDO_VDB_FILTER, pkg, None))
+
+    def _rollback(self, state_pos, mark):
+        """undo every journal record from mark on, truncating the plan to
+        state_pos"""
+        journal = self.journal
+        state = self.state
+        pkg_choices = self.pkg_choices
+        rev_blockers = self.rev_blockers
+        blockers_refcnt = self.blockers_refcnt
+        key_gens = self.key_gens
+        idx = len(journal)
+        try:
+            while idx > mark:
+                kind, a, b = journal[idx - 1]
+                if kind == UNDO_GEN:
+                    key_gens[a] = b
+                elif kind == UNDO_SLOT:
+                    state.remove_slotting(a)
+                elif kind == UNDO_CHOICES:
+                    if b is _missing:
+                        del pkg_choices[a]
+                    else:
+                        pkg_choices[a] = b
+                elif kind == UNDO_UNSLOT:
+                    state.fill_slotting(a, force=True)
+                elif kind == UNDO_VDB_FILTER:
+                    self.vdb_filter.remove(a)
+                elif kind == UNDO_INCREF:
+                    # everything appended after it was undone already.
+                    l = rev_blockers[a]
+                    l.pop()
+                    if not l:
+                        del rev_blockers[a]
+                    blockers_refcnt.remove(b[0])
+                    if b[0] not in blockers_refcnt:
+                        state.remove_limiter(b[0], b[1])
+                elif kind == UNDO_DECREF:
+                    rev_blockers.setdefault(a, []).insert(b[2], b[:2])
+                    if b[0] not in blockers_refcnt:
+                        state.add_limiter(b[0], b[1])
+                    blockers_refcnt.add(b[0])
+                elif kind == UNDO_HARDREF:
+                    self.forced_restrictions.remove(a)
+                else:
+                    raise AssertionError(
+                        "unknown undo record %r" % (journal[idx - 1],))
+                idx -= 1
+        finally:
+            if idx > mark:
+                # interrupted; drop just what was undone, keeping the plan
+                # entries that still have changes in effect.
+                state_pos = len(self._marks)
+                while state_pos and self._marks[state_pos - 1] >= idx:
+                    state_pos -= 1
+            del journal[idx:]
+            del self.plan[state_pos:]
+            del self._marks[state_pos:]
+
     def backtrack(self, state_pos):
         """Backtrack over a plan."""
         assert state_pos <= len(self.plan)
         if len(self.plan) == state_pos:
             return
-
-        # track exactly how many reversions we've done-
-        # since we do a single slicing of plan, if an exception occurs
-        # before finishing we need to prune what has been finished,
-        # and just that.
-        reversion_count = 0
-        try:
-            for reversion_count, change in enumerate(reversed(self.plan[state_pos:])):
-                change.revert(self)
-            reversion_count += 1
-            assert len(self.plan) - reversion_count == state_pos
-        finally:
-            if reversion_count:
-                self.plan = self.plan[:-reversion_count]
+        marks = self._marks
+        mark = min(marks[state_pos:])
+        # ops applied while another was (fex the blockers a remove drops)
+        # precede it in the plan, but are part of it; they go with it.
+        while state_pos and marks[state_pos - 1] > mark:
+            state_pos -= 1
+        self._rollback(state_pos, mark)
 
     def iter_ops(self, return_livefs=False):
         iterable = (x for x in self.plan if not x.internal)
@@ -141,9 +295,6 @@ class base_op_state(object):
     def apply(self, plan):
         raise NotImplemented(self, 'apply')
 
-    def revert(self, plan):
-        raise NotImplemented(self, 'revert')
-
 
 class add_op(base_op_state):
 
@@ -151,15 +302,12 @@ class add_op(base_op_state):
     desc = "add"
 
     def apply(self, plan):
-        l = plan.state.fill_slotting(self.pkg, force=self.force)
+        mark = len(plan.journal)
+        l = plan._slot(self.pkg, force=self.force)
         if l and not self.force:
             return l
-        plan.pkg_choices[self.pkg] = self.choices
-        plan.plan.append(self)
-
-    def revert(self, plan):
-        plan.state.remove_slotting(self.pkg)
-        del plan.pkg_choices[self.pkg]
+        plan._set_choices(self.pkg, self.choices)
+        plan._append(self, mark)
 
 
 class add_hardref_op(base_op_state):
@@ -175,11 +323,9 @@ class add_hardref_op(base_op_state):
         self.restriction = restriction
 
     def apply(self, plan):
-        plan.plan.append(self)
+        plan._append(self, len(plan.journal))
         plan.forced_restrictions.add(self.restriction)
-
-    def revert(self, plan):
-        plan.forced_restrictions.remove(self.restriction)
+        plan.journal.append((UNDO_HARDREF, self.restriction, None))
 
 
 class add_backref_op(base_op_state):
@@ -189,11 +335,7 @@ class add_backref_op(base_op_state):
     internal = True
 
     def apply(self, plan):
-        plan.plan.append(self)
-        pass
-
-    def revert(self, plan):
-        pass
+        plan._append(self, len(plan.journal))
 
 
 class remove_op(base_op_state):
@@ -202,16 +344,12 @@ class remove_op(base_op_state):
     desc = "remove"
 
     def apply(self, plan):
-        plan.state.remove_slotting(self.pkg)
+        mark = len(plan.journal)
+        plan._unslot(self.pkg)
         plan._remove_pkg_blockers(self.choices)
-        del plan.pkg_choices[self.pkg]
-        plan.plan.append(self)
-        plan.vdb_filter.add(self.pkg)
-
-    def revert(self, plan):
-        plan.state.fill_slotting(self.pkg, force=True)
-        plan.pkg_choices[self.pkg] = self.choices
-        plan.vdb_filter.remove(self.pkg)
+        plan._del_choices(self.pkg)
+        plan._append(self, mark)
+        plan._filter_vdb(self.pkg)
 
 
 class replace_op(base_op_state):
@@ -226,45 +364,31 @@ class replace_op(base_op_state):
 
     def apply(self, plan):
         revert_point = plan.current_state
+        mark = len(plan.journal)
+        plan._read(self.pkg.key)
         old = plan.state.get_conflicting_slot(self.pkg)
         # probably should just convert to an add...
         force_old = bool(plan.state.check_limiters(old))
         assert old is not None
-        plan.state.remove_slotting(old)
+        plan._unslot(old)
         old_choices = plan.pkg_choices[old]
         # assertion for my own sanity...
         assert revert_point == plan.current_state
+        # wipe olds blockers.
         plan._remove_pkg_blockers(old_choices)
-        l = plan.state.fill_slotting(self.pkg, force=self.force)
+        l = plan._slot(self.pkg, force=self.force)
         if l:
             # revert... limiter.
-            l2 = plan.state.fill_slotting(old)
-            plan.backtrack(revert_point)
-            assert not l2
+            plan._rollback(revert_point, mark)
             return l
 
-        # wipe olds blockers.
-
         self.old_pkg = old
         self.force_old = force_old
         self.old_choices = old_choices
-        del plan.pkg_choices[old]
-        plan.pkg_choices[self.pkg] = self.choices
-        plan.plan.append(self)
-        plan.vdb_filter.add(old)
-
-    def revert(self, plan):
-        # far simpler, since the apply op generates multiple ops on its own.
-        # all we have to care about is swap.
-        plan.state.remove_slotting(self.pkg)
-        l = plan.state.fill_slotting(self.old_pkg, force=self.force_old)
-        if bool(l) != self.force_old:
-            raise AssertionError(
-                "Internal error detected, unable to revert %s; got %s, "
-                "force_old=%s " % (self, l, self.force_old))
-        del plan.pkg_choices[self.pkg]
-        plan.pkg_choices[self.old_pkg] = self.old_choices
-        plan.vdb_filter.remove(self.old_pkg)
+        plan._del_choices(old)
+        plan._set_choices(self.pkg, self.choices)
+        plan._append(self, mark)
+        plan._filter_vdb(old)
 
     def __str__(self):
         s = ''
@@ -304,51 +428,39 @@ class blocker_base_op(object):
     def apply(self, plan):
         raise NotImplementedError(self, 'apply')
 
-    def revert(self, plan):
-        raise NotImplementedError(self, 'revert')
-
 
 class incref_forward_block_op(blocker_base_op):
 
     __slots__ = ()
 
     def apply(self, plan):
-        plan.plan.append(self)
+        plan._append(self, len(plan.journal))
         if self.blocker not in plan.blockers_refcnt:
             l = plan.state.add_limiter(self.blocker, self.key)
         else:
             l = []
-        plan.rev_blockers.setdefault(self.choices, []).append(
-             (self.blocker, self.key))
+        entry = (self.blocker, self.key)
+        plan.rev_blockers.setdefault(self.choices, []).append(entry)
         plan.blockers_refcnt.add(self.blocker)
+        plan._touch(self.key)
+        plan.journal.append((UNDO_INCREF, self.choices, entry))
         return l
 
-    def revert(self, plan):
-        l = plan.rev_blockers[self.choices]
-        l.remove((self.blocker, self.key))
-        if not l:
-            del plan.rev_blockers[self.choices]
-        plan.blockers_refcnt.remove(self.blocker)
-        if self.blocker not in plan.blockers_refcnt:
-            plan.state.remove_limiter(self.blocker, self.key)
-
 
 class decref_forward_block_op(blocker_base_op):
 
     __slots__ = ()
 
     def apply(self, plan):
-        plan.plan.append(self)
+        plan._append(self, len(plan.journal))
         plan.blockers_refcnt.remove(self.blocker)
         if self.blocker not in plan.blockers_refcnt:
             plan.state.remove_limiter(self.blocker, self.key)
-        plan.rev_blockers[self.choices].remove((self.blocker, self.key))
-        if not plan.rev_blockers[self.choices]:
+        l = plan.rev_blockers[self.choices]
+        idx = l.index((self.blocker, self.key))
+        del l[idx]
+        if not l:
             del plan.rev_blockers[self.choices]
-
-    def revert(self, plan):
-        plan.rev_blockers.setdefault(self.choices, []).append(
-            (self.blocker, self.key))
-        if self.blocker not in plan.blockers_refcnt:
-            plan.state.add_limiter(self.blocker, self.key)
-        plan.blockers_refcnt.add(self.blocker)
+        plan._touch(self.key)
+        plan.journal.append(
+            (UNDO_DECREF, self.choices, (self.blocker, self.key, idx)))
@@ -21,7 +21,8 @@ class native_PackageRestriction(object):
     __slots__ = ('_pull_attr_func', '_attr_split', 'restriction', 'ignore_missing',
         'negate')
 
-    __attr_comparison__ = ("__class__", "negate", "_attr_split", "restriction")
+    __attr_comparison__ = ("__class__", "negate", "_attr_split", "restriction",
+        "ignore_missing")
     __metaclass__ = generic_equality
 
     def __init__(self, attr, childrestriction, negate=False, ignore_missing=True):
@@ -213,6 +214,7 @@ PackageRestrictionMulti_base = native_PackageRestrictionMulti
 class PackageRestriction(PackageRestriction_base, PackageRestriction_mixin):
     __slots__ = ()
     __inst_caching__ = True
+    __intern__ = True
 
     if is_py3k:
         __hash__ = PackageRestriction_mixin.__hash__
@@ -247,6 +249,7 @@ class Conditional(PackageRestriction):
 
     # note that instance caching is turned off.
     # rarely pays off for conditionals from a speed/mem comparison
+    __intern__ = False
 
     def __init__(self, attr, childrestriction, payload, **kwds):
         """
@@ -7,10 +7,67 @@ base restriction class
 """
 
 from functools import partial
+from weakref import ref
 
 from snakeoil import caching, klass
 from snakeoil.currying import pretty_docs
 
+_intern_tables = {}
+
+
+def native_intern(inst):
+    """
+    hash cons a restriction
+
+    :return: the live instance of the same class that compares equal to inst
+        if one exists, else inst (which is registered for future lookups)
+    """
+    kls = inst.__class__
+    table = _intern_tables.get(kls)
+    if table is None:
+        table = _intern_tables[kls] = {}
+    try:
+        r = ref(inst, lambda r: table.pop(r, None))
+    except TypeError:
+        # no weakref support.
+        return inst
+    try:
+        existing = table.get(r)
+        if existing is not None:
+            existing = existing()
+            if existing is not None:
+                return existing
+        table[r] = r
+    except (NotImplementedError, TypeError):
+        # unhashable.
+        pass
+    return inst
+
+try:
+    from pkgcore.restrictions._restrictions import intern
+except ImportError:
+    intern = native_intern
+
+
+class InterningInstMeta(caching.WeakInstMeta):
+
+    """
+    :obj:`snakeoil.caching.WeakInstMeta` extended with hash consing
+
+    Classes setting ``__intern__`` have each new instance passed through
+    :obj:`intern`; equal restrictions built from differing args (keywords
+    vs positional, explicit defaults, differing subclass constructors)
+    thus collapse into one instance, and comparisons between them hit the
+    identity fast path.  ``disable_inst_caching=True`` disables both.
+    """
+
+    def __call__(cls, *a, **kw):
+        if not cls.__intern__:
+            return caching.WeakInstMeta.__call__(cls, *a, **kw)
+        elif kw.pop("disable_inst_caching", False):
+            return type.__call__(cls, *a, **kw)
+        return intern(type.__call__(cls, *a, **kw))
+
 
 class base(object):
 
@@ -21,8 +78,9 @@ class base(object):
     wind up in memory).
     """
 
-    __metaclass__ = caching.WeakInstMeta
+    __metaclass__ = InterningInstMeta
     __inst_caching__ = True
+    __intern__ = False
 
     # __weakref__ here's is implicit via the metaclass
     __slots__ = ()
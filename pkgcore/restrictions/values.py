@@ -90,15 +90,15 @@ class VersionRestriction(base):
     __slots__ = ()
 
 
-class StrRegex(base):
+class native_StrRegex(object):
 
     """
     regex based matching
     """
 
-    __slots__ = ('_hash', 'flags', 'regex', '_matchfunc', 'ismatch', 'negate')
-    __metaclass__ = hashed_base
-    __inst_caching__ = True
+    __slots__ = __attr_comparison__ = (
+        '_hash', 'flags', 'regex', '_matchfunc', 'ismatch', 'negate')
+    __metaclass__ = generic_equality
 
     def __init__(self, regex, case_sensitive=True, match=False, negate=False):
 
@@ -124,6 +124,10 @@ class StrRegex(base):
             sf(self, "_matchfunc", compiled_re.search)
         sf(self, "_hash", hash((self.regex, self.negate, self.flags, self.ismatch)))
 
+    @property
+    def case_sensitive(self):
+        return not self.flags
+
     def match(self, value):
         if not isinstance(value, basestring):
             # Be too clever for our own good --marienz
@@ -133,26 +137,42 @@ class StrRegex(base):
                 value = str(value)
         return (self._matchfunc(value) is not None) != self.negate
 
-    def __repr__(self):
-        result = [self.__class__.__name__, repr(self.regex)]
-        if self.negate:
-            result.append('negated')
-        if self.ismatch:
-            result.append('match')
-        else:
-            result.append('search')
-        result.append('@%#8x' % (id(self),))
-        return '<%s>' % (' '.join(result),)
+    __hash__ = reflective_hash('_hash')
 
-    def __str__(self):
-        if self.ismatch:
-            result = 'match '
-        else:
-            result = 'search '
-        result += self.regex
-        if self.negate:
-            return 'not ' + result
-        return result
+if extension is None:
+    base_StrRegex = native_StrRegex
+else:
+    base_StrRegex = extension.StrRegex
+
+def _StrRegex__repr__(self):
+    result = [self.__class__.__name__, repr(self.regex)]
+    if self.negate:
+        result.append('negated')
+    if self.ismatch:
+        result.append('match')
+    else:
+        result.append('search')
+    result.append('@%#8x' % (id(self),))
+    return '<%s>' % (' '.join(result),)
+
+def _StrRegex__str__(self):
+    if self.ismatch:
+        result = 'match '
+    else:
+        result = 'search '
+    result += self.regex
+    if self.negate:
+        return 'not ' + result
+    return result
+
+class StrRegex(base_StrRegex, base):
+
+    __slots__ = ()
+    __inst_caching__ = True
+    __intern__ = True
+
+    __repr__ = _StrRegex__repr__
+    __str__ = _StrRegex__str__
 
 
 class native_StrExactMatch(object):
@@ -225,21 +245,22 @@ class StrExactMatch(base_StrExactMatch, base):
 
     __slots__ = ()
     __inst_caching__ = True
+    __intern__ = True
 
     intersect = _StrExact_intersect
     __repr__ = _StrExact__repr__
     __str__ = _StrExact__str__
 
 
-class StrGlobMatch(base):
+class native_StrGlobMatch(object):
 
     """
     globbing matches; essentially startswith and endswith matches
     """
 
-    __slots__ = ('_hash', 'glob', 'prefix', 'negate', 'flags')
-    __metaclass__ = hashed_base
-    __inst_caching__ = True
+    __slots__ = __attr_comparison__ = (
+        '_hash', 'glob', 'prefix', 'negate', 'flags')
+    __metaclass__ = generic_equality
 
     def __init__(self, glob, case_sensitive=True, prefix=True, negate=False):
 
@@ -262,6 +283,10 @@ class StrGlobMatch(base):
         sf(self, "prefix", prefix)
         sf(self, "_hash", hash((self.glob, self.negate, self.flags, self.prefix)))
 
+    @property
+    def case_sensitive(self):
+        return not self.flags
+
     def match(self, value):
         value = str(value)
         if self.flags == re.I:
@@ -272,26 +297,40 @@ class StrGlobMatch(base):
             f = value.endswith
         return f(self.glob) ^ self.negate
 
-    def __repr__(self):
-        if self.negate:
-            string = '<%s %r case_sensitive=%r negated @%#8x>'
-        else:
-            string = '<%s %r case_sensitive=%r @%#8x>'
-        if self.prefix:
-            g = self.glob + ".*"
-        else:
-            g = ".*" + self.glob
-        return string % (self.__class__.__name__, g,
-            self.flags == re.I and True or False,
-            id(self))
+    __hash__ = reflective_hash('_hash')
 
-    def __str__(self):
-        s = ''
-        if self.negate:
-            s = 'not '
-        if self.prefix:
-            return "%s%s*" % (s, self.glob)
-        return "%s*%s" % (s, self.glob)
+if extension is None:
+    base_StrGlobMatch = native_StrGlobMatch
+else:
+    base_StrGlobMatch = extension.StrGlobMatch
+
+def _StrGlob__repr__(self):
+    if self.negate:
+        string = '<%s %r case_sensitive=%r negated @%#8x>'
+    else:
+        string = '<%s %r case_sensitive=%r @%#8x>'
+    if self.prefix:
+        g = self.glob + ".*"
+    else:
+        g = ".*" + self.glob
+    return string % (self.__class__.__name__, g, self.case_sensitive, id(self))
+
+def _StrGlob__str__(self):
+    s = ''
+    if self.negate:
+        s = 'not '
+    if self.prefix:
+        return "%s%s*" % (s, self.glob)
+    return "%s*%s" % (s, self.glob)
+
+class StrGlobMatch(base_StrGlobMatch, base):
+
+    __slots__ = ()
+    __inst_caching__ = True
+    __intern__ = True
+
+    __repr__ = _StrGlob__repr__
+    __str__ = _StrGlob__str__
 
 
 class EqualityMatch(base):
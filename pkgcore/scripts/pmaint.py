@@ -7,6 +7,7 @@
 __all__ = (
     "sync", "sync_main", "copy", "copy_main", "regen", "regen_main",
     "perl_rebuild", "perl_rebuild_main", "env_update", "env_update_main",
+    "cache", "cache_main",
 )
 
 from snakeoil.demandload import demandload
@@ -20,6 +21,8 @@ demandload(
     'time',
     'snakeoil.osutils:pjoin,listdir_dirs',
     'snakeoil.process:get_proc_count',
+    'pkgcore.cache:check@cache_check,packed',
+    'pkgcore.cache:errors@cache_errors',
     'pkgcore.ebuild:processor,triggers',
     'pkgcore.fs:contents,livefs',
     'pkgcore.merge:triggers@merge_triggers',
@@ -195,11 +198,17 @@ regen.add_argument(
 regen.add_argument(
     "-t", "--threads", type=int,
     default=commandline.DelayedValue(_get_default_jobs, 100),
-    help="number of threads to use for regeneration.  Defaults to using all "
-    "available processors")
+    help="number of worker processes (each driving its own ebuild "
+    "processor) to use for regeneration.  Defaults to using all available "
+    "processors")
 regen.add_argument(
     "--force", action='store_true', default=False,
     help="force regeneration to occur regardless of staleness checks")
+regen.add_argument(
+    "--index", metavar="FILE",
+    help="maintain a change index in FILE, regenerating only packages whose "
+    "ebuild or inherited eclasses changed since the last run using it.  "
+    "Combined with --force, everything is regenerated and the index rebuilt")
 regen.add_argument(
     "--rsync", action='store_true', default=False,
     help="perform actions necessary for rsync repos (update metadata/timestamp.chk)")
@@ -222,7 +231,8 @@ def regen_main(options, out, err):
     repo.operations.regen_cache(
         threads=options.threads,
         observer=observer.formatter_output(out), force=options.force,
-        eclass_caching=(not options.disable_eclass_caching))
+        eclass_caching=(not options.disable_eclass_caching),
+        index=options.index)
     end_time = time.time()
     if options.verbose:
         out.write(
@@ -239,6 +249,77 @@ def regen_main(options, out, err):
     return 0
 
 
+cache = subparsers.add_parser(
+    "cache", parents=shared_options,
+    description="verify, prune and compact a repository's metadata caches")
+cache.add_argument(
+    "--prune", action='store_true', default=False,
+    help="remove entries that are stale, corrupt, or whose ebuild is gone")
+cache.add_argument(
+    "--pack", metavar="DIR",
+    help="copy the valid entries of the repository's first cache into a "
+    "packed (single file) cache in DIR; point the repository's cache at it "
+    "afterwards to use it")
+cache.add_argument(
+    "-t", "--threads", type=int,
+    default=commandline.DelayedValue(_get_default_jobs, 100),
+    help="number of threads to read and validate entries with.  Defaults "
+    "to using all available processors")
+cache.add_argument(
+    "-v", "--verbose", action='store_true', default=False,
+    help="list every invalid entry")
+cache.add_argument(
+    "repo", action=commandline.StoreRepoObject,
+    help="repository whose caches to check")
+@cache.bind_main_func
+def cache_main(options, out, err):
+    """Verify, prune and compact a repository's metadata caches."""
+
+    repo = options.repo
+    caches = [x for x in getattr(repo, 'cache', None) or () if x is not None]
+    if not caches:
+        out.write("repository %s has no metadata cache" % (repo,))
+        return 0
+
+    obs = observer.formatter_output(out)
+    if not options.verbose:
+        # invalid entries are reported via info; errors still get through.
+        obs.info = lambda msg, *args, **kwds: None
+    failures = 0
+    for idx, db in enumerate(caches):
+        target = None
+        if idx == 0 and options.pack is not None:
+            target = packed.database(options.pack,
+                auxdbkeys=db._known_keys - frozenset([db._chf_key]))
+        label = getattr(db, 'location', db)
+        try:
+            stats = cache_check.check_cache(repo, db, obs,
+                threads=options.threads, prune=options.prune, target=target)
+        except cache_errors.CacheError as e:
+            err.write("failed checking cache %s: %s" % (label, e))
+            failures += 1
+            continue
+        out.write("cache %s: %i entries in %.2fs (%.1f entries/s)" % (
+            label, stats['entries'], stats['elapsed'],
+            stats['entries'] / max(stats['elapsed'], 1e-6)))
+        out.write("  " + ", ".join("%s: %i" % (x, stats[x])
+            for x in cache_check.statuses))
+        if options.prune:
+            if db.readonly:
+                out.write("  readonly; nothing pruned")
+            else:
+                reclaimed = 0
+                if stats['before'] is not None:
+                    reclaimed = max(stats['before'] - stats['after'], 0)
+                out.write("  pruned %i entries, reclaiming %i bytes" % (
+                    stats['pruned'], reclaimed))
+        if target is not None:
+            out.write("  packed %i entries into %s: %i bytes, down from %i" % (
+                stats['copied'], options.pack,
+                cache_check.disk_usage(target.location), stats['after'] or 0))
+    return int(bool(failures))
+
+
 perl_rebuild = subparsers.add_parser(
     "perl-rebuild", parents=(commandline.mk_argparser(add_help=False),),
     description="EXPERIMENTAL: perl-rebuild support for use after upgrading perl")
@@ -20,6 +20,7 @@ from pkgcore.ebuild import resolver, restricts
 from pkgcore.ebuild.atom import atom
 from pkgcore.merge import errors as merge_errors
 from pkgcore.operations import observer, format
+from pkgcore.resolver import profiling
 from pkgcore.resolver.util import reduce_to_failures
 from pkgcore.restrictions import packages
 from pkgcore.restrictions.boolean import OrRestriction
@@ -114,6 +115,27 @@ resolution_options.add_argument(
     '--with-bdeps', action='store_true',
     help="process build dependencies for built packages; "
          "by default they're ignored")
+resolution_options.add_argument(
+    '--speculative-jobs', type=int, default=0, metavar='JOBS',
+    help="try the fallback alternatives of || dependencies in up to JOBS "
+         "forked processes while the preferred one is resolved, skipping "
+         "those found unsolvable if it fails; the result is the same as "
+         "without, just sooner when alternatives fail deep in the graph")
+resolution_options.add_argument(
+    '--resolver-cache-size', type=int, metavar='MiB',
+    help="bound the memory the resolver's repository query caches hold "
+         "to roughly this many MiB, evicting the least recently used "
+         "packages' queries; by default they're never evicted")
+resolution_options.add_argument(
+    '--profile-resolver', metavar='PATH',
+    type=commandline.argparse.FileType('w'),
+    help="write a profile of the resolution to PATH: per atom wall time "
+         "and repository queries, cache hit rates, backtrack depths and "
+         "atom parse/version comparison counts")
+resolution_options.add_argument(
+    '--profile-resolver-format', choices=('json', 'stacks'), default='json',
+    help="format of --profile-resolver output; stacks is the folded "
+         "format flamegraph.pl consumes, weighted by microseconds")
 resolution_options.add_argument(
     '-O', '--nodeps', action='store_true',
     help='disable dependency resolution')
@@ -506,6 +528,10 @@ def main(options, out, err):
         extra_kwargs['resolver_cls'] = resolver.empty_tree_merge_plan
     if options.debug:
         extra_kwargs['debug'] = True
+    if options.speculative_jobs > 0:
+        extra_kwargs['speculative_jobs'] = options.speculative_jobs
+    if options.resolver_cache_size is not None:
+        extra_kwargs['cache_bytes'] = options.resolver_cache_size << 20
 
     # XXX: This should recurse on deep
     if options.newuse:
@@ -542,27 +568,43 @@ def main(options, out, err):
     else:
         vdb_time = 0.0
 
+    profiler = None
+    if options.profile_resolver is not None:
+        profiler = profiling.resolver_profiler(resolver_inst)
+        profiler.enable()
+
     failures = []
     resolve_time = time()
-    out.title('Resolving...')
-    out.write(out.bold, ' * ', out.reset, 'Resolving...')
-    ret = resolver_inst.add_atoms(atoms, finalize=True)
-    while ret:
-        out.error('resolution failed')
-        restrict = ret[0][0]
-        just_failures = reduce_to_failures(ret[1])
-        display_failures(out, just_failures, debug=options.debug)
-        failures.append(restrict)
-        if not options.ignore_failures:
-            break
-        out.write("restarting resolution")
-        atoms = [x for x in atoms if x != restrict]
-        resolver_inst.reset()
+    # the profile's wanted most when resolution blows up; always write it.
+    try:
+        out.title('Resolving...')
+        out.write(out.bold, ' * ', out.reset, 'Resolving...')
         ret = resolver_inst.add_atoms(atoms, finalize=True)
-    resolve_time = time() - resolve_time
+        while ret:
+            out.error('resolution failed')
+            restrict = ret[0][0]
+            just_failures = reduce_to_failures(ret[1])
+            display_failures(out, just_failures, debug=options.debug)
+            failures.append(restrict)
+            if not options.ignore_failures:
+                break
+            out.write("restarting resolution")
+            atoms = [x for x in atoms if x != restrict]
+            resolver_inst.reset()
+            ret = resolver_inst.add_atoms(atoms, finalize=True)
+    finally:
+        resolve_time = time() - resolve_time
+        if profiler is not None:
+            profiler.disable()
+            if options.profile_resolver_format == 'stacks':
+                profiler.write_stacks(options.profile_resolver)
+            else:
+                profiler.write_json(options.profile_resolver)
+            options.profile_resolver.close()
 
     if options.debug:
         out.write(out.bold, " * ", out.reset, "resolution took %.2f seconds" % resolve_time)
+        out.write(out.bold, " * ", out.reset, "USE cache: %s" % (domain.use_cache,))
 
     if failures:
         out.write()
@@ -0,0 +1,122 @@
+# License: GPL2/BSD
+
+import os
+
+from snakeoil.chksum import LazilyHashedPath
+from snakeoil.osutils import pjoin, ensure_dirs
+from snakeoil.test.mixins import TempDirMixin
+
+from pkgcore.cache import check, flat_hash, packed
+from pkgcore.ebuild import eclass_cache
+from pkgcore.operations.observer import null_output
+
+
+class FakeRepo(object):
+
+    extension = ".ebuild"
+
+    def __init__(self, location, versions, eclass_cache):
+        self.location = location
+        self.versions = versions
+        self.eclass_cache = eclass_cache
+
+
+class TestCheckCache(TempDirMixin):
+
+    keys = ("SLOT", "_eclasses_", "_mtime_")
+
+    def setUp(self):
+        TempDirMixin.setUp(self)
+        self.tree = pjoin(self.dir, "tree")
+        self.eclassdir = pjoin(self.tree, "eclass")
+        ensure_dirs(self.eclassdir)
+        for eclass in ("foo", "bar"):
+            self.touch(pjoin(self.eclassdir, "%s.eclass" % eclass), 100)
+        versions = {
+            ("dev-util", "diffball"): ("1.0", "1.1", "2.0"),
+            ("dev-lib", "fake"): ("1.0-r0",),
+            ("dev-lib", "old"): ("1",),
+        }
+        for (cat, pkg), vers in versions.iteritems():
+            for ver in vers:
+                self.touch(self.ebuild(cat, pkg, ver), 1000)
+        self.repo = FakeRepo(self.tree, versions,
+                             eclass_cache.cache(self.eclassdir))
+        self.cache = flat_hash.database(pjoin(self.dir, "cache"),
+            auxdbkeys=self.keys)
+
+        diffball = self.ebuild("dev-util", "diffball", "1.0")
+        self.add("dev-util/diffball-1.0", diffball, ["foo"])
+        self.add("dev-lib/fake-1.0", self.ebuild("dev-lib", "fake", "1.0-r0"),
+                 ["foo"])
+        # made stale below.
+        self.add("dev-util/diffball-1.1",
+                 self.ebuild("dev-util", "diffball", "1.1"), [])
+        self.add("dev-lib/old-1", self.ebuild("dev-lib", "old", "1"), ["bar"])
+        self.add("dev-util/gone-1", diffball, [])
+        with open(pjoin(self.cache.location, "dev-util",
+                        "diffball-2.0"), "w") as f:
+            f.write("garbage\n")
+        self.touch(self.ebuild("dev-util", "diffball", "1.1"), 2000)
+        self.touch(pjoin(self.eclassdir, "bar.eclass"), 200)
+        self.repo.eclass_cache = eclass_cache.cache(self.eclassdir)
+
+    def touch(self, path, mtime):
+        ensure_dirs(os.path.dirname(path))
+        open(path, "w").close()
+        os.utime(path, (mtime, mtime))
+
+    def ebuild(self, cat, pkg, ver):
+        return pjoin(self.tree, cat, pkg, "%s-%s.ebuild" % (pkg, ver))
+
+    def add(self, cpv, ebuild, eclasses):
+        self.cache[cpv] = {"SLOT": "0",
+            "_eclasses_": self.repo.eclass_cache.get_eclass_data(eclasses),
+            "_chf_": LazilyHashedPath(ebuild)}
+
+    def check(self, **kwds):
+        results = []
+        class observer(null_output):
+            def info(self, msg, *args, **kwds):
+                results.append(msg)
+        stats = check.check_cache(self.repo, self.cache, observer(), **kwds)
+        return stats, sorted(results)
+
+    def test_statuses(self):
+        for threads in (1, 3):
+            stats, reported = self.check(threads=threads)
+            self.assertEqual(dict((x, stats[x]) for x in check.statuses), {
+                check.VALID: 2, check.STALE_EBUILD: 1,
+                check.STALE_ECLASS: 1, check.ORPHANED: 1, check.CORRUPT: 1})
+            self.assertEqual(stats['entries'], 6)
+            self.assertEqual(stats['pruned'], 0)
+            self.assertEqual(reported, [
+                "dev-lib/old-1: stale (eclass)",
+                "dev-util/diffball-1.1: stale (ebuild)",
+                "dev-util/diffball-2.0: corrupt",
+                "dev-util/gone-1: orphaned"])
+
+    def test_prune(self):
+        stats, _ = self.check(prune=True)
+        self.assertEqual(stats['pruned'], 4)
+        self.assertEqual(sorted(self.cache.iterkeys()),
+            ["dev-lib/fake-1.0", "dev-util/diffball-1.0"])
+        self.assertTrue(stats['before'] > stats['after'])
+        stats, reported = self.check(prune=True)
+        self.assertEqual((stats[check.VALID], stats['pruned'], reported),
+            (2, 0, []))
+
+    def test_pack(self):
+        target = packed.database(pjoin(self.dir, "packed"),
+            auxdbkeys=self.keys)
+        stats, _ = self.check(target=target, threads=2)
+        self.assertEqual(stats['copied'], 2)
+        target = packed.database(pjoin(self.dir, "packed"),
+            auxdbkeys=self.keys)
+        self.assertEqual(sorted(target.iterkeys()),
+            ["dev-lib/fake-1.0", "dev-util/diffball-1.0"])
+        entry = target["dev-util/diffball-1.0"]
+        self.assertTrue(target.validate_entry(entry,
+            LazilyHashedPath(self.ebuild("dev-util", "diffball", "1.0")),
+            self.repo.eclass_cache))
+        self.assertEqual(sorted(entry["_eclasses_"]), ["foo"])
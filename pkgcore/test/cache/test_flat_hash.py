@@ -1,9 +1,13 @@
 # Copyright: 2006 Brian Harring <ferringb@gmail.com>
 # License: GPL2/BSD
 
+import os
+
+from snakeoil.test import mk_cpy_loadable_testcase
 from snakeoil.test.mixins import TempDirMixin
 
 from pkgcore.cache import flat_hash
+from pkgcore.test import TestCase
 from pkgcore.test.cache import util, test_base
 
 
@@ -24,3 +28,113 @@ class TestFlatHash(util.GenericCacheMixin, TempDirMixin):
     def get_db(self, readonly=False):
         return db(self.dir,
             auxdbkeys=self.cache_keys, readonly=readonly)
+
+
+    def test_prefetch(self):
+        db = self.get_db()
+        key, raw_data = self.test_data[0]
+        db[key] = dict(raw_data)
+        expected = db[key]
+        db.prefetch([key, "dev-util/missing-1", key])
+        self.assertEqual(len(db._prefetched), 2)
+        self.assertEqual(db[key], expected)
+        self.assertRaises(KeyError, db.__getitem__, "dev-util/missing-1")
+        self.assertFalse(db._prefetched)
+        # writes drop stale read ahead entries.
+        db.prefetch([key])
+        d = dict(raw_data)
+        d["SLOT"] = "1"
+        db[key] = d
+        self.assertEqual(db[key]["SLOT"], "1")
+        # past the limit, the oldest are dropped.
+        db.prefetch_limit = 2
+        db.prefetch(["dev-util/missing-1", "dev-util/missing-2"])
+        db.prefetch(["dev-util/missing-1", "dev-util/missing-3"])
+        self.assertEqual(list(db._prefetched),
+            ["dev-util/missing-1", "dev-util/missing-3"])
+
+    def test_prefetch_discard(self):
+        db = self.get_db()
+        key, raw_data = self.test_data[0]
+        db[key] = dict(raw_data)
+        discard = db.prefetch([key, "dev-util/missing-1"])
+        other = db.prefetch(["dev-util/missing-2"])
+        db[key]
+        discard()
+        # only what that prefetch queued, and was never requested, goes.
+        self.assertEqual(list(db._prefetched), ["dev-util/missing-2"])
+        other()
+        self.assertFalse(db._prefetched)
+
+    def test_prefetch_stale(self):
+        db = self.get_db()
+        key, raw_data = self.test_data[0]
+        db[key] = dict(raw_data)
+        db.prefetch([key])
+        entry = db._prefetched[key]
+        entry.fill(db, key)
+        # rewritten behind the cache's back, after the read ahead.
+        d = dict(raw_data)
+        d["SLOT"] = "2"
+        path = os.path.join(self.dir, key)
+        mtime = os.stat(path).st_mtime
+        db._prefetched.clear()
+        db[key] = d
+        os.utime(path, (mtime + 10, mtime + 10))
+        db._prefetched[key] = entry
+        self.assertEqual(db[key]["SLOT"], "2")
+
+
+class native_ParseEntryTest(TestCase):
+
+    parse_entry = staticmethod(flat_hash.native_parse_entry)
+
+    def parse(self, data, known=("SLOT", "DEPEND", "_eclasses_", "_mtime_"),
+              chf_type="mtime", splitter="\t",
+              eclass_chf_types=("eclassdir", "mtime")):
+        return self.parse_entry(data, frozenset(known), "_mtime_", chf_type,
+            splitter, eclass_chf_types)
+
+    def test_keys(self):
+        self.assertEqual(
+            self.parse("SLOT=0\n DEPEND=a=b \nUNKNOWN=1\n_mtime_=100.7\n"),
+            {"SLOT": "0", "DEPEND": "a=b", "_mtime_": 100L})
+        self.assertEqual(self.parse("_mtime_=1", chf_type=None),
+            {"_mtime_": "1"})
+        self.assertEqual(self.parse("_mtime_=ff\n", chf_type="md5"),
+            {"_mtime_": 255L})
+        self.assertRaises(KeyError, self.parse, "SLOT=0\n")
+        for bad in ("SLOT\n_mtime_=1\n", "SLOT=0\n\n_mtime_=1\n",
+                    "_mtime_=x\n"):
+            self.assertRaises(ValueError, self.parse, bad)
+
+    def test_eclasses(self):
+        self.assertEqual(
+            self.parse("_eclasses_=eutils\t/ec\t10\tflag-o\t/ec\t20.5\n"
+                       "_mtime_=1"),
+            {"_mtime_": 1L, "_eclasses_": [
+                ("eutils", (("eclassdir", "/ec"), ("mtime", 10L))),
+                ("flag-o", (("eclassdir", "/ec"), ("mtime", 20L)))]})
+        self.assertEqual(self.parse("_eclasses_= \n_mtime_=1")["_eclasses_"],
+            [])
+        self.assertEqual(self.parse("_eclasses_=a 1 b 2\n_mtime_=1",
+            splitter=" ", eclass_chf_types=("md5",))["_eclasses_"],
+            [("a", (("md5", 1L),)), ("b", (("md5", 2L),))])
+        self.assertEqual(self.parse("_eclasses_=a  b\n_mtime_=1",
+            splitter=" ", eclass_chf_types=())["_eclasses_"],
+            [("a", ()), ("", ()), ("b", ())])
+        for bad in ("eutils\t/ec", "eutils\t/ec\tx"):
+            self.assertRaises(ValueError, self.parse,
+                "_eclasses_=%s\n_mtime_=1" % (bad,))
+
+
+class cpy_ParseEntryTest(native_ParseEntryTest):
+
+    if flat_hash.parse_entry is flat_hash.native_parse_entry:
+        skip = "extension isn't available"
+    else:
+        parse_entry = staticmethod(flat_hash.parse_entry)
+
+
+test_cpy_used = mk_cpy_loadable_testcase('pkgcore.cache._flat_hash',
+    "pkgcore.cache.flat_hash", "parse_entry", "parse_entry")
@@ -0,0 +1,165 @@
+# License: GPL2/BSD
+
+import os
+
+from snakeoil.osutils import pjoin
+from snakeoil.test import mk_cpy_loadable_testcase
+from snakeoil.test.mixins import TempDirMixin
+
+from pkgcore.cache import errors, packed
+from pkgcore.test import TestCase
+from pkgcore.test.cache import util, test_base
+
+
+class db(packed.database):
+
+    def __setitem__(self, cpv, data):
+        data['_chf_'] = test_base._chf_obj
+        return packed.database.__setitem__(self, cpv, data)
+
+    def __getitem__(self, cpv):
+        d = dict(packed.database.__getitem__(self, cpv).iteritems())
+        d.pop('_%s_' % self.chf_type, None)
+        return d
+
+
+class TestPacked(util.GenericCacheMixin, TempDirMixin):
+
+    def get_db(self, readonly=False):
+        return db(self.dir,
+            auxdbkeys=self.cache_keys, readonly=readonly)
+
+    def test_commit(self):
+        d = self.get_db()
+        d["dev-util/diffball-0.7"] = {"SLOT": "0"}
+        d["dev-util/bsdiff-1.0"] = {"SLOT": "1"}
+        # queued updates are visible, but not to other instances.
+        self.assertEqual(d["dev-util/diffball-0.7"], {"SLOT": "0"})
+        self.assertNotIn("dev-util/diffball-0.7", self.get_db())
+        d.commit()
+        d2 = self.get_db()
+        self.assertEqual(sorted(d2.keys()),
+            ["dev-util/bsdiff-1.0", "dev-util/diffball-0.7"])
+        self.assertEqual(d2["dev-util/bsdiff-1.0"], {"SLOT": "1"})
+        self.assertRaises(KeyError, d2.__getitem__, "dev-util/foo-1")
+
+        del d2["dev-util/diffball-0.7"]
+        self.assertNotIn("dev-util/diffball-0.7", d2)
+        self.assertRaises(KeyError, d2.__delitem__, "dev-util/diffball-0.7")
+        d2["dev-util/bsdiff-1.0"] = {"SLOT": "2"}
+        self.assertEqual(list(d2), ["dev-util/bsdiff-1.0"])
+        d2.commit()
+        d3 = self.get_db()
+        self.assertEqual(list(d3), ["dev-util/bsdiff-1.0"])
+        self.assertEqual(d3["dev-util/bsdiff-1.0"], {"SLOT": "2"})
+        self.assertEqual(os.listdir(self.dir), [packed.database.filename])
+
+    def test_concurrent_writers(self):
+        d1, d2 = self.get_db(), self.get_db()
+        d1["dev-util/diffball-0.7"] = {"SLOT": "0"}
+        d1.commit()
+        self.assertIn("dev-util/diffball-0.7", d2)
+        d1["sys-apps/portage-2.2"] = {"SLOT": "0"}
+        d1.commit()
+        # d2 still sees the snapshot it mapped; its commit must not drop
+        # d1's newer entry.
+        self.assertNotIn("sys-apps/portage-2.2", d2)
+        d2["dev-util/bsdiff-1.0"] = {"SLOT": "1"}
+        d2.commit()
+        self.assertEqual(sorted(self.get_db().keys()),
+            ["dev-util/bsdiff-1.0", "dev-util/diffball-0.7",
+             "sys-apps/portage-2.2"])
+
+    def test_torn_append(self):
+        d = self.get_db()
+        d["dev-util/diffball-0.7"] = {"SLOT": "0"}
+        d.commit()
+        # simulate a writer dying after appending, before the header update.
+        with open(pjoin(self.dir, packed.database.filename), "ab") as f:
+            f.write("SLOT=garbage\ndev-util/diffball-0.7 0 100\n")
+        d = self.get_db()
+        self.assertEqual(d["dev-util/diffball-0.7"], {"SLOT": "0"})
+        d["dev-util/bsdiff-1.0"] = {"SLOT": "1"}
+        d.commit()
+        d = self.get_db()
+        self.assertEqual(d["dev-util/diffball-0.7"], {"SLOT": "0"})
+        self.assertEqual(d["dev-util/bsdiff-1.0"], {"SLOT": "1"})
+
+    def test_compaction(self):
+        path = pjoin(self.dir, packed.database.filename)
+        d = self.get_db()
+        d.compact_min = 0
+        d["dev-util/bsdiff-1.0"] = {"SLOT": "1"}
+        for x in xrange(50):
+            d["dev-util/diffball-0.7"] = {"SLOT": str(x)}
+            d.commit()
+        # superseded data never exceeds the live data.
+        self.assertTrue(os.stat(path).st_size < 300)
+        d = self.get_db()
+        self.assertEqual(d["dev-util/diffball-0.7"], {"SLOT": "49"})
+        self.assertEqual(d["dev-util/bsdiff-1.0"], {"SLOT": "1"})
+        self.assertEqual(os.listdir(self.dir), [packed.database.filename])
+
+    def test_forced_compaction(self):
+        path = pjoin(self.dir, packed.database.filename)
+        d = self.get_db()
+        # nothing written yet; nothing to compact.
+        d.commit(force=True)
+        self.assertEqual(os.listdir(self.dir), [])
+        for x in xrange(5):
+            d["dev-util/diffball-0.7"] = {"SLOT": str(x)}
+            d.commit()
+        size = os.stat(path).st_size
+        d.commit(force=True)
+        self.assertTrue(os.stat(path).st_size < size)
+        self.assertEqual(self.get_db()["dev-util/diffball-0.7"], {"SLOT": "4"})
+
+    def test_corruption(self):
+        with open(pjoin(self.dir, packed.database.filename), "wb") as f:
+            f.write("not a cache file at all, but long enough")
+        self.assertRaises(errors.GeneralCacheCorruption,
+            self.get_db().__contains__, "dev-util/diffball-0.7")
+
+
+class native_DecoderTest(TestCase):
+
+    parse_index = staticmethod(packed.native_parse_index)
+    decode_record = staticmethod(packed.native_decode_record)
+
+    def test_parse_index(self):
+        buf = "junk\ndev-util/diffball-0.7 32 10\n\nsys-apps/portage-2.2 42 0\n"
+        self.assertEqual(self.parse_index(buf, 5, len(buf) - 5),
+            {"dev-util/diffball-0.7": (32, 10),
+             "sys-apps/portage-2.2": (42, 0)})
+        self.assertEqual(self.parse_index(buf, 5, 0), {})
+        for bad in ("dev-util/foo 1\n", "dev-util/foo 1 x\n", " 1 2\n",
+                    "dev-util/foo 1 2 3\n"):
+            self.assertRaises(ValueError, self.parse_index, bad, 0, len(bad))
+
+    def test_decode_record(self):
+        buf = "SLOT=0\nIUSE=\nDEPEND=a=b\nUNKNOWN=1\n"
+        known = frozenset(["SLOT", "IUSE", "DEPEND"])
+        self.assertEqual(self.decode_record(buf, 0, len(buf), known),
+            [("SLOT", "0"), ("IUSE", ""), ("DEPEND", "a=b")])
+        # only the given range is decoded.
+        self.assertEqual(self.decode_record(buf, 7, 6, known), [("IUSE", "")])
+        self.assertRaises(ValueError, self.decode_record, "SLOT\n", 0, 5,
+            known)
+
+
+class cpy_DecoderTest(native_DecoderTest):
+
+    if packed.parse_index is packed.native_parse_index:
+        skip = "extension isn't available"
+    else:
+        parse_index = staticmethod(packed.parse_index)
+        decode_record = staticmethod(packed.decode_record)
+
+        def test_bounds(self):
+            self.assertRaises(ValueError, self.decode_record, "SLOT=0\n",
+                4, 10, frozenset())
+            self.assertRaises(ValueError, self.parse_index, "", -1, 0)
+
+
+test_cpy_used = mk_cpy_loadable_testcase('pkgcore.cache._packed',
+    "pkgcore.cache.packed", "parse_index", "parse_index")
@@ -0,0 +1,65 @@
+# License: GPL2/BSD
+
+from pkgcore.ebuild.columnar import MetadataColumns
+from pkgcore.test import TestCase
+
+
+class TestMetadataColumns(TestCase):
+
+    data = {
+        ("dev-util", "diffball"): {
+            "0.7": {"SLOT": "0", "KEYWORDS": "x86 ppc", "IUSE": "foo bar",
+                    "EAPI": "5", "DEPEND": "dev-libs/bar"},
+            "1.0": {"SLOT": "1/2", "KEYWORDS": "~x86", "IUSE": "foo"},
+            "1.1": {"SLOT": "1/2", "KEYWORDS": "~x86", "IUSE": "foo"},
+        },
+        ("dev-lib", "fake"): {
+            "1.0": {"SLOT": "0", "KEYWORDS": "x86 ppc", "IUSE": "bar foo"},
+        },
+    }
+
+    def setUp(self):
+        self.loaded = []
+        self.index = MetadataColumns(self._lookup)
+
+    def _lookup(self, cp):
+        self.loaded.append(cp)
+        return self.data.get(cp, {}).iteritems()
+
+    def test_lazy_load(self):
+        self.assertEqual(len(self.index), 0)
+        self.assertEqual(sorted(self.index.rows(("dev-lib", "fake"))), ["1.0"])
+        self.index.rows(("dev-lib", "fake"))
+        self.assertEqual(self.loaded, [("dev-lib", "fake")])
+        self.assertEqual(len(self.index), 1)
+        self.assertEqual(self.index.rows(("dev-util", "nonexistent")), {})
+        self.assertEqual(len(self.index), 1)
+
+    def test_dictionary_encoding(self):
+        codes = self.index.codes(("dev-util", "diffball"), "keywords")
+        self.assertEqual(codes["1.0"], codes["1.1"])
+        self.assertNotEqual(codes["0.7"], codes["1.0"])
+        other = self.index.codes(("dev-lib", "fake"), "keywords")
+        self.assertEqual(other["1.0"], codes["0.7"])
+        # iuse is a set; differing order is still a differing raw value.
+        iuse = self.index.codes(("dev-lib", "fake"), "iuse")["1.0"]
+        self.assertEqual(self.index.value("iuse", iuse),
+            frozenset(["foo", "bar"]))
+
+    def test_converters(self):
+        cp = ("dev-util", "diffball")
+        def values(attr):
+            return dict((ver, self.index.value(attr, code))
+                        for ver, code in self.index.codes(cp, attr).iteritems())
+        self.assertEqual(values("slot"), {"0.7": "0", "1.0": "1", "1.1": "1"})
+        self.assertEqual(values("subslot"),
+            {"0.7": "0", "1.0": "2", "1.1": "2"})
+        self.assertEqual(values("keywords")["0.7"], ("x86", "ppc"))
+        self.assertEqual(values("iuse")["1.0"], frozenset(["foo"]))
+
+    def test_raw(self):
+        cp = ("dev-util", "diffball")
+        self.assertEqual(self.index.raw(cp, "0.7", "DEPEND"), "dev-libs/bar")
+        self.assertEqual(self.index.raw(cp, "0.7", "EAPI"), "5")
+        self.assertEqual(self.index.raw(cp, "1.0", "DEPEND"), None)
+        self.assertRaises(KeyError, self.index.raw, cp, "2.0", "DEPEND")
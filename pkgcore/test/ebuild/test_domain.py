@@ -0,0 +1,53 @@
+# License: GPL2/BSD
+
+from pkgcore.ebuild import domain
+from pkgcore.ebuild.conditionals import DepSet
+from pkgcore.ebuild.cpv import versioned_CPV_cls
+from pkgcore.test import TestCase, malleable_obj
+from pkgcore.util.parserestrict import parse_match
+
+
+class fake_pkg(versioned_CPV_cls):
+
+    def __init__(self, cpv, keywords=(), license=""):
+        versioned_CPV_cls.__init__(self, cpv)
+        sf = object.__setattr__
+        sf(self, "keywords", tuple(keywords))
+        sf(self, "license", DepSet.parse(license, str))
+        sf(self, "repo", None)
+
+
+class TestVisibilityChecks(TestCase):
+
+    def setUp(self):
+        # the checks only need the domain's methods; skip configuring one.
+        self.domain = domain.domain.__new__(domain.domain)
+        self.domain.default_licenses_manager = malleable_obj(
+            groups={"FREE": ("GPL-2", "BSD")})
+
+    def test_license_filter(self):
+        # globs interleave with atoms; stacking order is what counts.
+        check = self.domain.make_license_filter(["-*"], [
+            (parse_match("*/*"), ("@FREE",)),
+            (parse_match("dev-util/*"), ("EULA",)),
+            (parse_match("dev-util/bsdiff"), ("-EULA",)),
+            (parse_match("sys-apps/*"), ("-BSD",)),
+        ])
+        self.assertTrue(check(fake_pkg("dev-util/diffball-1", license="EULA")))
+        self.assertFalse(check(fake_pkg("dev-util/bsdiff-1", license="EULA")))
+        self.assertTrue(check(fake_pkg("dev-util/bsdiff-1", license="BSD")))
+        self.assertFalse(check(fake_pkg("sys-apps/foo-1", license="BSD")))
+        self.assertTrue(check(fake_pkg("sys-apps/foo-1", license="GPL-2")))
+        self.assertFalse(check(fake_pkg("app-misc/bar-1", license="EULA")))
+
+    def test_keywords_filter(self):
+        check = self.domain.make_keywords_filter("x86", ["x86"],
+            [(parse_match("sys-apps/*"), ())],
+            [(parse_match("*/*"), ("-sparc",)),
+             (parse_match("dev-util/*"), ("x86",))])
+        # profile keywords apply by glob...
+        self.assertTrue(check(fake_pkg("dev-util/diffball-1", ["~amd64"])))
+        self.assertFalse(check(fake_pkg("sys-apps/foo-1", ["~amd64"])))
+        # ...as do the user's accept_keywords; empty means ~arch.
+        self.assertTrue(check(fake_pkg("sys-apps/foo-1", ["~x86"])))
+        self.assertFalse(check(fake_pkg("app-misc/bar-1", ["~x86"])))
@@ -40,6 +40,28 @@ class TestBase(TestCase):
         assertRebuildResults(True, 'eclass1', 100)
         assertRebuildResults(False, 'eclass1', 200)
 
+    def test_rebuild_eclass_entry_memoized(self):
+        ec = self.ec.eclasses
+        entry = tuple((x, (('mtime', ec[x].mtime),)) for x in sorted(ec))
+        got = self.ec.rebuild_cache_entry(entry)
+        self.assertEqual(got, ec)
+        # identical vectors share the verdict.
+        self.assertIdentical(got, self.ec.rebuild_cache_entry(list(entry)))
+        # unhashable vectors still validate.
+        self.assertEqual(got, self.ec.rebuild_cache_entry(
+            [(ec, list(chfs)) for ec, chfs in entry]))
+        self.assertIdentical(None, self.ec.rebuild_cache_entry(
+            (('eclass1', (('mtime', 101),)),)))
+        self.assertEqual(self.ec.rebuild_cache_entry((('eclass3', ()),)),
+                         {'eclass3': None})
+        self.assertEqual(self.ec.rebuild_cache_entry(()), {})
+
+    def test_eclass_ids(self):
+        ids = self.ec.eclass_ids
+        self.assertIdentical(ids, self.ec.eclass_ids)
+        self.assertEqual(sorted(ids), sorted(self.ec.eclasses))
+        self.assertEqual(sorted(ids.values()), range(len(ids)))
+
     def test_get_eclass_data(self):
         keys = self.ec.eclasses.keys()
         data = self.ec.get_eclass_data([])
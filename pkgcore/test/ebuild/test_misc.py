@@ -4,8 +4,10 @@
 from snakeoil.test import mk_cpy_loadable_testcase
 
 from pkgcore.ebuild import misc
+from pkgcore.ebuild.cpv import versioned_CPV
 from pkgcore.restrictions import packages
 from pkgcore.test import TestCase
+from pkgcore.util.parserestrict import parse_match
 
 AlwaysTrue = packages.AlwaysTrue
 AlwaysFalse = packages.AlwaysFalse
@@ -43,6 +45,21 @@ class test_collapsed_restrict_to_data(base):
             [(AlwaysTrue, ['x', 'y']), (AlwaysTrue, ['-x'])]),
             defaults=['y'])
 
+    def test_pull_frozen_data(self):
+        obj = self.kls([(AlwaysTrue, ['x'])],
+            [(parse_match("dev-util/*"), ['y']),
+             (parse_match("dev-util/diffball"), ['-x'])])
+        pkg1 = versioned_CPV("dev-util/bsdiff-1.0")
+        pkg2 = versioned_CPV("dev-util/bsdiff-2.0")
+        pkg3 = versioned_CPV("dev-util/diffball-1.0")
+        self.assertEqual(obj.pull_frozen_data(pkg1), frozenset(['x', 'y']))
+        self.assertIdentical(obj.pull_frozen_data(pkg2),
+            obj.pull_frozen_data(pkg1))
+        self.assertEqual(obj.pull_frozen_data(pkg3), frozenset(['y']))
+        self.assertEqual(obj.pull_frozen_data(pkg3), obj.pull_data(pkg3))
+        self.assertEqual(obj.pull_frozen_data(versioned_CPV("sys-apps/foo-1")),
+            frozenset(['x']))
+
 
 class test_incremental_license_expansion(TestCase):
 
@@ -52,36 +69,378 @@ class test_incremental_license_expansion(TestCase):
     test_it.todo = "implement this..."
 
 
+class test_compile_license_acceptance(TestCase):
+
+    groups = {"FREE": ("GPL-2", "BSD"), "OSI": ("BSD", "MIT")}
+
+    def assertAccepts(self, tokens, licenses):
+        accepts = misc.compile_license_acceptance(self.groups, tokens)
+        expected = misc.incremental_expansion_license(licenses, self.groups,
+            tokens).issuperset(licenses)
+        self.assertEqual(accepts(licenses), expected,
+            msg="%r against %r" % (tokens, licenses))
+
+    def test_it(self):
+        stacks = [
+            [], ["*"], ["-*"], ["GPL-2"], ["@FREE"], ["*", "-@FREE"],
+            ["*", "-GPL-2", "GPL-2"], ["*", "-@OSI", "MIT"],
+            ["@FREE", "-BSD"], ["@FREE", "-*", "MIT"], ["-*", "*", "-BSD"],
+            ["GPL-2", "*", "-*"], ["@NONEXISTENT", "MIT"],
+        ]
+        for tokens in stacks:
+            for licenses in (["GPL-2"], ["BSD"], ["MIT"], ["GPL-2", "MIT"],
+                             ["EULA"], []):
+                self.assertAccepts(tokens, licenses)
+
+    def test_errors(self):
+        for tokens in (["-"], ["-@"], ["@"]):
+            self.assertRaises(ValueError, misc.compile_license_acceptance,
+                self.groups, tokens)
+
+
 class test_native_incremental_expansion(TestCase):
     f = staticmethod(misc.native_incremental_expansion)
+    set_kls = set
 
     def test_it(self):
-        s = set("ab")
+        s = self.set_kls("ab")
         self.f(s, ("-a", "b", "-b", "-b", "c"))
         self.assertEqual(sorted(s), ["c"])
         self.assertRaises(ValueError,
-            self.f, set(), '-')
+            self.f, self.set_kls(), '-')
 
     def test_non_finalized(self):
-        s = set("ab")
+        s = self.set_kls("ab")
         self.f(s, ("-a", "b", "-b", "c", "c"),
             finalize=False)
         self.assertEqual(sorted(s), ["-a", "-b", "c"])
 
     def test_starred(self):
-        s = set('ab')
+        s = self.set_kls('ab')
         self.f(s, ('c', '-*', 'd'))
         self.assertEqual(sorted(s), ['d'])
+        s = self.set_kls('ab')
+        self.f(s, ('c', '-*', 'd'), finalize=False)
+        self.assertEqual(sorted(s), ['-*', 'd'])
+
+    def test_double_negation(self):
+        s = self.set_kls(['-a', 'a'])
+        self.f(s, ('--a',), finalize=False)
+        self.assertEqual(sorted(s), ['--a', 'a'])
+        self.f(s, ('-a',), finalize=False)
+        self.assertEqual(sorted(s), ['--a', '-a'])
 
 class test_CPY_incremental_expansion(test_native_incremental_expansion):
     if misc.incremental_expansion == misc.native_incremental_expansion:
         skip = "CPy extension not available"
     f = staticmethod(misc.incremental_expansion)
 
+class test_CPY_incremental_expansion_FlagSet(test_CPY_incremental_expansion):
+    set_kls = misc.FlagSet
+
+
+class test_native_incremental_expansion_layers(TestCase):
+    f = staticmethod(misc.native_incremental_expansion_layers)
+    set_kls = set
+
+    def test_it(self):
+        s = self.set_kls("ab")
+        self.assertIdentical(self.f(s, [("-a", "b"), (), ["-b", "c"]]), s)
+        self.assertEqual(sorted(s), ["c"])
+        s = self.set_kls()
+        self.f(s, [("a", "-b"), ("b", "-c")], finalize=False)
+        self.assertEqual(sorted(s), ["-c", "a", "b"])
+
+    def test_starred(self):
+        s = self.f(self.set_kls('ab'), [('c',), ('d', '-*', 'e'), ('f',)])
+        self.assertEqual(sorted(s), ['e', 'f'])
+        s = self.f(self.set_kls('ab'), [('c', '-*'), ('d', '-*'), ('e',)],
+            finalize=False)
+        self.assertEqual(sorted(s), ['-*', 'e'])
+
+    def test_errors(self):
+        # layers prior to a reset are still validated.
+        try:
+            self.f(self.set_kls(), [('a', '-'), ('-*',)], msg_prefix="foo: ")
+        except ValueError as e:
+            self.assertIn("foo: ", str(e))
+        else:
+            self.fail("no exception raised")
+
+class test_CPY_incremental_expansion_layers(
+        test_native_incremental_expansion_layers):
+    if misc.incremental_expansion == misc.native_incremental_expansion:
+        skip = "CPy extension not available"
+    f = staticmethod(misc.incremental_expansion_layers)
+
+    def test_types(self):
+        self.assertRaises(ValueError, self.f, set(), [('a', 1)])
+        self.assertRaises(TypeError, self.f, set(), [1])
+
+class test_CPY_incremental_expansion_layers_FlagSet(
+        test_CPY_incremental_expansion_layers):
+    set_kls = misc.FlagSet
+
+
+class test_native_FlagSet(TestCase):
+    kls = misc.native_FlagSet
+
+    def test_it(self):
+        s = self.kls(["a", "b"])
+        self.assertIn("a", s)
+        self.assertNotIn("c", s)
+        self.assertNotIn(1, s)
+        self.assertEqual(len(s), 2)
+        s.add("c")
+        s.discard("a")
+        s.discard("nonexistent")
+        self.assertEqual(sorted(s), ["b", "c"])
+        s.update(["d", "e"])
+        s.difference_update(["b", "e", "f"])
+        self.assertEqual(sorted(s), ["c", "d"])
+        self.assertEqual(s.to_frozenset(), frozenset(["c", "d"]))
+        s.clear()
+        self.assertFalse(s)
+        self.assertEqual(list(s), [])
+
+    def test_copy_eq(self):
+        s = self.kls(["a", "b"])
+        s2 = s.copy()
+        self.assertEqual(s, s2)
+        s2.add("c")
+        self.assertNotEqual(s, s2)
+        self.assertEqual(sorted(s), ["a", "b"])
+        s2.discard("c")
+        self.assertEqual(s, s2)
+        # set against set ops
+        s2.update(self.kls(["x%i" % x for x in xrange(200)]))
+        self.assertEqual(len(s2), 202)
+        s2.difference_update(self.kls(["x%i" % x for x in xrange(200)]))
+        self.assertEqual(s, s2)
+
+
+class test_CPY_FlagSet(test_native_FlagSet):
+    if misc.FlagSet is misc.native_FlagSet:
+        skip = "CPy extension not available"
+    else:
+        kls = misc.FlagSet
+
+        def test_unhashable(self):
+            self.assertRaises(TypeError, hash, self.kls())
+            self.assertRaises(TypeError, self.kls().add, 1)
+
 test_cpy_used = mk_cpy_loadable_testcase('pkgcore.ebuild._misc',
     "pkgcore.ebuild.misc", "incremental_expansion", "incremental_expansion")
 
 
+class fake_pkg(object):
+
+    def __init__(self, cpvstr, repo_id):
+        self._cpv = versioned_CPV(cpvstr)
+        self.repo = fake_repo(repo_id)
+
+    def __getattr__(self, attr):
+        return getattr(self._cpv, attr)
+
+
+class fake_repo(object):
+
+    def __init__(self, repo_id):
+        self.repo_id = repo_id
+
+
+class TestRestrictIndex(TestCase):
+
+    def test_it(self):
+        entries = [
+            (parse_match("dev-util/*"), "cat"),
+            (parse_match("*/diffball"), "pkg"),
+            (parse_match("dev-*/*"), "cat_glob"),
+            (parse_match("*/diff*"), "pkg_glob"),
+            (parse_match("dev-util/diffball"), "cp"),
+            (parse_match("*::gentoo"), "residual"),
+            (AlwaysFalse, "never"),
+            (parse_match("=dev-util/diffball-0.7"), "versioned"),
+            (parse_match("sys-apps/portage"), "other"),
+        ]
+        index = misc.RestrictIndex(entries)
+        self.assertEqual(len(index), len(entries))
+
+        def matches(cpvstr, repo_id="gentoo"):
+            pkg = fake_pkg(cpvstr, repo_id)
+            return [data for r, data in index.iter_match(pkg)]
+
+        self.assertEqual(matches("dev-util/diffball-0.7"),
+            ["cat", "pkg", "cat_glob", "pkg_glob", "cp", "residual",
+             "versioned"])
+        self.assertEqual(matches("dev-util/diffball-1.0", "foo"),
+            ["cat", "pkg", "cat_glob", "pkg_glob", "cp"])
+        self.assertEqual(matches("dev-libs/diffutils-1.0", "foo"),
+            ["cat_glob", "pkg_glob"])
+        self.assertEqual(matches("sys-apps/portage-2.2"),
+            ["residual", "other"])
+        self.assertFalse(misc.RestrictIndex())
+
+
+class TestChunkedDataDict(TestCase):
+
+    def chunk(self, restrict, flags):
+        neg = [x[1:] for x in flags.split() if x[0] == "-"]
+        pos = [x for x in flags.split() if x[0] != "-"]
+        return misc.chunked_data(parse_match(restrict), neg, pos)
+
+    def test_render_pkg(self):
+        d = misc.ChunkedDataDict()
+        d.add_bare_global((), ("a", "b"))
+        d.update_from_stream([
+            self.chunk("dev-util/*", "c -a"),
+            self.chunk("dev-util/diffball", "-c d"),
+            self.chunk("*/diff*", "e -d"),
+            self.chunk("=dev-util/diffball-0.7", "a"),
+            self.chunk("*::gentoo", "f"),
+        ])
+        def render(cpvstr, repo_id="gentoo", d=d):
+            pkg = fake_pkg(cpvstr, repo_id)
+            rendered = sorted(d.render_pkg(pkg))
+            # same as trying every entry of the stack in turn.
+            items = d._dict.get(pkg.key)
+            if items is None:
+                items = d._global_settings
+            linear = set()
+            misc.incremental_chunked(linear,
+                (x for x in items if x.key.match(pkg)))
+            self.assertEqual(rendered, sorted(linear))
+            return rendered
+        # globs and the key's own atoms stack in the order given.
+        self.assertEqual(render("dev-util/diffball-0.7"),
+            ["a", "b", "e", "f"])
+        self.assertEqual(render("dev-util/diffball-1.0", "foo"),
+            ["b", "e"])
+        self.assertEqual(render("dev-util/bsdiff-1.0"), ["b", "c", "f"])
+        self.assertEqual(render("dev-libs/diffutils-1.0", "foo"),
+            ["a", "b", "e"])
+        self.assertEqual(render("sys-apps/portage-2.2", "foo"), ["a", "b"])
+        # modifications drop what was indexed.
+        d.add_bare_global(("b",), ())
+        d.update_from_stream([self.chunk("dev-util/diffball", "g")])
+        self.assertIn("g", render("dev-util/diffball-1.0", "foo"))
+        self.assertEqual(render("sys-apps/portage-2.2", "foo"), ["a"])
+        c = d.clone(unfreeze=True)
+        c.add_bare_global((), ("h",))
+        self.assertEqual(render("sys-apps/portage-2.2", "foo", c), ["a", "h"])
+        self.assertEqual(render("sys-apps/portage-2.2", "foo"), ["a"])
+        d.freeze()
+        d.optimize()
+        for cpvstr in ("dev-util/diffball-0.7", "dev-util/bsdiff-1.0",
+                       "dev-libs/diffutils-1.0"):
+            render(cpvstr)
+
+
+class TestPackageUseCache(TestCase):
+
+    def test_it(self):
+        calls = []
+        def render(pkg):
+            calls.append(pkg)
+            return frozenset([pkg.cpvstr])
+
+        class repo(object):
+            repo_id = 'gentoo'
+        class pkg(object):
+            cpvstr = 'dev-util/diffball-0.7'
+            slot = '0'
+            repo = None
+
+        c = misc.PackageUseCache()
+        self.assertEqual(c.hit_rate, 0.0)
+        key = c.key(pkg, True)
+        self.assertEqual(key, ('dev-util/diffball-0.7', '0', None, True))
+        pkg.repo = repo
+        key = c.key(pkg, True)
+        self.assertEqual(key, ('dev-util/diffball-0.7', '0', 'gentoo', True))
+        val = c.get(key, render, pkg)
+        self.assertIdentical(c.get(key, render, pkg), val)
+        self.assertEqual(calls, [pkg])
+        self.assertEqual((c.hits, c.misses, len(c)), (1, 1, 1))
+        self.assertEqual(c.hit_rate, 0.5)
+        self.assertIn("50.0% hit rate", str(c))
+        c.get(c.key(pkg, False), render, pkg)
+        self.assertEqual(len(calls), 2)
+        c.invalidate()
+        self.assertEqual(len(c), 0)
+        c.get(key, render, pkg)
+        self.assertEqual(len(calls), 3)
+
+
+class test_native_VisibilityFilter(TestCase):
+    kls = staticmethod(misc.native_VisibilityFilter)
+
+    def test_it(self):
+        calls = []
+        def check(name, result):
+            def f(pkg):
+                calls.append((name, pkg.cpvstr))
+                return result(pkg)
+            return f
+
+        f = self.kls([
+            check("mask", lambda pkg: pkg.package != "masked"),
+            check("keywords", lambda pkg: pkg.version != "0.7"),
+        ])
+        self.assertEqual(len(f.checks), 2)
+        pkg = versioned_CPV("dev-util/diffball-1.0")
+        self.assertIdentical(f.match(pkg), True)
+        self.assertIdentical(f.match(pkg), True)
+        self.assertEqual(calls, [("mask", pkg.cpvstr), ("keywords", pkg.cpvstr)])
+        # short-circuits on the first failure.
+        del calls[:]
+        self.assertIdentical(
+            f.match(versioned_CPV("dev-util/masked-1.0")), False)
+        self.assertEqual([x[0] for x in calls], ["mask"])
+        self.assertIdentical(
+            f.match(versioned_CPV("dev-util/diffball-0.7")), False)
+        self.assertEqual(len(f.verdicts), 3)
+        del calls[:]
+        f.invalidate()
+        self.assertEqual(len(f.verdicts), 0)
+        f.match(pkg)
+        self.assertEqual(len(calls), 2)
+
+    def test_uncacheable(self):
+        class pkg(object):
+            package = "foo"
+        f = self.kls([lambda pkg: pkg.package == "foo"])
+        self.assertTrue(f.match(pkg))
+        self.assertEqual(len(f.verdicts), 0)
+
+    def test_errors(self):
+        def check(pkg):
+            raise KeyError(pkg)
+        f = self.kls([check])
+        self.assertRaises(KeyError, f.match,
+            versioned_CPV("dev-util/diffball-1.0"))
+        self.assertEqual(len(f.verdicts), 0)
+
+
+class test_CPY_VisibilityFilter(test_native_VisibilityFilter):
+    if misc.VisibilityFilter_base is misc.native_VisibilityFilter:
+        skip = "CPy extension not available"
+    else:
+        kls = staticmethod(misc.VisibilityFilter_base)
+
+
+class test_VisibilityFilter(test_native_VisibilityFilter):
+    kls = staticmethod(misc.VisibilityFilter)
+
+    def test_restriction(self):
+        f = self.kls([lambda pkg: pkg.package == "diffball"])
+        self.assertTrue(f)
+        pkg = versioned_CPV("dev-util/diffball-1.0")
+        self.assertTrue(f.force_True(pkg))
+        self.assertFalse(f.force_False(pkg))
+        self.assertNotIdentical(f, self.kls(f.checks))
+
+
 class TestIncrementalsDict(TestCase):
     kls = misc.IncrementalsDict
 
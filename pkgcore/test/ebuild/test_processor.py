@@ -0,0 +1,144 @@
+# License: GPL2/BSD
+
+import os
+import subprocess
+
+from snakeoil.osutils import pjoin
+from snakeoil.test import mk_cpy_loadable_testcase
+from snakeoil.test.mixins import TempDirMixin
+
+from pkgcore import const
+from pkgcore.ebuild import eclass_cache, processor
+from pkgcore.test import TestCase
+
+
+class native_FramingTest(TestCase):
+
+    encode_env = staticmethod(processor.native_encode_env)
+    decode_keys = staticmethod(processor.native_decode_keys)
+
+    def test_encode_env(self):
+        self.assertEqual(self.encode_env({}, frozenset()), "export ")
+        for env, expected in (
+                ({"P": "foo1"}, "export P=foo1"),
+                ({"D": "a b"}, "export D='a b'"),
+                ({"E": "it's"}, "export E=$'it\\'s'"),
+                ({"F": ""}, "export F=''"),
+                ({"U": u"x y"}, "export U='x y'"),
+                ({"SKIP": "1"}, "export "),
+                ):
+            self.assertEqual(self.encode_env(env, frozenset(["SKIP"])),
+                expected)
+        env = {"A": "1", "B": "x y", "C": "z'"}
+        self.assertEqual(self.encode_env(env, frozenset()),
+            processor.native_encode_env(env, frozenset()))
+        self.assertRaises(KeyError, self.encode_env, {"1A": "x"}, frozenset())
+        self.assertRaises(ValueError, self.encode_env, {"A": 1}, frozenset())
+
+    def test_decode_keys(self):
+        self.assertEqual(self.decode_keys(""), {})
+        self.assertEqual(
+            self.decode_keys("EAPI=5\nDEPEND=a =b\n\nIUSE=\nSLOT=0"),
+            {"EAPI": "5", "DEPEND": "a =b", "IUSE": "", "SLOT": "0"})
+        self.assertRaises(ValueError, self.decode_keys, "EAPI=5\nSLOT\n")
+
+
+class cpy_FramingTest(native_FramingTest):
+
+    if processor.encode_env is processor.native_encode_env:
+        skip = "extension isn't available"
+    else:
+        encode_env = staticmethod(processor.encode_env)
+        decode_keys = staticmethod(processor.decode_keys)
+
+
+class TestFrames(TestCase):
+
+    def test_roundtrip(self):
+        ebp = object.__new__(processor.EbuildProcessor)
+        rfd, wfd = os.pipe()
+        ebp.ebd_write = os.fdopen(wfd, "w")
+        ebp.ebd_read = os.fdopen(rfd, "r")
+        try:
+            ebp.write_frame("keys", "EAPI=5\nSLOT=0\n")
+            ebp.write("trailing")
+            command, size = ebp.read().split()
+            self.assertEqual(command, "keys")
+            self.assertEqual(ebp.read_frame(size), "EAPI=5\nSLOT=0\n")
+            self.assertEqual(ebp.read(), "trailing\n")
+            for bad in (None, "", "x"):
+                self.assertRaises(processor.InternalError, ebp.read_frame, bad)
+        finally:
+            ebp.ebd_write.close()
+            ebp.ebd_read.close()
+
+
+class TestEclassBundle(TempDirMixin):
+
+    def setUp(self):
+        TempDirMixin.setUp(self)
+        processor.remove_eclass_bundles()
+
+    def tearDown(self):
+        processor.remove_eclass_bundles()
+        TempDirMixin.tearDown(self)
+
+    def write_eclass(self, name, text):
+        with open(pjoin(self.dir, name + ".eclass"), "w") as f:
+            f.write(text)
+
+    def source(self, bundle, commands):
+        p = subprocess.Popen(
+            [const.BASH_BINARY, "-c", "declare -A PKGCORE_PRELOADED_ECLASSES;"
+             'source "$1"; %s' % commands, "bash", bundle.path],
+            stdout=subprocess.PIPE)
+        return p.communicate()[0]
+
+    def test_it(self):
+        self.write_eclass("foo", "FOO='foo value'\n")
+        self.write_eclass("bar", "BAR=bar")
+        self.write_eclass("copy", "FOO='foo value'\n")
+        ec = eclass_cache.cache(self.dir)
+        bundle = processor.get_eclass_bundle(ec)
+        self.assertEqual(sorted(bundle.index), ["bar", "copy", "foo"])
+        self.assertEqual(bundle.index["foo"][0], pjoin(self.dir, "foo.eclass"))
+        # identical content shares a function.
+        self.assertEqual(bundle.index["foo"][1], bundle.index["copy"][1])
+        self.assertNotEqual(bundle.index["foo"][1], bundle.index["bar"][1])
+        self.assertEqual(os.stat(bundle.path).st_mode & 0777, 0644)
+        self.assertEqual(
+            self.source(bundle, '${PKGCORE_PRELOADED_ECLASSES[foo]}; '
+                        '${PKGCORE_PRELOADED_ECLASSES[bar]}; echo "$FOO:$BAR"'),
+            "foo value:bar\n")
+
+        # reused as long as the content is unchanged, even across caches.
+        self.assertIdentical(processor.get_eclass_bundle(ec), bundle)
+        self.assertIdentical(
+            processor.get_eclass_bundle(eclass_cache.cache(self.dir)), bundle)
+
+        self.write_eclass("bar", "BAR=changed")
+        os.utime(pjoin(self.dir, "bar.eclass"), (1, 1))
+        bundle2 = processor.get_eclass_bundle(eclass_cache.cache(self.dir))
+        self.assertNotEqual(bundle2.key, bundle.key)
+        self.assertEqual(bundle2.index["foo"], bundle.index["foo"])
+
+        processor.remove_eclass_bundles()
+        self.assertFalse(os.path.exists(bundle.path))
+        self.assertFalse(os.path.exists(bundle2.path))
+
+    def test_broken_eclass(self):
+        self.write_eclass("good", "GOOD=1")
+        self.write_eclass("broken", "if true; then\n")
+        bundle = processor.get_eclass_bundle(eclass_cache.cache(self.dir))
+        self.assertEqual(list(bundle.index), ["good"])
+        self.assertEqual(
+            self.source(bundle, '${PKGCORE_PRELOADED_ECLASSES[good]}; '
+                        'echo "$GOOD"'), "1\n")
+
+    def test_empty(self):
+        self.assertIdentical(
+            processor.get_eclass_bundle(eclass_cache.cache(self.dir)), None)
+
+
+test_cpy_used = mk_cpy_loadable_testcase('pkgcore.ebuild._processor',
+    "pkgcore.ebuild.processor", "encode_env", "encode_env")
@@ -0,0 +1,270 @@
+# License: GPL2/BSD
+
+import os
+
+from snakeoil.osutils import pjoin
+from snakeoil.test.mixins import TempDirMixin
+
+from pkgcore.operations import regen
+
+
+class collecting_observer(object):
+
+    def __init__(self):
+        self.errors, self.infos = [], []
+
+    def error(self, msg):
+        self.errors.append(msg)
+
+    def info(self, msg):
+        self.infos.append(msg)
+
+
+class TestRegenParallel(TempDirMixin):
+
+    def test_it(self):
+        log_dir = self.dir
+
+        class helper(object):
+            def __init__(self):
+                self.f = open(pjoin(log_dir, "log.%i" % os.getpid()), "w")
+
+            def __call__(self, pkg):
+                if pkg % 10 == 3:
+                    raise ValueError("bad pkg")
+                self.f.write("%i\n" % pkg)
+
+            def finish(self):
+                self.f.write("finished\n")
+                self.f.close()
+
+        def flush():
+            with open(pjoin(log_dir, "log.%i" % os.getpid()), "a") as f:
+                f.write("flushed\n")
+
+        observer = collecting_observer()
+        stats = regen.regen_parallel(range(100), helper, observer, 3,
+            flush=flush)
+        self.assertEqual(len(stats), 3)
+        self.assertEqual(sum(x[0] for x in stats), 100)
+        self.assertEqual(sum(x[1] for x in stats), 10)
+        self.assertEqual(len(observer.errors), 10)
+        self.assertEqual(len(observer.infos), 3)
+
+        seen = []
+        logs = os.listdir(log_dir)
+        self.assertEqual(len(logs), 3)
+        for log in logs:
+            with open(pjoin(log_dir, log)) as f:
+                lines = f.read().split()
+            # the helper finishes, then the worker flushes.
+            self.assertEqual(lines[-2:], ["finished", "flushed"])
+            seen.extend(int(x) for x in lines[:-2])
+        self.assertEqual(sorted(seen), [x for x in range(100) if x % 10 != 3])
+
+    def test_fewer_pkgs_than_workers(self):
+        observer = collecting_observer()
+        stats = regen.regen_parallel([1], lambda: str, observer, 4)
+        self.assertEqual(stats, [(1, 0, stats[0][2])])
+        self.assertEqual(observer.errors, [])
+
+
+class TestStatEbuilds(TempDirMixin):
+
+    def test_it(self):
+        paths = [pjoin(self.dir, "%i.ebuild" % x) for x in xrange(20)]
+        for path in paths[:-1]:
+            with open(path, "w") as f:
+                f.write(path)
+        for threads in (1, 4):
+            stats = regen.stat_ebuilds(paths, threads)
+            self.assertEqual(sorted(stats), sorted(paths))
+            self.assertEqual(stats[paths[-1]], None)
+            st = os.stat(paths[0])
+            self.assertEqual(stats[paths[0]], (st.st_mtime, st.st_size))
+
+
+class TestChangeIndex(TempDirMixin):
+
+    eclasses = {"eutils": ("/ec/eutils.eclass", 1),
+                "multilib": ("/ec/multilib.eclass", 2)}
+
+    def mk_index(self):
+        return regen.ChangeIndex(pjoin(self.dir, "index"))
+
+    def test_it(self):
+        index = self.mk_index()
+        stats = {"/a.ebuild": (1.5, 10), "/b.ebuild": (2.0, 20),
+                 "/c.ebuild": (3.0, 30)}
+        self.assertEqual(index.changed(stats, self.eclasses), set(stats))
+        index.update(stats, self.eclasses,
+                     {"/a.ebuild": ("eutils",),
+                      "/b.ebuild": ("multilib", "eutils")})
+        # c failed to regenerate, thus isn't recorded.
+        self.assertEqual(index.changed(stats, self.eclasses), set(["/c.ebuild"]))
+        index.save()
+
+        index = self.mk_index()
+        self.assertEqual(index.eclasses, self.eclasses)
+        self.assertEqual(index.ebuilds["/b.ebuild"],
+                         ((2.0, 20), ("eutils", "multilib")))
+        self.assertEqual(index.eclass_users(),
+                         {"eutils": set(["/a.ebuild", "/b.ebuild"]),
+                          "multilib": set(["/b.ebuild"])})
+        self.assertEqual(index.changed(stats, self.eclasses), set(["/c.ebuild"]))
+
+        # ebuild changes.
+        stats["/a.ebuild"] = (1.5, 11)
+        self.assertEqual(index.changed(stats, self.eclasses),
+                         set(["/a.ebuild", "/c.ebuild"]))
+        stats["/a.ebuild"] = (1.5, 10)
+
+        # eclass changes hit their users, whether modified or shadowed.
+        eclasses = dict(self.eclasses, multilib=("/ec/multilib.eclass", 3))
+        self.assertEqual(index.changed(stats, eclasses),
+                         set(["/b.ebuild", "/c.ebuild"]))
+        eclasses = dict(self.eclasses, eutils=("/overlay/eutils.eclass", 1))
+        self.assertEqual(index.changed(stats, eclasses), set(stats))
+        del eclasses["eutils"]
+        self.assertEqual(index.changed(stats, eclasses), set(stats))
+
+        # lost cache entries, checked only for otherwise clean ebuilds.
+        checked = []
+        def uncached(paths):
+            paths = sorted(paths)
+            checked.extend(paths)
+            return paths[:1]
+        self.assertEqual(index.changed(stats, self.eclasses, uncached),
+                         set(["/a.ebuild", "/c.ebuild"]))
+        self.assertEqual(checked, ["/a.ebuild", "/b.ebuild"])
+
+        # vanished ebuilds are dropped.
+        stats["/b.ebuild"] = None
+        index.update(stats, self.eclasses, {})
+        self.assertEqual(sorted(index.ebuilds), ["/a.ebuild"])
+
+    def test_bad_files(self):
+        path = pjoin(self.dir, "index")
+        for data in ("", "some other format\n",
+                     regen.ChangeIndex.header + "\nebuild\t/a.ebuild\tx\n",
+                     regen.ChangeIndex.header + "\nspork\t/a.ebuild\n"):
+            with open(path, "w") as f:
+                f.write(data)
+            index = self.mk_index()
+            self.assertEqual((index.ebuilds, index.eclasses), ({}, {}))
+
+
+class fake_pkg(object):
+
+    def __init__(self, path):
+        self.path = path
+        self.cpvstr = "cat/" + os.path.basename(path)
+
+    def __str__(self):
+        return self.path
+
+
+class fake_eclass(object):
+
+    def __init__(self, path, mtime):
+        self.path, self.mtime = path, mtime
+
+
+class TestIncrementalRegen(TempDirMixin):
+
+    def setUp(self):
+        TempDirMixin.setUp(self)
+        self.log = pjoin(self.dir, "log")
+        self.pkgs = []
+        for x in xrange(10):
+            path = pjoin(self.dir, "%i.ebuild" % x)
+            with open(path, "w") as f:
+                f.write("eutils" if x % 2 else "")
+            self.pkgs.append(fake_pkg(path))
+
+    def mk_repo(self):
+        log = self.log
+        cache = self.cache = pjoin(self.dir, "cache")
+        if not os.path.exists(cache):
+            os.mkdir(cache)
+
+        class mock_ecache(object):
+            eclasses = {"eutils": fake_eclass("/ec/eutils.eclass", 1)}
+
+        class mock_factory(object):
+            # on disk; threaded regen writes from forked workers.
+            @staticmethod
+            def _get_cached_metadata(cpvstr, ebuild_path, prune=True):
+                path = pjoin(cache, os.path.basename(cpvstr))
+                if not os.path.exists(path):
+                    return None
+                with open(path) as f:
+                    return f.read()
+
+        class repo(list):
+            eclass_cache = mock_ecache
+            package_class = mock_factory
+
+            def _regen_operation_helper(self, **options):
+                def helper(pkg):
+                    with open(log, "a") as f:
+                        f.write(pkg.path + "\n")
+                    with open(pkg.path) as f:
+                        inherits = f.read().split()
+                    if "broken" in inherits:
+                        raise ValueError("broken")
+                    with open(pjoin(cache, os.path.basename(pkg.path)),
+                              "w") as f:
+                        f.write(" ".join(inherits))
+                    return {"_eclasses_": dict.fromkeys(inherits)}
+                return helper
+
+        return repo(self.pkgs)
+
+    def regen(self, repo, threads=1, **kwds):
+        if os.path.exists(self.log):
+            os.unlink(self.log)
+        observer = collecting_observer()
+        regen.regen_repository(repo, observer, threads=threads,
+            index=pjoin(self.dir, "index"), eclass_caching=False, **kwds)
+        if not os.path.exists(self.log):
+            return []
+        with open(self.log) as f:
+            return sorted(os.path.basename(x) for x in f.read().split())
+
+    def test_it(self):
+        for threads in (1, 2):
+            repo = self.mk_repo()
+            self.assertEqual(len(self.regen(repo, threads)), 10)
+            self.assertEqual(self.regen(repo, threads), [])
+
+            # ebuild changes.
+            with open(self.pkgs[0].path, "w") as f:
+                f.write("eutils ")
+            self.assertEqual(self.regen(repo, threads), ["0.ebuild"])
+
+            # eclass changes.
+            repo.eclass_cache.eclasses["eutils"].mtime += 1
+            self.assertEqual(self.regen(repo, threads),
+                             ["0.ebuild", "1.ebuild", "3.ebuild", "5.ebuild",
+                              "7.ebuild", "9.ebuild"])
+
+            # failures are retried.
+            with open(self.pkgs[2].path, "w") as f:
+                f.write("broken")
+            self.assertEqual(self.regen(repo, threads), ["2.ebuild"])
+            self.assertEqual(self.regen(repo, threads), ["2.ebuild"])
+            with open(self.pkgs[2].path, "w") as f:
+                f.write("")
+            self.assertEqual(self.regen(repo, threads), ["2.ebuild"])
+
+            # force regenerates everything.
+            self.assertEqual(len(self.regen(repo, threads, force=True)), 10)
+            self.assertEqual(self.regen(repo, threads), [])
+
+            # cache entries lost for unchanged ebuilds are restored.
+            os.unlink(pjoin(self.cache, "4.ebuild"))
+            self.assertEqual(self.regen(repo, threads), ["4.ebuild"])
+            self.assertTrue(os.path.exists(pjoin(self.cache, "4.ebuild")))
+            self.assertEqual(self.regen(repo, threads), [])
+            os.unlink(pjoin(self.dir, "index"))
@@ -0,0 +1,79 @@
+# License: GPL2/BSD
+
+import sys
+
+from pkgcore.ebuild.atom import atom
+from pkgcore.repository import misc
+from pkgcore.repository.util import SimpleTree
+from pkgcore.test import TestCase
+
+
+class TestBoundedCachingRepo(TestCase):
+
+    def setUp(self):
+        self.repo = SimpleTree({
+            "dev-util": {"diffball": ["1.0", "0.7"]},
+            "dev-lib": {"fake": ["1.0", "1.0-r1"], "bsdiff": ["1.0"]}})
+        self.cache = misc.bounded_caching_repo(self.repo, sorted, 250,
+            weigher=lambda pkg: 100)
+        self.cache.query_overhead = 0
+
+    def test_hits(self):
+        a = atom("dev-util/diffball")
+        v = self.cache.match(a)
+        self.assertEqual(sorted(x.cpvstr for x in v),
+            ["dev-util/diffball-0.7", "dev-util/diffball-1.0"])
+        self.assertIdentical(v, self.cache.match(a))
+        self.assertEqual(list(v), list(self.cache.itermatch(a)))
+        self.assertEqual(self.cache.stats,
+            {'hits': 2, 'misses': 1, 'evictions': 0, 'bytes': 200})
+
+    def test_eviction(self):
+        diffball, fake = atom("dev-util/diffball"), atom("dev-lib/fake")
+        v = self.cache.match(diffball)
+        self.assertEqual(self.cache.stats['bytes'], 0)
+        # results are weighed as they're pulled.
+        iter(v).next()
+        self.assertEqual(self.cache.stats['bytes'], 100)
+        list(v)
+        list(self.cache.match(fake))
+        # over the limit; eviction waits for the next miss.
+        self.assertEqual(self.cache.stats['bytes'], 400)
+        self.cache.match(diffball)
+        self.cache.match(atom("dev-lib/bsdiff"))
+        # fake is least recently used.
+        self.assertEqual(self.cache.stats,
+            {'hits': 1, 'misses': 3, 'evictions': 1, 'bytes': 200})
+        self.cache.match(diffball)
+        self.assertEqual(self.cache.stats['hits'], 2)
+        self.cache.match(fake)
+        self.assertEqual(self.cache.stats['misses'], 4)
+        self.cache.clear()
+        self.assertEqual(self.cache.stats['bytes'], 0)
+        self.cache.match(diffball)
+        self.assertEqual(self.cache.stats['misses'], 5)
+
+    def test_shards(self):
+        # queries for the same key are evicted together.
+        self.cache.max_bytes = 0
+        versioned = atom("=dev-util/diffball-1.0")
+        list(self.cache.match(versioned))
+        list(self.cache.match(atom("dev-util/diffball")))
+        self.cache.match(atom("dev-lib/fake"))
+        self.assertEqual(self.cache.stats['evictions'], 2)
+        self.cache.match(versioned)
+        self.assertEqual(self.cache.stats['hits'], 0)
+
+
+class Test_estimate_bytes(TestCase):
+
+    def test_it(self):
+        class kls(object):
+            __slots__ = ("a", "b", "__dict__")
+            def __getattr__(self, attr):
+                raise AssertionError("triggered %s" % attr)
+        o = kls()
+        o.a = ["x" * 100]
+        o.c = "y" * 1000
+        size = misc.estimate_bytes(o)
+        self.assertTrue(size >= sys.getsizeof(o) + 1100, size)
@@ -0,0 +1,212 @@
+# License: GPL2/BSD
+
+from pkgcore.ebuild.atom import atom
+from pkgcore.ebuild.columnar import MetadataColumns
+from pkgcore.ebuild.cpv import versioned_CPV
+from pkgcore.ebuild.restricts import SlotDep
+from pkgcore.repository import planner
+from pkgcore.repository.util import SimpleTree
+from pkgcore.restrictions import packages, values, boolean, restriction
+from pkgcore.test import TestCase
+
+
+class CountingTree(SimpleTree):
+
+    """SimpleTree tracking every package instantiated"""
+
+    def __init__(self, *args, **kwargs):
+        SimpleTree.__init__(self, *args, **kwargs)
+        self.instantiated = []
+        self.package_class = self._make_pkg
+
+    def _make_pkg(self, *args):
+        pkg = versioned_CPV(*args)
+        self.instantiated.append(pkg.cpvstr)
+        return pkg
+
+
+def cat_r(cat, **kwds):
+    return packages.PackageRestriction("category",
+        values.StrExactMatch(cat), **kwds)
+
+def pkg_r(pkg, **kwds):
+    return packages.PackageRestriction("package",
+        values.StrExactMatch(pkg), **kwds)
+
+
+class TestPlanner(TestCase):
+
+    def setUp(self):
+        self.repo = CountingTree({
+            "dev-util": {"diffball": ["1.0", "0.7", "1.2-r1"],
+                         "bsdiff": ["0.4.1", "0.4.2"]},
+            "dev-lib": {"fake": ["1.0", "1.0-r1"]},
+            "sys-apps": {"diffball": ["3.0"], "portage": ["2.2"]},
+        })
+
+    def assertCandidates(self, restrict, expected):
+        plan = planner.plan_query(restrict)
+        self.assertEqual(sorted(plan.candidates(self.repo)), sorted(expected),
+            msg=plan.explain())
+
+    def assertMatched(self, restrict, expected, instantiated=None):
+        del self.repo.instantiated[:]
+        self.assertEqual(
+            sorted(x.cpvstr for x in self.repo.itermatch(restrict)),
+            sorted(expected))
+        if instantiated is not None:
+            self.assertEqual(sorted(self.repo.instantiated),
+                sorted(instantiated))
+
+    def test_full_scan(self):
+        plan = planner.plan_query(packages.AlwaysTrue)
+        self.assertTrue(plan.full_scan)
+        self.assertIn("full scan", plan.explain())
+        plan = planner.plan_query(packages.PackageRestriction("description",
+            values.StrRegex("foo")))
+        self.assertTrue(plan.full_scan)
+
+    def test_nothing(self):
+        plan = planner.plan_query(packages.AlwaysFalse)
+        self.assertEqual(plan.terms, ())
+        self.assertEqual(list(plan.candidates(self.repo)), [])
+        self.assertIn("nothing can match", plan.explain())
+        self.assertCandidates(
+            packages.AndRestriction(cat_r("dev-util"), cat_r("dev-lib")), [])
+
+    def test_exact_lookups(self):
+        self.assertCandidates(cat_r("dev-util"),
+            [("dev-util", "diffball"), ("dev-util", "bsdiff")])
+        self.assertCandidates(pkg_r("diffball"),
+            [("dev-util", "diffball"), ("sys-apps", "diffball")])
+        self.assertCandidates(
+            packages.AndRestriction(cat_r("sys-apps"), pkg_r("diffball")),
+            [("sys-apps", "diffball")])
+        # nonexistent bits shouldn't explode.
+        self.assertCandidates(cat_r("dev-foo"), [])
+        self.assertCandidates(pkg_r("foo"), [])
+
+    def test_union(self):
+        r = packages.OrRestriction(
+            packages.AndRestriction(cat_r("sys-apps"), pkg_r("portage")),
+            pkg_r("fake"))
+        self.assertCandidates(r,
+            [("sys-apps", "portage"), ("dev-lib", "fake")])
+        plan = planner.plan_query(r)
+        self.assertEqual(len(plan.terms), 2)
+        self.assertIn("union of 2 terms", plan.explain())
+        # an unconstrained branch forces a full scan.
+        plan = planner.plan_query(
+            packages.OrRestriction(pkg_r("fake"), packages.AlwaysTrue))
+        self.assertTrue(plan.full_scan)
+
+    def test_negation(self):
+        self.assertCandidates(cat_r("dev-util", negate=True),
+            [("dev-lib", "fake"), ("sys-apps", "diffball"),
+             ("sys-apps", "portage")])
+        self.assertCandidates(restriction.Negate(cat_r("dev-util")),
+            [("dev-lib", "fake"), ("sys-apps", "diffball"),
+             ("sys-apps", "portage")])
+        # NAND; either the category or the package must differ.
+        r = packages.AndRestriction(cat_r("dev-util"), pkg_r("diffball"),
+            negate=True)
+        self.assertMatched(r, ["dev-util/bsdiff-0.4.1",
+            "dev-util/bsdiff-0.4.2", "dev-lib/fake-1.0", "dev-lib/fake-1.0-r1",
+            "sys-apps/diffball-3.0", "sys-apps/portage-2.2"])
+
+    def test_predicates(self):
+        r = packages.PackageRestriction("category",
+            values.StrGlobMatch("dev-"))
+        self.assertCandidates(r, [("dev-util", "diffball"),
+            ("dev-util", "bsdiff"), ("dev-lib", "fake")])
+        r = packages.AndRestriction(r, packages.PackageRestriction("package",
+            values.StrRegex("^diff")))
+        self.assertCandidates(r, [("dev-util", "diffball")])
+        self.assertIn("category filter", planner.plan_query(r).explain())
+
+    def test_version_pruning(self):
+        self.assertMatched(atom(">=dev-util/diffball-1.0"),
+            ["dev-util/diffball-1.0", "dev-util/diffball-1.2-r1"],
+            ["dev-util/diffball-1.0", "dev-util/diffball-1.2-r1"])
+        self.assertMatched(atom("=dev-util/diffball-1*"),
+            ["dev-util/diffball-1.0", "dev-util/diffball-1.2-r1"],
+            ["dev-util/diffball-1.0", "dev-util/diffball-1.2-r1"])
+        self.assertMatched(atom("~dev-lib/fake-1.0"),
+            ["dev-lib/fake-1.0", "dev-lib/fake-1.0-r1"],
+            ["dev-lib/fake-1.0", "dev-lib/fake-1.0-r1"])
+        self.assertMatched(atom("=dev-lib/fake-1.0-r1"),
+            ["dev-lib/fake-1.0-r1"], ["dev-lib/fake-1.0-r1"])
+        # one branch unconstrained on version; all versions of that cp.
+        r = packages.OrRestriction(atom("<dev-util/diffball-1.0"),
+            packages.AndRestriction(cat_r("dev-util"), pkg_r("diffball")))
+        self.assertMatched(r, ["dev-util/diffball-0.7",
+            "dev-util/diffball-1.0", "dev-util/diffball-1.2-r1"])
+        self.assertIn("version filter",
+            planner.plan_query(atom(">=dev-util/diffball-1.0")).explain())
+
+    def test_slot_index(self):
+        slots = {("dev-util", "diffball"):
+            {"0.7": "0", "1.0": "1", "1.2-r1": "1"}}
+        self.repo.slot_index = slots.get
+        r = packages.AndRestriction(atom("dev-util/diffball"), SlotDep("1"))
+        plan = planner.plan_query(r)
+        self.assertEqual(
+            plan.version_filter(self.repo)(("dev-util", "diffball"),
+                ("0.7", "1.0", "1.2-r1")),
+            ["1.0", "1.2-r1"])
+        self.assertIn("slot in index lookup [1]", plan.explain())
+
+    def test_metadata_index(self):
+        data = {("dev-util", "diffball"): {
+            "0.7": {"KEYWORDS": "x86", "SLOT": "0"},
+            "1.0": {"KEYWORDS": "~x86 amd64", "SLOT": "1/2"},
+            "1.2-r1": {"KEYWORDS": "~x86 amd64", "SLOT": "1/3"}}}
+        self.repo.metadata_index = MetadataColumns(
+            lambda cp: data.get(cp, {}).iteritems())
+        kw = packages.PackageRestriction("keywords",
+            values.ContainmentMatch2(frozenset(["amd64"])))
+        r = packages.AndRestriction(atom("dev-util/diffball"), kw)
+        self.assertIn("keywords filter", planner.plan_query(r).explain())
+        self.assertEqual(planner.plan_query(r).filtered_attrs,
+            frozenset(["keywords"]))
+        f = planner.plan_query(r).version_filter(self.repo)
+        self.assertEqual(f(("dev-util", "diffball"), ("0.7", "1.0", "1.2-r1")),
+            ["1.0", "1.2-r1"])
+        # unindexed versions are left for the real match to decide.
+        self.assertEqual(f(("dev-util", "diffball"), ("0.7", "2.0")), ["2.0"])
+        r = packages.AndRestriction(atom("dev-util/diffball"),
+            packages.PackageRestriction("keywords",
+                values.ContainmentMatch2(frozenset(["amd64"])), negate=True))
+        f = planner.plan_query(r).version_filter(self.repo)
+        self.assertEqual(f(("dev-util", "diffball"), ("0.7", "1.0", "1.2-r1")),
+            ["0.7"])
+        # slot comes from the index too, absent a slot_index.
+        r = packages.AndRestriction(atom("dev-util/diffball"), SlotDep("1"))
+        f = planner.plan_query(r).version_filter(self.repo)
+        self.assertEqual(f(("dev-util", "diffball"), ("0.7", "1.0", "1.2-r1")),
+            ["1.0", "1.2-r1"])
+        r = packages.AndRestriction(atom("dev-util/diffball"),
+            packages.PackageRestriction("subslot", values.StrExactMatch("3")))
+        f = planner.plan_query(r).version_filter(self.repo)
+        self.assertEqual(f(("dev-util", "diffball"), ("0.7", "1.0", "1.2-r1")),
+            ["1.2-r1"])
+
+    def test_override_attrs(self):
+        slots = {("dev-util", "diffball"):
+            {"0.7": "0", "1.0": "1", "1.2-r1": "1"}}
+        self.repo.slot_index = slots.get
+        r = packages.AndRestriction(atom("dev-util/diffball"), SlotDep("1"))
+        def count(**kwds):
+            del self.repo.instantiated[:]
+            list(self.repo.itermatch(r, pkg_klass_override=lambda x: x,
+                                     **kwds))
+            return len(self.repo.instantiated)
+        # an override may change anything; no pruning.
+        self.assertEqual(count(), 3)
+        self.assertEqual(count(pkg_klass_override_attrs=("slot",)), 3)
+        self.assertEqual(count(pkg_klass_override_attrs=("depends",)), 2)
+
+    def test_repo_plan_query(self):
+        plan = self.repo.plan_query(atom("dev-util/diffball"))
+        self.assertIsInstance(plan, planner.QueryPlan)
+        self.assertIn("dev-util", plan.explain())
@@ -160,6 +160,59 @@ class TestPrototype(TestCase):
                 "dev-lib/fake-1.0", "dev-lib/fake-1.0-r1")))
 
 
+    def test_prefetch_metadata(self):
+        hints = []
+        self.repo.prefetch_metadata = lambda pairs: hints.append(
+            sorted("/".join(cp) + "-" + ver for cp, vers in pairs for ver in vers))
+        self.repo.prefetch_window = 2
+        # index only restrictions don't need metadata; no hints.
+        self.repo.match(atom("dev-util/diffball"))
+        self.assertEqual(hints, [])
+        r = packages.PackageRestriction("unversioned_atom", values.AlwaysTrue)
+        self.assertEqual(len(self.repo.match(r)), 6)
+        self.assertEqual(sorted(x for l in hints for x in l),
+            ["dev-lib/fake-1.0", "dev-lib/fake-1.0-r1",
+             "dev-util/bsdiff-0.4.1", "dev-util/bsdiff-0.4.2",
+             "dev-util/diffball-0.7", "dev-util/diffball-1.0"])
+        self.assertEqual(sorted(map(len, hints)), [2, 4])
+        del hints[:]
+        r = packages.AndRestriction(atom("=dev-util/diffball-1.0"), r)
+        self.assertEqual(len(self.repo.match(r)), 1)
+        self.assertEqual(hints, [["dev-util/diffball-1.0"]])
+        # repo restrictions are answerable without metadata.
+        del hints[:]
+        self.repo.match(atom("dev-util/diffball::foo"))
+        self.assertEqual(hints, [])
+
+    def test_prefetch_discard(self):
+        discarded = []
+        self.repo.prefetch_metadata = lambda pairs: partial(
+            discarded.append, [cp for cp, vers in pairs])
+        self.repo.prefetch_window = 1
+        r = packages.PackageRestriction("unversioned_atom", values.AlwaysTrue)
+        i = self.repo.itermatch(r)
+        i.next()
+        self.assertEqual(discarded, [])
+        # abandoning the search drops what was read ahead for it.
+        i.close()
+        self.assertEqual(len(discarded), 2)
+        del discarded[:]
+        self.repo.match(r)
+        self.assertEqual(len(discarded), 3)
+
+    def test_plan_caching(self):
+        # instance cached restrictions (atoms) are only planned once...
+        a = atom(">=dev-util/diffball-1.0")
+        plan = self.repo._cached_plan(a, False)
+        self.assertIdentical(plan, self.repo._cached_plan(a, False))
+        self.assertNotIdentical(plan, self.repo._cached_plan(a, True))
+        self.assertEqual(["dev-util/diffball-1.0"],
+                         [x.cpvstr for x in self.repo.itermatch(a)])
+        # ...others, possibly mutable, every time.
+        r = packages.AndRestriction(a)
+        self.assertNotIdentical(self.repo._cached_plan(r, False),
+                                self.repo._cached_plan(r, False))
+
     def test_iter(self):
         self.assertEqual(
             sorted(self.repo),
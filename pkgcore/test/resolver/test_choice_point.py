@@ -84,3 +84,11 @@ class TestChoicePoint(TestCase):
         self.assertEqual(c.current_pkg.marker, 1)
         c.reduce_atoms("anddep1")
         self.assertEqual(bool(c), False)
+
+    def test_would_change(self):
+        c = self.gen_choice_point()
+        c.current_pkg
+        for atom in ("dependsordep", "ordep2", "ordep1", "or1", "or2"):
+            expected = c.would_change(atom)
+            self.assertEqual(c.reduce_atoms(atom), expected, msg=atom)
+        self.assertRaises(IndexError, c.would_change, "or2")
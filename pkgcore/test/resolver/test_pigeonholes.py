@@ -1,7 +1,9 @@
 # Copyright: 2006-2007 Brian Harring <ferringb@gmail.com>
 # License: GPL2/BSD
 
-from pkgcore.resolver.pigeonholes import PigeonHoledSlots
+from snakeoil.test import mk_cpy_loadable_testcase
+
+from pkgcore.resolver import pigeonholes
 from pkgcore.restrictions import restriction
 from pkgcore.test import TestCase
 from pkgcore.test.resolver.test_choice_point import fake_package
@@ -27,10 +29,12 @@ class fake_blocker(restriction.base):
                 return True
         return False
 
-class SlotTesting(TestCase):
+class native_SlotTesting(TestCase):
+
+    kls = staticmethod(pigeonholes.native_PigeonHoledSlots)
 
     def test_add(self):
-        c = PigeonHoledSlots()
+        c = self.kls()
         o = fake_package()
         self.assertEqual([], c.fill_slotting(o))
         # test that it doesn't invalidly block o when (innefficiently)
@@ -40,7 +44,7 @@ class SlotTesting(TestCase):
         self.assertFalse(c.fill_slotting(fake_package(slot=1, key=1)))
 
     def test_add_limiter(self):
-        c = PigeonHoledSlots()
+        c = self.kls()
         p = fake_package()
         o = fake_blocker(None, p)
         self.assertFalse([], c.fill_slotting(p))
@@ -51,7 +55,7 @@ class SlotTesting(TestCase):
         self.assertFalse([], c.fill_slotting(fake_package()))
 
     def test_remove_slotting(self):
-        c = PigeonHoledSlots()
+        c = self.kls()
         p, p2 = fake_package(), fake_package(slot=2)
         o = fake_blocker(None, p)
         self.assertFalse([], c.add_limiter(o))
@@ -62,3 +66,76 @@ class SlotTesting(TestCase):
         self.assertFalse([], c.fill_slotting(p2))
         c.remove_slotting(p)
         c.remove_slotting(p2)
+
+    def test_slots(self):
+        c = self.kls()
+        p, p2, p3 = fake_package(), fake_package(slot=2), fake_package()
+        self.assertEqual([], c.fill_slotting(p))
+        self.assertEqual([], c.fill_slotting(p2))
+        self.assertEqual(p, c.get_conflicting_slot(p3))
+        self.assertEqual(None, c.get_conflicting_slot(fake_package(slot=3)))
+        self.assertEqual([p], c.fill_slotting(p3, force=True))
+        self.assertEqual(sorted([p, p2, p3]),
+            sorted(c.find_atom_matches(fake_blocker(None, [p, p2, p3]))))
+        c.remove_slotting(p)
+        self.assertRaises(KeyError, c.remove_slotting, p)
+        self.assertEqual(p3, c.get_conflicting_slot(p))
+        c.remove_slotting(p3)
+        self.assertEqual(None, c.get_conflicting_slot(p))
+        self.assertEqual([p2], c.find_atom_matches(fake_blocker(None, p2)))
+        c.remove_slotting(p2)
+        # emptied buckets are dropped entirely.
+        self.assertEqual({}, c.slots)
+        self.assertRaises(KeyError, c.remove_slotting, p2)
+
+    def test_limiters(self):
+        c = self.kls()
+        p, p2 = fake_package(), fake_package(key=1)
+        o, o2 = fake_blocker(None, p), fake_blocker(None, [p, p2])
+        self.assertRaises(TypeError, c.add_limiter, p)
+        self.assertEqual([], c.add_limiter(o))
+        self.assertEqual([], c.add_limiter(o2))
+        self.assertEqual([o, o2], c.check_limiters(p))
+        self.assertEqual([], c.check_limiters(p2))
+        # keys can be overridden.
+        self.assertEqual([], c.add_limiter(o2, key=1))
+        self.assertEqual([o2], c.check_limiters(p2))
+        c.remove_limiter(o2, key=1)
+        c.remove_limiter(o)
+        self.assertEqual([o2], c.check_limiters(p))
+        c.remove_limiter(o2)
+        self.assertEqual({}, c.limiters)
+
+
+class cpy_SlotTesting(native_SlotTesting):
+
+    kls = staticmethod(pigeonholes.PigeonHoledSlots_base)
+    if pigeonholes.PigeonHoledSlots_base is \
+            pigeonholes.native_PigeonHoledSlots:
+        skip = "CPy extension not available"
+
+
+class SlotTesting(native_SlotTesting):
+
+    kls = staticmethod(pigeonholes.PigeonHoledSlots)
+
+    def test_contains(self):
+        c = self.kls()
+        p, p2 = fake_package(), fake_package(slot=2)
+        o = fake_blocker(None, p)
+        self.assertFalse(p in c)
+        c.fill_slotting(p)
+        self.assertTrue(p in c)
+        self.assertFalse(p2 in c)
+        self.assertFalse(o in c)
+        c.add_limiter(o)
+        self.assertTrue(o in c)
+        c.remove_limiter(o)
+        c.remove_slotting(p)
+        self.assertFalse(o in c)
+        self.assertFalse(p in c)
+
+
+test_cpy_used = mk_cpy_loadable_testcase('pkgcore.resolver._pigeonholes',
+    "pkgcore.resolver.pigeonholes", "PigeonHoledSlots_base",
+    "PigeonHoledSlots")
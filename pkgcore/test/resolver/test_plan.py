@@ -3,6 +3,10 @@
 
 from snakeoil.currying import post_curry
 
+from pkgcore.ebuild import processor
+from pkgcore.ebuild.atom import atom
+from pkgcore.ebuild.conditionals import DepSet
+from pkgcore.ebuild.cpv import versioned_CPV_cls
 from pkgcore.resolver import plan
 from pkgcore.test import TestCase
 from pkgcore.test.misc import FakePkg
@@ -30,3 +34,138 @@ class TestPkgSorting(TestCase):
 
     test_pkg_sort_lowest = post_curry(check_it, plan.pkg_sort_lowest,
         [11,9,1,6], [1,6,9,11])
+
+
+class fake_pkg(versioned_CPV_cls):
+
+    def __init__(self, cpv, repo, rdepend=""):
+        versioned_CPV_cls.__init__(self, cpv)
+        sf = object.__setattr__
+        sf(self, "repo", repo)
+        sf(self, "slot", "0")
+        sf(self, "depends", DepSet.parse("", atom))
+        sf(self, "rdepends", DepSet.parse(rdepend, atom))
+        sf(self, "post_rdepends", DepSet.parse("", atom))
+        sf(self, "provides", ())
+        sf(self, "built", False)
+        sf(self, "package_is_real", True)
+
+    @property
+    def slotted_atom(self):
+        return atom("%s:%s" % (self.key, self.slot))
+
+
+class fake_repo(object):
+
+    livefs = False
+    repo_id = "fake"
+
+    def __init__(self, pkgs):
+        self.pkgs = [fake_pkg(cpv, self, rdepend)
+                     for cpv, rdepend in pkgs.iteritems()]
+
+    def itermatch(self, restrict, sorter=iter, **kwds):
+        return (x for x in sorter(self.pkgs) if restrict.match(x))
+
+    def has_match(self, restrict):
+        return any(True for x in self.itermatch(restrict))
+
+    def clear(self):
+        pass
+
+
+class TestChoiceMemo(TestCase):
+
+    def resolve(self, pkgs, targets, memoize=True):
+        resolver = plan.merge_plan([fake_repo(pkgs)], plan.pkg_sort_highest,
+            plan.merge_plan.prefer_highest_version_strategy)
+        resolver.memoize_choices = memoize
+        failures = [bool(resolver.add_atoms([atom(x)])) for x in targets]
+        return (failures, [str(x) for x in resolver.state.plan],
+            resolver.choice_memo_stats)
+
+    def assertResolves(self, pkgs, targets, ops, **stats):
+        result = self.resolve(pkgs, targets)
+        self.assertEqual(result[:2], self.resolve(pkgs, targets, False)[:2])
+        self.assertEqual([x for x in result[1] if x.startswith("add")], ops)
+        for key, val in stats.iteritems():
+            self.assertEqual(result[2][key], val, msg="%s: %r != %r" % (
+                key, result[2][key], val))
+        return result
+
+    def test_reuse(self):
+        # top-2's a/common resolution is reused for top-1 once a/bad fails.
+        self.assertResolves({
+            "t/top-2": "a/common a/bad", "t/top-1": "a/common",
+            "a/common-1": "a/leaf !a/blocked", "a/leaf-1": "",
+            "a/bad-1": "a/missing"}, ["t/top"],
+            ["add: a/leaf-1", "add: a/common-1", "add: t/top-1"],
+            hits=1, stale=0)
+
+    def test_invalidation(self):
+        # top-1's blocker changes a key a/common's resolution looked at, so
+        # it has to be redone (and fails).
+        self.assertResolves({
+            "t/top-2": "a/common a/bad", "t/top-1": "!a/leaf a/common",
+            "a/common-2": "a/leaf", "a/common-1": "", "a/leaf-1": "",
+            "a/bad-1": "a/missing"}, ["t/top"],
+            ["add: a/common-1", "add: t/top-1"],
+            hits=0, stale=1)
+
+
+class TestSpeculation(TestCase):
+
+    pkgs = {
+        "t/top-1": "|| ( a/deep b/deep c/ok d/ok )",
+        "a/deep-1": "a/mid", "a/mid-1": "a/missing",
+        "b/deep-1": "b/missing", "c/ok-1": "", "d/ok-1": ""}
+
+    def resolve(self, jobs):
+        resolver = plan.merge_plan([fake_repo(self.pkgs)],
+            plan.pkg_sort_highest,
+            plan.merge_plan.prefer_highest_version_strategy,
+            speculative_jobs=jobs)
+        failures = resolver.add_atoms([atom("t/top")])
+        self.assertEqual(0, len(resolver.speculation or ()))
+        return ([str(x) for x in resolver.state.plan], failures,
+            resolver.speculation_stats)
+
+    def test_skip_failed(self):
+        expected = self.resolve(0)
+        self.assertEqual(expected[2], {'forked': 0, 'skipped': 0})
+        result = self.resolve(2)
+        self.assertEqual(expected[:2], result[:2])
+        self.assertIn("add: c/ok-1", result[0])
+        # b/deep's probe failed, so it wasn't retried; the pool was full
+        # before d/ok came up.
+        self.assertEqual(result[2], {'forked': 2, 'skipped': 1})
+
+    def test_probe_processors(self):
+        class fake_ebp(object):
+            pid = 1
+            shutdown = False
+            def shutdown_processor(self, **kwds):
+                self.shutdown = True
+        resolver = plan.merge_plan([fake_repo(self.pkgs)],
+            plan.pkg_sort_highest,
+            plan.merge_plan.prefer_highest_version_strategy)
+        inherited, spawned = fake_ebp(), fake_ebp()
+        def _rec_add_atom(*args, **kwds):
+            processor.active_ebp_list.append(spawned)
+            return None
+        resolver._rec_add_atom = _rec_add_atom
+        saved = processor.active_ebp_list[:], processor.inactive_ebp_list[:]
+        processor.inactive_ebp_list.append(inherited)
+        try:
+            # invoked in process; it's what the forked child runs.
+            self.assertTrue(resolver._probe_atom(atom("c/ok"), None, None,
+                                                 None))
+            self.assertEqual(processor.active_ebp_list, [])
+            self.assertEqual(processor.inactive_ebp_list, [])
+        finally:
+            processor.active_ebp_list[:], processor.inactive_ebp_list[:] = \
+                saved
+        # the parent's daemon is left alone, the child's own is reaped.
+        self.assertEqual(inherited.pid, None)
+        self.assertFalse(inherited.shutdown)
+        self.assertTrue(spawned.shutdown)
@@ -0,0 +1,65 @@
+# License: GPL2/BSD
+
+from StringIO import StringIO
+import json
+
+from pkgcore.ebuild import atom as atom_mod, cpv
+from pkgcore.ebuild.atom import atom
+from pkgcore.resolver import plan
+from pkgcore.resolver.profiling import resolver_profiler
+from pkgcore.test import TestCase
+from pkgcore.test.resolver.test_plan import fake_repo
+
+
+class TestResolverProfiler(TestCase):
+
+    pkgs = {
+        "t/top-2": "a/dep a/bad", "t/top-1": "a/dep",
+        "a/dep-1": "a/leaf", "a/leaf-1": "", "a/bad-1": "a/missing"}
+
+    def profile(self):
+        resolver = plan.merge_plan([fake_repo(self.pkgs)],
+            plan.pkg_sort_highest,
+            plan.merge_plan.prefer_highest_version_strategy)
+        # the wrappers are unique per profiler; stash what they replace.
+        originals = (atom_mod.atom.__dict__['__init__'], cpv.ver_cmp,
+                     resolver.all_raw_dbs[0].match.im_func)
+        profiler = resolver_profiler(resolver)
+        with profiler:
+            self.assertFalse(resolver.add_atoms([atom("t/top")]))
+        self.assertEqual(originals, (atom_mod.atom.__dict__['__init__'],
+            cpv.ver_cmp, resolver.all_raw_dbs[0].match.im_func))
+        self.assertNotIn('__cmp__', cpv.CPV.__dict__)
+        self.assertNotIn('_rec_add_atom', resolver.__dict__)
+        return profiler
+
+    def test_report(self):
+        report = self.profile().report()
+        atoms = report["atoms"]
+        self.assertEqual(atoms["t/top"]["calls"], 1)
+        # once for top-2 (whose a/bad fails), once for top-1.
+        self.assertEqual(atoms["a/dep"]["calls"], 2)
+        self.assertEqual(atoms["a/bad"]["failures"], 1)
+        self.assertEqual(atoms["a/missing"]["failures"], 1)
+        self.assertTrue(atoms["t/top"]["itermatch"] >= 1)
+        self.assertTrue(atoms["t/top"]["elapsed"] >=
+                        atoms["t/top"]["self_elapsed"])
+        self.assertEqual(report["frames"]["max_depth"], 3)
+        repo = report["repos"][0]
+        self.assertTrue(repo["misses"])
+        self.assertEqual(repo["hit_rate"], float(repo["hits"]) /
+                         (repo["hits"] + repo["misses"]))
+        self.assertTrue(report["backtracks"]["count"])
+        self.assertTrue(report["calls"]["cpv_compare"])
+        # it's all plain data.
+        self.assertEqual(report, json.loads(json.dumps(report)))
+
+    def test_stacks(self):
+        handle = StringIO()
+        self.profile().write_stacks(handle)
+        stacks = {}
+        for line in handle.getvalue().splitlines():
+            path, usecs = line.rsplit(" ", 1)
+            stacks[path] = int(usecs)
+        self.assertIn("t/top;a/bad;a/missing", stacks)
+        self.assertEqual(sorted(stacks), sorted(set(stacks)))
@@ -0,0 +1,113 @@
+# License: GPL2/BSD
+
+from pkgcore.resolver import state
+from pkgcore.test import TestCase
+from pkgcore.test.resolver.test_choice_point import fake_package
+from pkgcore.test.resolver.test_pigeonholes import fake_blocker
+
+
+class TestPlanState(TestCase):
+
+    def snapshot(self, plan):
+        return (
+            dict((key, dict((slot, list(bucket))
+                            for slot, bucket in slots.iteritems()))
+                 for key, slots in plan.state.slots.iteritems()),
+            # limiter order isn't significant.
+            dict((key, sorted(l, key=id))
+                 for key, l in plan.state.limiters.iteritems()),
+            dict(plan.pkg_choices),
+            dict((key, list(l)) for key, l in plan.rev_blockers.iteritems()),
+            dict(plan.blockers_refcnt), set(plan.vdb_filter),
+            dict(plan.forced_restrictions), list(plan.plan))
+
+    def test_add_backtrack(self):
+        plan = state.plan_state()
+        empty = self.snapshot(plan)
+        p, p2 = fake_package(key="a"), fake_package(key="b")
+        self.assertEqual(None, state.add_op("c1", p).apply(plan))
+        point = plan.current_state
+        after_p = self.snapshot(plan)
+        state.add_op("c2", p2).apply(plan)
+        state.add_backref_op("c2", p2).apply(plan)
+        state.add_hardref_op("restrict").apply(plan)
+        self.assertEqual(plan.pkg_choices, {p: "c1", p2: "c2"})
+        self.assertEqual(list(plan.forced_restrictions), ["restrict"])
+        # conflicting adds don't change anything.
+        self.assertEqual([p], state.add_op("c3", fake_package(key="a"))
+                         .apply(plan))
+        self.assertEqual(4, plan.current_state)
+        plan.backtrack(point)
+        self.assertEqual(after_p, self.snapshot(plan))
+        plan.backtrack(0)
+        self.assertEqual(empty, self.snapshot(plan))
+        self.assertEqual([], plan.journal)
+
+    def test_blockers(self):
+        plan = state.plan_state()
+        p, p2 = fake_package(key="a"), fake_package(key="b")
+        b, b2 = fake_blocker("b", p2), fake_blocker("b", ())
+        state.add_op("c1", p).apply(plan)
+        state.add_op("c2", p2).apply(plan)
+        point = plan.current_state
+        before = self.snapshot(plan)
+        self.assertEqual([p2], plan.add_blocker("c1", b))
+        self.assertEqual([], plan.add_blocker("c1", b2))
+        self.assertEqual([], plan.add_blocker("c2", b2))
+        middle = self.snapshot(plan)
+        middle_point = plan.current_state
+        # dropping a pkg drops its blockers; the restored list must retain
+        # its order so later undos pop the right entry.
+        state.remove_op("c1", p).apply(plan)
+        self.assertNotIn("c1", plan.rev_blockers)
+        self.assertEqual([(b2, "b")], plan.rev_blockers["c2"])
+        self.assertIn(p, plan.vdb_filter)
+        self.assertEqual([b2], plan.state.limiters["b"])
+        plan.backtrack(middle_point)
+        self.assertEqual(middle, self.snapshot(plan))
+        plan.backtrack(point)
+        self.assertEqual(before, self.snapshot(plan))
+
+    def test_nested_ops(self):
+        # the decrefs a remove triggers precede it in the plan, but are part
+        # of it; backtracking to them reverts the remove too.
+        plan = state.plan_state()
+        p = fake_package(key="a")
+        state.add_op("c1", p).apply(plan)
+        plan.add_blocker("c1", fake_blocker("b"))
+        before = self.snapshot(plan)
+        point = plan.current_state
+        state.remove_op("c1", p).apply(plan)
+        self.assertEqual(
+            [state.decref_forward_block_op, state.remove_op],
+            [x.__class__ for x in plan[point:]])
+        self.assertEqual((plan[-1],), plan.applied_ops(point))
+        self.assertEqual(tuple(plan[:point]) + (plan[-1],),
+                         plan.applied_ops(0))
+        plan.backtrack(point + 1)
+        self.assertEqual(before, self.snapshot(plan))
+
+    def test_replace(self):
+        plan = state.plan_state()
+        p, p2 = fake_package(key="a"), fake_package(key="a")
+        state.add_op("c1", p).apply(plan)
+        plan.add_blocker("c1", fake_blocker("b"))
+        point = plan.current_state
+        before = self.snapshot(plan)
+        op = state.replace_op("c2", p2)
+        self.assertEqual(None, op.apply(plan))
+        self.assertEqual(op.old_pkg, p)
+        self.assertEqual(plan.pkg_choices, {p2: "c2"})
+        self.assertEqual([p2], plan.state.slots["a"][0])
+        self.assertEqual({}, plan.rev_blockers)
+        plan.backtrack(point)
+        self.assertEqual(before, self.snapshot(plan))
+
+        # a replacement that's blocked leaves everything as it was.
+        p3 = fake_package(key="a")
+        plan.add_blocker("c9", fake_blocker("a", p3))
+        before = self.snapshot(plan)
+        journal = list(plan.journal)
+        self.assertTrue(state.replace_op("c3", p3).apply(plan))
+        self.assertEqual(before, self.snapshot(plan))
+        self.assertEqual(journal, plan.journal)
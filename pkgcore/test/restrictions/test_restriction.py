@@ -4,8 +4,8 @@
 
 from functools import partial
 
-from pkgcore.restrictions import restriction
-from pkgcore.test import TestRestriction
+from pkgcore.restrictions import packages, restriction, values
+from pkgcore.test import TestCase, TestRestriction
 
 
 class SillyBool(restriction.base):
@@ -102,3 +102,75 @@ class AnyMatchTest(TestRestriction):
             # just test these do not traceback
             self.assertTrue(repr(inst))
             self.assertTrue(str(inst))
+
+
+class Value(object):
+
+    __slots__ = ('val', '__weakref__')
+
+    def __init__(self, val):
+        self.val = val
+
+    def __eq__(self, other):
+        return self.val == other.val
+
+    def __hash__(self):
+        return hash(self.val)
+
+
+class SubValue(Value):
+    __slots__ = ()
+
+
+class native_InternTest(TestCase):
+
+    intern = staticmethod(restriction.native_intern)
+
+    def test_it(self):
+        a = Value('foo')
+        self.assertIdentical(self.intern(a), a)
+        self.assertIdentical(self.intern(Value('foo')), a)
+        b = Value('bar')
+        self.assertIdentical(self.intern(b), b)
+        # equal, but of differing types; not shared.
+        c = SubValue('foo')
+        self.assertIdentical(self.intern(c), c)
+
+    def test_weak(self):
+        a = Value('foo')
+        self.intern(a)
+        del a
+        b = Value('foo')
+        self.assertIdentical(self.intern(b), b)
+
+    def test_uninternable(self):
+        # no weakref support
+        t = ('foo',)
+        self.assertIdentical(self.intern(t), t)
+        # unhashable
+        v = Value([])
+        self.assertIdentical(self.intern(v), v)
+
+
+class cpy_InternTest(native_InternTest):
+
+    if restriction.intern is restriction.native_intern:
+        skip = "cpython extension isn't available"
+    else:
+        intern = staticmethod(restriction.intern)
+
+
+class InterningInstMetaTest(TestCase):
+
+    def test_it(self):
+        self.assertIdentical(values.StrExactMatch("dev-libs"),
+            values.StrExactMatch("dev-libs", case_sensitive=True, negate=False))
+        self.assertNotIdentical(values.StrExactMatch("dev-libs"),
+            values.StrExactMatch("dev-libs", disable_inst_caching=True))
+        r = packages.PackageRestriction("category",
+            values.StrExactMatch("dev-libs"))
+        self.assertIdentical(r, packages.PackageRestriction("category",
+            values.StrExactMatch("dev-libs"), negate=False))
+        self.assertNotIdentical(r, packages.PackageRestriction("category",
+            values.StrExactMatch("dev-libs"), ignore_missing=False))
+
@@ -52,9 +52,21 @@ class GetAttrTest(TestRestriction):
         self.assertForceFalse(fails, args)
 
 
-class StrRegexTest(TestRestriction):
+class native_StrRegexTest(TestRestriction):
 
-    kls = values.StrRegex
+    if values.base_StrRegex is values.native_StrRegex:
+        kls = values.StrRegex
+    else:
+        # named to match; test_repr checks the class name.
+        class StrRegex(values.native_StrRegex, values.base):
+            __slots__ = ()
+            __inst_caching__ = True
+
+            __repr__ = values._StrRegex__repr__
+            __str__ = values._StrRegex__str__
+        kls = StrRegex
+
+    kls = staticmethod(kls)
 
     def test_match(self):
         for negated in (False, True):
@@ -96,6 +108,63 @@ class StrRegexTest(TestRestriction):
             ]:
             self.assertTrue(repr(restr).startswith(string), (restr, string))
 
+    def test_conversions(self):
+        for negated in (False, True):
+            self.assertMatches(self.kls('^$', negate=negated),
+                None, [None]*3, negated=negated)
+            self.assertMatches(self.kls('1.2', match=True, negate=negated),
+                1.23, [1.23]*3, negated=negated)
+            self.assertMatches(self.kls('pkg', negate=negated),
+                u'a-pkg', [u'a-pkg']*3, negated=negated)
+
+    def test_literals(self):
+        # literal patterns take a shortcut in the extension; verify it
+        # behaves identically to an actual regex run.
+        for negated in (False, True):
+            self.assertMatches(self.kls('oo', negate=negated),
+                'foo', ['foo']*3, negated=negated)
+            self.assertNotMatches(self.kls('oo', match=True, negate=negated),
+                'foo', ['foo']*3, negated=negated)
+            self.assertMatches(self.kls('fo', match=True, negate=negated),
+                'foo', ['foo']*3, negated=negated)
+            self.assertNotMatches(self.kls('foo-', match=True,
+                negate=negated), 'foo', ['foo']*3, negated=negated)
+            self.assertMatches(self.kls('', negate=negated),
+                'foo', ['foo']*3, negated=negated)
+
+    def test__eq__(self):
+        for negate in (True, False):
+            self.assertEqual(
+                self.kls("rsync", negate=negate),
+                self.kls("rsync", negate=negate))
+            self.assertEqual(
+                hash(self.kls("rsync", negate=negate)),
+                hash(self.kls("rsync", negate=negate)))
+            self.assertNotEqual(
+                self.kls("rsync", negate=negate),
+                self.kls("rsync", negate=not negate))
+            self.assertNotEqual(
+                self.kls("rsync", negate=negate),
+                self.kls("rsync", match=True, negate=negate))
+            self.assertNotEqual(
+                self.kls("rsync", case_sensitive=False, negate=negate),
+                self.kls("rsync", negate=negate))
+            self.assertNotEqual(
+                self.kls("rsync", negate=negate),
+                self.kls("rsyn.", negate=negate))
+
+
+class cpy_StrRegexTest(native_StrRegexTest):
+
+    if values.base_StrRegex is values.native_StrRegex:
+        skip = "cpython extension not available"
+    else:
+        kls = staticmethod(values.StrRegex)
+
+    def test_invalid(self):
+        import re
+        self.assertRaises(re.error, self.kls, 'foo(')
+
 
 
 class native_TestStrExactMatch(TestRestriction):
@@ -165,10 +234,38 @@ class cpy_TestStrExactMatch(native_TestStrExactMatch):
         # this seems insane, but it's the right alloc to trigger it
         self.kls("", case_sensitive=False).__ne__(u"\uEFA3\uC2EF\uBE5B\u9D98\uFE2F\uB781\u27C7\u8592")
 
+    def test_case_insensitive_conversions(self):
+        for negated in (False, True):
+            # non-strings are str'd, and the folding applies to that.
+            self.assertMatches(self.kls('True', case_sensitive=False,
+                negate=negated), True, [True]*3, negated=negated)
+            self.assertMatches(self.kls(1, case_sensitive=False,
+                negate=negated), 1, [1]*3, negated=negated)
+            # unicode falls back to python's folding.
+            self.assertMatches(self.kls('Package', case_sensitive=False,
+                negate=negated), u'PACKAGE', [u'PACKAGE']*3, negated=negated)
+            self.assertMatches(self.kls(u'\xc4x', case_sensitive=False,
+                negate=negated), u'\xe4X', [u'\xe4X']*3, negated=negated)
+            self.assertNotMatches(self.kls('package', case_sensitive=False,
+                negate=negated), 'packagE2', ['packagE2']*3, negated=negated)
+            # non ascii bytes aren't folded.
+            self.assertNotMatches(self.kls('\xc4', case_sensitive=False,
+                negate=negated), '\xe4', ['\xe4']*3, negated=negated)
+
+
+class native_TestStrGlobMatch(TestRestriction):
+
+    if values.base_StrGlobMatch is values.native_StrGlobMatch:
+        kls = values.StrGlobMatch
+    else:
+        class kls(values.native_StrGlobMatch, values.base):
+            __slots__ = ()
+            __inst_caching__ = True
 
-class TestStrGlobMatch(TestRestriction):
+            __repr__ = values._StrGlob__repr__
+            __str__ = values._StrGlob__str__
 
-    kls = values.StrGlobMatch
+    kls = staticmethod(kls)
 
     def test_matching(self):
         for negated in (True, False):
@@ -231,6 +328,39 @@ class TestStrGlobMatch(TestRestriction):
             self.kls("rsync", negate=True),
             self.kls("rsync", negate=False))
 
+    def test__hash__(self):
+        for negate in (True, False):
+            for prefix in (True, False):
+                self.assertEqual(
+                    hash(self.kls("rsync", prefix=prefix, negate=negate)),
+                    hash(self.kls("rsync", prefix=prefix, negate=negate)))
+                self.assertEqual(
+                    hash(self.kls("RSync", case_sensitive=False,
+                        prefix=prefix, negate=negate)),
+                    hash(self.kls("rsync", case_sensitive=False,
+                        prefix=prefix, negate=negate)))
+
+    def test_conversions(self):
+        for negated in (False, True):
+            self.assertMatches(self.kls('1.2', negate=negated),
+                1.23, [1.23]*3, negated=negated)
+            self.assertMatches(self.kls('Pkg', case_sensitive=False,
+                prefix=False, negate=negated),
+                u'a-pKG', [u'a-pKG']*3, negated=negated)
+            self.assertNotMatches(self.kls('longer-than-value',
+                negate=negated), 'longer', ['longer']*3, negated=negated)
+            self.assertNotMatches(self.kls('longer-than-value',
+                prefix=False, negate=negated), 'value', ['value']*3,
+                negated=negated)
+
+
+class cpy_TestStrGlobMatch(native_TestStrGlobMatch):
+
+    if values.base_StrGlobMatch is values.native_StrGlobMatch:
+        skip = "cpython extension not available"
+    else:
+        kls = staticmethod(values.StrGlobMatch)
+
 
 class TestEqualityMatch(TestRestriction):
 
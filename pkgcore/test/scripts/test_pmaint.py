@@ -235,3 +235,21 @@ class TestRegen(TestCase, helpers.ArgParseMixin):
         self.assertEqual(
             [options.repo.__class__, options.threads],
             [TestSimpleTree, 2])
+
+
+class TestCache(TestCase, helpers.ArgParseMixin):
+
+    _argparser = pmaint.cache
+
+    def test_parser(self):
+
+        @configurable(typename='repo')
+        def fake_repo():
+            return util.SimpleTree({})
+
+        options = self.parse(
+            'spork', '--prune', '--pack', '/tmp/packed', '-t', '2',
+            spork=basics.HardCodedConfigSection({'class': fake_repo}))
+        self.assertEqual(
+            [options.prune, options.pack, options.threads],
+            [True, '/tmp/packed', 2])
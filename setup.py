@@ -391,8 +391,16 @@ if not snk_distutils.is_py3k:
         snk_distutils.OptionalExtension(
             'pkgcore.ebuild._filter_env', [
                 'src/filter_env.c', 'src/bmh_search.c']),
+        snk_distutils.OptionalExtension(
+            'pkgcore.ebuild._processor', ['src/processor.c']),
         snk_distutils.OptionalExtension(
             'pkgcore.restrictions._restrictions', ['src/restrictions.c']),
+        snk_distutils.OptionalExtension(
+            'pkgcore.cache._packed', ['src/packed.c']),
+        snk_distutils.OptionalExtension(
+            'pkgcore.cache._flat_hash', ['src/flat_hash.c']),
+        snk_distutils.OptionalExtension(
+            'pkgcore.resolver._pigeonholes', ['src/pigeonholes.c']),
     ])
     if float(sys.version[:3]) >= 2.6:
         extensions.append(snk_distutils.OptionalExtension(
@@ -0,0 +1,303 @@
+/*
+ * License: BSD 3 clause
+ *
+ * cpy entry parsing for pkgcore.cache.flat_hash
+ */
+
+#include <snakeoil/common.h>
+#include <string.h>
+#include <math.h>
+
+/* how a chf's serialized form is converted; see
+ * pkgcore.cache.template._get_chf_deserializer */
+enum chf_kind {
+	CHF_STR,
+	CHF_MTIME,
+	CHF_HEX
+};
+
+static PyObject *flat_hash_eclasses_key = NULL;
+
+/* matches str.strip()'s notion of whitespace */
+#define IS_WHITESPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' || \
+	(c) == '\r' || (c) == '\v' || (c) == '\f')
+
+static void
+flat_hash_strip(const char **start, const char **end)
+{
+	const char *s = *start, *e = *end;
+	while(s < e && IS_WHITESPACE(*s))
+		s++;
+	while(e > s && IS_WHITESPACE(e[-1]))
+		e--;
+	*start = s;
+	*end = e;
+}
+
+static int
+flat_hash_chf_kind(PyObject *chf_type)
+{
+	const char *name;
+	if(!(name = PyString_AsString(chf_type)))
+		return -1;
+	if(!strcmp(name, "eclassdir"))
+		return CHF_STR;
+	if(!strcmp(name, "mtime"))
+		return CHF_MTIME;
+	return CHF_HEX;
+}
+
+static PyObject *
+flat_hash_convert(int kind, const char *p, Py_ssize_t len)
+{
+	PyObject *s, *tmp, *result;
+	if(!(s = PyString_FromStringAndSize(p, len)) || kind == CHF_STR)
+		return s;
+	if(kind == CHF_MTIME) {
+		/* long(math.floor(float(val))) */
+		tmp = PyFloat_FromString(s, NULL);
+		Py_DECREF(s);
+		if(!tmp)
+			return NULL;
+		result = PyLong_FromDouble(floor(PyFloat_AS_DOUBLE(tmp)));
+		Py_DECREF(tmp);
+		return result;
+	}
+	/* long(val, 16) */
+	if((Py_ssize_t)strlen(PyString_AS_STRING(s)) != len) {
+		PyErr_SetString(PyExc_ValueError, "null byte in chf value");
+		result = NULL;
+	} else {
+		result = PyLong_FromString(PyString_AS_STRING(s), NULL, 16);
+	}
+	Py_DECREF(s);
+	return result;
+}
+
+static const char *
+flat_hash_find(const char *p, const char *end, const char *sep,
+	Py_ssize_t sep_len)
+{
+	if(sep_len == 1)
+		return memchr(p, *sep, end - p);
+	for(; end - p >= sep_len; p++) {
+		if(*p == *sep && !memcmp(p, sep, sep_len))
+			return p;
+	}
+	return NULL;
+}
+
+/* equivalent of template.reconstruct_eclasses, raising ValueError */
+static PyObject *
+flat_hash_decode_eclasses(PyObject *value, PyObject *splitter,
+	PyObject *chf_types, int *kinds)
+{
+	PyObject *result, *item, *chfs, *pair, *eclass, *val;
+	const char *p, *end, *sep, *field_end, *spl;
+	Py_ssize_t spl_len, count, tuple_len, i;
+	int ret;
+
+	p = PyString_AS_STRING(value);
+	end = p + PyString_GET_SIZE(value);
+	flat_hash_strip(&p, &end);
+	if(!(result = PyList_New(0)))
+		return NULL;
+	if(p == end)
+		return result;
+
+	spl = PyString_AS_STRING(splitter);
+	spl_len = PyString_GET_SIZE(splitter);
+	tuple_len = PyTuple_GET_SIZE(chf_types) + 1;
+	for(count = 1, sep = p;
+		(sep = flat_hash_find(sep, end, spl, spl_len)); sep += spl_len)
+		count++;
+	if(count % tuple_len) {
+		PyErr_Format(PyExc_ValueError,
+			"_eclasses_ was of invalid len %zd(must be mod %zd)",
+			count, tuple_len);
+		goto error;
+	}
+
+#define NEXT_FIELD()									\
+	if(!(field_end = flat_hash_find(p, end, spl, spl_len)))	\
+		field_end = end;
+
+	while(count) {
+		NEXT_FIELD();
+		if(!(eclass = PyString_FromStringAndSize(p, field_end - p)))
+			goto error;
+		p = field_end + spl_len;
+		if(!(chfs = PyTuple_New(tuple_len - 1))) {
+			Py_DECREF(eclass);
+			goto error;
+		}
+		item = PyTuple_Pack(2, eclass, chfs);
+		Py_DECREF(eclass);
+		Py_DECREF(chfs);
+		if(!item)
+			goto error;
+		for(i = 0; i < tuple_len - 1; i++) {
+			NEXT_FIELD();
+			if(!(val = flat_hash_convert(kinds[i], p, field_end - p))) {
+				Py_DECREF(item);
+				goto error;
+			}
+			p = field_end + spl_len;
+			pair = PyTuple_Pack(2, PyTuple_GET_ITEM(chf_types, i), val);
+			Py_DECREF(val);
+			if(!pair) {
+				Py_DECREF(item);
+				goto error;
+			}
+			PyTuple_SET_ITEM(chfs, i, pair);
+		}
+		ret = PyList_Append(result, item);
+		Py_DECREF(item);
+		if(ret)
+			goto error;
+		count -= tuple_len;
+	}
+#undef NEXT_FIELD
+	return result;
+
+error:
+	Py_DECREF(result);
+	return NULL;
+}
+
+static PyObject *
+flat_hash_parse_entry(PyObject *self, PyObject *args)
+{
+	PyObject *buffer, *known, *chf_key, *chf_type, *splitter, *chf_types;
+	PyObject *result, *key, *val;
+	const void *data;
+	const char *p, *end, *line_end, *start, *stop, *sep;
+	Py_ssize_t size, i;
+	int ret, chf_kind = -1, *kinds = NULL;
+
+	if(!PyArg_ParseTuple(args, "OOSOSO:parse_entry", &buffer, &known,
+		&chf_key, &chf_type, &splitter, &chf_types))
+		return NULL;
+	if(PyObject_AsReadBuffer(buffer, &data, &size))
+		return NULL;
+	if(!PyString_GET_SIZE(splitter)) {
+		PyErr_SetString(PyExc_ValueError, "empty eclass_splitter");
+		return NULL;
+	}
+	if(chf_type != Py_None && -1 == (chf_kind = flat_hash_chf_kind(chf_type)))
+		return NULL;
+	if(!(chf_types = PySequence_Tuple(chf_types)))
+		return NULL;
+	if(!(kinds = PyMem_New(int, PyTuple_GET_SIZE(chf_types) + 1))) {
+		Py_DECREF(chf_types);
+		return PyErr_NoMemory();
+	}
+	for(i = 0; i < PyTuple_GET_SIZE(chf_types); i++) {
+		if(-1 == (kinds[i] = flat_hash_chf_kind(
+			PyTuple_GET_ITEM(chf_types, i))))
+			goto cleanup;
+	}
+
+	if(!(result = PyDict_New()))
+		goto cleanup;
+
+	p = (const char *)data;
+	end = p + size;
+	/* lines, as readlines would give them; a trailing newline doesn't
+	 * start another (empty, thus malformed) line. */
+	while(p < end) {
+		if(!(line_end = memchr(p, '\n', end - p)))
+			line_end = end;
+		start = p;
+		stop = line_end;
+		flat_hash_strip(&start, &stop);
+		if(!(sep = memchr(start, '=', stop - start))) {
+			val = PyString_FromStringAndSize(start, stop - start);
+			if(val) {
+				PyErr_Format(PyExc_ValueError, "malformed line: %s",
+					PyString_AS_STRING(val));
+				Py_DECREF(val);
+			}
+			goto error;
+		}
+		if(!(key = PyString_FromStringAndSize(start, sep - start)))
+			goto error;
+		PyString_InternInPlace(&key);
+		if(-1 == (ret = PySequence_Contains(known, key))) {
+			Py_DECREF(key);
+			goto error;
+		} else if(ret) {
+			if(!(val = PyString_FromStringAndSize(sep + 1, stop - sep - 1))) {
+				Py_DECREF(key);
+				goto error;
+			}
+			ret = PyDict_SetItem(result, key, val);
+			Py_DECREF(val);
+			if(ret) {
+				Py_DECREF(key);
+				goto error;
+			}
+		}
+		Py_DECREF(key);
+		p = line_end + 1;
+	}
+
+	if(chf_kind != -1) {
+		if(!(val = PyDict_GetItem(result, chf_key))) {
+			PyErr_SetObject(PyExc_KeyError, chf_key);
+			goto error;
+		}
+		if(!(val = flat_hash_convert(chf_kind, PyString_AS_STRING(val),
+			PyString_GET_SIZE(val))))
+			goto error;
+		ret = PyDict_SetItem(result, chf_key, val);
+		Py_DECREF(val);
+		if(ret)
+			goto error;
+	}
+
+	if((val = PyDict_GetItem(result, flat_hash_eclasses_key))) {
+		if(!(val = flat_hash_decode_eclasses(val, splitter, chf_types, kinds)))
+			goto error;
+		ret = PyDict_SetItem(result, flat_hash_eclasses_key, val);
+		Py_DECREF(val);
+		if(ret)
+			goto error;
+	}
+
+	PyMem_Free(kinds);
+	Py_DECREF(chf_types);
+	return result;
+
+error:
+	Py_DECREF(result);
+cleanup:
+	PyMem_Free(kinds);
+	Py_DECREF(chf_types);
+	return NULL;
+}
+
+PyDoc_STRVAR(
+	flat_hash_parse_entry_documentation,
+	"parse_entry(data, known_keys, chf_key, chf_type, eclass_splitter, "
+	"eclass_chf_types)\n\n"
+	"parse a flat_hash cache entry into a dict, skipping keys not in "
+	"known_keys.  chf_key's value is deserialized per chf_type (unless "
+	"that's None), and _eclasses_ is reconstructed.");
+
+static PyMethodDef FlatHashMethods[] = {
+	{"parse_entry", (PyCFunction)flat_hash_parse_entry, METH_VARARGS,
+		flat_hash_parse_entry_documentation},
+	{NULL, NULL, 0, NULL}		/* Sentinel */
+};
+
+PyDoc_STRVAR(
+	flat_hash_documentation,
+	"cpython entry parsing for pkgcore.cache.flat_hash");
+
+PyMODINIT_FUNC
+init_flat_hash(void)
+{
+	snakeoil_LOAD_STRING(flat_hash_eclasses_key, "_eclasses_");
+	Py_InitModule3("_flat_hash", FlatHashMethods, flat_hash_documentation);
+}
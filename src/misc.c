@@ -3,15 +3,598 @@
  * Copyright: 2008 Charlie Shepherd <masterdriverz@gmail.com>
  * License: BSD 3 clause
  *
- * primarily a cpy version of incremental_expansion for speed.
+ * primarily a cpy version of incremental_expansion for speed, along with
+ * FlagSet and the VisibilityFilter base.
  */
 
 #include <snakeoil/common.h>
+#include <structmember.h>
 
 static PyObject *discard_str = NULL;
 static PyObject *clear_str = NULL;
 static PyObject *add_str = NULL;
+static PyObject *cpvstr_str = NULL;
 
+/*
+ * flag interning.
+ *
+ * Every flag seen is assigned a small integer index; flag_names maps it
+ * back, flag_opposites holds the index of what the flag discards when
+ * expanded ("-x" for "x", "x" for "-x").  Once a flag has been seen,
+ * expanding it requires no allocation, and FlagSet can store it as a bit.
+ */
+
+static PyObject *flag_index = NULL;
+static PyObject *flag_names = NULL;
+static Py_ssize_t *flag_opposites = NULL;
+static Py_ssize_t flag_opposites_size = 0;
+
+#define BITS_PER_WORD (sizeof(unsigned long) * 8)
+
+static Py_ssize_t
+flag_intern(PyObject *flag)
+{
+	PyObject *tmp, *opposite;
+	Py_ssize_t idx, opposite_idx, len;
+	char *str;
+
+	if((tmp = PyDict_GetItem(flag_index, flag)))
+		return PyInt_AS_LONG(tmp);
+
+	str = PyString_AS_STRING(flag);
+	len = PyString_GET_SIZE(flag);
+	if('-' == *str) {
+		opposite = PyString_FromStringAndSize(str + 1, len - 1);
+	} else {
+		// note that this auto sets a trailing null.
+		if((opposite = PyString_FromStringAndSize(NULL, len + 1))) {
+			char *p = PyString_AS_STRING(opposite);
+			p[0] = '-';
+			Py_MEMCPY(p + 1, str, len + 1);
+		}
+	}
+	if(!opposite)
+		return -1;
+
+	idx = PyList_GET_SIZE(flag_names);
+	if(idx >= flag_opposites_size) {
+		Py_ssize_t new_size = flag_opposites_size ? flag_opposites_size * 2 : 256;
+		Py_ssize_t *new_opposites = PyMem_Realloc(flag_opposites,
+			new_size * sizeof(Py_ssize_t));
+		if(!new_opposites) {
+			Py_DECREF(opposite);
+			PyErr_NoMemory();
+			return -1;
+		}
+		flag_opposites = new_opposites;
+		flag_opposites_size = new_size;
+	}
+	if(!(tmp = PyInt_FromSsize_t(idx))) {
+		Py_DECREF(opposite);
+		return -1;
+	}
+	if(PyDict_SetItem(flag_index, flag, tmp)) {
+		Py_DECREF(tmp);
+		Py_DECREF(opposite);
+		return -1;
+	}
+	Py_DECREF(tmp);
+	if(PyList_Append(flag_names, flag))
+		goto rollback;
+
+	// typically the opposite's opposite is this flag, but "--x" -> "-x" -> "x".
+	opposite_idx = flag_intern(opposite);
+	if(-1 == opposite_idx) {
+		PyList_SetSlice(flag_names, idx, idx + 1, NULL);
+		goto rollback;
+	}
+	Py_DECREF(opposite);
+	flag_opposites[idx] = opposite_idx;
+	return idx;
+rollback:
+	Py_DECREF(opposite);
+	PyDict_DelItem(flag_index, flag);
+	return -1;
+}
+
+/* returns -1 if the flag isn't known; doesn't set an exception. */
+static Py_ssize_t
+flag_lookup(PyObject *flag)
+{
+	PyObject *tmp = PyDict_GetItem(flag_index, flag);
+	return tmp ? PyInt_AS_LONG(tmp) : -1;
+}
+
+
+/* bitset of interned flags */
+
+typedef struct {
+	PyObject_HEAD
+	unsigned long *bits;
+	Py_ssize_t words;
+} pkgcore_FlagSet;
+
+static PyTypeObject pkgcore_FlagSet_Type;
+
+#define FlagSet_Check(op) PyObject_TypeCheck(op, &pkgcore_FlagSet_Type)
+
+static int
+flagset_grow(pkgcore_FlagSet *self, Py_ssize_t words)
+{
+	unsigned long *bits;
+	if(words <= self->words)
+		return 0;
+	if(words < self->words * 2)
+		words = self->words * 2;
+	if(!(bits = PyMem_Realloc(self->bits, words * sizeof(unsigned long)))) {
+		PyErr_NoMemory();
+		return -1;
+	}
+	memset(bits + self->words, 0,
+		(words - self->words) * sizeof(unsigned long));
+	self->bits = bits;
+	self->words = words;
+	return 0;
+}
+
+static inline int
+flagset_set_bit(pkgcore_FlagSet *self, Py_ssize_t idx)
+{
+	Py_ssize_t word = idx / BITS_PER_WORD;
+	if(word >= self->words && flagset_grow(self, word + 1))
+		return -1;
+	self->bits[word] |= 1UL << (idx % BITS_PER_WORD);
+	return 0;
+}
+
+static inline void
+flagset_clear_bit(pkgcore_FlagSet *self, Py_ssize_t idx)
+{
+	Py_ssize_t word = idx / BITS_PER_WORD;
+	if(word < self->words)
+		self->bits[word] &= ~(1UL << (idx % BITS_PER_WORD));
+}
+
+static inline int
+flagset_test_bit(pkgcore_FlagSet *self, Py_ssize_t idx)
+{
+	Py_ssize_t word = idx / BITS_PER_WORD;
+	if(word >= self->words)
+		return 0;
+	return (self->bits[word] >> (idx % BITS_PER_WORD)) & 1;
+}
+
+static inline void
+flagset_clear(pkgcore_FlagSet *self)
+{
+	if(self->words)
+		memset(self->bits, 0, self->words * sizeof(unsigned long));
+}
+
+static Py_ssize_t
+flag_intern_checked(PyObject *flag)
+{
+	if(!PyString_CheckExact(flag)) {
+		PyErr_Format(PyExc_TypeError, "flags must be strings, got %s",
+			Py_TYPE(flag)->tp_name);
+		return -1;
+	}
+	return flag_intern(flag);
+}
+
+static int
+flagset_update(pkgcore_FlagSet *self, PyObject *iterable, int add)
+{
+	PyObject *iterator, *item;
+	if(FlagSet_Check(iterable)) {
+		pkgcore_FlagSet *other = (pkgcore_FlagSet *)iterable;
+		Py_ssize_t i;
+		if(add && flagset_grow(self, other->words))
+			return -1;
+		for(i = 0; i < other->words && i < self->words; i++) {
+			if(add)
+				self->bits[i] |= other->bits[i];
+			else
+				self->bits[i] &= ~other->bits[i];
+		}
+		return 0;
+	}
+	if(!(iterator = PyObject_GetIter(iterable)))
+		return -1;
+	while((item = PyIter_Next(iterator))) {
+		Py_ssize_t idx;
+		if(add) {
+			if(-1 == (idx = flag_intern_checked(item)) ||
+				flagset_set_bit(self, idx)) {
+				Py_DECREF(item);
+				Py_DECREF(iterator);
+				return -1;
+			}
+		} else if(PyString_CheckExact(item) &&
+			-1 != (idx = flag_lookup(item))) {
+			flagset_clear_bit(self, idx);
+		}
+		Py_DECREF(item);
+	}
+	Py_DECREF(iterator);
+	return PyErr_Occurred() ? -1 : 0;
+}
+
+static int
+pkgcore_FlagSet_init(pkgcore_FlagSet *self, PyObject *args, PyObject *kwds)
+{
+	PyObject *iterable = NULL;
+	static char *kwlist[] = {"iterable", NULL};
+	if(!PyArg_ParseTupleAndKeywords(args, kwds, "|O:FlagSet", kwlist,
+		&iterable))
+		return -1;
+	flagset_clear(self);
+	if(iterable)
+		return flagset_update(self, iterable, 1);
+	return 0;
+}
+
+static void
+pkgcore_FlagSet_dealloc(pkgcore_FlagSet *self)
+{
+	PyMem_Free(self->bits);
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *
+pkgcore_FlagSet_to_list(pkgcore_FlagSet *self)
+{
+	PyObject *l = PyList_New(0);
+	Py_ssize_t word;
+	if(!l)
+		return NULL;
+	for(word = 0; word < self->words; word++) {
+		unsigned long bits = self->bits[word];
+		Py_ssize_t idx = word * BITS_PER_WORD;
+		for(; bits; bits >>= 1, idx++) {
+			if((bits & 1) &&
+				PyList_Append(l, PyList_GET_ITEM(flag_names, idx))) {
+				Py_DECREF(l);
+				return NULL;
+			}
+		}
+	}
+	return l;
+}
+
+static PyObject *
+pkgcore_FlagSet_iter(pkgcore_FlagSet *self)
+{
+	PyObject *l = pkgcore_FlagSet_to_list(self);
+	PyObject *ret;
+	if(!l)
+		return NULL;
+	ret = PyObject_GetIter(l);
+	Py_DECREF(l);
+	return ret;
+}
+
+static PyObject *
+pkgcore_FlagSet_to_frozenset(pkgcore_FlagSet *self, PyObject *unused)
+{
+	PyObject *l = pkgcore_FlagSet_to_list(self);
+	PyObject *ret;
+	if(!l)
+		return NULL;
+	ret = PyFrozenSet_New(l);
+	Py_DECREF(l);
+	return ret;
+}
+
+static Py_ssize_t
+pkgcore_FlagSet_len(pkgcore_FlagSet *self)
+{
+	Py_ssize_t word, count = 0;
+	for(word = 0; word < self->words; word++) {
+		unsigned long bits = self->bits[word];
+		for(; bits; count++)
+			bits &= bits - 1;
+	}
+	return count;
+}
+
+static int
+pkgcore_FlagSet_contains(pkgcore_FlagSet *self, PyObject *flag)
+{
+	Py_ssize_t idx;
+	if(!PyString_CheckExact(flag) || -1 == (idx = flag_lookup(flag)))
+		return 0;
+	return flagset_test_bit(self, idx);
+}
+
+static PyObject *
+pkgcore_FlagSet_add(pkgcore_FlagSet *self, PyObject *flag)
+{
+	Py_ssize_t idx = flag_intern_checked(flag);
+	if(-1 == idx || flagset_set_bit(self, idx))
+		return NULL;
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+pkgcore_FlagSet_discard(pkgcore_FlagSet *self, PyObject *flag)
+{
+	Py_ssize_t idx;
+	if(PyString_CheckExact(flag) && -1 != (idx = flag_lookup(flag)))
+		flagset_clear_bit(self, idx);
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+pkgcore_FlagSet_clear(pkgcore_FlagSet *self, PyObject *unused)
+{
+	flagset_clear(self);
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+pkgcore_FlagSet_update(pkgcore_FlagSet *self, PyObject *iterable)
+{
+	if(flagset_update(self, iterable, 1))
+		return NULL;
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+pkgcore_FlagSet_difference_update(pkgcore_FlagSet *self, PyObject *iterable)
+{
+	if(flagset_update(self, iterable, 0))
+		return NULL;
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+pkgcore_FlagSet_copy(pkgcore_FlagSet *self, PyObject *unused)
+{
+	pkgcore_FlagSet *new = (pkgcore_FlagSet *)PyType_GenericAlloc(
+		Py_TYPE(self), 0);
+	if(!new)
+		return NULL;
+	if(self->words) {
+		if(!(new->bits = PyMem_New(unsigned long, self->words))) {
+			Py_DECREF(new);
+			return PyErr_NoMemory();
+		}
+		Py_MEMCPY(new->bits, self->bits, self->words * sizeof(unsigned long));
+		new->words = self->words;
+	}
+	return (PyObject *)new;
+}
+
+static PyObject *
+pkgcore_FlagSet_richcompare(pkgcore_FlagSet *self, PyObject *other, int op)
+{
+	pkgcore_FlagSet *o;
+	Py_ssize_t i, common;
+	int equal = 1;
+	if((op != Py_EQ && op != Py_NE) || !FlagSet_Check(other)) {
+		Py_INCREF(Py_NotImplemented);
+		return Py_NotImplemented;
+	}
+	o = (pkgcore_FlagSet *)other;
+	common = self->words < o->words ? self->words : o->words;
+	for(i = 0; equal && i < common; i++)
+		equal = self->bits[i] == o->bits[i];
+	for(i = common; equal && i < self->words; i++)
+		equal = !self->bits[i];
+	for(i = common; equal && i < o->words; i++)
+		equal = !o->bits[i];
+	if(equal == (op == Py_EQ))
+		Py_RETURN_TRUE;
+	Py_RETURN_FALSE;
+}
+
+static PyObject *
+pkgcore_FlagSet_repr(pkgcore_FlagSet *self)
+{
+	PyObject *l, *l_repr, *ret;
+	if(!(l = pkgcore_FlagSet_to_list(self)))
+		return NULL;
+	l_repr = PyObject_Repr(l);
+	Py_DECREF(l);
+	if(!l_repr)
+		return NULL;
+	ret = PyString_FromFormat("%s(%s)", Py_TYPE(self)->tp_name,
+		PyString_AS_STRING(l_repr));
+	Py_DECREF(l_repr);
+	return ret;
+}
+
+static PyMethodDef pkgcore_FlagSet_methods[] = {
+	{"add", (PyCFunction)pkgcore_FlagSet_add, METH_O},
+	{"discard", (PyCFunction)pkgcore_FlagSet_discard, METH_O},
+	{"clear", (PyCFunction)pkgcore_FlagSet_clear, METH_NOARGS},
+	{"update", (PyCFunction)pkgcore_FlagSet_update, METH_O},
+	{"difference_update", (PyCFunction)pkgcore_FlagSet_difference_update,
+		METH_O},
+	{"copy", (PyCFunction)pkgcore_FlagSet_copy, METH_NOARGS},
+	{"to_frozenset", (PyCFunction)pkgcore_FlagSet_to_frozenset, METH_NOARGS},
+	{NULL}
+};
+
+static PySequenceMethods pkgcore_FlagSet_as_sequence = {
+	(lenfunc)pkgcore_FlagSet_len,			/* sq_length */
+	0,										/* sq_concat */
+	0,										/* sq_repeat */
+	0,										/* sq_item */
+	0,										/* sq_slice */
+	0,										/* sq_ass_item */
+	0,										/* sq_ass_slice */
+	(objobjproc)pkgcore_FlagSet_contains,	/* sq_contains */
+};
+
+PyDoc_STRVAR(
+	pkgcore_FlagSet_documentation,
+	"set of flags stored as a bitset of interned flag indexes");
+
+static PyTypeObject pkgcore_FlagSet_Type = {
+	PyObject_HEAD_INIT(NULL)
+	0,												/* ob_size */
+	"pkgcore.ebuild._misc.FlagSet",					/* tp_name */
+	sizeof(pkgcore_FlagSet),						/* tp_basicsize */
+	0,												/* tp_itemsize */
+	(destructor)pkgcore_FlagSet_dealloc,			/* tp_dealloc */
+	0,												/* tp_print */
+	0,												/* tp_getattr */
+	0,												/* tp_setattr */
+	0,												/* tp_compare */
+	(reprfunc)pkgcore_FlagSet_repr,					/* tp_repr */
+	0,												/* tp_as_number */
+	&pkgcore_FlagSet_as_sequence,					/* tp_as_sequence */
+	0,												/* tp_as_mapping */
+	PyObject_HashNotImplemented,					/* tp_hash  */
+	0,												/* tp_call */
+	0,												/* tp_str */
+	0,												/* tp_getattro */
+	0,												/* tp_setattro */
+	0,												/* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE,			/* tp_flags */
+	pkgcore_FlagSet_documentation,					/* tp_doc */
+	0,												/* tp_traverse */
+	0,												/* tp_clear */
+	(richcmpfunc)pkgcore_FlagSet_richcompare,		/* tp_richcompare */
+	0,												/* tp_weaklistoffset */
+	(getiterfunc)pkgcore_FlagSet_iter,				/* tp_iter */
+	0,												/* tp_iternext */
+	pkgcore_FlagSet_methods,						/* tp_methods */
+	0,												/* tp_members */
+	0,												/* tp_getset */
+	0,												/* tp_base */
+	0,												/* tp_dict */
+	0,												/* tp_descr_get */
+	0,												/* tp_descr_set */
+	0,												/* tp_dictoffset */
+	(initproc)pkgcore_FlagSet_init,					/* tp_init */
+	0,												/* tp_alloc */
+	PyType_GenericNew,								/* tp_new */
+};
+
+
+/* what incremental expansion is being applied to */
+#define TARGET_GENERIC 0
+#define TARGET_SET 1
+#define TARGET_FLAGSET 2
+
+static int
+expansion_target_kind(PyObject *orig)
+{
+	if(FlagSet_Check(orig))
+		return TARGET_FLAGSET;
+	else if(PySet_Check(orig))
+		return TARGET_SET;
+	return TARGET_GENERIC;
+}
+
+/* returns a borrowed reference to the flag item discards; NULL on error. */
+static inline PyObject *
+flag_opposite(PyObject *item, Py_ssize_t *idx)
+{
+	if(-1 == (*idx = flag_intern(item)))
+		return NULL;
+	return PyList_GET_ITEM(flag_names, flag_opposites[*idx]);
+}
+
+static int
+target_call(PyObject *orig, PyObject *method, PyObject *arg)
+{
+	PyObject *tmp_ret = PyObject_CallMethodObjArgs(orig, method, arg, NULL);
+	if(!tmp_ret)
+		return -1;
+	Py_DECREF(tmp_ret);
+	return 0;
+}
+
+static int
+target_clear(PyObject *orig, int kind)
+{
+	if(TARGET_FLAGSET == kind) {
+		flagset_clear((pkgcore_FlagSet *)orig);
+		return 0;
+	} else if(TARGET_SET == kind) {
+		return PySet_Clear(orig);
+	}
+	return target_call(orig, clear_str, NULL);
+}
+
+static int
+target_discard(PyObject *orig, int kind, PyObject *flag, Py_ssize_t idx)
+{
+	if(TARGET_FLAGSET == kind) {
+		flagset_clear_bit((pkgcore_FlagSet *)orig, idx);
+		return 0;
+	} else if(TARGET_SET == kind) {
+		return -1 == PySet_Discard(orig, flag) ? -1 : 0;
+	}
+	return target_call(orig, discard_str, flag);
+}
+
+static int
+target_add(PyObject *orig, int kind, PyObject *flag, Py_ssize_t idx)
+{
+	if(TARGET_FLAGSET == kind) {
+		return flagset_set_bit((pkgcore_FlagSet *)orig, idx);
+	} else if(TARGET_SET == kind) {
+		return PySet_Add(orig, flag);
+	}
+	return target_call(orig, add_str, flag);
+}
+
+/* returns 1 if item is a '-*' reset, -1 (with an exception set) if it's
+ * not a valid token, else 0. */
+static int
+check_token(PyObject *item, char *msg_prefix)
+{
+	char *str;
+	if (!PyString_CheckExact(item)) {
+		PyErr_Format(PyExc_ValueError,
+			"iterable should yield strings");
+		return -1;
+	}
+	str = PyString_AS_STRING(item);
+	if ('-' == *str) {
+		if ('\0' == str[1]) {
+			PyErr_Format(PyExc_ValueError,
+			"%sencountered an incomplete negation, '-'",
+				msg_prefix);
+			return -1;
+		}
+		if ('*' == str[1] && '\0' == str[2])
+			return 1;
+	}
+	return 0;
+}
+
+static int
+expand_token(PyObject *orig, int kind, PyObject *item, char *msg_prefix,
+	int finalize)
+{
+	PyObject *discard_val;
+	Py_ssize_t idx = -1;
+	int ret = check_token(item, msg_prefix);
+	if(-1 == ret)
+		return -1;
+	if(1 == ret) {
+		if(target_clear(orig, kind))
+			return -1;
+		if(finalize)
+			return 0;
+		if(TARGET_FLAGSET == kind && -1 == (idx = flag_intern(item)))
+			return -1;
+		return target_add(orig, kind, item, idx);
+	}
+	if(!(discard_val = flag_opposite(item, &idx)))
+		return -1;
+	if(target_discard(orig, kind, discard_val, flag_opposites[idx]))
+		return -1;
+	if('-' == *PyString_AS_STRING(item) && finalize)
+		return 0;
+	return target_add(orig, kind, item, idx);
+}
 
 static PyObject *
 incremental_expansion(PyObject *self, PyObject *args, PyObject *kwargs)
@@ -26,15 +609,14 @@ incremental_expansion(PyObject *self, PyObject *args, PyObject *kwargs)
 	};
 	PyObject *orig, *iterable, *finalize_obj = NULL;
 	PyObject *iterator, *item = NULL;
-	PyObject *tmp_ret = NULL;
-	int is_set;
+	int kind;
 
 	char *msg_prefix = "";
 	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|sO", keywords,
 		&orig, &iterable, &msg_prefix, &finalize_obj))
 		return NULL;
 
-	is_set = PySet_Check(orig);
+	kind = expansion_target_kind(orig);
 	if(finalize_obj) {
 		finalize = PyObject_IsTrue(finalize_obj);
 		if(-1 == finalize) {
@@ -49,95 +631,13 @@ incremental_expansion(PyObject *self, PyObject *args, PyObject *kwargs)
 		return NULL;
 
 	while ((item = PyIter_Next(iterator))) {
-		char *str;
-		if (!PyString_CheckExact(item)) {
-			PyErr_Format(PyExc_ValueError,
-				"iterable should yield strings");
+		if (expand_token(orig, kind, item, msg_prefix, finalize))
 			goto err;
-		}
-		str = PyString_AS_STRING(item);
-		if ('-' == *str) {
-			str++;
-			if ('\0' == *str) {
-				PyErr_Format(PyExc_ValueError,
-				"%sencountered an incomplete negation, '-'",
-					msg_prefix);
-				goto err;
-			}
-			if ('*' == *str && '\0' == str[1]) {
-				if(is_set) {
-					if(-1 == PySet_Clear(orig)) {
-						goto err;
-					}
-				} else {
-					if (NULL == (tmp_ret = PyObject_CallMethodObjArgs(orig, clear_str, NULL))) {
-						goto err;
-					}
-					Py_DECREF(tmp_ret);
-				}
-			} else {
-				PyObject *discard_val;
-				if (NULL == (discard_val = PyString_FromString(str))) {
-					goto err;
-				}
-				if(is_set) {
-					if(-1 == PySet_Discard(orig, discard_val)) {
-						Py_DECREF(discard_val);
-						goto err;
-					}
-					Py_DECREF(discard_val);
-				} else {
-					tmp_ret = PyObject_CallMethodObjArgs(orig, discard_str, discard_val, NULL);
-					Py_DECREF(discard_val);
-					if(!tmp_ret) {
-						goto err;
-					}
-					Py_DECREF(tmp_ret);
-				}
-			}
-			if (!finalize) {
-				if(is_set) {
-					if(-1 == PySet_Add(orig, item)) {
-						goto err;
-					}
-				} else {
-					if (NULL == (tmp_ret = PyObject_CallMethodObjArgs(orig, add_str, item, NULL)))
-						goto err;
-					Py_DECREF(tmp_ret);
-				}
-			}
-		} else {
-			Py_ssize_t len = strlen(str);
-			// note that this auto sets a trailing newline.
-			PyObject *discard_val = PyString_FromStringAndSize(NULL, len + 1);
-			if(!discard_val)
-				goto err;
-			char *p = PyString_AS_STRING(discard_val);
-			p[0] = '-';
-			Py_MEMCPY(p + 1, str, len + 1);
-
-			if(is_set) {
-				if(-1 == PySet_Discard(orig, discard_val)) {
-					Py_DECREF(discard_val);
-					goto err;
-				}
-				Py_DECREF(discard_val);
-			} else {
-				tmp_ret = PyObject_CallMethodObjArgs(orig, discard_str, discard_val, NULL);
-				Py_DECREF(discard_val);
-				if(!tmp_ret)
-					goto err;
-				Py_DECREF(tmp_ret);
-			}
-			if(NULL == (tmp_ret = PyObject_CallMethodObjArgs(orig, add_str,
-				item, NULL))) {
-				goto err;
-			}
-			Py_DECREF(tmp_ret);
-		}
 		Py_DECREF(item);
 	}
 	Py_DECREF(iterator);
+	if(PyErr_Occurred())
+		return NULL;
 	Py_RETURN_NONE;
 err:
 	Py_XDECREF(iterator);
@@ -145,9 +645,273 @@ err:
 	return NULL;
 }
 
+/*
+ * incremental_expansion across a stack of layers in one pass.  Tokens are
+ * validated up front (so errors are reported just as stacking them one by
+ * one would), and everything prior to the last '-*' is skipped outright
+ * rather than being expanded only to be cleared.
+ */
+static PyObject *
+incremental_expansion_layers(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+	int finalize;
+	static char *keywords[] = {
+		"orig",
+		"layers",
+		"msg_prefix",
+		"finalize",
+		NULL
+	};
+	PyObject *orig, *layers, *finalize_obj = NULL;
+	PyObject *fast_layers = NULL, *ret = NULL;
+	Py_ssize_t layer_count, i, j, start_layer = 0, start = 0;
+	int kind;
+
+	char *msg_prefix = "";
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|sO", keywords,
+		&orig, &layers, &msg_prefix, &finalize_obj))
+		return NULL;
+
+	kind = expansion_target_kind(orig);
+	if(finalize_obj) {
+		finalize = PyObject_IsTrue(finalize_obj);
+		if(-1 == finalize) {
+			return NULL;
+		}
+	} else {
+		finalize = 1;
+	}
+
+	if(!(layers = PySequence_Fast(layers, "layers must be iterable")))
+		return NULL;
+	layer_count = PySequence_Fast_GET_SIZE(layers);
+	if(!(fast_layers = PyTuple_New(layer_count)))
+		goto cleanup;
+
+	for(i = 0; i < layer_count; i++) {
+		PyObject *layer = PySequence_Fast(
+			PySequence_Fast_GET_ITEM(layers, i), "layers must be iterable");
+		if(!layer)
+			goto cleanup;
+		PyTuple_SET_ITEM(fast_layers, i, layer);
+		for(j = 0; j < PySequence_Fast_GET_SIZE(layer); j++) {
+			int reset = check_token(PySequence_Fast_GET_ITEM(layer, j),
+				msg_prefix);
+			if(-1 == reset)
+				goto cleanup;
+			if(reset) {
+				start_layer = i;
+				start = j;
+			}
+		}
+	}
+
+	for(i = start_layer; i < layer_count; i++) {
+		PyObject *layer = PyTuple_GET_ITEM(fast_layers, i);
+		for(j = (i == start_layer ? start : 0);
+			j < PySequence_Fast_GET_SIZE(layer); j++) {
+			if(expand_token(orig, kind, PySequence_Fast_GET_ITEM(layer, j),
+				msg_prefix, finalize))
+				goto cleanup;
+		}
+	}
+	Py_INCREF(orig);
+	ret = orig;
+cleanup:
+	Py_XDECREF(fast_layers);
+	Py_DECREF(layers);
+	return ret;
+}
+
+/*
+ * visibility filtering.
+ *
+ * Runs a sequence of checks (callables taking a package) against each
+ * package, stopping at the first that fails; the verdict is stored
+ * keyed on the package's cpvstr, thus an instance is only valid for a
+ * single repository and configuration.
+ */
+
+typedef struct {
+	PyObject_HEAD
+	PyObject *checks;
+	PyObject *verdicts;
+} pkgcore_VisibilityFilter;
+
+static int
+pkgcore_VisibilityFilter_init(pkgcore_VisibilityFilter *self,
+	PyObject *args, PyObject *kwds)
+{
+	PyObject *checks, *tmp;
+	static char *kwlist[] = {"checks", NULL};
+	if(!PyArg_ParseTupleAndKeywords(args, kwds, "O:VisibilityFilter", kwlist,
+		&checks))
+		return -1;
+	if(!(checks = PySequence_Tuple(checks)))
+		return -1;
+	tmp = self->checks;
+	self->checks = checks;
+	Py_XDECREF(tmp);
+	if(!self->verdicts) {
+		if(!(self->verdicts = PyDict_New()))
+			return -1;
+	} else {
+		PyDict_Clear(self->verdicts);
+	}
+	return 0;
+}
+
+static int
+pkgcore_VisibilityFilter_traverse(pkgcore_VisibilityFilter *self,
+	visitproc visit, void *arg)
+{
+	Py_VISIT(self->checks);
+	Py_VISIT(self->verdicts);
+	return 0;
+}
+
+static int
+pkgcore_VisibilityFilter_clear(pkgcore_VisibilityFilter *self)
+{
+	Py_CLEAR(self->checks);
+	Py_CLEAR(self->verdicts);
+	return 0;
+}
+
+static void
+pkgcore_VisibilityFilter_dealloc(pkgcore_VisibilityFilter *self)
+{
+	PyObject_GC_UnTrack(self);
+	pkgcore_VisibilityFilter_clear(self);
+	self->ob_type->tp_free((PyObject *)self);
+}
+
+static PyObject *
+pkgcore_VisibilityFilter_match(pkgcore_VisibilityFilter *self, PyObject *pkg)
+{
+	PyObject *key, *verdict = Py_True, *tmp;
+	Py_ssize_t x;
+	int ret;
+
+	if(!self->checks || !self->verdicts) {
+		PyErr_SetString(PyExc_TypeError, "VisibilityFilter isn't initialized");
+		return NULL;
+	}
+
+	if(!(key = PyObject_GetAttr(pkg, cpvstr_str))) {
+		/* no cpvstr; can't cache it, but can still judge it */
+		if(!PyErr_ExceptionMatches(PyExc_AttributeError))
+			return NULL;
+		PyErr_Clear();
+	} else if((tmp = PyDict_GetItem(self->verdicts, key))) {
+		Py_DECREF(key);
+		Py_INCREF(tmp);
+		return tmp;
+	}
+
+	for(x = 0; x < PyTuple_GET_SIZE(self->checks); x++) {
+		if(!(tmp = PyObject_CallFunctionObjArgs(
+			PyTuple_GET_ITEM(self->checks, x), pkg, NULL))) {
+			Py_XDECREF(key);
+			return NULL;
+		}
+		ret = PyObject_IsTrue(tmp);
+		Py_DECREF(tmp);
+		if(-1 == ret) {
+			Py_XDECREF(key);
+			return NULL;
+		} else if(!ret) {
+			verdict = Py_False;
+			break;
+		}
+	}
+
+	if(key) {
+		ret = PyDict_SetItem(self->verdicts, key, verdict);
+		Py_DECREF(key);
+		if(ret)
+			return NULL;
+	}
+	Py_INCREF(verdict);
+	return verdict;
+}
+
+static PyObject *
+pkgcore_VisibilityFilter_invalidate(pkgcore_VisibilityFilter *self,
+	PyObject *unused)
+{
+	if(self->verdicts)
+		PyDict_Clear(self->verdicts);
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef pkgcore_VisibilityFilter_methods[] = {
+	{"match", (PyCFunction)pkgcore_VisibilityFilter_match, METH_O},
+	{"invalidate", (PyCFunction)pkgcore_VisibilityFilter_invalidate,
+		METH_NOARGS},
+	{NULL}
+};
+
+static PyMemberDef pkgcore_VisibilityFilter_members[] = {
+	{"checks", T_OBJECT, offsetof(pkgcore_VisibilityFilter, checks), READONLY},
+	{"verdicts", T_OBJECT, offsetof(pkgcore_VisibilityFilter, verdicts),
+		READONLY},
+	{NULL}
+};
+
+PyDoc_STRVAR(
+	pkgcore_VisibilityFilter_documentation,
+	"cpython VisibilityFilter base class for speed");
+
+static PyTypeObject pkgcore_VisibilityFilter_Type = {
+	PyObject_HEAD_INIT(NULL)
+	0,												/* ob_size */
+	"pkgcore.ebuild._misc.VisibilityFilter",		/* tp_name */
+	sizeof(pkgcore_VisibilityFilter),				/* tp_basicsize */
+	0,												/* tp_itemsize */
+	(destructor)pkgcore_VisibilityFilter_dealloc,	/* tp_dealloc */
+	0,												/* tp_print */
+	0,												/* tp_getattr */
+	0,												/* tp_setattr */
+	0,												/* tp_compare */
+	0,												/* tp_repr */
+	0,												/* tp_as_number */
+	0,												/* tp_as_sequence */
+	0,												/* tp_as_mapping */
+	0,												/* tp_hash  */
+	0,												/* tp_call */
+	0,												/* tp_str */
+	0,												/* tp_getattro */
+	0,												/* tp_setattro */
+	0,												/* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE|Py_TPFLAGS_HAVE_GC,
+													/* tp_flags */
+	pkgcore_VisibilityFilter_documentation,			/* tp_doc */
+	(traverseproc)pkgcore_VisibilityFilter_traverse,
+													/* tp_traverse */
+	(inquiry)pkgcore_VisibilityFilter_clear,		/* tp_clear */
+	0,												/* tp_richcompare */
+	0,												/* tp_weaklistoffset */
+	0,												/* tp_iter */
+	0,												/* tp_iternext */
+	pkgcore_VisibilityFilter_methods,				/* tp_methods */
+	pkgcore_VisibilityFilter_members,				/* tp_members */
+	0,												/* tp_getset */
+	0,												/* tp_base */
+	0,												/* tp_dict */
+	0,												/* tp_descr_get */
+	0,												/* tp_descr_set */
+	0,												/* tp_dictoffset */
+	(initproc)pkgcore_VisibilityFilter_init,		/* tp_init */
+	0,												/* tp_alloc */
+	PyType_GenericNew,								/* tp_new */
+};
+
 static PyMethodDef MiscMethods[] = {
 	{"incremental_expansion", (PyCFunction)incremental_expansion,
 		METH_VARARGS | METH_KEYWORDS, ""},
+	{"incremental_expansion_layers", (PyCFunction)incremental_expansion_layers,
+		METH_VARARGS | METH_KEYWORDS, ""},
 	{NULL, NULL, 0, NULL}		/* Sentinel */
 };
 
@@ -157,6 +921,29 @@ init_misc(void)
 	snakeoil_LOAD_STRING(discard_str, "discard");
 	snakeoil_LOAD_STRING(add_str, "add");
 	snakeoil_LOAD_STRING(clear_str, "clear");
+	snakeoil_LOAD_STRING(cpvstr_str, "cpvstr");
+
+	if(!(flag_index = PyDict_New()))
+		return;
+	if(!(flag_names = PyList_New(0)))
+		return;
+
+	if (PyType_Ready(&pkgcore_FlagSet_Type) < 0)
+		return;
+	if (PyType_Ready(&pkgcore_VisibilityFilter_Type) < 0)
+		return;
 
 	PyObject *m = Py_InitModule("_misc", MiscMethods);
+	if (!m)
+		return;
+
+	Py_INCREF(&pkgcore_FlagSet_Type);
+	if (PyModule_AddObject(
+			m, "FlagSet", (PyObject *)&pkgcore_FlagSet_Type) == -1)
+		return;
+
+	Py_INCREF(&pkgcore_VisibilityFilter_Type);
+	if (PyModule_AddObject(m, "VisibilityFilter",
+			(PyObject *)&pkgcore_VisibilityFilter_Type) == -1)
+		return;
 }
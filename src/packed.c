@@ -0,0 +1,200 @@
+/*
+ * License: BSD 3 clause
+ *
+ * cpy index and record decoding for pkgcore.cache.packed
+ */
+
+#include <snakeoil/common.h>
+#include <string.h>
+
+static int
+packed_get_buffer(PyObject *buffer, Py_ssize_t offset, Py_ssize_t length,
+	const char **start)
+{
+	const void *data;
+	Py_ssize_t size;
+	if(PyObject_AsReadBuffer(buffer, &data, &size))
+		return -1;
+	if(offset < 0 || length < 0 || offset > size || length > size - offset) {
+		PyErr_Format(PyExc_ValueError,
+			"range %zd:%zd is outside of the buffer (size %zd)",
+			offset, offset + length, size);
+		return -1;
+	}
+	*start = (const char *)data + offset;
+	return 0;
+}
+
+static void
+packed_malformed(const char *msg, const char *p, const char *end)
+{
+	PyObject *line = PyString_FromStringAndSize(p, end - p);
+	if(line) {
+		PyErr_Format(PyExc_ValueError, "%s: %s", msg,
+			PyString_AS_STRING(line));
+		Py_DECREF(line);
+	}
+}
+
+static int
+packed_parse_ssize(const char *p, const char *end, Py_ssize_t *result)
+{
+	Py_ssize_t val = 0;
+	if(p == end)
+		return -1;
+	for(; p < end; p++) {
+		if(*p < '0' || *p > '9')
+			return -1;
+		if(val > (PY_SSIZE_T_MAX - 9) / 10)
+			return -1;
+		val = val * 10 + (*p - '0');
+	}
+	*result = val;
+	return 0;
+}
+
+static PyObject *
+packed_parse_index(PyObject *self, PyObject *args)
+{
+	PyObject *buffer, *result, *key, *val;
+	Py_ssize_t offset, length, rec_offset, rec_length;
+	const char *p, *end, *line_end, *sep1, *sep2;
+
+	if(!PyArg_ParseTuple(args, "Onn:parse_index", &buffer, &offset, &length))
+		return NULL;
+	if(packed_get_buffer(buffer, offset, length, &p))
+		return NULL;
+	end = p + length;
+
+	if(!(result = PyDict_New()))
+		return NULL;
+
+	while(p < end) {
+		if(!(line_end = memchr(p, '\n', end - p)))
+			line_end = end;
+		if(line_end == p) {
+			p++;
+			continue;
+		}
+		sep1 = memchr(p, ' ', line_end - p);
+		sep2 = sep1 ? memchr(sep1 + 1, ' ', line_end - sep1 - 1) : NULL;
+		if(!sep2 || sep1 == p ||
+			packed_parse_ssize(sep1 + 1, sep2, &rec_offset) ||
+			packed_parse_ssize(sep2 + 1, line_end, &rec_length)) {
+			packed_malformed("malformed index line", p, line_end);
+			goto error;
+		}
+		if(!(key = PyString_FromStringAndSize(p, sep1 - p)))
+			goto error;
+		if(!(val = Py_BuildValue("(nn)", rec_offset, rec_length))) {
+			Py_DECREF(key);
+			goto error;
+		}
+		if(PyDict_SetItem(result, key, val)) {
+			Py_DECREF(key);
+			Py_DECREF(val);
+			goto error;
+		}
+		Py_DECREF(key);
+		Py_DECREF(val);
+		p = line_end + 1;
+	}
+	return result;
+
+error:
+	Py_DECREF(result);
+	return NULL;
+}
+
+static PyObject *
+packed_decode_record(PyObject *self, PyObject *args)
+{
+	PyObject *buffer, *known, *result, *key, *val, *tmp;
+	Py_ssize_t offset, length;
+	const char *p, *end, *line_end, *sep;
+	int ret;
+
+	if(!PyArg_ParseTuple(args, "OnnO:decode_record", &buffer, &offset,
+		&length, &known))
+		return NULL;
+	if(packed_get_buffer(buffer, offset, length, &p))
+		return NULL;
+	end = p + length;
+
+	if(!(result = PyList_New(0)))
+		return NULL;
+
+	while(p < end) {
+		if(!(line_end = memchr(p, '\n', end - p)))
+			line_end = end;
+		if(line_end == p) {
+			p++;
+			continue;
+		}
+		if(!(sep = memchr(p, '=', line_end - p))) {
+			packed_malformed("malformed line", p, line_end);
+			goto error;
+		}
+		if(!(key = PyString_FromStringAndSize(p, sep - p)))
+			goto error;
+		PyString_InternInPlace(&key);
+		if(-1 == (ret = PySequence_Contains(known, key))) {
+			Py_DECREF(key);
+			goto error;
+		} else if(ret) {
+			val = PyString_FromStringAndSize(sep + 1, line_end - sep - 1);
+			if(!val) {
+				Py_DECREF(key);
+				goto error;
+			}
+			tmp = PyTuple_Pack(2, key, val);
+			Py_DECREF(val);
+			if(!tmp) {
+				Py_DECREF(key);
+				goto error;
+			}
+			ret = PyList_Append(result, tmp);
+			Py_DECREF(tmp);
+			if(ret) {
+				Py_DECREF(key);
+				goto error;
+			}
+		}
+		Py_DECREF(key);
+		p = line_end + 1;
+	}
+	return result;
+
+error:
+	Py_DECREF(result);
+	return NULL;
+}
+
+PyDoc_STRVAR(
+	packed_parse_index_documentation,
+	"parse_index(buffer, offset, length)\n\n"
+	"parse a packed cache index block into a dict of cpv: (offset, length)");
+
+PyDoc_STRVAR(
+	packed_decode_record_documentation,
+	"decode_record(buffer, offset, length, known_keys)\n\n"
+	"decode a packed cache record into a list of (key, value) pairs, "
+	"skipping keys not in known_keys");
+
+static PyMethodDef PackedMethods[] = {
+	{"parse_index", (PyCFunction)packed_parse_index, METH_VARARGS,
+		packed_parse_index_documentation},
+	{"decode_record", (PyCFunction)packed_decode_record, METH_VARARGS,
+		packed_decode_record_documentation},
+	{NULL, NULL, 0, NULL}		/* Sentinel */
+};
+
+PyDoc_STRVAR(
+	packed_documentation,
+	"cpython index and record decoding for pkgcore.cache.packed");
+
+PyMODINIT_FUNC
+init_packed(void)
+{
+	Py_InitModule3("_packed", PackedMethods, packed_documentation);
+}
@@ -0,0 +1,525 @@
+/*
+ * License: BSD 3 clause
+ *
+ * cpython PigeonHoledSlots base for pkgcore.resolver.pigeonholes
+ *
+ * Objs are held in {key: {slot: [objs]}}, limiters in {key: [limiters]};
+ * keys that are strings are interned, so the per key lookups done on every
+ * resolver choice and backtrack are pointer compares.
+ */
+
+#include <snakeoil/common.h>
+#include <structmember.h>
+
+static PyObject *key_str = NULL;
+static PyObject *slot_str = NULL;
+static PyObject *match_str = NULL;
+static PyObject *restriction_base = NULL;
+
+typedef struct {
+	PyObject_HEAD
+	PyObject *slots;
+	PyObject *limiters;
+} pkgcore_PigeonHoledSlots;
+
+/* new reference to obj.key, interned if it's a string */
+static PyObject *
+get_key(PyObject *obj)
+{
+	PyObject *key = PyObject_GetAttr(obj, key_str);
+	if(key && PyString_CheckExact(key))
+		PyString_InternInPlace(&key);
+	return key;
+}
+
+/* key, falling back to atom.key if it's None/NULL; new reference */
+static PyObject *
+resolve_key(PyObject *atom, PyObject *key)
+{
+	if(!key || key == Py_None)
+		return get_key(atom);
+	Py_INCREF(key);
+	if(PyString_CheckExact(key))
+		PyString_InternInPlace(&key);
+	return key;
+}
+
+static PyObject *
+key_error(const char *fmt, PyObject *obj)
+{
+	PyObject *s = PyObject_Str(obj);
+	if(s) {
+		PyErr_Format(PyExc_KeyError, fmt, PyString_AS_STRING(s));
+		Py_DECREF(s);
+	}
+	return NULL;
+}
+
+/* remove every occurence of obj (by identity) from l; returns the count */
+static Py_ssize_t
+remove_identity(PyObject *l, PyObject *obj)
+{
+	Py_ssize_t idx, count = 0;
+	for(idx = PyList_GET_SIZE(l) - 1; idx >= 0; idx--) {
+		if(PyList_GET_ITEM(l, idx) == obj) {
+			if(PyList_SetSlice(l, idx, idx + 1, NULL))
+				return -1;
+			count++;
+		}
+	}
+	return count;
+}
+
+/* append the items of seq that match (via match_obj.match, or
+ * item.match(obj) if match_obj is NULL) to result */
+static int
+extend_matching(PyObject *result, PyObject *seq, PyObject *match_obj,
+	PyObject *obj)
+{
+	Py_ssize_t idx;
+	int ret;
+	PyObject *item, *tmp;
+	for(idx = 0; idx < PyList_GET_SIZE(seq); idx++) {
+		item = PyList_GET_ITEM(seq, idx);
+		Py_INCREF(item);
+		if(match_obj)
+			tmp = PyObject_CallMethodObjArgs(match_obj, match_str, item, NULL);
+		else
+			tmp = PyObject_CallMethodObjArgs(item, match_str, obj, NULL);
+		if(!tmp) {
+			Py_DECREF(item);
+			return -1;
+		}
+		ret = PyObject_IsTrue(tmp);
+		Py_DECREF(tmp);
+		if(ret > 0)
+			ret = PyList_Append(result, item);
+		Py_DECREF(item);
+		if(ret < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int
+pkgcore_PigeonHoledSlots_init(pkgcore_PigeonHoledSlots *self,
+	PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {NULL};
+	if(!PyArg_ParseTupleAndKeywords(args, kwds, ":PigeonHoledSlots", kwlist))
+		return -1;
+	Py_CLEAR(self->slots);
+	Py_CLEAR(self->limiters);
+	if(!(self->slots = PyDict_New()))
+		return -1;
+	if(!(self->limiters = PyDict_New()))
+		return -1;
+	return 0;
+}
+
+static int
+pkgcore_PigeonHoledSlots_traverse(pkgcore_PigeonHoledSlots *self,
+	visitproc visit, void *arg)
+{
+	Py_VISIT(self->slots);
+	Py_VISIT(self->limiters);
+	return 0;
+}
+
+static int
+pkgcore_PigeonHoledSlots_clear(pkgcore_PigeonHoledSlots *self)
+{
+	Py_CLEAR(self->slots);
+	Py_CLEAR(self->limiters);
+	return 0;
+}
+
+static void
+pkgcore_PigeonHoledSlots_dealloc(pkgcore_PigeonHoledSlots *self)
+{
+	PyObject_GC_UnTrack(self);
+	pkgcore_PigeonHoledSlots_clear(self);
+	self->ob_type->tp_free((PyObject *)self);
+}
+
+static int
+check_initialized(pkgcore_PigeonHoledSlots *self)
+{
+	if(!self->slots || !self->limiters) {
+		PyErr_SetString(PyExc_TypeError,
+			"PigeonHoledSlots isn't initialized");
+		return -1;
+	}
+	return 0;
+}
+
+static PyObject *
+check_limiters(pkgcore_PigeonHoledSlots *self, PyObject *obj, PyObject *key)
+{
+	PyObject *result, *limiters;
+	if(!(result = PyList_New(0)))
+		return NULL;
+	limiters = PyDict_GetItem(self->limiters, key);
+	if(limiters && extend_matching(result, limiters, NULL, obj)) {
+		Py_DECREF(result);
+		return NULL;
+	}
+	return result;
+}
+
+static PyObject *
+pkgcore_PigeonHoledSlots_check_limiters(pkgcore_PigeonHoledSlots *self,
+	PyObject *obj)
+{
+	PyObject *key, *result;
+	if(check_initialized(self) || !(key = get_key(obj)))
+		return NULL;
+	result = check_limiters(self, obj, key);
+	Py_DECREF(key);
+	return result;
+}
+
+static PyObject *
+pkgcore_PigeonHoledSlots_fill_slotting(pkgcore_PigeonHoledSlots *self,
+	PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"obj", "force", NULL};
+	PyObject *obj, *force_obj = NULL, *key = NULL, *slot = NULL;
+	PyObject *slots, *bucket = NULL, *result = NULL;
+	int force = 0;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwds, "O|O:fill_slotting", kwlist,
+		&obj, &force_obj))
+		return NULL;
+	if(force_obj && -1 == (force = PyObject_IsTrue(force_obj)))
+		return NULL;
+	if(check_initialized(self) || !(key = get_key(obj)))
+		return NULL;
+	if(!(result = check_limiters(self, obj, key)))
+		goto err;
+	if(!(slot = PyObject_GetAttr(obj, slot_str)))
+		goto err;
+
+	if((slots = PyDict_GetItem(self->slots, key))) {
+		if((bucket = PyDict_GetItem(slots, slot))) {
+			if(PyList_SetSlice(result, PyList_GET_SIZE(result),
+				PyList_GET_SIZE(result), bucket))
+				goto err;
+		}
+	}
+
+	if(!PyList_GET_SIZE(result) || force) {
+		if(!bucket) {
+			if(!slots) {
+				if(!(slots = PyDict_New()))
+					goto err;
+				if(PyDict_SetItem(self->slots, key, slots)) {
+					Py_DECREF(slots);
+					goto err;
+				}
+				Py_DECREF(slots);
+			}
+			if(!(bucket = PyList_New(0)))
+				goto err;
+			if(PyDict_SetItem(slots, slot, bucket)) {
+				Py_DECREF(bucket);
+				goto err;
+			}
+			Py_DECREF(bucket);
+		}
+		if(PyList_Append(bucket, obj))
+			goto err;
+	}
+	Py_DECREF(key);
+	Py_DECREF(slot);
+	return result;
+err:
+	Py_XDECREF(key);
+	Py_XDECREF(slot);
+	Py_XDECREF(result);
+	return NULL;
+}
+
+static PyObject *
+pkgcore_PigeonHoledSlots_get_conflicting_slot(pkgcore_PigeonHoledSlots *self,
+	PyObject *pkg)
+{
+	PyObject *key, *slot, *slots, *bucket = NULL;
+	if(check_initialized(self) || !(key = get_key(pkg)))
+		return NULL;
+	if((slots = PyDict_GetItem(self->slots, key))) {
+		if(!(slot = PyObject_GetAttr(pkg, slot_str))) {
+			Py_DECREF(key);
+			return NULL;
+		}
+		bucket = PyDict_GetItem(slots, slot);
+		Py_DECREF(slot);
+	}
+	Py_DECREF(key);
+	if(bucket && PyList_GET_SIZE(bucket)) {
+		Py_INCREF(PyList_GET_ITEM(bucket, 0));
+		return PyList_GET_ITEM(bucket, 0);
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+find_atom_matches(pkgcore_PigeonHoledSlots *self, PyObject *atom,
+	PyObject *key)
+{
+	PyObject *result, *slots, *bucket, *slot;
+	Py_ssize_t pos = 0;
+	if(!(result = PyList_New(0)))
+		return NULL;
+	if(!(slots = PyDict_GetItem(self->slots, key)))
+		return result;
+	Py_INCREF(slots);
+	while(PyDict_Next(slots, &pos, &slot, &bucket)) {
+		if(extend_matching(result, bucket, atom, NULL)) {
+			Py_DECREF(result);
+			result = NULL;
+			break;
+		}
+	}
+	Py_DECREF(slots);
+	return result;
+}
+
+static PyObject *
+pkgcore_PigeonHoledSlots_find_atom_matches(pkgcore_PigeonHoledSlots *self,
+	PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"atom", "key", NULL};
+	PyObject *atom, *key = NULL, *result;
+	if(!PyArg_ParseTupleAndKeywords(args, kwds, "O|O:find_atom_matches",
+		kwlist, &atom, &key))
+		return NULL;
+	if(check_initialized(self) || !(key = resolve_key(atom, key)))
+		return NULL;
+	result = find_atom_matches(self, atom, key);
+	Py_DECREF(key);
+	return result;
+}
+
+static PyObject *
+pkgcore_PigeonHoledSlots_add_limiter(pkgcore_PigeonHoledSlots *self,
+	PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"atom", "key", NULL};
+	PyObject *atom, *key = NULL, *limiters, *result = NULL;
+	int ret;
+	if(!PyArg_ParseTupleAndKeywords(args, kwds, "O|O:add_limiter",
+		kwlist, &atom, &key))
+		return NULL;
+	if(check_initialized(self))
+		return NULL;
+	if(-1 == (ret = PyObject_IsInstance(atom, restriction_base)))
+		return NULL;
+	if(!ret) {
+		PyObject *s = PyObject_Repr(atom), *k;
+		if(!s)
+			return NULL;
+		if(!(k = PyObject_Repr(key ? key : Py_None))) {
+			Py_DECREF(s);
+			return NULL;
+		}
+		PyErr_Format(PyExc_TypeError,
+			"atom must be a restriction.base derivative: got %s, key=%s",
+			PyString_AS_STRING(s), PyString_AS_STRING(k));
+		Py_DECREF(s);
+		Py_DECREF(k);
+		return NULL;
+	}
+	if(!(key = resolve_key(atom, key)))
+		return NULL;
+	if(!(limiters = PyDict_GetItem(self->limiters, key))) {
+		if(!(limiters = PyList_New(0)))
+			goto out;
+		ret = PyDict_SetItem(self->limiters, key, limiters);
+		Py_DECREF(limiters);
+		if(ret)
+			goto out;
+	}
+	if(!PyList_Append(limiters, atom))
+		result = find_atom_matches(self, atom, key);
+out:
+	Py_DECREF(key);
+	return result;
+}
+
+static PyObject *
+pkgcore_PigeonHoledSlots_remove_slotting(pkgcore_PigeonHoledSlots *self,
+	PyObject *obj)
+{
+	PyObject *key, *slot = NULL, *slots, *bucket, *result = NULL;
+	Py_ssize_t count;
+	if(check_initialized(self) || !(key = get_key(obj)))
+		return NULL;
+	if(!(slots = PyDict_GetItem(self->slots, key))) {
+		PyErr_SetObject(PyExc_KeyError, key);
+		goto out;
+	}
+	if(!(slot = PyObject_GetAttr(obj, slot_str)))
+		goto out;
+	if(!(bucket = PyDict_GetItem(slots, slot))) {
+		key_error("obj %s isn't slotted", obj);
+		goto out;
+	}
+	if(-1 == (count = remove_identity(bucket, obj)))
+		goto out;
+	if(!count) {
+		key_error("obj %s isn't slotted", obj);
+		goto out;
+	}
+	if(!PyList_GET_SIZE(bucket)) {
+		/* slots may go away with its entry; hold it meanwhile */
+		Py_INCREF(slots);
+		if(PyDict_DelItem(slots, slot) ||
+			(!PyDict_Size(slots) && PyDict_DelItem(self->slots, key))) {
+			Py_DECREF(slots);
+			goto out;
+		}
+		Py_DECREF(slots);
+	}
+	Py_INCREF(Py_None);
+	result = Py_None;
+out:
+	Py_DECREF(key);
+	Py_XDECREF(slot);
+	return result;
+}
+
+static PyObject *
+pkgcore_PigeonHoledSlots_remove_limiter(pkgcore_PigeonHoledSlots *self,
+	PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"atom", "key", NULL};
+	PyObject *atom, *key = NULL, *limiters, *result = NULL;
+	Py_ssize_t count;
+	if(!PyArg_ParseTupleAndKeywords(args, kwds, "O|O:remove_limiter",
+		kwlist, &atom, &key))
+		return NULL;
+	if(check_initialized(self) || !(key = resolve_key(atom, key)))
+		return NULL;
+	if(!(limiters = PyDict_GetItem(self->limiters, key))) {
+		PyErr_SetObject(PyExc_KeyError, key);
+		goto out;
+	}
+	if(-1 == (count = remove_identity(limiters, atom)))
+		goto out;
+	if(!count) {
+		key_error("obj %s isn't slotted", atom);
+		goto out;
+	}
+	if(!PyList_GET_SIZE(limiters) && PyDict_DelItem(self->limiters, key))
+		goto out;
+	Py_INCREF(Py_None);
+	result = Py_None;
+out:
+	Py_DECREF(key);
+	return result;
+}
+
+static PyMethodDef pkgcore_PigeonHoledSlots_methods[] = {
+	{"fill_slotting", (PyCFunction)pkgcore_PigeonHoledSlots_fill_slotting,
+		METH_VARARGS | METH_KEYWORDS},
+	{"get_conflicting_slot",
+		(PyCFunction)pkgcore_PigeonHoledSlots_get_conflicting_slot, METH_O},
+	{"find_atom_matches",
+		(PyCFunction)pkgcore_PigeonHoledSlots_find_atom_matches,
+		METH_VARARGS | METH_KEYWORDS},
+	{"add_limiter", (PyCFunction)pkgcore_PigeonHoledSlots_add_limiter,
+		METH_VARARGS | METH_KEYWORDS},
+	{"check_limiters", (PyCFunction)pkgcore_PigeonHoledSlots_check_limiters,
+		METH_O},
+	{"remove_slotting", (PyCFunction)pkgcore_PigeonHoledSlots_remove_slotting,
+		METH_O},
+	{"remove_limiter", (PyCFunction)pkgcore_PigeonHoledSlots_remove_limiter,
+		METH_VARARGS | METH_KEYWORDS},
+	{NULL}
+};
+
+static PyMemberDef pkgcore_PigeonHoledSlots_members[] = {
+	{"slots", T_OBJECT, offsetof(pkgcore_PigeonHoledSlots, slots), READONLY},
+	{"limiters", T_OBJECT, offsetof(pkgcore_PigeonHoledSlots, limiters),
+		READONLY},
+	{NULL}
+};
+
+PyDoc_STRVAR(
+	pkgcore_PigeonHoledSlots_documentation,
+	"cpython PigeonHoledSlots base class for speed");
+
+static PyTypeObject pkgcore_PigeonHoledSlots_Type = {
+	PyObject_HEAD_INIT(NULL)
+	0,												/* ob_size */
+	"pkgcore.resolver._pigeonholes.PigeonHoledSlots",	/* tp_name */
+	sizeof(pkgcore_PigeonHoledSlots),				/* tp_basicsize */
+	0,												/* tp_itemsize */
+	(destructor)pkgcore_PigeonHoledSlots_dealloc,	/* tp_dealloc */
+	0,												/* tp_print */
+	0,												/* tp_getattr */
+	0,												/* tp_setattr */
+	0,												/* tp_compare */
+	0,												/* tp_repr */
+	0,												/* tp_as_number */
+	0,												/* tp_as_sequence */
+	0,												/* tp_as_mapping */
+	0,												/* tp_hash  */
+	0,												/* tp_call */
+	0,												/* tp_str */
+	0,												/* tp_getattro */
+	0,												/* tp_setattro */
+	0,												/* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE|Py_TPFLAGS_HAVE_GC,
+													/* tp_flags */
+	pkgcore_PigeonHoledSlots_documentation,			/* tp_doc */
+	(traverseproc)pkgcore_PigeonHoledSlots_traverse,
+													/* tp_traverse */
+	(inquiry)pkgcore_PigeonHoledSlots_clear,		/* tp_clear */
+	0,												/* tp_richcompare */
+	0,												/* tp_weaklistoffset */
+	0,												/* tp_iter */
+	0,												/* tp_iternext */
+	pkgcore_PigeonHoledSlots_methods,				/* tp_methods */
+	pkgcore_PigeonHoledSlots_members,				/* tp_members */
+	0,												/* tp_getset */
+	0,												/* tp_base */
+	0,												/* tp_dict */
+	0,												/* tp_descr_get */
+	0,												/* tp_descr_set */
+	0,												/* tp_dictoffset */
+	(initproc)pkgcore_PigeonHoledSlots_init,		/* tp_init */
+	0,												/* tp_alloc */
+	PyType_GenericNew,								/* tp_new */
+};
+
+PyDoc_STRVAR(
+	pigeonholes_documentation,
+	"cpython slot/blocker tracking for pkgcore.resolver.pigeonholes");
+
+PyMODINIT_FUNC
+init_pigeonholes(void)
+{
+	PyObject *m;
+
+	snakeoil_LOAD_STRING(key_str, "key");
+	snakeoil_LOAD_STRING(slot_str, "slot");
+	snakeoil_LOAD_STRING(match_str, "match");
+	if(!restriction_base) {
+		snakeoil_LOAD_SINGLE_ATTR(restriction_base,
+			"pkgcore.restrictions.restriction", "base");
+	}
+
+	if (PyType_Ready(&pkgcore_PigeonHoledSlots_Type) < 0)
+		return;
+
+	m = Py_InitModule3("_pigeonholes", NULL, pigeonholes_documentation);
+	if (!m)
+		return;
+
+	Py_INCREF(&pkgcore_PigeonHoledSlots_Type);
+	if (PyModule_AddObject(m, "PigeonHoledSlots",
+			(PyObject *)&pkgcore_PigeonHoledSlots_Type) == -1)
+		return;
+}
@@ -0,0 +1,247 @@
+/*
+ * License: BSD 3 clause
+ *
+ * cpy framing helpers for pkgcore.ebuild.processor
+ */
+
+#include <snakeoil/common.h>
+#include <ctype.h>
+#include <string.h>
+
+/* compute the length val needs once quoted per _generate_env_str;
+ * returns the quoting mode: 0 bare, 1 single quoted, 2 $'' quoted. */
+static int
+processor_quoting(const char *val, Py_ssize_t len, Py_ssize_t *quoted_len)
+{
+	Py_ssize_t i, quotes = 0;
+	int alnum = len > 0;
+	for(i = 0; i < len; i++) {
+		if(val[i] == '\'') {
+			quotes++;
+			alnum = 0;
+		} else if(alnum && !isalnum(Py_CHARMASK(val[i]))) {
+			alnum = 0;
+		}
+	}
+	if(alnum) {
+		*quoted_len = len;
+		return 0;
+	}
+	if(!quotes) {
+		*quoted_len = len + 2;
+		return 1;
+	}
+	*quoted_len = len + quotes + 3;
+	return 2;
+}
+
+static PyObject *
+processor_encode_env(PyObject *self, PyObject *args)
+{
+	PyObject *env, *dont_export, *items, *key, *val, *tmp;
+	PyObject *result = NULL, *vals = NULL;
+	Py_ssize_t i, count, size, quoted_len, klen, vlen;
+	const char *kstr, *vstr;
+	char *p;
+	int ret;
+
+	if(!PyArg_ParseTuple(args, "OO:encode_env", &env, &dont_export))
+		return NULL;
+	if(!(items = PyMapping_Items(env)))
+		return NULL;
+	count = PyList_GET_SIZE(items);
+	/* str values of the exported keys, None for the skipped. */
+	if(!(vals = PyList_New(count)))
+		goto cleanup;
+
+	size = 6;
+	for(i = 0; i < count; i++) {
+		tmp = PyList_GET_ITEM(items, i);
+		if(!PyTuple_Check(tmp) || PyTuple_GET_SIZE(tmp) != 2) {
+			PyErr_SetString(PyExc_TypeError, "items must be pairs");
+			goto cleanup;
+		}
+		key = PyTuple_GET_ITEM(tmp, 0);
+		val = PyTuple_GET_ITEM(tmp, 1);
+		if(-1 == (ret = PySequence_Contains(dont_export, key)))
+			goto cleanup;
+		if(ret) {
+			Py_INCREF(Py_None);
+			PyList_SET_ITEM(vals, i, Py_None);
+			continue;
+		}
+		if(!PyString_Check(key)) {
+			PyErr_Format(PyExc_TypeError, "env keys must be str, got %s",
+				Py_TYPE(key)->tp_name);
+			goto cleanup;
+		}
+		if(!PyString_GET_SIZE(key)) {
+			PyErr_SetString(PyExc_IndexError, "string index out of range");
+			goto cleanup;
+		}
+		if(!isalpha(Py_CHARMASK(PyString_AS_STRING(key)[0]))) {
+			PyErr_Format(PyExc_KeyError,
+				"%s: bash doesn't allow digits as the first char",
+				PyString_AS_STRING(key));
+			goto cleanup;
+		}
+		if(PyString_Check(val)) {
+			Py_INCREF(val);
+		} else if(PyUnicode_Check(val)) {
+			if(!(val = PyObject_Str(val)))
+				goto cleanup;
+		} else {
+			if((tmp = PyObject_Repr(val))) {
+				PyErr_Format(PyExc_ValueError,
+					"_generate_env_str was fed a bad value; key=%s, val=%s",
+					PyString_AS_STRING(key), PyString_AS_STRING(tmp));
+				Py_DECREF(tmp);
+			}
+			goto cleanup;
+		}
+		PyList_SET_ITEM(vals, i, val);
+		processor_quoting(PyString_AS_STRING(val), PyString_GET_SIZE(val),
+			&quoted_len);
+		/* separating space, key, '=', value */
+		size += 1 + PyString_GET_SIZE(key) + 1 + quoted_len;
+	}
+
+	/* 'export' + the leading space of the first pair, if any */
+	if(!(result = PyString_FromStringAndSize(NULL, size)))
+		goto cleanup;
+	p = PyString_AS_STRING(result);
+	memcpy(p, "export", 6);
+	p += 6;
+	if(size == 6) {
+		/* 'export %s' % '' */
+		_PyString_Resize(&result, 7);
+		if(result)
+			PyString_AS_STRING(result)[6] = ' ';
+		goto cleanup;
+	}
+	for(i = 0; i < count; i++) {
+		val = PyList_GET_ITEM(vals, i);
+		if(val == Py_None)
+			continue;
+		key = PyTuple_GET_ITEM(PyList_GET_ITEM(items, i), 0);
+		kstr = PyString_AS_STRING(key);
+		klen = PyString_GET_SIZE(key);
+		vstr = PyString_AS_STRING(val);
+		vlen = PyString_GET_SIZE(val);
+		*p++ = ' ';
+		memcpy(p, kstr, klen);
+		p += klen;
+		*p++ = '=';
+		switch(processor_quoting(vstr, vlen, &quoted_len)) {
+		case 0:
+			memcpy(p, vstr, vlen);
+			p += vlen;
+			break;
+		case 1:
+			*p++ = '\'';
+			memcpy(p, vstr, vlen);
+			p += vlen;
+			*p++ = '\'';
+			break;
+		default:
+			*p++ = '$';
+			*p++ = '\'';
+			for(; vlen; vlen--, vstr++) {
+				if(*vstr == '\'')
+					*p++ = '\\';
+				*p++ = *vstr;
+			}
+			*p++ = '\'';
+		}
+	}
+
+cleanup:
+	Py_DECREF(items);
+	Py_XDECREF(vals);
+	if(PyErr_Occurred()) {
+		Py_CLEAR(result);
+	}
+	return result;
+}
+
+static PyObject *
+processor_decode_keys(PyObject *self, PyObject *args)
+{
+	PyObject *buffer, *result, *key, *val;
+	const void *data;
+	const char *p, *end, *line_end, *sep;
+	Py_ssize_t size;
+	int ret;
+
+	if(!PyArg_ParseTuple(args, "O:decode_keys", &buffer))
+		return NULL;
+	if(PyObject_AsReadBuffer(buffer, &data, &size))
+		return NULL;
+	if(!(result = PyDict_New()))
+		return NULL;
+
+	p = (const char *)data;
+	end = p + size;
+	while(p < end) {
+		if(!(line_end = memchr(p, '\n', end - p)))
+			line_end = end;
+		if(line_end == p) {
+			p++;
+			continue;
+		}
+		if(!(sep = memchr(p, '=', line_end - p))) {
+			if((val = PyString_FromStringAndSize(p, line_end - p))) {
+				PyErr_Format(PyExc_ValueError, "malformed key line: %s",
+					PyString_AS_STRING(val));
+				Py_DECREF(val);
+			}
+			goto error;
+		}
+		if(!(key = PyString_FromStringAndSize(p, sep - p)))
+			goto error;
+		PyString_InternInPlace(&key);
+		if(!(val = PyString_FromStringAndSize(sep + 1, line_end - sep - 1))) {
+			Py_DECREF(key);
+			goto error;
+		}
+		ret = PyDict_SetItem(result, key, val);
+		Py_DECREF(key);
+		Py_DECREF(val);
+		if(ret)
+			goto error;
+		p = line_end + 1;
+	}
+	return result;
+
+error:
+	Py_DECREF(result);
+	return NULL;
+}
+
+PyDoc_STRVAR(
+	processor_encode_env_documentation,
+	"encode_env(env, dont_export)\n\n"
+	"render env as a bash export statement, skipping keys in dont_export");
+
+PyDoc_STRVAR(
+	processor_decode_keys_documentation,
+	"decode_keys(payload)\n\n"
+	"decode a keys frame's KEY=value lines into a dict");
+
+static PyMethodDef ProcessorMethods[] = {
+	{"encode_env", (PyCFunction)processor_encode_env, METH_VARARGS,
+		processor_encode_env_documentation},
+	{"decode_keys", (PyCFunction)processor_decode_keys, METH_VARARGS,
+		processor_decode_keys_documentation},
+	{NULL, NULL, 0, NULL}		/* Sentinel */
+};
+
+PyDoc_STRVAR(
+	processor_documentation,
+	"cpython framing helpers for pkgcore.ebuild.processor");
+
+PyMODINIT_FUNC
+init_processor(void)
+{
+	Py_InitModule3("_processor", ProcessorMethods, processor_documentation);
+}
@@ -20,13 +20,23 @@ static PyObject *pkgcore_restrictions_subtype = NULL;
 static PyObject *pkgcore_match_str = NULL;
 static PyObject *pkgcore_handle_exception_str = NULL;
 static PyObject *pkgcore_sentinel_str = NULL;
+static PyObject *pkgcore_re_compile = NULL;
+static PyObject *pkgcore_intern_tables = NULL;
+static int pkgcore_re_ignorecase = 0;
 
 // global
 #define NEGATED_RESTRICT	0x1
 
-//strexactmatch
+//strexactmatch, strglobmatch, strregex
 #define CASE_SENSITIVE	  0x2
 
+//strglobmatch
+#define GLOB_PREFIX	  0x4
+
+//strregex
+#define REGEX_MATCH	  0x4
+#define REGEX_LITERAL	  0x8
+
 //packagerestriction
 #define IGNORE_MISSING	  0x2
 
@@ -52,6 +62,14 @@ static PyObject *pkgcore_sentinel_str = NULL;
 	}													   \
 }
 
+// tp_hash for types carrying a precomputed _hash
+#define PKGCORE_COMMON_HASH(type)								\
+static long													 \
+type##_hash(type *self)										 \
+{															   \
+	return PyLong_AsLong(self->hash);						   \
+}
+
 
 typedef struct {
 	PyObject_HEAD
@@ -113,8 +131,12 @@ pkgcore_StrExactMatch_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
 	self->hash = NULL;
 	if(!(flags & CASE_SENSITIVE)) {
 		self->exact = PyObject_CallMethod(exact, "lower", NULL);
-		if(!exact)
+		if(!self->exact) {
+			// dealloc expects exact to be set.
+			Py_INCREF(Py_None);
+			self->exact = Py_None;
 			Py_CLEAR(self);
+		}
 	} else {
 		Py_INCREF(exact);
 		self->exact = exact;
@@ -140,36 +162,62 @@ pkgcore_StrExactMatch_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
 	return (PyObject *)self;
 }
 
+/*
+ * ascii case folding compare of len bytes of value against lowered (which
+ * is expected to already be lowercase); returns 1 for equal, 0 for not.
+ * No allocation is done, which is the point- this is hit for every pkg in
+ * case insensitive searches.
+ */
+static int
+pkgcore_ascii_lower_eq(const char *lowered, const char *value, Py_ssize_t len)
+{
+	const unsigned char *l = (const unsigned char *)lowered;
+	const unsigned char *v = (const unsigned char *)value;
+	for(; len; len--, l++, v++) {
+		if(*l != Py_TOLOWER(*v))
+			return 0;
+	}
+	return 1;
+}
+
 static PyObject *
 pkgcore_StrExactMatch_match(pkgcore_StrExactMatch *self,
 	PyObject *value)
 {
-	PyObject *real_value = value;
+	PyObject *real_value, *ret;
 	if(!PyString_Check(value) && !PyUnicode_Check(value)) {
-		PyObject *tmp = PyObject_Str(value);
-		if(!tmp)
-			return tmp;
-		real_value = tmp;
-	} else
+		if(!(real_value = PyObject_Str(value)))
+			return NULL;
+	} else {
+		Py_INCREF(value);
 		real_value = value;
-	if(!(self->flags & CASE_SENSITIVE)) {
-		PyObject *tmp = PyObject_CallMethod(value, "lower", NULL);
+	}
 
-		if(real_value != value) {
+	if(!(self->flags & CASE_SENSITIVE)) {
+		if(PyString_CheckExact(self->exact) && PyString_Check(real_value)) {
+			// common case; str vs str, fold in place.
+			int result = (PyString_GET_SIZE(self->exact) ==
+				PyString_GET_SIZE(real_value)) &&
+				pkgcore_ascii_lower_eq(PyString_AS_STRING(self->exact),
+					PyString_AS_STRING(real_value),
+					PyString_GET_SIZE(real_value));
 			Py_DECREF(real_value);
+			if(IS_NEGATED(self->flags))
+				result = !result;
+			ret = result ? Py_True : Py_False;
+			Py_INCREF(ret);
+			return ret;
 		}
-
+		// unicode on one side; let python handle the folding.
+		PyObject *tmp = PyObject_CallMethod(real_value, "lower", NULL);
+		Py_DECREF(real_value);
 		if(!tmp)
 			return NULL;
 		real_value = tmp;
 	}
-	PyObject *ret = PyObject_RichCompare(self->exact, real_value,
+	ret = PyObject_RichCompare(self->exact, real_value,
 		IS_NEGATED(self->flags) ? Py_NE : Py_EQ);
-
-	if(real_value != value) {
-		Py_DECREF(real_value);
-	}
-
+	Py_DECREF(real_value);
 	return ret;
 }
 
@@ -194,6 +242,8 @@ static PyMemberDef pkgcore_StrExactMatch_members[] = {
 	{NULL}
 };
 
+PKGCORE_COMMON_HASH(pkgcore_StrExactMatch)
+
 snakeoil_IMMUTABLE_ATTR_BOOL(pkgcore_StrExactMatch, "negate", negate,
 	(self->flags & NEGATED_RESTRICT))
 snakeoil_IMMUTABLE_ATTR_BOOL(pkgcore_StrExactMatch, "case_sensitive", case,
@@ -229,7 +279,7 @@ static PyTypeObject pkgcore_StrExactMatch_Type = {
 	0,											   /* tp_as_number*/
 	0,											   /* tp_as_sequence*/
 	0,											   /* tp_as_mapping*/
-	0,											   /* tp_hash */
+	(hashfunc)pkgcore_StrExactMatch_hash,			/* tp_hash */
 	(ternaryfunc)0,								  /* tp_call*/
 	(reprfunc)0,									 /* tp_str*/
 	0,											   /* tp_getattro*/
@@ -264,6 +314,477 @@ pkgcore_StrExactMatch_richcompare(pkgcore_StrExactMatch *self,
 	return PyObject_RichCompare(self->exact, other->exact, op);
 }
 
+/*
+ * compute the _hash attr for a restriction from a tuple built via
+ * Py_BuildValue; steals the reference to tup (NULL is passed through).
+ */
+static PyObject *
+pkgcore_hash_from_tuple(PyObject *tup)
+{
+	if(!tup)
+		return NULL;
+	long hash = PyObject_Hash(tup);
+	Py_DECREF(tup);
+	if(hash == -1)
+		return NULL;
+	return PyLong_FromLong(hash);
+}
+
+// parse a python bool-ish arg into flags; NULL leaves flags as is.
+static int
+pkgcore_set_flag(PyObject *obj, char *flags, char flag)
+{
+	if(!obj)
+		return 0;
+	int result = PyObject_IsTrue(obj);
+	if(-1 == result)
+		return -1;
+	if(result) {
+		*flags |= flag;
+	} else {
+		*flags &= ~flag;
+	}
+	return 0;
+}
+
+// convert a value to a str/unicode for matching; returns a new reference.
+static PyObject *
+pkgcore_value_to_str(PyObject *value)
+{
+	if(PyString_Check(value) || PyUnicode_Check(value)) {
+		Py_INCREF(value);
+		return value;
+	}
+	return PyObject_Str(value);
+}
+
+
+typedef struct {
+	PyObject_HEAD
+	PyObject *glob;
+	PyObject *hash;
+	char flags;
+} pkgcore_StrGlobMatch;
+
+static void
+pkgcore_StrGlobMatch_dealloc(pkgcore_StrGlobMatch *self)
+{
+	Py_CLEAR(self->hash);
+	Py_CLEAR(self->glob);
+	self->ob_type->tp_free((PyObject *)self);
+}
+
+static PyObject *
+pkgcore_StrGlobMatch_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+	PyObject *glob, *sensitive = NULL, *prefix = NULL, *negate = NULL;
+	char flags = CASE_SENSITIVE | GLOB_PREFIX;
+
+	static char *kwlist[] = {"glob", "case_sensitive", "prefix", "negate",
+		NULL};
+	if(!PyArg_ParseTupleAndKeywords(args, kwds, "O|OOO", kwlist,
+		&glob, &sensitive, &prefix, &negate)) {
+		return NULL;
+	}
+	if(-1 == pkgcore_set_flag(sensitive, &flags, CASE_SENSITIVE) ||
+		-1 == pkgcore_set_flag(prefix, &flags, GLOB_PREFIX) ||
+		-1 == pkgcore_set_flag(negate, &flags, NEGATED_RESTRICT)) {
+		return NULL;
+	}
+
+	if(!(glob = pkgcore_value_to_str(glob)))
+		return NULL;
+	if(!(flags & CASE_SENSITIVE)) {
+		PyObject *tmp = PyObject_CallMethod(glob, "lower", NULL);
+		Py_DECREF(glob);
+		if(!(glob = tmp))
+			return NULL;
+	}
+
+	pkgcore_StrGlobMatch *self = \
+		(pkgcore_StrGlobMatch *)type->tp_alloc(type, 0);
+	if(!self) {
+		Py_DECREF(glob);
+		return NULL;
+	}
+	self->glob = glob;
+	self->flags = flags;
+	// mirrors the native hash of (glob, negate, re flags, prefix)
+	self->hash = pkgcore_hash_from_tuple(Py_BuildValue("(ONiN)", glob,
+		PyBool_FromLong(IS_NEGATED(flags)),
+		(flags & CASE_SENSITIVE) ? 0 : pkgcore_re_ignorecase,
+		PyBool_FromLong(flags & GLOB_PREFIX)));
+	if(!self->hash)
+		Py_CLEAR(self);
+	return (PyObject *)self;
+}
+
+static PyObject *
+pkgcore_StrGlobMatch_match(pkgcore_StrGlobMatch *self, PyObject *value)
+{
+	PyObject *real_value;
+	int result;
+
+	if(!(real_value = pkgcore_value_to_str(value)))
+		return NULL;
+
+	if(PyString_CheckExact(self->glob) && PyString_Check(real_value)) {
+		// fast path; straight prefix/suffix compare of the bytes.
+		Py_ssize_t glob_len = PyString_GET_SIZE(self->glob);
+		Py_ssize_t len = PyString_GET_SIZE(real_value);
+		const char *start = PyString_AS_STRING(real_value);
+		if(glob_len > len) {
+			result = 0;
+		} else {
+			if(!(self->flags & GLOB_PREFIX))
+				start += len - glob_len;
+			if(self->flags & CASE_SENSITIVE) {
+				result = !memcmp(PyString_AS_STRING(self->glob), start,
+					glob_len);
+			} else {
+				result = pkgcore_ascii_lower_eq(
+					PyString_AS_STRING(self->glob), start, glob_len);
+			}
+		}
+		Py_DECREF(real_value);
+	} else {
+		PyObject *tmp;
+		if(!(self->flags & CASE_SENSITIVE)) {
+			tmp = PyObject_CallMethod(real_value, "lower", NULL);
+			Py_DECREF(real_value);
+			if(!(real_value = tmp))
+				return NULL;
+		}
+		tmp = PyObject_CallMethod(real_value,
+			(self->flags & GLOB_PREFIX) ? "startswith" : "endswith",
+			"O", self->glob);
+		Py_DECREF(real_value);
+		if(!tmp)
+			return NULL;
+		result = PyObject_IsTrue(tmp);
+		Py_DECREF(tmp);
+		if(-1 == result)
+			return NULL;
+	}
+	if(IS_NEGATED(self->flags))
+		result = !result;
+	return PyBool_FromLong(result);
+}
+
+static PyMethodDef pkgcore_StrGlobMatch_methods[] = {
+	{"match", (PyCFunction)pkgcore_StrGlobMatch_match, METH_O},
+	{NULL}
+};
+
+PyDoc_STRVAR(
+	pkgcore_StrGlobMatch_documentation,
+	"\nglobbing matches; essentially startswith and endswith matches\n"
+	"@param glob: string chunk that must be matched\n"
+	"@keyword case_sensitive: should the match be case sensitive? "
+		"(default: True)\n"
+	"@keyword prefix: should the glob be a prefix check for matching, "
+		"or postfix matching (default: True)\n"
+	"@keyword negate: should the match results be inverted? (default: False)\n"
+	);
+
+static PyMemberDef pkgcore_StrGlobMatch_members[] = {
+	{"glob", T_OBJECT, offsetof(pkgcore_StrGlobMatch, glob), READONLY},
+	{"_hash", T_OBJECT, offsetof(pkgcore_StrGlobMatch, hash), READONLY},
+	{NULL}
+};
+
+PKGCORE_COMMON_HASH(pkgcore_StrGlobMatch)
+
+snakeoil_IMMUTABLE_ATTR_BOOL(pkgcore_StrGlobMatch, "negate", negate,
+	(self->flags & NEGATED_RESTRICT))
+snakeoil_IMMUTABLE_ATTR_BOOL(pkgcore_StrGlobMatch, "case_sensitive", case,
+	(self->flags & CASE_SENSITIVE))
+snakeoil_IMMUTABLE_ATTR_BOOL(pkgcore_StrGlobMatch, "prefix", prefix,
+	(self->flags & GLOB_PREFIX))
+
+static PyGetSetDef pkgcore_StrGlobMatch_attrs[] = {
+snakeoil_GETSET(pkgcore_StrGlobMatch, "negate", negate),
+snakeoil_GETSET(pkgcore_StrGlobMatch, "case_sensitive", case),
+snakeoil_GETSET(pkgcore_StrGlobMatch, "prefix", prefix),
+	{NULL}
+};
+
+PyObject *
+pkgcore_StrGlobMatch_richcompare(pkgcore_StrGlobMatch *self,
+	pkgcore_StrGlobMatch *other, int op);
+
+static PyTypeObject pkgcore_StrGlobMatch_Type = {
+	PyObject_HEAD_INIT(NULL)
+	0,											   /* ob_size*/
+	"pkgcore.restrictions._restrictions.StrGlobMatch",
+													 /* tp_name*/
+	sizeof(pkgcore_StrGlobMatch),					/* tp_basicsize*/
+	0,											   /* tp_itemsize*/
+	(destructor)pkgcore_StrGlobMatch_dealloc,		/* tp_dealloc*/
+	0,											   /* tp_print*/
+	0,											   /* tp_getattr*/
+	0,											   /* tp_setattr*/
+	0,											   /* tp_compare*/
+	0,											   /* tp_repr*/
+	0,											   /* tp_as_number*/
+	0,											   /* tp_as_sequence*/
+	0,											   /* tp_as_mapping*/
+	(hashfunc)pkgcore_StrGlobMatch_hash,			/* tp_hash */
+	(ternaryfunc)0,								  /* tp_call*/
+	(reprfunc)0,									 /* tp_str*/
+	0,											   /* tp_getattro*/
+	0,											   /* tp_setattro*/
+	0,											   /* tp_as_buffer*/
+	Py_TPFLAGS_BASETYPE|Py_TPFLAGS_DEFAULT,		  /* tp_flags*/
+	pkgcore_StrGlobMatch_documentation,			  /* tp_doc */
+	(traverseproc)0,								 /* tp_traverse */
+	(inquiry)0,									  /* tp_clear */
+	(richcmpfunc)pkgcore_StrGlobMatch_richcompare,   /* tp_richcompare */
+	0,											   /* tp_weaklistoffset */
+	(getiterfunc)0,								  /* tp_iter */
+	(iternextfunc)0,								 /* tp_iternext */
+	pkgcore_StrGlobMatch_methods,					/* tp_methods */
+	pkgcore_StrGlobMatch_members,					/* tp_members */
+	pkgcore_StrGlobMatch_attrs,					  /* tp_getset */
+	0,											   /* tp_base */
+	0,											   /* tp_dict */
+	0,											   /* tp_descr_get */
+	0,											   /* tp_descr_set */
+	0,											   /* tp_dictoffset */
+	(initproc)0,									 /* tp_init */
+	0,											   /* tp_alloc */
+	pkgcore_StrGlobMatch_new,						/* tp_new */
+};
+
+PyObject *
+pkgcore_StrGlobMatch_richcompare(pkgcore_StrGlobMatch *self,
+	pkgcore_StrGlobMatch *other, int op)
+{
+	PKGCORE_COMMON_RICHCOMPARE(pkgcore_StrGlobMatch_Type, self, other, op);
+	return PyObject_RichCompare(self->glob, other->glob, op);
+}
+
+
+typedef struct {
+	PyObject_HEAD
+	PyObject *regex;
+	PyObject *matchfunc;
+	PyObject *hash;
+	char flags;
+} pkgcore_StrRegex;
+
+static void
+pkgcore_StrRegex_dealloc(pkgcore_StrRegex *self)
+{
+	Py_CLEAR(self->hash);
+	Py_CLEAR(self->matchfunc);
+	Py_CLEAR(self->regex);
+	self->ob_type->tp_free((PyObject *)self);
+}
+
+// does the pattern contain anything that isn't a literal for re?
+static int
+pkgcore_regex_is_literal(PyObject *regex)
+{
+	if(!PyString_CheckExact(regex))
+		return 0;
+	const char *p = PyString_AS_STRING(regex);
+	const char *end = p + PyString_GET_SIZE(regex);
+	for(; p < end; p++) {
+		if(!*p || strchr(".^$*+?{}[]\\|()", *p))
+			return 0;
+	}
+	return 1;
+}
+
+static PyObject *
+pkgcore_StrRegex_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+	PyObject *regex, *sensitive = NULL, *ismatch = NULL, *negate = NULL;
+	PyObject *compiled;
+	char flags = CASE_SENSITIVE;
+	int re_flags;
+
+	static char *kwlist[] = {"regex", "case_sensitive", "match", "negate",
+		NULL};
+	if(!PyArg_ParseTupleAndKeywords(args, kwds, "O|OOO", kwlist,
+		&regex, &sensitive, &ismatch, &negate)) {
+		return NULL;
+	}
+	if(-1 == pkgcore_set_flag(sensitive, &flags, CASE_SENSITIVE) ||
+		-1 == pkgcore_set_flag(ismatch, &flags, REGEX_MATCH) ||
+		-1 == pkgcore_set_flag(negate, &flags, NEGATED_RESTRICT)) {
+		return NULL;
+	}
+	re_flags = (flags & CASE_SENSITIVE) ? 0 : pkgcore_re_ignorecase;
+
+	// compile once; match just invokes the bound method from here on.
+	if(!(compiled = PyObject_CallFunction(pkgcore_re_compile, "Oi",
+		regex, re_flags))) {
+		return NULL;
+	}
+	if((flags & CASE_SENSITIVE) && pkgcore_regex_is_literal(regex))
+		flags |= REGEX_LITERAL;
+
+	pkgcore_StrRegex *self = (pkgcore_StrRegex *)type->tp_alloc(type, 0);
+	if(!self) {
+		Py_DECREF(compiled);
+		return NULL;
+	}
+	self->flags = flags;
+	Py_INCREF(regex);
+	self->regex = regex;
+	self->matchfunc = PyObject_GetAttrString(compiled,
+		(flags & REGEX_MATCH) ? "match" : "search");
+	Py_DECREF(compiled);
+	if(!self->matchfunc) {
+		Py_DECREF(self);
+		return NULL;
+	}
+	// mirrors the native hash of (regex, negate, re flags, ismatch)
+	self->hash = pkgcore_hash_from_tuple(Py_BuildValue("(ONiN)", regex,
+		PyBool_FromLong(IS_NEGATED(flags)), re_flags,
+		PyBool_FromLong(flags & REGEX_MATCH)));
+	if(!self->hash)
+		Py_CLEAR(self);
+	return (PyObject *)self;
+}
+
+static PyObject *
+pkgcore_StrRegex_match(pkgcore_StrRegex *self, PyObject *value)
+{
+	PyObject *real_value, *tmp;
+	int result;
+
+	if(value == Py_None) {
+		real_value = PyString_FromStringAndSize(NULL, 0);
+	} else {
+		real_value = pkgcore_value_to_str(value);
+	}
+	if(!real_value)
+		return NULL;
+
+	if((self->flags & REGEX_LITERAL) && PyString_CheckExact(real_value)) {
+		// no metachars; substring/prefix checks suffice.
+		Py_ssize_t regex_len = PyString_GET_SIZE(self->regex);
+		if(self->flags & REGEX_MATCH) {
+			result = (regex_len <= PyString_GET_SIZE(real_value)) &&
+				!memcmp(PyString_AS_STRING(self->regex),
+					PyString_AS_STRING(real_value), regex_len);
+		} else {
+			result = PySequence_Contains(real_value, self->regex);
+		}
+	} else {
+		tmp = PyObject_CallFunctionObjArgs(self->matchfunc, real_value, NULL);
+		if(!tmp) {
+			result = -1;
+		} else {
+			result = (tmp != Py_None);
+			Py_DECREF(tmp);
+		}
+	}
+	Py_DECREF(real_value);
+	if(-1 == result)
+		return NULL;
+	if(IS_NEGATED(self->flags))
+		result = !result;
+	return PyBool_FromLong(result);
+}
+
+static PyMethodDef pkgcore_StrRegex_methods[] = {
+	{"match", (PyCFunction)pkgcore_StrRegex_match, METH_O},
+	{NULL}
+};
+
+PyDoc_STRVAR(
+	pkgcore_StrRegex_documentation,
+	"\nregex based matching\n"
+	"@param regex: regex pattern to match\n"
+	"@keyword case_sensitive: should the match be case sensitive? "
+		"(default: True)\n"
+	"@keyword match: should re.match be used instead of re.search? "
+		"(default: False)\n"
+	"@keyword negate: should the match results be inverted? (default: False)\n"
+	);
+
+static PyMemberDef pkgcore_StrRegex_members[] = {
+	{"regex", T_OBJECT, offsetof(pkgcore_StrRegex, regex), READONLY},
+	{"_matchfunc", T_OBJECT, offsetof(pkgcore_StrRegex, matchfunc), READONLY},
+	{"_hash", T_OBJECT, offsetof(pkgcore_StrRegex, hash), READONLY},
+	{NULL}
+};
+
+PKGCORE_COMMON_HASH(pkgcore_StrRegex)
+
+snakeoil_IMMUTABLE_ATTR_BOOL(pkgcore_StrRegex, "negate", negate,
+	(self->flags & NEGATED_RESTRICT))
+snakeoil_IMMUTABLE_ATTR_BOOL(pkgcore_StrRegex, "case_sensitive", case,
+	(self->flags & CASE_SENSITIVE))
+snakeoil_IMMUTABLE_ATTR_BOOL(pkgcore_StrRegex, "ismatch", ismatch,
+	(self->flags & REGEX_MATCH))
+
+static PyGetSetDef pkgcore_StrRegex_attrs[] = {
+snakeoil_GETSET(pkgcore_StrRegex, "negate", negate),
+snakeoil_GETSET(pkgcore_StrRegex, "case_sensitive", case),
+snakeoil_GETSET(pkgcore_StrRegex, "ismatch", ismatch),
+	{NULL}
+};
+
+PyObject *
+pkgcore_StrRegex_richcompare(pkgcore_StrRegex *self,
+	pkgcore_StrRegex *other, int op);
+
+static PyTypeObject pkgcore_StrRegex_Type = {
+	PyObject_HEAD_INIT(NULL)
+	0,											   /* ob_size*/
+	"pkgcore.restrictions._restrictions.StrRegex",
+													 /* tp_name*/
+	sizeof(pkgcore_StrRegex),						/* tp_basicsize*/
+	0,											   /* tp_itemsize*/
+	(destructor)pkgcore_StrRegex_dealloc,			/* tp_dealloc*/
+	0,											   /* tp_print*/
+	0,											   /* tp_getattr*/
+	0,											   /* tp_setattr*/
+	0,											   /* tp_compare*/
+	0,											   /* tp_repr*/
+	0,											   /* tp_as_number*/
+	0,											   /* tp_as_sequence*/
+	0,											   /* tp_as_mapping*/
+	(hashfunc)pkgcore_StrRegex_hash,			/* tp_hash */
+	(ternaryfunc)0,								  /* tp_call*/
+	(reprfunc)0,									 /* tp_str*/
+	0,											   /* tp_getattro*/
+	0,											   /* tp_setattro*/
+	0,											   /* tp_as_buffer*/
+	Py_TPFLAGS_BASETYPE|Py_TPFLAGS_DEFAULT,		  /* tp_flags*/
+	pkgcore_StrRegex_documentation,				  /* tp_doc */
+	(traverseproc)0,								 /* tp_traverse */
+	(inquiry)0,									  /* tp_clear */
+	(richcmpfunc)pkgcore_StrRegex_richcompare,	   /* tp_richcompare */
+	0,											   /* tp_weaklistoffset */
+	(getiterfunc)0,								  /* tp_iter */
+	(iternextfunc)0,								 /* tp_iternext */
+	pkgcore_StrRegex_methods,						/* tp_methods */
+	pkgcore_StrRegex_members,						/* tp_members */
+	pkgcore_StrRegex_attrs,						  /* tp_getset */
+	0,											   /* tp_base */
+	0,											   /* tp_dict */
+	0,											   /* tp_descr_get */
+	0,											   /* tp_descr_set */
+	0,											   /* tp_dictoffset */
+	(initproc)0,									 /* tp_init */
+	0,											   /* tp_alloc */
+	pkgcore_StrRegex_new,							/* tp_new */
+};
+
+PyObject *
+pkgcore_StrRegex_richcompare(pkgcore_StrRegex *self,
+	pkgcore_StrRegex *other, int op)
+{
+	PKGCORE_COMMON_RICHCOMPARE(pkgcore_StrRegex_Type, self, other, op);
+	return PyObject_RichCompare(self->regex, other->regex, op);
+}
+
 typedef struct {
 	PyObject_HEAD
 	PyObject *attr;
@@ -569,12 +1090,6 @@ pkgcore_PackageRestriction_richcompare(pkgcore_PackageRestriction *self,
 	pkgcore_PackageRestriction *other, int op)
 {
 	PKGCORE_COMMON_RICHCOMPARE(pkgcore_PackageRestriction_Type, self, other, op);
-	if(self->attr != other->attr) {
-		if(op == Py_EQ) {
-			Py_RETURN_FALSE;
-		}
-		Py_RETURN_TRUE;
-	}
 	PyObject *ret = PyObject_RichCompare(self->attr, other->attr, op);
 	if (ret == Py_NotImplemented ||
 		ret == (op == Py_EQ ? Py_False : Py_True)) {
@@ -585,6 +1100,95 @@ pkgcore_PackageRestriction_richcompare(pkgcore_PackageRestriction *self,
 }
 
 
+/*
+ * hash consing of restrictions.
+ *
+ * Each type gets its own table of weakref -> weakref; weakrefs hash and
+ * compare as their referent while it's alive, so a lookup with a ref to a
+ * freshly built instance finds any live instance equal to it.  The ref's
+ * callback drops the entry once the referent goes away.
+ */
+
+static PyObject *
+pkgcore_intern_discard(PyObject *table, PyObject *ref)
+{
+	if(PyDict_DelItem(table, ref)) {
+		/* already gone; nothing to do. */
+		PyErr_Clear();
+	}
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef pkgcore_intern_discard_def = {
+	"_intern_discard", (PyCFunction)pkgcore_intern_discard, METH_O, NULL};
+
+static PyObject *
+pkgcore_intern(PyObject *self, PyObject *inst)
+{
+	PyObject *entry, *table, *ref, *existing;
+	if(!PyType_SUPPORTS_WEAKREFS(Py_TYPE(inst))) {
+		Py_INCREF(inst);
+		return inst;
+	}
+	entry = PyDict_GetItem(pkgcore_intern_tables, (PyObject *)Py_TYPE(inst));
+	if(!entry) {
+		PyObject *discard;
+		if(!(table = PyDict_New()))
+			return NULL;
+		discard = PyCFunction_New(&pkgcore_intern_discard_def, table);
+		if(!discard) {
+			Py_DECREF(table);
+			return NULL;
+		}
+		entry = PyTuple_Pack(2, table, discard);
+		Py_DECREF(table);
+		Py_DECREF(discard);
+		if(!entry)
+			return NULL;
+		if(PyDict_SetItem(pkgcore_intern_tables, (PyObject *)Py_TYPE(inst),
+			entry)) {
+			Py_DECREF(entry);
+			return NULL;
+		}
+		Py_DECREF(entry);
+	}
+	table = PyTuple_GET_ITEM(entry, 0);
+	if(!(ref = PyWeakref_NewRef(inst, PyTuple_GET_ITEM(entry, 1))))
+		return NULL;
+	/* PyDict_GetItem swallows hash/comparison errors; unhashable instances
+	 * fall through to the SetItem below, which is where we notice. */
+	existing = PyDict_GetItem(table, ref);
+	if(existing) {
+		PyObject *obj = PyWeakref_GET_OBJECT(existing);
+		if(obj != Py_None) {
+			Py_INCREF(obj);
+			Py_DECREF(ref);
+			return obj;
+		}
+	}
+	if(PyDict_SetItem(table, ref, ref)) {
+		if(!PyErr_ExceptionMatches(PyExc_TypeError) &&
+			!PyErr_ExceptionMatches(PyExc_NotImplementedError)) {
+			Py_DECREF(ref);
+			return NULL;
+		}
+		/* unhashable; can't be interned. */
+		PyErr_Clear();
+	}
+	Py_DECREF(ref);
+	Py_INCREF(inst);
+	return inst;
+}
+
+static PyMethodDef pkgcore_restrictions_methods[] = {
+	{"intern", (PyCFunction)pkgcore_intern, METH_O,
+		"return the live instance equal to (and of the same type as) the "
+		"passed in restriction if one exists, else register and return "
+		"the restriction itself"},
+	{NULL, NULL, 0, NULL}		/* Sentinel */
+};
+
+
 PyDoc_STRVAR(
 	pkgcore_restrictions_documentation,
 	"cpython restrictions extensions for speed");
@@ -592,7 +1196,7 @@ PyDoc_STRVAR(
 PyMODINIT_FUNC
 init_restrictions(void)
 {
-	PyObject *m = Py_InitModule3("_restrictions", NULL,
+	PyObject *m = Py_InitModule3("_restrictions", pkgcore_restrictions_methods,
 		pkgcore_restrictions_documentation);
 	if (!m)
 		return;
@@ -600,9 +1204,28 @@ init_restrictions(void)
 	if (PyType_Ready(&pkgcore_StrExactMatch_Type) < 0)
 		return;
 
+	if (PyType_Ready(&pkgcore_StrGlobMatch_Type) < 0)
+		return;
+
+	if (PyType_Ready(&pkgcore_StrRegex_Type) < 0)
+		return;
+
 	if (PyType_Ready(&pkgcore_PackageRestriction_Type) < 0)
 		return;
 
+	PyObject *re_module, *tmp;
+	snakeoil_LOAD_MODULE(re_module, "re");
+	snakeoil_LOAD_ATTR(pkgcore_re_compile, re_module, "compile");
+	snakeoil_LOAD_ATTR(tmp, re_module, "I");
+	Py_DECREF(re_module);
+	pkgcore_re_ignorecase = (int)PyInt_AsLong(tmp);
+	Py_DECREF(tmp);
+	if(PyErr_Occurred())
+		return;
+
+	if(!(pkgcore_intern_tables = PyDict_New()))
+		return;
+
 	snakeoil_LOAD_STRING(pkgcore_restrictions_type, "type");
 	snakeoil_LOAD_STRING(pkgcore_restrictions_subtype, "subtype");
 	snakeoil_LOAD_STRING(pkgcore_match_str, "match");
@@ -614,6 +1237,16 @@ init_restrictions(void)
 			m, "StrExactMatch", (PyObject *)&pkgcore_StrExactMatch_Type) == -1)
 		return;
 
+	Py_INCREF(&pkgcore_StrGlobMatch_Type);
+	if (PyModule_AddObject(
+			m, "StrGlobMatch", (PyObject *)&pkgcore_StrGlobMatch_Type) == -1)
+		return;
+
+	Py_INCREF(&pkgcore_StrRegex_Type);
+	if (PyModule_AddObject(
+			m, "StrRegex", (PyObject *)&pkgcore_StrRegex_Type) == -1)
+		return;
+
 	Py_INCREF(&pkgcore_PackageRestriction_Type);
 	if (PyModule_AddObject(
 			m, "PackageRestriction",